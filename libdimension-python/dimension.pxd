@@ -20,6 +20,7 @@
 
 from cpython cimport bool
 from libc.math cimport *
+from libc.stdint cimport *
 from libc.stdio cimport *
 
 cdef extern from "errno.h":
@@ -95,6 +96,11 @@ cdef extern from "../libdimension/dimension.h":
   void dmnsn_future_pause(dmnsn_future *future) nogil
   void dmnsn_future_resume(dmnsn_future *future)
 
+  ctypedef dmnsn_future *dmnsn_future_fn(void *ptr)
+  dmnsn_future *dmnsn_future_then(dmnsn_future *future, dmnsn_future_fn *continuation, void *ptr)
+  void dmnsn_future_wait_all(dmnsn_future **futures, size_t nfutures) nogil
+  size_t dmnsn_future_wait_any(dmnsn_future **futures, size_t nfutures) nogil
+
   ##########
   # Timers #
   ##########
@@ -204,11 +210,22 @@ cdef extern from "../libdimension/dimension.h":
   # Canvases #
   ############
 
+  ctypedef enum dmnsn_canvas_format:
+    DMNSN_CANVAS_DOUBLE
+    DMNSN_CANVAS_FLOAT
+    DMNSN_CANVAS_HALF
+    DMNSN_CANVAS_LINEAR16
+    DMNSN_CANVAS_TILED
+
   ctypedef struct dmnsn_canvas:
     size_t width
     size_t height
+    dmnsn_canvas_format format
 
   dmnsn_canvas *dmnsn_new_canvas(dmnsn_pool *pool, size_t width, size_t height)
+  dmnsn_canvas *dmnsn_new_canvas_format(dmnsn_pool *pool,
+                                        size_t width, size_t height,
+                                        dmnsn_canvas_format format)
 
   dmnsn_tcolor dmnsn_canvas_get_pixel(dmnsn_canvas *canvas, size_t x, size_t y)
   void dmnsn_canvas_set_pixel(dmnsn_canvas *canvas, size_t x, size_t y,
@@ -329,6 +346,9 @@ cdef extern from "../libdimension/dimension.h":
   dmnsn_object *dmnsn_new_smooth_triangle(dmnsn_pool *pool, dmnsn_vector vertices[3], dmnsn_vector normals[3])
   dmnsn_object *dmnsn_new_triangle_fan(dmnsn_pool *pool, dmnsn_vector *vertices, size_t nvertices)
   dmnsn_object *dmnsn_new_smooth_triangle_fan(dmnsn_pool *pool, dmnsn_vector *vertices, dmnsn_vector *normals, size_t nvertices)
+  dmnsn_object *dmnsn_new_mesh(dmnsn_pool *pool, dmnsn_vector *vertices, dmnsn_vector *normals, size_t nvertices, uint32_t *indices, size_t ntriangles)
+  dmnsn_object *dmnsn_read_mesh(dmnsn_pool *pool, FILE *file) nogil
+  dmnsn_object *dmnsn_new_instance(dmnsn_pool *pool, dmnsn_object *prototype)
   dmnsn_object *dmnsn_new_plane(dmnsn_pool *pool, dmnsn_vector normal)
   dmnsn_object *dmnsn_new_sphere(dmnsn_pool *pool)
   dmnsn_object *dmnsn_new_cube(dmnsn_pool *pool)
@@ -375,6 +395,21 @@ cdef extern from "../libdimension/dimension.h":
     DMNSN_RENDER_REFLECTION
     DMNSN_RENDER_FULL
 
+  ctypedef enum dmnsn_tile_order:
+    DMNSN_TILE_SCANLINE
+    DMNSN_TILE_HILBERT
+    DMNSN_TILE_CENTER_OUT
+
+  ctypedef enum dmnsn_bvh_kind:
+    DMNSN_BVH_NONE
+    DMNSN_BVH_PRTREE
+    DMNSN_BVH_SAH
+    DMNSN_BVH_LBVH
+
+  ctypedef enum dmnsn_bvh_traversal:
+    DMNSN_BVH_PREORDER
+    DMNSN_BVH_ORDERED
+
   ctypedef struct dmnsn_scene:
     dmnsn_pigment *background
     dmnsn_texture *default_texture
@@ -395,9 +430,19 @@ cdef extern from "../libdimension/dimension.h":
     double adc_bailout
     unsigned int nthreads
 
+    size_t tile_width
+    size_t tile_height
+    dmnsn_tile_order tile_order
+
+    dmnsn_bvh_kind bvh_kind
+    dmnsn_bvh_traversal bvh_traversal
+
     dmnsn_timer bounding_timer
     dmnsn_timer render_timer
 
+    size_t shadow_cache_lookups
+    size_t shadow_cache_hits
+
   dmnsn_scene *dmnsn_new_scene(dmnsn_pool *pool)
 
   void dmnsn_render(dmnsn_scene *scene)
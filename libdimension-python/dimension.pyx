@@ -68,13 +68,54 @@ cdef dmnsn_pool *_get_pool():
 # Futures #
 ###########
 
+cdef class _FutureChain:
+  """The Python state shared by the stages of a chained Future."""
+  cdef _continuation
+  cdef list _finalizers
+  cdef _exception
+
+  def __init__(self, continuation):
+    self._continuation = continuation
+    self._finalizers = []
+    self._exception = None
+
+  cdef _adopt(self, Future future):
+    """Take responsibility for finalizing a stage of the chain."""
+    if future._chain is not None:
+      self._finalizers.append(future._chain._finalize)
+    if future._finalizer is not None:
+      self._finalizers.append(future._finalizer)
+    future._future = NULL
+    future._finalizer = None
+    future._chain = None
+
+  def _finalize(self):
+    for finalizer in self._finalizers:
+      finalizer()
+
+cdef dmnsn_future *_future_continuation(void *ptr) with gil:
+  cdef _FutureChain chain = <_FutureChain>ptr
+  cdef Future future
+  cdef dmnsn_future *ret
+  try:
+    future = chain._continuation()
+    future._assert_unfinished()
+    ret = future._future
+    chain._adopt(future)
+    return ret
+  except BaseException as e:
+    chain._exception = e
+    return NULL
+
 cdef class Future:
   cdef dmnsn_future *_future
   cdef _finalizer
+  cdef _FutureChain _chain
 
   def __cinit__(self):
     self._future = NULL
     self._finalizer = None
+    self._chain = None
 
   def __init__(self):
     raise RuntimeError("attempt to create a Future object.")
@@ -89,6 +130,11 @@ cdef class Future:
     try:
       with nogil:
         retcode = dmnsn_future_join(self._future)
+      if self._chain is not None:
+        # Every stage that ran has finished, so clean them all up
+        self._chain._finalize()
+        if self._chain._exception is not None:
+          raise self._chain._exception
       if retcode != 0:
         raise RuntimeError("background task failed.")
       if self._finalizer is not None:
@@ -118,6 +164,22 @@ cdef class Future:
   def resume(self):
     dmnsn_future_resume(self._future)
 
+  def then(self, continuation):
+    """
+    Chain another background task after this one.
+
+    When this task succeeds, continuation() is called, and should return
+    another Future.  The returned Future covers both tasks, and this one
+    cannot be used anymore.
+    """
+    self._assert_unfinished()
+    cdef _FutureChain chain = _FutureChain(continuation)
+    cdef dmnsn_future *first = self._future
+    chain._adopt(self)
+    cdef Future ret = _Future(dmnsn_future_then(first, _future_continuation, <void *>chain))
+    ret._chain = chain
+    return ret
+
   # Let Futures be used as context managers
   def __enter__(self):
     return self
@@ -138,6 +200,41 @@ cdef Future _Future(dmnsn_future *future):
   self._future = future
   return self
 
+cdef dmnsn_future **_futures_array(futures) except NULL:
+  cdef size_t n = len(futures)
+  cdef dmnsn_future **array = <dmnsn_future **>dmnsn_malloc((n if n > 0 else 1)*sizeof(dmnsn_future *))
+  cdef Future future
+  try:
+    for i, future in enumerate(futures):
+      future._assert_unfinished()
+      array[i] = future._future
+  except:
+    dmnsn_free(array)
+    raise
+  return array
+
+def wait_all(futures):
+  """Wait for every Future in a sequence to finish."""
+  futures = list(futures)
+  cdef size_t n = len(futures)
+  cdef dmnsn_future **array = _futures_array(futures)
+  with nogil:
+    dmnsn_future_wait_all(array, n)
+  dmnsn_free(array)
+
+def wait_any(futures):
+  """Wait for any Future in a sequence to finish, and return its index."""
+  futures = list(futures)
+  cdef size_t n = len(futures)
+  if n == 0:
+    raise ValueError("no futures to wait for.")
+  cdef dmnsn_future **array = _futures_array(futures)
+  cdef size_t i
+  with nogil:
+    i = dmnsn_future_wait_any(array, n)
+  dmnsn_free(array)
+  return i
+
 ##########
 # Timers #
 ##########
@@ -635,15 +732,35 @@ cdef class Canvas:
   """A rendering target."""
   cdef dmnsn_canvas *_canvas
 
-  def __init__(self, width, height):
+  def __init__(self, width, height, str format not None = "double",
+               tiled = False):
     """
     Create a Canvas.
 
     Keyword arguments:
     width  -- the width of the canvas
     height -- the height of the canvas
-    """
-    self._canvas = dmnsn_new_canvas(_get_pool(), width, height)
+    format -- the pixel storage format: "double", "float", "half", or
+              "linear16" (default: "double")
+    tiled  -- whether to store the pixels in tiles rather than rows (default:
+              False)
+    """
+    cdef dmnsn_canvas_format cformat
+    if format == "double":
+      cformat = DMNSN_CANVAS_DOUBLE
+    elif format == "float":
+      cformat = DMNSN_CANVAS_FLOAT
+    elif format == "half":
+      cformat = DMNSN_CANVAS_HALF
+    elif format == "linear16":
+      cformat = DMNSN_CANVAS_LINEAR16
+    else:
+      raise ValueError("unknown canvas format '%s'" % format)
+
+    if tiled:
+      cformat = <dmnsn_canvas_format>(cformat | DMNSN_CANVAS_TILED)
+
+    self._canvas = dmnsn_new_canvas_format(_get_pool(), width, height, cformat)
     self.clear(Black)
 
   property width:
@@ -654,6 +771,22 @@ cdef class Canvas:
     """The height of the canvas."""
     def __get__(self):
       return self._canvas.height
+  property format:
+    """The pixel storage format of the canvas."""
+    def __get__(self):
+      cdef int storage = self._canvas.format & ~DMNSN_CANVAS_TILED
+      if storage == DMNSN_CANVAS_DOUBLE:
+        return "double"
+      elif storage == DMNSN_CANVAS_FLOAT:
+        return "float"
+      elif storage == DMNSN_CANVAS_HALF:
+        return "half"
+      elif storage == DMNSN_CANVAS_LINEAR16:
+        return "linear16"
+  property tiled:
+    """Whether the canvas is stored in tiles rather than rows."""
+    def __get__(self):
+      return bool(self._canvas.format & DMNSN_CANVAS_TILED)
 
   def __len__(self):
     """The width of the canvas."""
@@ -1182,6 +1315,91 @@ cdef class TriangleFan(Object):
 
     Object.__init__(self, *args, **kwargs)
 
+cdef class Mesh(Object):
+  """A triangle mesh."""
+  def __init__(self, vertices, faces, normals = None, *args, **kwargs):
+    """
+    Create a Mesh.
+
+    Keyword arguments:
+    vertices -- the vertices of the mesh
+    faces    -- a sequence of (a, b, c) vertex indices for each triangle
+    normals  -- the (optional) normal vectors for each vertex
+
+    Additionally, Mesh() accepts any arguments that Object() accepts.
+    """
+    cdef size_t nvertices = len(vertices)
+    cdef size_t ntriangles = len(faces)
+    if ntriangles == 0:
+      raise TypeError("expected at least 1 face")
+    if normals is not None and len(normals) != nvertices:
+      raise TypeError("expected same number of vertices and normals")
+
+    cdef dmnsn_vector *varray = NULL
+    cdef dmnsn_vector *narray = NULL
+    cdef uint32_t *iarray = NULL
+    try:
+      varray = <dmnsn_vector *>dmnsn_malloc(nvertices*sizeof(dmnsn_vector))
+      for i in range(nvertices):
+        varray[i] = Vector(vertices[i])._v
+
+      if normals is not None:
+        narray = <dmnsn_vector *>dmnsn_malloc(nvertices*sizeof(dmnsn_vector))
+        for i in range(nvertices):
+          narray[i] = Vector(normals[i])._v
+
+      iarray = <uint32_t *>dmnsn_malloc(3*ntriangles*sizeof(uint32_t))
+      for i in range(ntriangles):
+        face = faces[i]
+        if len(face) != 3:
+          raise TypeError("expected 3 vertex indices per face")
+        for j in range(3):
+          if face[j] < 0 or face[j] >= nvertices:
+            raise IndexError("vertex index out of range")
+          iarray[3*i + j] = face[j]
+
+      self._object = dmnsn_new_mesh(_get_pool(), varray, narray, nvertices, iarray, ntriangles)
+    finally:
+      dmnsn_free(iarray)
+      dmnsn_free(narray)
+      dmnsn_free(varray)
+
+    if self._object == NULL:
+      raise ValueError("invalid mesh")
+
+    Object.__init__(self, *args, **kwargs)
+
+  @staticmethod
+  def from_file(path, *args, **kwargs):
+    """
+    Load a Mesh from a Wavefront OBJ or binary PLY file.
+
+    Keyword arguments:
+    path -- the path of the file to load
+
+    Additionally, from_file() accepts any arguments that Object() accepts.
+    """
+    bpath = path.encode("UTF-8")
+    cdef char *cpath = bpath
+    cdef FILE *file = fopen(cpath, "rb")
+    if file == NULL:
+      _raise_OSError(path)
+
+    cdef dmnsn_pool *pool = _get_pool()
+    cdef dmnsn_object *object
+    with nogil:
+      object = dmnsn_read_mesh(pool, file)
+    if object == NULL:
+      fclose(file)
+      _raise_OSError(path)
+    if fclose(file) != 0:
+      _raise_OSError()
+
+    cdef Mesh self = Mesh.__new__(Mesh)
+    self._object = object
+    Object.__init__(self, *args, **kwargs)
+    return self
+
 cdef class Plane(Object):
   """A plane."""
   def __init__(self, normal, double distance, *args, **kwargs):
@@ -1408,6 +1626,26 @@ cdef class Merge(Object):
 
     Object.__init__(self, *args, **kwargs)
 
+cdef class Instance(Object):
+  """An instance of a shared prototype object."""
+  def __init__(self, Object prototype not None, *args, **kwargs):
+    """
+    Create an Instance.
+
+    Keyword arguments:
+    prototype -- the object to instance, which should not also be added to the
+                 scene
+
+    Additionally, Instance() accepts any arguments that Object() accepts.  By
+    default, the instance has the prototype's texture and interior.
+    """
+    self._object = dmnsn_new_instance(_get_pool(), prototype._object)
+
+    Object.__init__(self, *args, **kwargs)
+
+    if self._object.texture == NULL:
+      self._object.texture = prototype._object.texture
+
 ##########
 # Lights #
 ##########
@@ -1599,6 +1837,86 @@ cdef class Scene:
     def __set__(self, q):
       self._scene.quality = _string_to_quality(q)
 
+  property tile_width:
+    """The width of a render tile, or 0 for the whole image (default: 32)."""
+    def __get__(self):
+      return self._scene.tile_width
+    def __set__(self, width):
+      if width < 0:
+        raise ValueError("%d is an invalid tile width." % width)
+      self._scene.tile_width = width
+  property tile_height:
+    """The height of a render tile, or 0 for the whole image (default: 32)."""
+    def __get__(self):
+      return self._scene.tile_height
+    def __set__(self, height):
+      if height < 0:
+        raise ValueError("%d is an invalid tile height." % height)
+      self._scene.tile_height = height
+  property tile_order:
+    """
+    The order in which tiles are rendered: "scanline", "hilbert", or
+    "center-out" (default: "scanline").
+    """
+    def __get__(self):
+      if self._scene.tile_order == DMNSN_TILE_SCANLINE:
+        return "scanline"
+      elif self._scene.tile_order == DMNSN_TILE_HILBERT:
+        return "hilbert"
+      elif self._scene.tile_order == DMNSN_TILE_CENTER_OUT:
+        return "center-out"
+    def __set__(self, str order not None):
+      if order == "scanline":
+        self._scene.tile_order = DMNSN_TILE_SCANLINE
+      elif order == "hilbert":
+        self._scene.tile_order = DMNSN_TILE_HILBERT
+      elif order == "center-out":
+        self._scene.tile_order = DMNSN_TILE_CENTER_OUT
+      else:
+        raise ValueError("unknown tile order '%s'" % order)
+  property bvh:
+    """
+    The bounding hierarchy to build: "prtree", "sah", "lbvh", or "none"
+    (default: "prtree").
+    """
+    def __get__(self):
+      if self._scene.bvh_kind == DMNSN_BVH_NONE:
+        return "none"
+      elif self._scene.bvh_kind == DMNSN_BVH_PRTREE:
+        return "prtree"
+      elif self._scene.bvh_kind == DMNSN_BVH_SAH:
+        return "sah"
+      elif self._scene.bvh_kind == DMNSN_BVH_LBVH:
+        return "lbvh"
+    def __set__(self, str kind not None):
+      if kind == "none":
+        self._scene.bvh_kind = DMNSN_BVH_NONE
+      elif kind == "prtree":
+        self._scene.bvh_kind = DMNSN_BVH_PRTREE
+      elif kind == "sah":
+        self._scene.bvh_kind = DMNSN_BVH_SAH
+      elif kind == "lbvh":
+        self._scene.bvh_kind = DMNSN_BVH_LBVH
+      else:
+        raise ValueError("unknown bounding hierarchy '%s'" % kind)
+  property bvh_traversal:
+    """
+    The order to visit the bounding hierarchy in: "ordered" (nearest first) or
+    "preorder" (default: "ordered").
+    """
+    def __get__(self):
+      if self._scene.bvh_traversal == DMNSN_BVH_PREORDER:
+        return "preorder"
+      elif self._scene.bvh_traversal == DMNSN_BVH_ORDERED:
+        return "ordered"
+    def __set__(self, str traversal not None):
+      if traversal == "preorder":
+        self._scene.bvh_traversal = DMNSN_BVH_PREORDER
+      elif traversal == "ordered":
+        self._scene.bvh_traversal = DMNSN_BVH_ORDERED
+      else:
+        raise ValueError("unknown bounding hierarchy traversal '%s'" % traversal)
+
   property bounding_timer:
     """The Timer for building the bounding hierarchy."""
     def __get__(self):
@@ -1608,6 +1926,21 @@ cdef class Scene:
     def __get__(self):
       return _Timer(self._scene.render_timer)
 
+  property shadow_cache_lookups:
+    """The number of shadow rays that tried a cached occluder."""
+    def __get__(self):
+      return self._scene.shadow_cache_lookups
+  property shadow_cache_hits:
+    """The number of shadow rays blocked by a cached occluder."""
+    def __get__(self):
+      return self._scene.shadow_cache_hits
+  property shadow_cache_hit_rate:
+    """The fraction of shadow cache lookups that hit."""
+    def __get__(self):
+      if self._scene.shadow_cache_lookups == 0:
+        return 0.0
+      return <double>self._scene.shadow_cache_hits/self._scene.shadow_cache_lookups
+
   def render(self):
     """Render the scene."""
     self.render_async().join()
@@ -20,6 +20,7 @@
 #########################################################################
 
 import errno
+import os
 from dimension import *
 
 # Treat warnings as errors for tests
@@ -53,5 +54,26 @@ canvas.clear(Blue)
 if have_PNG:
     canvas.write_PNG("png.png")
 
+    # Chain two exports together
+    future = canvas.write_PNG_async("png.png").then(
+        lambda: canvas.write_PNG_async("png2.png")
+    )
+    with future:
+        future.wait(0.5)
+        assert future.progress() >= 0.5, future.progress()
+    assert os.path.getsize("png2.png") == os.path.getsize("png.png")
+
+# Compact storage formats
+compact = Canvas(37, 21, format = "half", tiled = True)
+assert compact.format == "half", compact.format
+assert compact.tiled
+compact[36][20] = TColor(Red, trans = 0.5)
+assert compact[36][20].color == Red, compact[36][20]
+assert compact[36][20].trans == 0.5, compact[36][20]
+assert compact[0][0].color == Black, compact[0][0]
+
+if have_PNG:
+    compact.write_PNG("compact.png")
+
 #if haveGL:
 #    canvas.drawGL()
@@ -53,7 +53,45 @@ scene.default_texture = Texture(finish = Ambient(sRGB(0.1)) + Diffuse(sRGB(0.7))
 scene.background      = background
 scene.adc_bailout     = 1/255
 scene.recursion_limit = 5
-scene.render()
+scene.tile_width      = 64
+scene.tile_height     = 16
+scene.tile_order      = "hilbert"
 
 if have_PNG:
-  canvas.write_PNG("demo.png")
+  # Write the image while it's being rendered, and check that we get the same
+  # file as writing it afterwards
+  future = scene.render_async()
+  with canvas.write_PNG_async("demo.png"):
+    future.join()
+  canvas.write_PNG("demo-after.png")
+  with open("demo.png", "rb") as streamed, open("demo-after.png", "rb") as after:
+    assert streamed.read() == after.read()
+else:
+  scene.render()
+
+if have_PNG:
+  # The other bounding hierarchies and traversal orders must give the same
+  # image.  Scenes can only be rendered once, so build a fresh one for each.
+  for bvh, traversal in [("sah", "ordered"), ("lbvh", "ordered"), ("prtree", "preorder")]:
+    with open(path) as fh:
+      exec(compile(fh.read(), path, "exec"))
+
+    bvh_canvas = Canvas(width = 768, height = 480)
+    bvh_canvas.optimize_PNG()
+    scene = Scene(canvas  = bvh_canvas,
+                  objects = objects,
+                  lights  = lights,
+                  camera  = camera)
+    scene.default_texture = Texture(finish = Ambient(sRGB(0.1)) + Diffuse(sRGB(0.7)))
+    scene.background      = background
+    scene.adc_bailout     = 1/255
+    scene.recursion_limit = 5
+    scene.bvh             = bvh
+    scene.bvh_traversal   = traversal
+    scene.render()
+
+    bvh_path = "demo-%s-%s.png" % (bvh, traversal)
+    bvh_canvas.write_PNG(bvh_path)
+    with open(bvh_path, "rb") as other, open("demo-after.png", "rb") as after:
+      assert other.read() == after.read(), (bvh, traversal)
+    assert 0 <= scene.shadow_cache_hits <= scene.shadow_cache_lookups
@@ -26,10 +26,10 @@
 #define ITERATIONS 100000
 
 static void
-dmnsn_bench_future_increment(void)
+dmnsn_bench_future_increment_total(const char *name, size_t total)
 {
   dmnsn_future *future = dmnsn_new_future();
-  dmnsn_future_set_total(future, ITERATIONS);
+  dmnsn_future_set_total(future, total);
 
   sandglass_t sandglass;
   if (sandglass_init_monotonic(&sandglass, SANDGLASS_CPUTIME) != 0) {
@@ -39,11 +39,20 @@ dmnsn_bench_future_increment(void)
 
   // Benchmark the increment operation.
   sandglass_bench_fine(&sandglass, dmnsn_future_increment(future));
-  printf("dmnsn_future_increment(): %ld\n", sandglass.grains);
+  printf("dmnsn_future_increment() (%s): %ld\n", name, sandglass.grains);
 
+  dmnsn_future_flush();
   dmnsn_delete_future(future);
 }
 
+static void
+dmnsn_bench_future_increment(void)
+{
+  // Small totals publish every increment, like the unbatched implementation
+  dmnsn_bench_future_increment_total("unbatched", 1);
+  dmnsn_bench_future_increment_total("batched", ITERATIONS);
+}
+
 static int
 dmnsn_bench_future_ccthread(void *ptr, unsigned int thread,
                             unsigned int nthreads)
@@ -55,12 +64,19 @@ dmnsn_bench_future_ccthread(void *ptr, unsigned int thread,
   return 0;
 }
 
+/// Payload for the concurrent benchmarks.
+typedef struct dmnsn_bench_future_payload {
+  dmnsn_future *future;
+  size_t total; ///< The total to report, which controls batching.
+} dmnsn_bench_future_payload;
+
 static int
 dmnsn_bench_future_thread(void *ptr)
 {
-  dmnsn_future *future = (dmnsn_future *)ptr;
+  dmnsn_bench_future_payload *payload = ptr;
+  dmnsn_future *future = payload->future;
   size_t nthreads = 2*dmnsn_ncpus();
-  dmnsn_future_set_total(future, nthreads*ITERATIONS);
+  dmnsn_future_set_total(future, payload->total ? payload->total : nthreads*ITERATIONS);
 
   // Now run a bunch of increments concurrently.
   return dmnsn_execute_concurrently(future, dmnsn_bench_future_ccthread,
@@ -68,17 +84,42 @@ dmnsn_bench_future_thread(void *ptr)
 }
 
 static void
-dmnsn_bench_future_concurrent(void)
+dmnsn_bench_future_concurrent(const char *name, size_t total)
+{
+  printf("\nNo pausing (%s):\n", name);
+
+  dmnsn_future *future = dmnsn_new_future();
+  dmnsn_bench_future_payload payload = {
+    .future = future,
+    .total = total,
+  };
+
+  dmnsn_timer timer;
+  dmnsn_timer_start(&timer);
+
+  dmnsn_new_thread(future, dmnsn_bench_future_thread, &payload);
+
+  dmnsn_future_join(future);
+  dmnsn_timer_stop(&timer);
+  printf("100%%: " DMNSN_TIMER_FORMAT "\n", DMNSN_TIMER_PRINTF(timer));
+}
+
+static void
+dmnsn_bench_future_waiting(void)
 {
-  printf("\nNo pausing:\n");
+  printf("\nWaiting:\n");
 
   dmnsn_future *future = dmnsn_new_future();
+  dmnsn_bench_future_payload payload = {
+    .future = future,
+    .total = 0,
+  };
 
   dmnsn_timer timer1, timer2;
   dmnsn_timer_start(&timer1);
   timer2 = timer1;
 
-  dmnsn_new_thread(future, dmnsn_bench_future_thread, future);
+  dmnsn_new_thread(future, dmnsn_bench_future_thread, &payload);
 
   dmnsn_future_wait(future, 0.5);
   dmnsn_timer_stop(&timer1);
@@ -95,13 +136,17 @@ dmnsn_bench_future_pausing(void)
   printf("\nWith pausing:\n");
 
   dmnsn_future *future = dmnsn_new_future();
+  dmnsn_bench_future_payload payload = {
+    .future = future,
+    .total = 0,
+  };
   bool hit_fifty = false;
 
   dmnsn_timer timer1, timer2;
   dmnsn_timer_start(&timer1);
   timer2 = timer1;
 
-  dmnsn_new_thread(future, dmnsn_bench_future_thread, future);
+  dmnsn_new_thread(future, dmnsn_bench_future_thread, &payload);
 
   while (!dmnsn_future_is_done(future)) {
     dmnsn_future_pause(future);
@@ -122,7 +167,9 @@ int
 main(void)
 {
   dmnsn_bench_future_increment();
-  dmnsn_bench_future_concurrent();
+  dmnsn_bench_future_concurrent("unbatched", 1);
+  dmnsn_bench_future_concurrent("batched", 0);
+  dmnsn_bench_future_waiting();
   dmnsn_bench_future_pausing();
   return EXIT_SUCCESS;
 }
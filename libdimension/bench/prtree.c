@@ -17,20 +17,30 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
  *************************************************************************/
 
+// Count node visits in BVH queries
+#define DMNSN_BVH_STATS
+
 #include "../platform/platform.c"
 #include "../concurrency/threads.c"
 #include "../concurrency/future.c"
+#include "../concurrency/sort.c"
+#include "../concurrency/tasks.c"
 #include "../bvh/bvh.c"
+#include "../bvh/lbvh.c"
 #include "../bvh/prtree.c"
+#include "../bvh/sah.c"
 #include <sandglass.h>
 #include <stdlib.h>
 
+static unsigned long calls = 0;
+
 static bool
 dmnsn_fake_intersection_fn(const dmnsn_object *object, dmnsn_ray ray,
                            dmnsn_intersection *intersection)
 {
   intersection->t = (object->aabb.min.Z - ray.x0.Z)/ray.n.Z;
   intersection->normal = dmnsn_x;
+  ++calls;
   return true;
 }
 
@@ -67,6 +77,64 @@ dmnsn_new_fake_object(dmnsn_pool *pool)
   return object;
 }
 
+static void
+dmnsn_bench_bvh(sandglass_t *sandglass, const dmnsn_array *objects,
+                dmnsn_bvh_kind kind, dmnsn_bvh_traversal traversal,
+                const char *name)
+{
+  dmnsn_bvh *bvh;
+  sandglass_bench_noprecache(sandglass, {
+    bvh = dmnsn_new_bvh(objects, kind, traversal);
+  });
+  printf("dmnsn_new_bvh(%s): %ld\n", name, sandglass->grains);
+
+  // An explicit cache avoids thread-local lookups, and keeps the statistics
+  // below separate for each BVH
+  dmnsn_intersection_cache *cache = dmnsn_new_intersection_cache(bvh);
+
+  // dmnsn_bvh_intersection()
+  dmnsn_ray ray = dmnsn_new_ray(
+    dmnsn_new_vector( 1.0,  1.0, -2.0),
+    dmnsn_new_vector(-0.5, -0.5,  1.0)
+  );
+  dmnsn_intersection intersection;
+
+  sandglass_bench_fine(sandglass, {
+    dmnsn_bvh_intersection(bvh, cache, ray, &intersection, NULL, true);
+  });
+  printf("dmnsn_bvh_intersection(%s): %ld\n", name, sandglass->grains);
+
+  sandglass_bench_fine(sandglass, {
+    dmnsn_bvh_intersection(bvh, cache, ray, &intersection, NULL, false);
+  });
+  printf("dmnsn_bvh_intersection(%s, nocache): %ld\n", name, sandglass->grains);
+
+  // dmnsn_bvh_inside()
+  sandglass_bench_fine(sandglass, {
+    dmnsn_bvh_inside(bvh, cache, dmnsn_zero);
+  });
+  printf("dmnsn_bvh_inside(%s): %ld\n", name, sandglass->grains);
+
+  // Traversal cost: object intersection tests per ray, over a fixed set of
+  // rays through the scene
+  const unsigned int nrays = 1000;
+  srand(1);
+  calls = 0;
+  cache->visits = 0;
+  for (unsigned int i = 0; i < nrays; ++i) {
+    dmnsn_ray random_ray = dmnsn_new_ray(
+      dmnsn_new_vector(2.0*rand()/RAND_MAX - 1.0, 2.0*rand()/RAND_MAX - 1.0, -2.0),
+      dmnsn_new_vector(2.0*rand()/RAND_MAX - 1.0, 2.0*rand()/RAND_MAX - 1.0, 1.0)
+    );
+    dmnsn_bvh_intersection(bvh, cache, random_ray, &intersection, NULL, true);
+  }
+  printf("%s intersection tests per ray: %.1f\n", name, (double)calls/nrays);
+  printf("%s node visits per ray: %.1f\n", name, (double)cache->visits/nrays);
+
+  dmnsn_delete_intersection_cache(cache);
+  dmnsn_delete_bvh(bvh);
+}
+
 int
 main(void)
 {
@@ -89,37 +157,20 @@ main(void)
     dmnsn_array_push(objects, &object);
   }
 
-  dmnsn_bvh *bvh;
-  sandglass_bench_noprecache(&sandglass, {
-    bvh = dmnsn_new_bvh(objects, DMNSN_BVH_PRTREE);
-  });
-  printf("dmnsn_new_bvh(DMNSN_BVH_PRTREE): %ld\n", sandglass.grains);
-
-  // dmnsn_bvh_intersection()
-  dmnsn_ray ray = dmnsn_new_ray(
-    dmnsn_new_vector( 1.0,  1.0, -2.0),
-    dmnsn_new_vector(-0.5, -0.5,  1.0)
-  );
-  dmnsn_intersection intersection;
-
-  sandglass_bench_fine(&sandglass, {
-    dmnsn_bvh_intersection(bvh, ray, &intersection, true);
-  });
-  printf("dmnsn_bvh_intersection(): %ld\n", sandglass.grains);
-
-  sandglass_bench_fine(&sandglass, {
-    dmnsn_bvh_intersection(bvh, ray, &intersection, false);
-  });
-  printf("dmnsn_bvh_intersection(nocache): %ld\n", sandglass.grains);
-
-  // dmnsn_bvh_inside()
-  sandglass_bench_fine(&sandglass, {
-    dmnsn_bvh_inside(bvh, dmnsn_zero);
-  });
-  printf("dmnsn_bvh_inside(): %ld\n", sandglass.grains);
+  dmnsn_bench_bvh(&sandglass, objects, DMNSN_BVH_PRTREE, DMNSN_BVH_PREORDER,
+                  "DMNSN_BVH_PRTREE, DMNSN_BVH_PREORDER");
+  dmnsn_bench_bvh(&sandglass, objects, DMNSN_BVH_PRTREE, DMNSN_BVH_ORDERED,
+                  "DMNSN_BVH_PRTREE, DMNSN_BVH_ORDERED");
+  dmnsn_bench_bvh(&sandglass, objects, DMNSN_BVH_SAH, DMNSN_BVH_PREORDER,
+                  "DMNSN_BVH_SAH, DMNSN_BVH_PREORDER");
+  dmnsn_bench_bvh(&sandglass, objects, DMNSN_BVH_SAH, DMNSN_BVH_ORDERED,
+                  "DMNSN_BVH_SAH, DMNSN_BVH_ORDERED");
+  dmnsn_bench_bvh(&sandglass, objects, DMNSN_BVH_LBVH, DMNSN_BVH_PREORDER,
+                  "DMNSN_BVH_LBVH, DMNSN_BVH_PREORDER");
+  dmnsn_bench_bvh(&sandglass, objects, DMNSN_BVH_LBVH, DMNSN_BVH_ORDERED,
+                  "DMNSN_BVH_LBVH, DMNSN_BVH_ORDERED");
 
   // Cleanup
-  dmnsn_delete_bvh(bvh);
   dmnsn_delete_pool(pool);
   return EXIT_SUCCESS;
 }
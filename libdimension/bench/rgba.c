@@ -0,0 +1,112 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Benchmark Suite.                   *
+ *                                                                       *
+ * The Dimension Benchmark Suite is free software; you can redistribute  *
+ * it and/or modify it under the terms of the GNU General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Benchmark Suite is distributed in the hope that it will *
+ * be useful, but WITHOUT ANY WARRANTY; without even the implied         *
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See *
+ * the GNU General Public License for more details.                      *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+
+#include "../platform/platform.c"
+#include "../concurrency/future.c"
+#include "../concurrency/threads.c"
+#include "../canvas/rgba.c"
+#include <stdlib.h>
+
+#define NPIXELS (1 << 20)
+#define ITERATIONS 16
+
+/// Print the throughput of a timed run.
+static void
+dmnsn_bench_report(const char *name, dmnsn_timer timer)
+{
+  double rate = ((double)NPIXELS*ITERATIONS)/timer.real;
+  printf("%s: %.1f Mpixels/s\n", name, rate/1.0e6);
+}
+
+/// The old per-pixel conversion, for comparison.
+static void
+dmnsn_bench_pow_rgba16(const dmnsn_tcolor *tcolors, size_t n, uint16_t *rgba)
+{
+  for (size_t i = 0; i < n; ++i, rgba += 4) {
+    dmnsn_tcolor tcolor = dmnsn_tcolor_remove_filter(tcolors[i]);
+    tcolor.c = dmnsn_color_to_sRGB(tcolor.c);
+    tcolor = dmnsn_tcolor_clamp(tcolor);
+
+    rgba[0] = lround(tcolor.c.R*UINT16_MAX);
+    rgba[1] = lround(tcolor.c.G*UINT16_MAX);
+    rgba[2] = lround(tcolor.c.B*UINT16_MAX);
+    rgba[3] = lround(tcolor.T*UINT16_MAX);
+  }
+}
+
+int
+main(void)
+{
+  dmnsn_tcolor *tcolors = dmnsn_malloc(NPIXELS*sizeof(dmnsn_tcolor));
+  uint8_t *rgba8 = dmnsn_malloc(4*NPIXELS*sizeof(uint8_t));
+  uint16_t *rgba16 = dmnsn_malloc(4*NPIXELS*sizeof(uint16_t));
+
+  for (size_t i = 0; i < NPIXELS; ++i) {
+    tcolors[i] = dmnsn_new_tcolor5(
+      (double)rand()/RAND_MAX,
+      (double)rand()/RAND_MAX,
+      (double)rand()/RAND_MAX,
+      (double)rand()/RAND_MAX,
+      0.0
+    );
+  }
+
+  dmnsn_timer timer;
+
+  dmnsn_timer_start(&timer);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    dmnsn_bench_pow_rgba16(tcolors, NPIXELS, rgba16);
+  }
+  dmnsn_timer_stop(&timer);
+  dmnsn_bench_report("pow() + lround() (16-bit)", timer);
+
+  dmnsn_timer_start(&timer);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    dmnsn_tcolors_to_rgba16(tcolors, NPIXELS, rgba16);
+  }
+  dmnsn_timer_stop(&timer);
+  dmnsn_bench_report("dmnsn_tcolors_to_rgba16()", timer);
+
+  dmnsn_timer_start(&timer);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    dmnsn_tcolors_to_rgba8(tcolors, NPIXELS, rgba8);
+  }
+  dmnsn_timer_stop(&timer);
+  dmnsn_bench_report("dmnsn_tcolors_to_rgba8()", timer);
+
+  dmnsn_timer_start(&timer);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    dmnsn_rgba16_to_tcolors(rgba16, NPIXELS, 4, tcolors);
+  }
+  dmnsn_timer_stop(&timer);
+  dmnsn_bench_report("dmnsn_rgba16_to_tcolors()", timer);
+
+  dmnsn_timer_start(&timer);
+  for (int i = 0; i < ITERATIONS; ++i) {
+    dmnsn_rgba8_to_tcolors(rgba8, NPIXELS, 4, tcolors);
+  }
+  dmnsn_timer_stop(&timer);
+  dmnsn_bench_report("dmnsn_rgba8_to_tcolors()", timer);
+
+  dmnsn_free(rgba16);
+  dmnsn_free(rgba8);
+  dmnsn_free(tcolors);
+  return EXIT_SUCCESS;
+}
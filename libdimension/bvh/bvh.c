@@ -25,8 +25,18 @@
 
 #include "internal/bvh.h"
 #include "internal/concurrency.h"
+#include "internal/lbvh.h"
 #include "internal/prtree.h"
+#include "internal/sah.h"
+#include <float.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE__
+  #include <xmmintrin.h>
+#endif
 
 /// Implementation for DMNSN_BVH_NONE: just stick all objects in one node.
 static dmnsn_bvh_node *
@@ -42,19 +52,72 @@ dmnsn_new_stupid_bvh(const dmnsn_array *objects)
   return root;
 }
 
+/// Number of children per flat BVH node.
+#define DMNSN_BVH_WIDTH 4
+/// Maximum number of objects in a leaf of the flat BVH.
+#define DMNSN_BVH_LEAF_SIZE 2
+
+/**
+ * A wide, flat BVH node for storing in an array.  The child bounding boxes are
+ * stored in single precision, rounded outwards, in a structure-of-arrays layout
+ * so they can all be tested against a ray at once.
+ */
+typedef struct dmnsn_flat_bvh_node {
+  /// Child bounding boxes, indexed by [max][axis][child].
+  float bounds[2][3][DMNSN_BVH_WIDTH];
+  /// The index of each child node, or of the first object in a leaf.
+  uint32_t children[DMNSN_BVH_WIDTH];
+  /// The number of objects in each leaf child, or 0 for inner nodes.
+  uint32_t counts[DMNSN_BVH_WIDTH];
+} dmnsn_flat_bvh_node;
+
+/// A pending subtree during BVH traversal.
+typedef struct dmnsn_bvh_stack_entry {
+  uint32_t index; ///< The node or first object index.
+  uint32_t count; ///< The number of objects, or 0 for inner nodes.
+  float t;        ///< A lower bound on the ray's entry distance.
+} dmnsn_bvh_stack_entry;
+
+/// A pending subtree during packet traversal.
+typedef struct dmnsn_bvh_packet_entry {
+  uint32_t index; ///< The node or first object index.
+  uint32_t count; ///< The number of objects, or 0 for inner nodes.
+  uint32_t mask;  ///< The rays that hit this subtree's bounding box.
+  float t;        ///< A lower bound on the entry distance of any of the rays.
+} dmnsn_bvh_packet_entry;
+
 // Implementation of opaque dmnsn_bvh type.
 struct dmnsn_bvh {
   dmnsn_array *unbounded;           ///< The unbounded objects.
-  dmnsn_array *bounded;             ///< The BVH of the bounded objects.
-  pthread_key_t intersection_cache; ///< The thread-local intersection cache.
+  dmnsn_array *bounded;             ///< The flat BVH of the bounded objects.
+  dmnsn_array *objects;             ///< The objects referenced by the leaves.
+  dmnsn_aabb aabb;                  ///< The bounding box of the bounded objects.
+  size_t stack_size;                ///< The traversal stack size needed.
+  dmnsn_bvh_traversal traversal;    ///< The traversal order for rays.
+  pthread_key_t intersection_cache; ///< Intersection cache for implicit callers.
+  /// Chain of every thread-local cache, freed with the BVH.
+  atomic(dmnsn_intersection_cache *) caches;
 };
 
-/// A flat BVH node for storing in an array for fast pre-order traversal.
-typedef struct dmnsn_flat_bvh_node {
-  dmnsn_aabb aabb;      ///< The bounding box of this node.
-  dmnsn_object *object; ///< The referenced object, for leaf nodes.
-  ptrdiff_t skip;       ///< Displacement to the next sibling.
-} dmnsn_flat_bvh_node;
+/// The number of intersections to cache.
+#define DMNSN_INTERSECTION_CACHE_SIZE 32
+
+// Implementation of opaque dmnsn_intersection_cache type.
+struct dmnsn_intersection_cache {
+#if DMNSN_DEBUG
+  const dmnsn_bvh *bvh; ///< The BVH this cache is for.
+#endif
+#ifdef DMNSN_BVH_STATS
+  unsigned long visits; ///< The number of nodes visited, for benchmarks.
+#endif
+  size_t i;
+  dmnsn_object *objects[DMNSN_INTERSECTION_CACHE_SIZE];
+  /// The previous thread-local cache in the BVH's chain.
+  struct dmnsn_intersection_cache *prev;
+  /// The packet traversal stack, stored after the regular one.
+  dmnsn_bvh_packet_entry *packet_stack;
+  dmnsn_bvh_stack_entry stack[]; ///< The traversal stack.
+};
 
 /// Add an object or its children, if any, to an array.
 static void
@@ -101,40 +164,193 @@ dmnsn_split_unbounded(dmnsn_array *objects)
   return unbounded;
 }
 
-/// Recursively flatten a BVH into an array of flat nodes.
+/// Round a double down to a float.
+static inline float
+dmnsn_round_down(double x)
+{
+  float f = x;
+  return f > x ? nextafterf(f, -INFINITY) : f;
+}
+
+/// Round a double up to a float.
+static inline float
+dmnsn_round_up(double x)
+{
+  float f = x;
+  return f < x ? nextafterf(f, INFINITY) : f;
+}
+
+/// A range of sibling subtrees, which together become one child of a wide node.
+typedef struct dmnsn_bvh_slot {
+  dmnsn_bvh_node **nodes; ///< The subtrees.
+  size_t n;               ///< The number of subtrees.
+  dmnsn_aabb aabb;        ///< The bounding box of the whole range.
+} dmnsn_bvh_slot;
+
+/// Make a slot for a range of subtrees.
+static dmnsn_bvh_slot
+dmnsn_new_bvh_slot(dmnsn_bvh_node **nodes, size_t n)
+{
+  while (true) {
+    while (n > 0 && !nodes[n - 1]) {
+      --n;
+    }
+
+    // Look through lone inner nodes to their children
+    if (n == 1 && !nodes[0]->object) {
+      dmnsn_bvh_node *node = nodes[0];
+      nodes = node->children;
+      n = node->nchildren;
+    } else {
+      break;
+    }
+  }
+
+  dmnsn_bvh_slot slot = {
+    .nodes = nodes,
+    .n = n,
+    .aabb = dmnsn_zero_aabb(),
+  };
+  for (size_t i = 0; i < n; ++i) {
+    slot.aabb.min = dmnsn_vector_min(slot.aabb.min, nodes[i]->aabb.min);
+    slot.aabb.max = dmnsn_vector_max(slot.aabb.max, nodes[i]->aabb.max);
+  }
+  return slot;
+}
+
+/**
+ * Split slots until they fill a wide node.  Ranges of siblings are treated as
+ * an implicit binary tree, and the largest slot is split in half each time,
+ * which handles the binary and 8-ary trees from the various builders alike.
+ */
+static size_t
+dmnsn_split_bvh_slots(dmnsn_bvh_slot slots[DMNSN_BVH_WIDTH], size_t nslots)
+{
+  while (nslots < DMNSN_BVH_WIDTH) {
+    size_t best = nslots;
+    double best_area = -INFINITY;
+    for (size_t i = 0; i < nslots; ++i) {
+      double area = dmnsn_bvh_area(slots[i].aabb);
+      if (slots[i].n > 1 && area > best_area) {
+        best = i;
+        best_area = area;
+      }
+    }
+
+    if (best == nslots) {
+      break;
+    }
+
+    // Split the slot in place, to preserve the order of the objects
+    dmnsn_bvh_slot slot = slots[best];
+    size_t half = slot.n/2;
+    memmove(slots + best + 2, slots + best + 1, (nslots - best - 1)*sizeof(dmnsn_bvh_slot));
+    slots[best] = dmnsn_new_bvh_slot(slot.nodes, half);
+    slots[best + 1] = dmnsn_new_bvh_slot(slot.nodes + half, slot.n - half);
+    ++nslots;
+  }
+
+  return nslots;
+}
+
+/// Count the objects in a range of subtrees, stopping after \p limit.
+static size_t
+dmnsn_count_bvh_objects(dmnsn_bvh_node **nodes, size_t n, size_t limit)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < n && nodes[i] && count <= limit; ++i) {
+    if (nodes[i]->object) {
+      ++count;
+    } else {
+      count += dmnsn_count_bvh_objects(nodes[i]->children, nodes[i]->nchildren, limit - count);
+    }
+  }
+  return count;
+}
+
+/// Collect the objects in a range of subtrees, in order.
 static void
-dmnsn_flatten_bvh_recursive(dmnsn_bvh_node *node, dmnsn_array *flat)
+dmnsn_collect_bvh_objects(dmnsn_bvh_node **nodes, size_t n, dmnsn_array *objects)
 {
-  size_t currenti = dmnsn_array_size(flat);
-  dmnsn_array_resize(flat, currenti + 1);
-  dmnsn_flat_bvh_node *flatnode = dmnsn_array_at(flat, currenti);
+  for (size_t i = 0; i < n && nodes[i]; ++i) {
+    if (nodes[i]->object) {
+      dmnsn_array_push(objects, &nodes[i]->object);
+    } else {
+      dmnsn_collect_bvh_objects(nodes[i]->children, nodes[i]->nchildren, objects);
+    }
+  }
+}
+
+/// Recursively flatten a slot into a wide node.
+static uint32_t
+dmnsn_flatten_bvh_recursive(dmnsn_bvh *bvh, dmnsn_bvh_slot slot, size_t depth)
+{
+  size_t nodei = dmnsn_array_size(bvh->bounded);
+  dmnsn_assert(nodei <= UINT32_MAX, "BVH too large.");
+  dmnsn_array_resize(bvh->bounded, nodei + 1);
+
+  size_t stack_size = (DMNSN_BVH_WIDTH - 1)*depth + DMNSN_BVH_WIDTH;
+  if (stack_size > bvh->stack_size) {
+    bvh->stack_size = stack_size;
+  }
+
+  dmnsn_bvh_slot slots[DMNSN_BVH_WIDTH] = { slot };
+  size_t nslots = dmnsn_split_bvh_slots(slots, 1);
 
-  flatnode->aabb = node->aabb;
-  flatnode->object = node->object;
+  dmnsn_flat_bvh_node flatnode;
+  for (size_t i = 0; i < DMNSN_BVH_WIDTH; ++i) {
+    dmnsn_aabb aabb = dmnsn_zero_aabb();
+    flatnode.children[i] = 0;
+    flatnode.counts[i] = 0;
 
-  for (size_t i = 0; i < node->nchildren && node->children[i]; ++i) {
-    dmnsn_flatten_bvh_recursive(node->children[i], flat);
+    if (i < nslots) {
+      aabb = slots[i].aabb;
+
+      size_t count = dmnsn_count_bvh_objects(slots[i].nodes, slots[i].n, DMNSN_BVH_LEAF_SIZE);
+      if (count <= DMNSN_BVH_LEAF_SIZE) {
+        flatnode.children[i] = dmnsn_array_size(bvh->objects);
+        flatnode.counts[i] = count;
+        dmnsn_collect_bvh_objects(slots[i].nodes, slots[i].n, bvh->objects);
+      } else {
+        flatnode.children[i] = dmnsn_flatten_bvh_recursive(bvh, slots[i], depth + 1);
+      }
+    }
+
+    // Empty slots get an inverted box, but since that doesn't make the slab
+    // test miss, they're skipped explicitly during traversal
+    flatnode.bounds[0][0][i] = dmnsn_round_down(aabb.min.X);
+    flatnode.bounds[0][1][i] = dmnsn_round_down(aabb.min.Y);
+    flatnode.bounds[0][2][i] = dmnsn_round_down(aabb.min.Z);
+    flatnode.bounds[1][0][i] = dmnsn_round_up(aabb.max.X);
+    flatnode.bounds[1][1][i] = dmnsn_round_up(aabb.max.Y);
+    flatnode.bounds[1][2][i] = dmnsn_round_up(aabb.max.Z);
   }
 
-  // Array could have been realloc()'d somewhere else above
-  flatnode = dmnsn_array_at(flat, currenti);
-  flatnode->skip = dmnsn_array_size(flat) - currenti;
+  // Array could have been realloc()'d by the recursive calls
+  dmnsn_array_set(bvh->bounded, nodei, &flatnode);
+  return nodei;
 }
 
-/// Flatten a BVH into an array of flat nodes.
-static dmnsn_array *
-dmnsn_flatten_bvh(dmnsn_bvh_node *root)
+/// Flatten a BVH into an array of wide nodes.
+static void
+dmnsn_flatten_bvh(dmnsn_bvh *bvh, dmnsn_bvh_node *root)
 {
-  dmnsn_array *flat = DMNSN_NEW_ARRAY(dmnsn_flat_bvh_node);
+  bvh->bounded = DMNSN_NEW_ARRAY(dmnsn_flat_bvh_node);
+  bvh->objects = DMNSN_NEW_ARRAY(dmnsn_object *);
+  bvh->stack_size = 0;
+
   if (root) {
-    dmnsn_flatten_bvh_recursive(root, flat);
+    bvh->aabb = root->aabb;
+    dmnsn_flatten_bvh_recursive(bvh, dmnsn_new_bvh_slot(&root, 1), 0);
+  } else {
+    bvh->aabb = dmnsn_zero_aabb();
   }
-  return flat;
 }
 
-dmnsn_bvh *dmnsn_new_bvh(const dmnsn_array *objects, dmnsn_bvh_kind kind)
+dmnsn_bvh *dmnsn_new_bvh(const dmnsn_array *objects, dmnsn_bvh_kind kind, dmnsn_bvh_traversal traversal)
 {
   dmnsn_bvh *bvh = DMNSN_MALLOC(dmnsn_bvh);
+  bvh->traversal = traversal;
 
   dmnsn_array *bounded = dmnsn_split_objects(objects);
   bvh->unbounded = dmnsn_split_unbounded(bounded);
@@ -148,16 +364,25 @@ dmnsn_bvh *dmnsn_new_bvh(const dmnsn_array *objects, dmnsn_bvh_kind kind)
     case DMNSN_BVH_PRTREE:
       root = dmnsn_new_prtree(bounded);
       break;
+    case DMNSN_BVH_SAH:
+      root = dmnsn_new_sah_bvh(bounded);
+      break;
+    case DMNSN_BVH_LBVH:
+      root = dmnsn_new_lbvh(bounded);
+      break;
     default:
       dmnsn_unreachable("Invalid BVH kind.");
     }
   }
-  bvh->bounded = dmnsn_flatten_bvh(root);
+  dmnsn_flatten_bvh(bvh, root);
 
   dmnsn_delete_bvh_node(root);
   dmnsn_delete_array(bounded);
 
-  dmnsn_key_create(&bvh->intersection_cache, dmnsn_free);
+  // Worker threads are pooled and outlive the BVH, so the BVH frees the
+  // thread-local caches itself
+  dmnsn_key_create(&bvh->intersection_cache, NULL);
+  atomic_store_explicit(&bvh->caches, NULL, memory_order_relaxed);
 
   return bvh;
 }
@@ -166,18 +391,32 @@ void
 dmnsn_delete_bvh(dmnsn_bvh *bvh)
 {
   if (bvh) {
-    dmnsn_free(pthread_getspecific(bvh->intersection_cache));
+    dmnsn_intersection_cache *cache = atomic_load_explicit(&bvh->caches, memory_order_acquire);
+    while (cache) {
+      dmnsn_intersection_cache *prev = cache->prev;
+      dmnsn_delete_intersection_cache(cache);
+      cache = prev;
+    }
     dmnsn_key_delete(bvh->intersection_cache);
+    dmnsn_delete_array(bvh->objects);
     dmnsn_delete_array(bvh->bounded);
     dmnsn_delete_array(bvh->unbounded);
     dmnsn_free(bvh);
   }
 }
 
+/// Relative error allowed for in single-precision ray-box tests.
+#define DMNSN_BVH_FLOAT_ERROR (4.0*FLT_EPSILON)
+
 /// A ray with pre-calculated reciprocals to avoid divisions.
 typedef struct dmnsn_optimized_ray {
   dmnsn_vector x0;    ///< The origin of the ray.
   dmnsn_vector n_inv; ///< The inverse of each component of the ray's slope
+
+  float x0f[3];       ///< The origin, in single precision.
+  float n_invf[3];    ///< The inverse slope, in single precision.
+  unsigned int sign[3]; ///< Whether each component of the slope is negative.
+  float slack;        ///< Absolute error allowed for from rounding the origin.
 } dmnsn_optimized_ray;
 
 /// Precompute inverses for faster ray-box intersection tests.
@@ -188,6 +427,22 @@ dmnsn_optimize_ray(dmnsn_ray ray)
     .x0    = ray.x0,
     .n_inv = dmnsn_new_vector(1.0/ray.n.X, 1.0/ray.n.Y, 1.0/ray.n.Z)
   };
+
+  // Rounding the slope only introduces relative error in t, but rounding the
+  // origin shifts every t by up to this much
+  double slack = 0.0;
+  for (int i = 0; i < 3; ++i) {
+    optray.x0f[i] = optray.x0.n[i];
+    optray.n_invf[i] = optray.n_inv.n[i];
+    optray.sign[i] = optray.n_inv.n[i] < 0.0;
+
+    double error = fabs(optray.x0.n[i] - optray.x0f[i]);
+    if (error > 0.0 && isfinite(optray.n_inv.n[i])) {
+      slack = dmnsn_max(slack, error*fabs(optray.n_inv.n[i]));
+    }
+  }
+  optray.slack = dmnsn_round_up(slack*(1.0 + DMNSN_BVH_FLOAT_ERROR));
+
   return optray;
 }
 
@@ -223,39 +478,220 @@ dmnsn_ray_box_intersection(dmnsn_optimized_ray optray, dmnsn_aabb box, double t)
   return tmax >= dmnsn_max(0.0, tmin) && tmin < t;
 }
 
-/// The number of intersections to cache.
-#define DMNSN_INTERSECTION_CACHE_SIZE 32
+/**
+ * Test a ray against all the children of a wide node at once.  The same slab
+ * method as dmnsn_ray_box_intersection() is used, but in single precision, so
+ * the [tmin, tmax] intervals are widened to account for rounding error.  This
+ * makes the test conservative; it never misses a box the double-precision test
+ * would hit.
+ * @param[in]  optray  The ray to test.
+ * @param[in]  node    The node whose children to test.
+ * @param[in]  t       The distance to the closest intersection so far.
+ * @param[out] tmins   Lower bounds on the entry distance into each child.
+ * @return A bitmask of the children that were hit.
+ */
+static inline unsigned int
+dmnsn_ray_wide_box_intersection(const dmnsn_optimized_ray *optray, const dmnsn_flat_bvh_node *node, double t, float tmins[DMNSN_BVH_WIDTH])
+{
+  const float lo = 1.0f - DMNSN_BVH_FLOAT_ERROR, hi = 1.0f + DMNSN_BVH_FLOAT_ERROR;
+  float tf = t;
 
-/// An array of cached intersections.
-typedef struct dmnsn_intersection_cache {
-  size_t i;
-  dmnsn_object *objects[DMNSN_INTERSECTION_CACHE_SIZE];
-} dmnsn_intersection_cache;
+#ifdef __SSE__
+  __m128 tmin = _mm_setzero_ps();
+  __m128 tmax = _mm_set1_ps(tf);
+  for (int i = 0; i < 3; ++i) {
+    // Pick the near and far planes up front from the sign of the slope
+    __m128 near = _mm_loadu_ps(node->bounds[optray->sign[i]][i]);
+    __m128 far = _mm_loadu_ps(node->bounds[!optray->sign[i]][i]);
+    __m128 x0 = _mm_set1_ps(optray->x0f[i]);
+    __m128 n_inv = _mm_set1_ps(optray->n_invf[i]);
+
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(near, x0), n_inv);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(far, x0), n_inv);
+    t1 = _mm_sub_ps(_mm_mul_ps(t1, _mm_set1_ps(lo)), _mm_set1_ps(optray->slack));
+    t2 = _mm_add_ps(_mm_mul_ps(t2, _mm_set1_ps(hi)), _mm_set1_ps(optray->slack));
+
+    tmin = _mm_max_ps(t1, tmin);
+    tmax = _mm_min_ps(t2, tmax);
+  }
+
+  _mm_storeu_ps(tmins, tmin);
+  return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+  unsigned int mask = 0;
+  for (int j = 0; j < DMNSN_BVH_WIDTH; ++j) {
+    float tmin = 0.0f, tmax = tf;
+    for (int i = 0; i < 3; ++i) {
+      float near = node->bounds[optray->sign[i]][i][j];
+      float far = node->bounds[!optray->sign[i]][i][j];
+      float t1 = (near - optray->x0f[i])*optray->n_invf[i]*lo - optray->slack;
+      float t2 = (far - optray->x0f[i])*optray->n_invf[i]*hi + optray->slack;
+      tmin = t1 > tmin ? t1 : tmin;
+      tmax = t2 < tmax ? t2 : tmax;
+    }
+    tmins[j] = tmin;
+    mask |= (unsigned int)(tmin <= tmax) << j;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * Test whether a point is inside each child of a wide node.  Rounding the point
+ * to single precision can't make it fall outside a box that contains it, since
+ * the bounds are themselves floats rounded outwards.
+ * @return A bitmask of the children that contain the point.
+ */
+static inline unsigned int
+dmnsn_wide_box_contains(const dmnsn_flat_bvh_node *node, const float point[3])
+{
+#ifdef __SSE__
+  __m128 contains[3];
+  for (int i = 0; i < 3; ++i) {
+    __m128 x = _mm_set1_ps(point[i]);
+    contains[i] = _mm_and_ps(_mm_cmpge_ps(x, _mm_loadu_ps(node->bounds[0][i])),
+                             _mm_cmple_ps(x, _mm_loadu_ps(node->bounds[1][i])));
+  }
+  return _mm_movemask_ps(_mm_and_ps(contains[0], _mm_and_ps(contains[1], contains[2])));
+#else
+  unsigned int mask = 0;
+  for (int j = 0; j < DMNSN_BVH_WIDTH; ++j) {
+    bool contains = true;
+    for (int i = 0; i < 3; ++i) {
+      contains = contains
+        && point[i] >= node->bounds[0][i][j]
+        && point[i] <= node->bounds[1][i][j];
+    }
+    mask |= (unsigned int)contains << j;
+  }
+  return mask;
+#endif
+}
 
-static dmnsn_intersection_cache *
-dmnsn_get_intersection_cache(const dmnsn_bvh *bvh)
+/// Check whether a child slot of a node is empty.
+static inline bool
+dmnsn_bvh_slot_empty(const dmnsn_flat_bvh_node *node, unsigned int i)
 {
-  dmnsn_intersection_cache *cache
-    = pthread_getspecific(bvh->intersection_cache);
+  // Empty slots are marked by a zero index, since the root is never a child
+  return node->children[i] == 0 && node->counts[i] == 0;
+}
 
-  if (!cache) {
-    cache = DMNSN_MALLOC(dmnsn_intersection_cache);
-    cache->i = 0;
-    for (size_t i = 0; i < DMNSN_INTERSECTION_CACHE_SIZE; ++i) {
-      cache->objects[i] = NULL;
+/// Push the children of a node selected by \p mask, so the first is on top.
+static inline size_t
+dmnsn_bvh_push_children(dmnsn_bvh_stack_entry *stack, size_t size, const dmnsn_flat_bvh_node *node, unsigned int mask, const float tmins[DMNSN_BVH_WIDTH])
+{
+  for (int i = DMNSN_BVH_WIDTH - 1; i >= 0; --i) {
+    if ((mask & (1U << i)) && !dmnsn_bvh_slot_empty(node, i)) {
+      stack[size].index = node->children[i];
+      stack[size].count = node->counts[i];
+      stack[size].t = tmins[i];
+      ++size;
     }
+  }
+  return size;
+}
+
+/// Push the children of a node selected by \p mask, so the nearest is on top.
+static inline size_t
+dmnsn_bvh_push_ordered(dmnsn_bvh_stack_entry *stack, size_t size, const dmnsn_flat_bvh_node *node, unsigned int mask, const float tmins[DMNSN_BVH_WIDTH])
+{
+  // Insertion sort the hit children by decreasing entry distance, straight
+  // onto the stack
+  size_t start = size;
+  for (unsigned int i = 0; i < DMNSN_BVH_WIDTH; ++i) {
+    if (!(mask & (1U << i)) || dmnsn_bvh_slot_empty(node, i)) {
+      continue;
+    }
+
+    dmnsn_bvh_stack_entry entry = {
+      .index = node->children[i],
+      .count = node->counts[i],
+      .t = tmins[i],
+    };
+
+    size_t j = size;
+    while (j > start && stack[j - 1].t < entry.t) {
+      stack[j] = stack[j - 1];
+      --j;
+    }
+    stack[j] = entry;
+    ++size;
+  }
+  return size;
+}
+
+#ifdef DMNSN_BVH_STATS
+  #define dmnsn_bvh_visit(cache) (++(cache)->visits)
+#else
+  #define dmnsn_bvh_visit(cache) ((void)0)
+#endif
+
+dmnsn_intersection_cache *
+dmnsn_new_intersection_cache(const dmnsn_bvh *bvh)
+{
+  dmnsn_intersection_cache *cache = dmnsn_malloc(
+    sizeof(dmnsn_intersection_cache)
+    + bvh->stack_size*sizeof(dmnsn_bvh_stack_entry)
+    + bvh->stack_size*sizeof(dmnsn_bvh_packet_entry)
+  );
+  cache->packet_stack = (dmnsn_bvh_packet_entry *)(cache->stack + bvh->stack_size);
+#if DMNSN_DEBUG
+  cache->bvh = bvh;
+#endif
+#ifdef DMNSN_BVH_STATS
+  cache->visits = 0;
+#endif
+  cache->i = 0;
+  for (size_t i = 0; i < DMNSN_INTERSECTION_CACHE_SIZE; ++i) {
+    cache->objects[i] = NULL;
+  }
+  return cache;
+}
+
+void
+dmnsn_intersection_cache_reset(dmnsn_intersection_cache *cache)
+{
+  cache->i = 0;
+}
+
+void
+dmnsn_delete_intersection_cache(dmnsn_intersection_cache *cache)
+{
+  dmnsn_free(cache);
+}
+
+/// Get the intersection cache to use for a query.
+static inline dmnsn_intersection_cache *
+dmnsn_get_intersection_cache(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache)
+{
+  if (dmnsn_likely(cache)) {
+    dmnsn_assert(cache->bvh == bvh, "Intersection cache used with the wrong BVH.");
+    return cache;
+  }
+
+  // Callers without their own cache, like CSG objects nested inside a render,
+  // get a thread-local one
+  cache = pthread_getspecific(bvh->intersection_cache);
+  if (!cache) {
+    cache = dmnsn_new_intersection_cache(bvh);
     dmnsn_setspecific(bvh->intersection_cache, cache);
+
+    // Atomically update bvh->caches.  The chain is only read when the BVH is
+    // deleted, so it isn't really part of its const state.
+    dmnsn_bvh *owner = (dmnsn_bvh *)bvh;
+    cache->prev = atomic_exchange(&owner->caches, cache);
   }
 
   return cache;
 }
 
-/// Test for a closer object intersection than we've found so far.
+/// Test for a closer object intersection than we've found so far.  The normal
+/// is left for dmnsn_object_finalize(), once the closest one is known.
 static inline bool
 dmnsn_closer_intersection(dmnsn_object *object, dmnsn_ray ray, dmnsn_intersection *intersection, double *t)
 {
   dmnsn_intersection local_intersection;
-  if (dmnsn_object_intersection(object, ray, &local_intersection)) {
+  if (dmnsn_object_hit(object, ray, &local_intersection)) {
     if (local_intersection.t < *t) {
       *intersection = local_intersection;
       *t = local_intersection.t;
@@ -266,20 +702,23 @@ dmnsn_closer_intersection(dmnsn_object *object, dmnsn_ray ray, dmnsn_intersectio
 }
 
 DMNSN_HOT bool
-dmnsn_bvh_intersection(const dmnsn_bvh *bvh, dmnsn_ray ray, dmnsn_intersection *intersection, bool reset)
+dmnsn_bvh_intersection(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, dmnsn_ray ray, dmnsn_intersection *intersection, dmnsn_object **object, bool reset)
 {
   double t = INFINITY;
 
   // Search the unbounded objects
-  DMNSN_ARRAY_FOREACH (dmnsn_object **, object, bvh->unbounded) {
-    dmnsn_closer_intersection(*object, ray, intersection, &t);
+  dmnsn_object *unbounded = NULL;
+  DMNSN_ARRAY_FOREACH (dmnsn_object **, i, bvh->unbounded) {
+    if (dmnsn_closer_intersection(*i, ray, intersection, &t)) {
+      unbounded = *i;
+    }
   }
 
   // Precalculate 1.0/ray.n.{x,y,z} to save time in intersection tests
   dmnsn_optimized_ray optray = dmnsn_optimize_ray(ray);
 
   // Search the intersection cache
-  dmnsn_intersection_cache *cache = dmnsn_get_intersection_cache(bvh);
+  cache = dmnsn_get_intersection_cache(bvh, cache);
   if (dmnsn_unlikely(reset)) {
     cache->i = 0;
   }
@@ -294,18 +733,43 @@ dmnsn_bvh_intersection(const dmnsn_bvh *bvh, dmnsn_ray ray, dmnsn_intersection *
   }
 
   // Search the bounded objects
-  dmnsn_flat_bvh_node *node = dmnsn_array_first(bvh->bounded);
-  dmnsn_flat_bvh_node *last = dmnsn_array_last(bvh->bounded);
-  while (node <= last) {
-    if (dmnsn_ray_box_intersection(optray, node->aabb, t)) {
-      if (node->object && node->object != cached) {
-        if (dmnsn_closer_intersection(node->object, ray, intersection, &t)) {
-          found = node->object;
+  const dmnsn_flat_bvh_node *nodes = dmnsn_array_first(bvh->bounded);
+  dmnsn_object **objects = dmnsn_array_first(bvh->objects);
+  dmnsn_bvh_stack_entry *stack = cache->stack;
+  size_t size = 0;
+  if (dmnsn_array_size(bvh->bounded) > 0) {
+    stack[size++] = (dmnsn_bvh_stack_entry){ .index = 0, .count = 0, .t = 0.0f };
+  }
+  bool ordered = bvh->traversal == DMNSN_BVH_ORDERED;
+  while (size > 0) {
+    dmnsn_bvh_stack_entry entry = stack[--size];
+    if (ordered && entry.t > t) {
+      // Since the nearest children are visited first, t has often shrunk
+      // enough to skip their farther siblings entirely
+      continue;
+    }
+
+    if (entry.count > 0) {
+      for (uint32_t i = 0; i < entry.count; ++i) {
+        // The leaf's box was tested before t last shrank, and objects in
+        // multi-object leaves haven't had their own boxes tested at all
+        dmnsn_object *object = objects[entry.index + i];
+        if (object != cached && dmnsn_ray_box_intersection(optray, object->aabb, t)) {
+          if (dmnsn_closer_intersection(object, ray, intersection, &t)) {
+            found = object;
+          }
         }
       }
-      ++node;
     } else {
-      node += node->skip;
+      dmnsn_bvh_visit(cache);
+      const dmnsn_flat_bvh_node *node = nodes + entry.index;
+      float tmins[DMNSN_BVH_WIDTH];
+      unsigned int mask = dmnsn_ray_wide_box_intersection(&optray, node, t, tmins);
+      if (ordered) {
+        size = dmnsn_bvh_push_ordered(stack, size, node, mask, tmins);
+      } else {
+        size = dmnsn_bvh_push_children(stack, size, node, mask, tmins);
+      }
     }
   }
 
@@ -315,11 +779,467 @@ dmnsn_bvh_intersection(const dmnsn_bvh *bvh, dmnsn_ray ray, dmnsn_intersection *
     ++cache->i;
   }
 
-  return !isinf(t);
+  if (isinf(t)) {
+    return false;
+  }
+
+  dmnsn_object *closest = found ? found : unbounded;
+  dmnsn_object_finalize(closest, intersection);
+  if (object) {
+    *object = closest;
+  }
+  return true;
+}
+
+/// Test a packet of rays for closer intersections with one object, calling it
+/// once for all of them.  Returns a bitmask of the rays that got closer.
+static inline unsigned int
+dmnsn_closer_intersection_packet(dmnsn_object *object, const dmnsn_ray rays[DMNSN_BVH_PACKET_SIZE], unsigned int mask, dmnsn_intersection intersections[DMNSN_BVH_PACKET_SIZE], double t[DMNSN_BVH_PACKET_SIZE])
+{
+  if (!mask) {
+    return 0;
+  }
+
+  dmnsn_intersection local_intersections[DMNSN_BVH_PACKET_SIZE];
+  unsigned int hits = dmnsn_object_hit_packet(object, rays, mask, local_intersections);
+  unsigned int closer = 0;
+  for (unsigned int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    if ((hits & (1U << k)) && local_intersections[k].t < t[k]) {
+      intersections[k] = local_intersections[k];
+      t[k] = local_intersections[k].t;
+      closer |= 1U << k;
+    }
+  }
+  return closer;
+}
+
+/// A packet of rays with matching slope signs, in structure-of-arrays layout.
+typedef struct dmnsn_optimized_packet {
+  float x0f[3][DMNSN_BVH_PACKET_SIZE];    ///< The origins, in single precision.
+  float n_invf[3][DMNSN_BVH_PACKET_SIZE]; ///< The inverse slopes.
+  float slack[DMNSN_BVH_PACKET_SIZE];     ///< The rounding slack of each ray.
+  unsigned int sign[3];                   ///< The shared signs of the slopes.
+
+  bool intervals;   ///< Whether the interval bounds below can be used.
+  float x0_min[3];  ///< Lower bounds on the origins.
+  float x0_max[3];  ///< Upper bounds on the origins.
+  float n_inv_min[3]; ///< Lower bounds on the inverse slopes.
+  float n_inv_max[3]; ///< Upper bounds on the inverse slopes.
+  float max_slack;  ///< The largest slack of any ray.
+} dmnsn_optimized_packet;
+
+/// Gather the rays selected by \p mask into a packet.  Unselected lanes are
+/// copied from the first selected ray so they never produce NaNs.
+static inline void
+dmnsn_optimize_packet(dmnsn_optimized_packet *packet, const dmnsn_optimized_ray optrays[DMNSN_BVH_PACKET_SIZE], unsigned int mask, unsigned int first)
+{
+  // A lone ray gains nothing from the interval tests
+  packet->intervals = mask & (mask - 1);
+  packet->max_slack = 0.0f;
+  for (int i = 0; i < 3; ++i) {
+    packet->sign[i] = optrays[first].sign[i];
+    packet->x0_min[i] = packet->x0_max[i] = optrays[first].x0f[i];
+    packet->n_inv_min[i] = packet->n_inv_max[i] = optrays[first].n_invf[i];
+  }
+
+  for (unsigned int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    const dmnsn_optimized_ray *optray = &optrays[(mask & (1U << k)) ? k : first];
+    packet->slack[k] = optray->slack;
+    packet->max_slack = optray->slack > packet->max_slack ? optray->slack : packet->max_slack;
+    for (int i = 0; i < 3; ++i) {
+      float x0 = optray->x0f[i], n_inv = optray->n_invf[i];
+      packet->x0f[i][k] = x0;
+      packet->n_invf[i][k] = n_inv;
+      packet->x0_min[i] = x0 < packet->x0_min[i] ? x0 : packet->x0_min[i];
+      packet->x0_max[i] = x0 > packet->x0_max[i] ? x0 : packet->x0_max[i];
+      packet->n_inv_min[i] = n_inv < packet->n_inv_min[i] ? n_inv : packet->n_inv_min[i];
+      packet->n_inv_max[i] = n_inv > packet->n_inv_max[i] ? n_inv : packet->n_inv_max[i];
+
+      // Axis-parallel rays would make the interval arithmetic produce NaNs
+      if (!isfinite(n_inv)) {
+        packet->intervals = false;
+      }
+    }
+  }
+}
+
+/**
+ * Conservatively test whether any ray in a packet could hit each child of a
+ * wide node, using interval arithmetic over the whole packet.  This costs about
+ * as much as testing one ray, and lets whole children be culled without testing
+ * every ray against them.
+ * @param[in] packet  The packet to test.
+ * @param[in] node    The node whose children to test.
+ * @param[in] t       The distance to the farthest closest intersection so far.
+ * @return A bitmask of the children that might be hit.
+ */
+static inline unsigned int
+dmnsn_packet_interval_intersection(const dmnsn_optimized_packet *packet, const dmnsn_flat_bvh_node *node, float t)
+{
+  const float lo = 1.0f - DMNSN_BVH_FLOAT_ERROR, hi = 1.0f + DMNSN_BVH_FLOAT_ERROR;
+
+#ifdef __SSE__
+  __m128 tmin = _mm_setzero_ps();
+  __m128 tmax = _mm_set1_ps(t);
+  for (int i = 0; i < 3; ++i) {
+    __m128 near = _mm_loadu_ps(node->bounds[packet->sign[i]][i]);
+    __m128 far = _mm_loadu_ps(node->bounds[!packet->sign[i]][i]);
+    __m128 x0_min = _mm_set1_ps(packet->x0_min[i]);
+    __m128 x0_max = _mm_set1_ps(packet->x0_max[i]);
+    __m128 n_inv_min = _mm_set1_ps(packet->n_inv_min[i]);
+    __m128 n_inv_max = _mm_set1_ps(packet->n_inv_max[i]);
+
+    // The extremes of a product of intervals are at the corners
+    __m128 near_lo = _mm_sub_ps(near, x0_max), near_hi = _mm_sub_ps(near, x0_min);
+    __m128 t1 = _mm_min_ps(
+      _mm_min_ps(_mm_mul_ps(near_lo, n_inv_min), _mm_mul_ps(near_lo, n_inv_max)),
+      _mm_min_ps(_mm_mul_ps(near_hi, n_inv_min), _mm_mul_ps(near_hi, n_inv_max))
+    );
+    __m128 far_lo = _mm_sub_ps(far, x0_max), far_hi = _mm_sub_ps(far, x0_min);
+    __m128 t2 = _mm_max_ps(
+      _mm_max_ps(_mm_mul_ps(far_lo, n_inv_min), _mm_mul_ps(far_lo, n_inv_max)),
+      _mm_max_ps(_mm_mul_ps(far_hi, n_inv_min), _mm_mul_ps(far_hi, n_inv_max))
+    );
+    t1 = _mm_sub_ps(_mm_mul_ps(t1, _mm_set1_ps(lo)), _mm_set1_ps(packet->max_slack));
+    t2 = _mm_add_ps(_mm_mul_ps(t2, _mm_set1_ps(hi)), _mm_set1_ps(packet->max_slack));
+
+    tmin = _mm_max_ps(t1, tmin);
+    tmax = _mm_min_ps(t2, tmax);
+  }
+
+  return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+  unsigned int mask = 0;
+  for (int j = 0; j < DMNSN_BVH_WIDTH; ++j) {
+    float tmin = 0.0f, tmax = t;
+    for (int i = 0; i < 3; ++i) {
+      float near = node->bounds[packet->sign[i]][i][j];
+      float far = node->bounds[!packet->sign[i]][i][j];
+      float near_lo = near - packet->x0_max[i], near_hi = near - packet->x0_min[i];
+      float far_lo = far - packet->x0_max[i], far_hi = far - packet->x0_min[i];
+      float t1 = fminf(fminf(near_lo*packet->n_inv_min[i], near_lo*packet->n_inv_max[i]),
+                       fminf(near_hi*packet->n_inv_min[i], near_hi*packet->n_inv_max[i]));
+      float t2 = fmaxf(fmaxf(far_lo*packet->n_inv_min[i], far_lo*packet->n_inv_max[i]),
+                       fmaxf(far_hi*packet->n_inv_min[i], far_hi*packet->n_inv_max[i]));
+      t1 = t1*lo - packet->max_slack;
+      t2 = t2*hi + packet->max_slack;
+      tmin = t1 > tmin ? t1 : tmin;
+      tmax = t2 < tmax ? t2 : tmax;
+    }
+    mask |= (unsigned int)(tmin <= tmax) << j;
+  }
+  return mask;
+#endif
+}
+
+/**
+ * Test every ray in a packet against one child of a wide node at once.  This is
+ * the same conservative test as dmnsn_ray_wide_box_intersection(), vectorized
+ * across rays instead of boxes.
+ * @param[in]  packet  The packet to test.
+ * @param[in]  node    The node whose child to test.
+ * @param[in]  j       The child to test.
+ * @param[in]  t       The distance to each ray's closest intersection so far.
+ * @param[out] tmins   Lower bounds on each ray's entry distance into the child.
+ * @return A bitmask of the rays that hit the child.
+ */
+static inline unsigned int
+dmnsn_packet_box_intersection(const dmnsn_optimized_packet *packet, const dmnsn_flat_bvh_node *node, unsigned int j, const float t[DMNSN_BVH_PACKET_SIZE], float tmins[DMNSN_BVH_PACKET_SIZE])
+{
+  const float lo = 1.0f - DMNSN_BVH_FLOAT_ERROR, hi = 1.0f + DMNSN_BVH_FLOAT_ERROR;
+
+#ifdef __SSE__
+  __m128 slack = _mm_loadu_ps(packet->slack);
+  __m128 tmin = _mm_setzero_ps();
+  __m128 tmax = _mm_loadu_ps(t);
+  for (int i = 0; i < 3; ++i) {
+    __m128 near = _mm_set1_ps(node->bounds[packet->sign[i]][i][j]);
+    __m128 far = _mm_set1_ps(node->bounds[!packet->sign[i]][i][j]);
+    __m128 x0 = _mm_loadu_ps(packet->x0f[i]);
+    __m128 n_inv = _mm_loadu_ps(packet->n_invf[i]);
+
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(near, x0), n_inv);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(far, x0), n_inv);
+    t1 = _mm_sub_ps(_mm_mul_ps(t1, _mm_set1_ps(lo)), slack);
+    t2 = _mm_add_ps(_mm_mul_ps(t2, _mm_set1_ps(hi)), slack);
+
+    tmin = _mm_max_ps(t1, tmin);
+    tmax = _mm_min_ps(t2, tmax);
+  }
+
+  _mm_storeu_ps(tmins, tmin);
+  return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+  unsigned int mask = 0;
+  for (int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    float tmin = 0.0f, tmax = t[k];
+    for (int i = 0; i < 3; ++i) {
+      float near = node->bounds[packet->sign[i]][i][j];
+      float far = node->bounds[!packet->sign[i]][i][j];
+      float t1 = (near - packet->x0f[i][k])*packet->n_invf[i][k]*lo - packet->slack[k];
+      float t2 = (far - packet->x0f[i][k])*packet->n_invf[i][k]*hi + packet->slack[k];
+      tmin = t1 > tmin ? t1 : tmin;
+      tmax = t2 < tmax ? t2 : tmax;
+    }
+    tmins[k] = tmin;
+    mask |= (unsigned int)(tmin <= tmax) << k;
+  }
+  return mask;
+#endif
+}
+
+DMNSN_HOT unsigned int
+dmnsn_bvh_intersection_packet(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, const dmnsn_ray rays[DMNSN_BVH_PACKET_SIZE], unsigned int mask, dmnsn_intersection intersections[DMNSN_BVH_PACKET_SIZE], dmnsn_object *objects[DMNSN_BVH_PACKET_SIZE])
+{
+  cache = dmnsn_get_intersection_cache(bvh, cache);
+  mask &= (1U << DMNSN_BVH_PACKET_SIZE) - 1;
+  if (!mask) {
+    return 0;
+  }
+
+  unsigned int first = 0;
+  while (!(mask & (1U << first))) {
+    ++first;
+  }
+
+  // Rays heading into different octants visit the nodes in different orders,
+  // so trace them one at a time
+  dmnsn_optimized_ray optrays[DMNSN_BVH_PACKET_SIZE];
+  bool coherent = true;
+  for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    if (mask & (1U << k)) {
+      optrays[k] = dmnsn_optimize_ray(rays[k]);
+      for (int i = 0; i < 3; ++i) {
+        coherent = coherent && optrays[k].sign[i] == optrays[first].sign[i];
+      }
+    }
+  }
+
+  if (!coherent) {
+    unsigned int hits = 0;
+    for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+      if (mask & (1U << k)) {
+        hits |= dmnsn_bvh_intersection_packet(bvh, cache, rays, 1U << k, intersections, objects);
+      }
+    }
+    return hits;
+  }
+
+  // Search the unbounded objects
+  double t[DMNSN_BVH_PACKET_SIZE];
+  float tf[DMNSN_BVH_PACKET_SIZE];
+  dmnsn_object *unbounded[DMNSN_BVH_PACKET_SIZE], *cached[DMNSN_BVH_PACKET_SIZE], *found[DMNSN_BVH_PACKET_SIZE];
+  for (unsigned int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    t[k] = INFINITY;
+    unbounded[k] = cached[k] = found[k] = NULL;
+  }
+
+  DMNSN_ARRAY_FOREACH (dmnsn_object **, i, bvh->unbounded) {
+    unsigned int closer = dmnsn_closer_intersection_packet(*i, rays, mask, intersections, t);
+    for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+      if (closer & (1U << k)) {
+        unbounded[k] = *i;
+      }
+    }
+  }
+
+  // Search the objects hinted at by the caller
+  for (unsigned int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    if (!(mask & (1U << k))) {
+      // Unselected lanes can never hit anything
+      tf[k] = -INFINITY;
+      continue;
+    }
+
+    if (objects && objects[k] && !dmnsn_aabb_is_infinite(objects[k]->aabb)) {
+      cached[k] = objects[k];
+    }
+    if (cached[k] && dmnsn_ray_box_intersection(optrays[k], cached[k]->aabb, t[k])) {
+      if (dmnsn_closer_intersection(cached[k], rays[k], &intersections[k], &t[k])) {
+        found[k] = cached[k];
+      }
+    }
+
+    tf[k] = t[k];
+  }
+
+  dmnsn_optimized_packet packet;
+  dmnsn_optimize_packet(&packet, optrays, mask, first);
+
+  // Search the bounded objects
+  const dmnsn_flat_bvh_node *nodes = dmnsn_array_first(bvh->bounded);
+  dmnsn_object **leaves = dmnsn_array_first(bvh->objects);
+  dmnsn_bvh_packet_entry *stack = cache->packet_stack;
+  size_t size = 0;
+  if (dmnsn_array_size(bvh->bounded) > 0) {
+    stack[size++] = (dmnsn_bvh_packet_entry){ .index = 0, .count = 0, .mask = mask, .t = 0.0f };
+  }
+  bool ordered = bvh->traversal == DMNSN_BVH_ORDERED;
+  while (size > 0) {
+    dmnsn_bvh_packet_entry entry = stack[--size];
+
+    float tmax = -INFINITY;
+    for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+      if ((entry.mask & (1U << k)) && tf[k] > tmax) {
+        tmax = tf[k];
+      }
+    }
+    if (ordered && entry.t > tmax) {
+      // Every ray has already found something closer
+      continue;
+    }
+
+    if (entry.count > 0) {
+      for (uint32_t i = 0; i < entry.count; ++i) {
+        dmnsn_object *object = leaves[entry.index + i];
+        unsigned int rays_hit = 0;
+        for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+          if ((entry.mask & (1U << k)) && object != cached[k]
+              && dmnsn_ray_box_intersection(optrays[k], object->aabb, t[k])) {
+            rays_hit |= 1U << k;
+          }
+        }
+
+        unsigned int closer = dmnsn_closer_intersection_packet(object, rays, rays_hit, intersections, t);
+        for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+          if (closer & (1U << k)) {
+            found[k] = object;
+            tf[k] = t[k];
+          }
+        }
+      }
+      continue;
+    }
+
+    dmnsn_bvh_visit(cache);
+    const dmnsn_flat_bvh_node *node = nodes + entry.index;
+    unsigned int children = (1U << DMNSN_BVH_WIDTH) - 1;
+    if (packet.intervals) {
+      children = dmnsn_packet_interval_intersection(&packet, node, tmax);
+    }
+
+    dmnsn_bvh_packet_entry hit[DMNSN_BVH_WIDTH];
+    unsigned int nhit = 0;
+    for (unsigned int j = 0; j < DMNSN_BVH_WIDTH; ++j) {
+      if (!(children & (1U << j)) || dmnsn_bvh_slot_empty(node, j)) {
+        continue;
+      }
+
+      float tmins[DMNSN_BVH_PACKET_SIZE];
+      unsigned int rays_hit = dmnsn_packet_box_intersection(&packet, node, j, tf, tmins) & entry.mask;
+      if (!rays_hit) {
+        continue;
+      }
+
+      float tmin = INFINITY;
+      for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+        if ((rays_hit & (1U << k)) && tmins[k] < tmin) {
+          tmin = tmins[k];
+        }
+      }
+
+      dmnsn_bvh_packet_entry child = {
+        .index = node->children[j],
+        .count = node->counts[j],
+        .mask = rays_hit,
+        .t = tmin,
+      };
+
+      // Keep the hit children sorted by decreasing entry distance if ordered,
+      // or in reverse order otherwise, so the right one ends up on top
+      unsigned int l = nhit++;
+      while (l > 0 && (!ordered || hit[l - 1].t < child.t)) {
+        hit[l] = hit[l - 1];
+        --l;
+      }
+      hit[l] = child;
+    }
+
+    for (unsigned int j = 0; j < nhit; ++j) {
+      stack[size++] = hit[j];
+    }
+  }
+
+  unsigned int hits = 0;
+  for (unsigned int k = first; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    if (!(mask & (1U << k))) {
+      continue;
+    }
+
+    dmnsn_object *closest = found[k] ? found[k] : unbounded[k];
+    if (objects) {
+      objects[k] = closest;
+    }
+    if (closest) {
+      dmnsn_object_finalize(closest, &intersections[k]);
+      hits |= 1U << k;
+    }
+  }
+  return hits;
+}
+
+DMNSN_HOT bool
+dmnsn_bvh_occluded(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, dmnsn_ray ray, double t, dmnsn_object **occluder)
+{
+  dmnsn_optimized_ray optray = dmnsn_optimize_ray(ray);
+
+  // Try the last occluder first; neighbouring shadow rays tend to be blocked by
+  // the same object
+  if (occluder && *occluder) {
+    dmnsn_object *object = *occluder;
+    if (dmnsn_ray_box_intersection(optray, object->aabb, t)
+        && dmnsn_object_occlusion(object, ray, t)) {
+      return true;
+    }
+  }
+
+  // Search the unbounded objects
+  DMNSN_ARRAY_FOREACH (dmnsn_object **, object, bvh->unbounded) {
+    if (dmnsn_object_occlusion(*object, ray, t)) {
+      if (occluder) {
+        *occluder = *object;
+      }
+      return true;
+    }
+  }
+
+  // Search the bounded objects, stopping at the first hit.  Any hit will do, so
+  // there's no point in ordering the traversal or shrinking t.
+  if (dmnsn_array_size(bvh->bounded) == 0) {
+    return false;
+  }
+
+  const dmnsn_flat_bvh_node *nodes = dmnsn_array_first(bvh->bounded);
+  dmnsn_object **objects = dmnsn_array_first(bvh->objects);
+  dmnsn_bvh_stack_entry *stack = dmnsn_get_intersection_cache(bvh, cache)->stack;
+  size_t size = 0;
+  stack[size++] = (dmnsn_bvh_stack_entry){ .index = 0, .count = 0, .t = 0.0f };
+  while (size > 0) {
+    dmnsn_bvh_stack_entry entry = stack[--size];
+    if (entry.count > 0) {
+      for (uint32_t i = 0; i < entry.count; ++i) {
+        dmnsn_object *object = objects[entry.index + i];
+        if (dmnsn_ray_box_intersection(optray, object->aabb, t)
+            && dmnsn_object_occlusion(object, ray, t)) {
+          if (occluder) {
+            *occluder = object;
+          }
+          return true;
+        }
+      }
+    } else {
+      const dmnsn_flat_bvh_node *node = nodes + entry.index;
+      float tmins[DMNSN_BVH_WIDTH];
+      unsigned int mask = dmnsn_ray_wide_box_intersection(&optray, node, t, tmins);
+      size = dmnsn_bvh_push_children(stack, size, node, mask, tmins);
+    }
+  }
+
+  return false;
 }
 
 DMNSN_HOT bool
-dmnsn_bvh_inside(const dmnsn_bvh *bvh, dmnsn_vector point)
+dmnsn_bvh_inside(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, dmnsn_vector point)
 {
   // Search the unbounded objects
   DMNSN_ARRAY_FOREACH (dmnsn_object **, object, bvh->unbounded) {
@@ -328,16 +1248,30 @@ dmnsn_bvh_inside(const dmnsn_bvh *bvh, dmnsn_vector point)
   }
 
   // Search the bounded objects
-  dmnsn_flat_bvh_node *node = dmnsn_array_first(bvh->bounded);
-  dmnsn_flat_bvh_node *last = dmnsn_array_last(bvh->bounded);
-  while (node <= last) {
-    if (dmnsn_aabb_contains(node->aabb, point)) {
-      if (node->object && dmnsn_object_inside(node->object, point)) {
-        return true;
+  if (dmnsn_array_size(bvh->bounded) == 0 || !dmnsn_aabb_contains(bvh->aabb, point)) {
+    return false;
+  }
+
+  float pointf[3] = { point.X, point.Y, point.Z };
+  const float tmins[DMNSN_BVH_WIDTH] = { 0.0f };
+  const dmnsn_flat_bvh_node *nodes = dmnsn_array_first(bvh->bounded);
+  dmnsn_object **objects = dmnsn_array_first(bvh->objects);
+  dmnsn_bvh_stack_entry *stack = dmnsn_get_intersection_cache(bvh, cache)->stack;
+  size_t size = 0;
+  stack[size++] = (dmnsn_bvh_stack_entry){ .index = 0, .count = 0, .t = 0.0f };
+  while (size > 0) {
+    dmnsn_bvh_stack_entry entry = stack[--size];
+    if (entry.count > 0) {
+      for (uint32_t i = 0; i < entry.count; ++i) {
+        dmnsn_object *object = objects[entry.index + i];
+        if (dmnsn_aabb_contains(object->aabb, point) && dmnsn_object_inside(object, point)) {
+          return true;
+        }
       }
-      ++node;
     } else {
-      node += node->skip;
+      const dmnsn_flat_bvh_node *node = nodes + entry.index;
+      unsigned int mask = dmnsn_wide_box_contains(node, pointf);
+      size = dmnsn_bvh_push_children(stack, size, node, mask, tmins);
     }
   }
 
@@ -349,11 +1283,8 @@ dmnsn_bvh_aabb(const dmnsn_bvh *bvh)
 {
   if (dmnsn_array_size(bvh->unbounded) > 0) {
     return dmnsn_infinite_aabb();
-  } else if (dmnsn_array_size(bvh->bounded) > 0) {
-    dmnsn_flat_bvh_node *root = dmnsn_array_first(bvh->bounded);
-    return root->aabb;
   } else {
-    return dmnsn_zero_aabb();
+    return bvh->aabb;
   }
 }
 
@@ -400,3 +1331,12 @@ dmnsn_bvh_node_add(dmnsn_bvh_node *parent, dmnsn_bvh_node *child)
   parent->aabb.max = dmnsn_vector_max(parent->aabb.max, child->aabb.max);
   parent->children[parent->nchildren++] = child;
 }
+
+void
+dmnsn_bvh_node_refit(dmnsn_bvh_node *node)
+{
+  node->aabb = dmnsn_zero_aabb();
+  for (unsigned int i = 0; i < node->nchildren; ++i) {
+    node->aabb = dmnsn_bvh_union(node->aabb, node->children[i]->aabb);
+  }
+}
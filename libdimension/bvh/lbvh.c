@@ -0,0 +1,250 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Linear BVH implementation.
+ */
+
+#include "internal/lbvh.h"
+#include "internal/concurrency.h"
+#include "internal/sort.h"
+
+/// Bits of Morton code per axis.
+#define DMNSN_LBVH_BITS 21
+/// Compute Morton codes in parallel chunks of this many objects.
+#define DMNSN_LBVH_CHUNK 65536
+/// Build subtrees in parallel with at least this many objects.
+#define DMNSN_LBVH_PARALLEL_THRESHOLD 4096
+
+/// Spread the low 21 bits of \p x out to every third bit.
+static inline uint64_t
+dmnsn_lbvh_spread(uint64_t x)
+{
+  x &= UINT64_C(0x1FFFFF);
+  x = (x | x << 32) & UINT64_C(0x1F00000000FFFF);
+  x = (x | x << 16) & UINT64_C(0x1F0000FF0000FF);
+  x = (x | x << 8)  & UINT64_C(0x100F00F00F00F00F);
+  x = (x | x << 4)  & UINT64_C(0x10C30C30C30C30C3);
+  x = (x | x << 2)  & UINT64_C(0x1249249249249249);
+  return x;
+}
+
+/// Payload for computing the Morton codes of a range of objects.
+typedef struct dmnsn_lbvh_code_payload {
+  dmnsn_object **objects; ///< The objects.
+  dmnsn_sort_pair *pairs; ///< The Morton codes to compute.
+  size_t start, end;      ///< The range of objects.
+  dmnsn_vector min;       ///< The minimum centroid.
+  dmnsn_vector scale;     ///< Scale from centroids to Morton coordinates.
+} dmnsn_lbvh_code_payload;
+
+/// Morton code task.
+static void
+dmnsn_lbvh_code_task(void *ptr)
+{
+  dmnsn_lbvh_code_payload *payload = ptr;
+  for (size_t i = payload->start; i < payload->end; ++i) {
+    dmnsn_object *object = payload->objects[i];
+    dmnsn_vector centroid = dmnsn_vector_mul(0.5, dmnsn_vector_add(object->aabb.min, object->aabb.max));
+    dmnsn_vector v = dmnsn_vector_sub(centroid, payload->min);
+
+    uint64_t code = 0;
+    for (unsigned int j = 0; j < 3; ++j) {
+      uint64_t c = v.n[j]*payload->scale.n[j];
+      code |= dmnsn_lbvh_spread(c) << (2 - j);
+    }
+
+    payload->pairs[i].key = code;
+    payload->pairs[i].value = object;
+  }
+}
+
+/**
+ * Try to improve a node by swapping one of its children with a grandchild.
+ * This is the tree rotation of Kensler's "Tree Rotations for Improving Bounding
+ * Volume Hierarchies": the node's own box doesn't change, but one child can
+ * shrink, which lowers the expected cost of traversing it.
+ */
+static void
+dmnsn_lbvh_rotate(dmnsn_bvh_node *node)
+{
+  double best = 0.0;
+  unsigned int best_child = 0, best_grandchild = 0;
+
+  for (unsigned int i = 0; i < 2; ++i) {
+    dmnsn_bvh_node *child = node->children[i];
+    dmnsn_bvh_node *sibling = node->children[1 - i];
+    if (child->nchildren != 2) {
+      continue;
+    }
+
+    // Swap the sibling with one of this child's children
+    double area = dmnsn_bvh_area(child->aabb);
+    for (unsigned int j = 0; j < 2; ++j) {
+      dmnsn_bvh_node *kept = child->children[1 - j];
+      double savings = area - dmnsn_bvh_area(dmnsn_bvh_union(sibling->aabb, kept->aabb));
+      if (savings > best) {
+        best = savings;
+        best_child = i;
+        best_grandchild = j;
+      }
+    }
+  }
+
+  if (best > 0.0) {
+    dmnsn_bvh_node *child = node->children[best_child];
+    dmnsn_bvh_node *temp = node->children[1 - best_child];
+    node->children[1 - best_child] = child->children[best_grandchild];
+    child->children[best_grandchild] = temp;
+    dmnsn_bvh_node_refit(child);
+  }
+}
+
+/// Find where to split a sorted range of Morton codes.
+static size_t
+dmnsn_lbvh_split(const dmnsn_sort_pair *pairs, size_t n)
+{
+  uint64_t first = pairs[0].key;
+  uint64_t last = pairs[n - 1].key;
+  if (first == last) {
+    return n/2;
+  }
+
+  // Find the highest differing bit
+  uint64_t bit = first ^ last;
+  bit |= bit >> 1;
+  bit |= bit >> 2;
+  bit |= bit >> 4;
+  bit |= bit >> 8;
+  bit |= bit >> 16;
+  bit |= bit >> 32;
+  bit ^= bit >> 1;
+
+  // Binary search for the first code with that bit set
+  size_t lo = 0, hi = n - 1;
+  while (lo + 1 < hi) {
+    size_t mid = lo + (hi - lo)/2;
+    if (pairs[mid].key & bit) {
+      hi = mid;
+    } else {
+      lo = mid;
+    }
+  }
+  return hi;
+}
+
+static dmnsn_bvh_node *dmnsn_lbvh_build(const dmnsn_sort_pair *pairs, size_t n);
+
+/// Payload for building a subtree in parallel.
+typedef struct dmnsn_lbvh_payload {
+  const dmnsn_sort_pair *pairs; ///< The subtree's sorted objects.
+  size_t n;                     ///< The number of objects.
+  dmnsn_bvh_node *result;       ///< The built subtree.
+} dmnsn_lbvh_payload;
+
+/// Subtree building task.
+static void
+dmnsn_lbvh_build_task(void *ptr)
+{
+  dmnsn_lbvh_payload *payload = ptr;
+  payload->result = dmnsn_lbvh_build(payload->pairs, payload->n);
+}
+
+/// Recursively build a subtree.
+static dmnsn_bvh_node *
+dmnsn_lbvh_build(const dmnsn_sort_pair *pairs, size_t n)
+{
+  if (n == 1) {
+    return dmnsn_new_bvh_leaf_node(pairs[0].value);
+  }
+
+  size_t mid = dmnsn_lbvh_split(pairs, n);
+
+  dmnsn_bvh_node *left, *right;
+  if (n >= DMNSN_LBVH_PARALLEL_THRESHOLD) {
+    dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+    dmnsn_lbvh_payload payload = {
+      .pairs = pairs,
+      .n = mid,
+    };
+    dmnsn_spawn(&group, dmnsn_lbvh_build_task, &payload);
+    right = dmnsn_lbvh_build(pairs + mid, n - mid);
+    dmnsn_sync(&group);
+    left = payload.result;
+  } else {
+    left = dmnsn_lbvh_build(pairs, mid);
+    right = dmnsn_lbvh_build(pairs + mid, n - mid);
+  }
+
+  dmnsn_bvh_node *node = dmnsn_new_bvh_node(2);
+  dmnsn_bvh_node_add(node, left);
+  dmnsn_bvh_node_add(node, right);
+
+  // Both subtrees are finished, so they can be refined bottom-up
+  dmnsn_lbvh_rotate(node);
+  return node;
+}
+
+dmnsn_bvh_node *
+dmnsn_new_lbvh(const dmnsn_array *objects)
+{
+  size_t n = dmnsn_array_size(objects);
+  if (n == 0) {
+    return NULL;
+  }
+
+  // Find the bounds of the centroids
+  dmnsn_object **array = dmnsn_array_first(objects);
+  dmnsn_aabb centroids = dmnsn_zero_aabb();
+  for (size_t i = 0; i < n; ++i) {
+    dmnsn_vector centroid = dmnsn_vector_mul(0.5, dmnsn_vector_add(array[i]->aabb.min, array[i]->aabb.max));
+    centroids = dmnsn_aabb_swallow(centroids, centroid);
+  }
+
+  dmnsn_vector scale;
+  for (unsigned int i = 0; i < 3; ++i) {
+    double extent = centroids.max.n[i] - centroids.min.n[i];
+    scale.n[i] = extent > 0.0 ? ((UINT64_C(1) << DMNSN_LBVH_BITS) - 1)/extent : 0.0;
+  }
+
+  // Compute the Morton codes in parallel
+  dmnsn_sort_pair *pairs = dmnsn_malloc(n*sizeof(dmnsn_sort_pair));
+  size_t nchunks = (n + DMNSN_LBVH_CHUNK - 1)/DMNSN_LBVH_CHUNK;
+  dmnsn_lbvh_code_payload *payloads = dmnsn_malloc(nchunks*sizeof(dmnsn_lbvh_code_payload));
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  for (size_t i = 0; i < nchunks; ++i) {
+    payloads[i].objects = array;
+    payloads[i].pairs = pairs;
+    payloads[i].start = i*DMNSN_LBVH_CHUNK;
+    payloads[i].end = i + 1 < nchunks ? (i + 1)*DMNSN_LBVH_CHUNK : n;
+    payloads[i].min = centroids.min;
+    payloads[i].scale = scale;
+    dmnsn_spawn(&group, dmnsn_lbvh_code_task, &payloads[i]);
+  }
+  dmnsn_sync(&group);
+  dmnsn_free(payloads);
+
+  dmnsn_radix_sort(pairs, n);
+  dmnsn_bvh_node *root = dmnsn_lbvh_build(pairs, n);
+
+  dmnsn_free(pairs);
+  return root;
+}
@@ -23,10 +23,10 @@
  * Priority R-tree implementation.
  */
 
-#include "internal/platform.h"
 #include "internal/prtree.h"
 #include "internal/concurrency.h"
-#include <stdlib.h>
+#include "internal/sort.h"
+#include <string.h>
 
 /// Number of children per PR-node.
 #define DMNSN_PRTREE_B 8
@@ -69,66 +69,32 @@ enum {
   DMNSN_ZMAX
 };
 
-// List sorting comparators
-
-static int
-dmnsn_xmin_comp(const void *l, const void *r)
-{
-  double lval = (*(const dmnsn_colored_prnode **)l)->node->aabb.min.X;
-  double rval = (*(const dmnsn_colored_prnode **)r)->node->aabb.min.X;
-  return (lval > rval) - (lval < rval);
-}
-
-static int
-dmnsn_ymin_comp(const void *l, const void *r)
-{
-  double lval = (*(const dmnsn_colored_prnode **)l)->node->aabb.min.Y;
-  double rval = (*(const dmnsn_colored_prnode **)r)->node->aabb.min.Y;
-  return (lval > rval) - (lval < rval);
-}
-
-static int
-dmnsn_zmin_comp(const void *l, const void *r)
-{
-  double lval = (*(const dmnsn_colored_prnode **)l)->node->aabb.min.Z;
-  double rval = (*(const dmnsn_colored_prnode **)r)->node->aabb.min.Z;
-  return (lval > rval) - (lval < rval);
-}
-
-static int
-dmnsn_xmax_comp(const void *l, const void *r)
-{
-  double lval = (*(const dmnsn_colored_prnode **)l)->node->aabb.max.X;
-  double rval = (*(const dmnsn_colored_prnode **)r)->node->aabb.max.X;
-  return (lval < rval) - (lval > rval);
-}
-
-static int
-dmnsn_ymax_comp(const void *l, const void *r)
-{
-  double lval = (*(const dmnsn_colored_prnode **)l)->node->aabb.max.Y;
-  double rval = (*(const dmnsn_colored_prnode **)r)->node->aabb.max.Y;
-  return (lval < rval) - (lval > rval);
-}
-
-static int
-dmnsn_zmax_comp(const void *l, const void *r)
+/// Get the sort key for a node along one dimension.
+static inline uint64_t
+dmnsn_prnode_key(const dmnsn_colored_prnode *leaf, int comparator)
 {
-  double lval = (*(const dmnsn_colored_prnode **)l)->node->aabb.max.Z;
-  double rval = (*(const dmnsn_colored_prnode **)r)->node->aabb.max.Z;
-  return (lval < rval) - (lval > rval);
+  const dmnsn_aabb *aabb = &leaf->node->aabb;
+  switch (comparator) {
+  case DMNSN_XMIN:
+    return dmnsn_double_sort_key(aabb->min.X);
+  case DMNSN_YMIN:
+    return dmnsn_double_sort_key(aabb->min.Y);
+  case DMNSN_ZMIN:
+    return dmnsn_double_sort_key(aabb->min.Z);
+
+  // The max lists are sorted in descending order
+  case DMNSN_XMAX:
+    return ~dmnsn_double_sort_key(aabb->max.X);
+  case DMNSN_YMAX:
+    return ~dmnsn_double_sort_key(aabb->max.Y);
+  case DMNSN_ZMAX:
+    return ~dmnsn_double_sort_key(aabb->max.Z);
+
+  default:
+    dmnsn_unreachable("Invalid comparator.");
+  }
 }
 
-/// All comparators.
-static dmnsn_array_comparator_fn *const dmnsn_comparators[DMNSN_PSEUDO_B] = {
-  [DMNSN_XMIN] = dmnsn_xmin_comp,
-  [DMNSN_YMIN] = dmnsn_ymin_comp,
-  [DMNSN_ZMIN] = dmnsn_zmin_comp,
-  [DMNSN_XMAX] = dmnsn_xmax_comp,
-  [DMNSN_YMAX] = dmnsn_ymax_comp,
-  [DMNSN_ZMAX] = dmnsn_zmax_comp,
-};
-
 /// Add the priority leaves for this level.
 static void
 dmnsn_add_priority_leaves(dmnsn_colored_prnode **sorted_leaves[DMNSN_PSEUDO_B],
@@ -197,6 +163,10 @@ dmnsn_split_sorted_leaves_easy(dmnsn_colored_prnode **leaves, size_t start, size
 static void
 dmnsn_split_sorted_leaves_hard(dmnsn_colored_prnode **leaves, dmnsn_colored_prnode **buffer, size_t start, size_t end)
 {
+  // Each range gets its own slice of the buffer, so disjoint ranges can be split
+  // concurrently
+  buffer += start;
+
   size_t i, j, skip;
   for (i = start, j = 0, skip = 0; i < end; ++i) {
     if (leaves[i]->color == DMNSN_PRTREE_LEFT) {
@@ -240,6 +210,44 @@ dmnsn_split_sorted_leaves(dmnsn_colored_prnode **sorted_leaves[DMNSN_PSEUDO_B],
   }
 }
 
+/// Recurse into both subtrees in parallel with more than this many leaves.
+#define DMNSN_PARALLEL_SPLIT_THRESHOLD 4096
+
+static void
+dmnsn_priority_leaves_recursive(dmnsn_colored_prnode **sorted_leaves[DMNSN_PSEUDO_B],
+                                size_t start, size_t end,
+                                dmnsn_colored_prnode **buffer,
+                                dmnsn_array *new_leaves,
+                                int comparator);
+
+/// Payload for collecting the priority leaves of a subtree.
+typedef struct {
+  dmnsn_colored_prnode ***sorted_leaves;
+  size_t start, end;
+  dmnsn_colored_prnode **buffer;
+  dmnsn_array *new_leaves;
+  int comparator;
+} dmnsn_priority_leaves_payload;
+
+/// Subtree task.
+static void
+dmnsn_priority_leaves_task(void *ptr)
+{
+  dmnsn_priority_leaves_payload *payload = ptr;
+  dmnsn_priority_leaves_recursive(payload->sorted_leaves, payload->start, payload->end, payload->buffer, payload->new_leaves, payload->comparator);
+}
+
+/// Append the contents of one array of nodes to another.
+static void
+dmnsn_append_leaves(dmnsn_array *dest, const dmnsn_array *src)
+{
+  size_t size = dmnsn_array_size(dest), nsrc = dmnsn_array_size(src);
+  if (nsrc > 0) {
+    dmnsn_array_resize(dest, size + nsrc);
+    memcpy(dmnsn_array_at(dest, size), dmnsn_array_first(src), nsrc*sizeof(dmnsn_bvh_node *));
+  }
+}
+
 /// Recursively constructs an implicit pseudo-PR-tree and collects the priority
 /// leaves.
 static void
@@ -256,6 +264,33 @@ dmnsn_priority_leaves_recursive(dmnsn_colored_prnode **sorted_leaves[DMNSN_PSEUD
 
   int next = (comparator + 1)%DMNSN_PSEUDO_B;
 
+  if (start < mid && mid < end && end - start >= DMNSN_PARALLEL_SPLIT_THRESHOLD) {
+    // The subtrees contain disjoint sets of nodes, and occupy disjoint ranges
+    // of every list, so they can be built concurrently.  Each gets its own
+    // array of priority leaves, which are concatenated in order afterwards.
+    dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+    dmnsn_priority_leaves_payload left = {
+      .sorted_leaves = sorted_leaves,
+      .start = start,
+      .end = mid,
+      .buffer = buffer,
+      .new_leaves = DMNSN_NEW_ARRAY(dmnsn_bvh_node *),
+      .comparator = next,
+    };
+    dmnsn_spawn(&group, dmnsn_priority_leaves_task, &left);
+
+    dmnsn_array *right_leaves = DMNSN_NEW_ARRAY(dmnsn_bvh_node *);
+    dmnsn_priority_leaves_recursive(sorted_leaves, mid, end, buffer, right_leaves, next);
+
+    dmnsn_sync(&group);
+
+    dmnsn_append_leaves(new_leaves, left.new_leaves);
+    dmnsn_append_leaves(new_leaves, right_leaves);
+    dmnsn_delete_array(left.new_leaves);
+    dmnsn_delete_array(right_leaves);
+    return;
+  }
+
   if (start < mid) {
     dmnsn_priority_leaves_recursive(sorted_leaves, start, mid, buffer, new_leaves, next);
   }
@@ -268,41 +303,46 @@ dmnsn_priority_leaves_recursive(dmnsn_colored_prnode **sorted_leaves[DMNSN_PSEUD
 /// Sort each dimension in parallel with more than this many leaves.
 #define DMNSN_PARALLEL_SORT_THRESHOLD 1024
 
+/// Payload for sorting the leaves along one dimension.
 typedef struct {
   dmnsn_colored_prnode *colored_leaves;
   dmnsn_colored_prnode ***sorted_leaves;
   size_t nleaves;
+  int comparator;
 } dmnsn_sort_leaves_payload;
 
 static dmnsn_colored_prnode **
 dmnsn_sort_leaf_array(dmnsn_colored_prnode *colored_leaves, size_t nleaves, int comparator)
 {
-  dmnsn_colored_prnode **sorted_leaves = dmnsn_malloc(nleaves*sizeof(dmnsn_colored_prnode *));
-
+  // Extract the keys up front, rather than chasing pointers in a comparator
+  dmnsn_sort_pair *pairs = dmnsn_malloc(nleaves*sizeof(dmnsn_sort_pair));
   for (size_t i = 0; i < nleaves; ++i) {
-    sorted_leaves[i] = colored_leaves + i;
+    pairs[i].key = dmnsn_prnode_key(colored_leaves + i, comparator);
+    pairs[i].value = colored_leaves + i;
   }
 
-  qsort(sorted_leaves, nleaves, sizeof(dmnsn_colored_prnode *), dmnsn_comparators[comparator]);
+  dmnsn_radix_sort(pairs, nleaves);
+
+  dmnsn_colored_prnode **sorted_leaves = dmnsn_malloc(nleaves*sizeof(dmnsn_colored_prnode *));
+  for (size_t i = 0; i < nleaves; ++i) {
+    sorted_leaves[i] = pairs[i].value;
+  }
+  dmnsn_free(pairs);
 
   return sorted_leaves;
 }
 
-static int
-dmnsn_sort_leaves(void *ptr, unsigned int thread, unsigned int nthreads)
+/// Sorting task.
+static void
+dmnsn_sort_leaves(void *ptr)
 {
   dmnsn_sort_leaves_payload *payload = ptr;
-
-  for (unsigned int i = thread; i < DMNSN_PSEUDO_B; i += nthreads) {
-    payload->sorted_leaves[i] = dmnsn_sort_leaf_array(payload->colored_leaves, payload->nleaves, i);
-  }
-
-  return 0;
+  *payload->sorted_leaves = dmnsn_sort_leaf_array(payload->colored_leaves, payload->nleaves, payload->comparator);
 }
 
 /// Constructs an implicit pseudo-PR-tree and returns the priority leaves.
 static dmnsn_array *
-dmnsn_priority_leaves(const dmnsn_array *leaves, unsigned int nthreads)
+dmnsn_priority_leaves(const dmnsn_array *leaves)
 {
   dmnsn_bvh_node **leaves_arr = dmnsn_array_first(leaves);
   size_t nleaves = dmnsn_array_size(leaves);
@@ -315,21 +355,24 @@ dmnsn_priority_leaves(const dmnsn_array *leaves, unsigned int nthreads)
 
   dmnsn_colored_prnode **sorted_leaves[DMNSN_PSEUDO_B];
 
-  if (nleaves >= DMNSN_PARALLEL_SORT_THRESHOLD && nthreads > 1) {
-    dmnsn_sort_leaves_payload payload = {
-      .colored_leaves = colored_leaves,
-      .sorted_leaves = sorted_leaves,
-      .nleaves = nleaves,
-    };
-    dmnsn_execute_concurrently(NULL, dmnsn_sort_leaves, &payload, nthreads);
+  if (nleaves >= DMNSN_PARALLEL_SORT_THRESHOLD) {
+    dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+    dmnsn_sort_leaves_payload payloads[DMNSN_PSEUDO_B];
+    for (int i = 0; i < DMNSN_PSEUDO_B; ++i) {
+      payloads[i].colored_leaves = colored_leaves;
+      payloads[i].sorted_leaves = &sorted_leaves[i];
+      payloads[i].nleaves = nleaves;
+      payloads[i].comparator = i;
+      dmnsn_spawn(&group, dmnsn_sort_leaves, &payloads[i]);
+    }
+    dmnsn_sync(&group);
   } else {
     for (size_t i = 0; i < DMNSN_PSEUDO_B; ++i) {
       sorted_leaves[i] = dmnsn_sort_leaf_array(colored_leaves, nleaves, i);
     }
   }
 
-  size_t buffer_size = nleaves/2;
-  dmnsn_colored_prnode **buffer = dmnsn_malloc(buffer_size*sizeof(dmnsn_colored_prnode *));
+  dmnsn_colored_prnode **buffer = dmnsn_malloc(nleaves*sizeof(dmnsn_colored_prnode *));
 
   dmnsn_array *new_leaves = DMNSN_NEW_ARRAY(dmnsn_bvh_node *);
 
@@ -358,10 +401,8 @@ dmnsn_new_prtree(const dmnsn_array *objects)
     dmnsn_array_push(leaves, &node);
   }
 
-  unsigned int ncpus = dmnsn_ncpus();
-  unsigned int nthreads = ncpus < DMNSN_PSEUDO_B ? ncpus : DMNSN_PSEUDO_B;
   while (dmnsn_array_size(leaves) > 1) {
-    dmnsn_array *new_leaves = dmnsn_priority_leaves(leaves, nthreads);
+    dmnsn_array *new_leaves = dmnsn_priority_leaves(leaves);
     dmnsn_delete_array(leaves);
     leaves = new_leaves;
   }
@@ -0,0 +1,266 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Binned SAH BVH implementation.
+ */
+
+#include "internal/sah.h"
+#include "internal/concurrency.h"
+
+/// Maximum number of bins per axis; there's a candidate split between each.
+#define DMNSN_SAH_BINS 16
+/// Maximum number of objects in a leaf.
+#define DMNSN_SAH_MAX_LEAF 4
+/// Cost of traversing a node, relative to intersecting an object.
+#define DMNSN_SAH_TRAVERSAL_COST 0.5
+/// Build subtrees in parallel with at least this many objects.
+#define DMNSN_SAH_PARALLEL_THRESHOLD 1024
+
+/// An object, with its bounding box and centroid cached for the build.
+typedef struct dmnsn_sah_ref {
+  dmnsn_aabb aabb;       ///< The object's bounding box.
+  dmnsn_vector centroid; ///< The center of the bounding box.
+  dmnsn_object *object;  ///< The object itself.
+} dmnsn_sah_ref;
+
+/// A bin of objects whose centroids fall in the same slab.
+typedef struct dmnsn_sah_bin {
+  dmnsn_aabb aabb; ///< The bounding box of the objects in this bin.
+  size_t count;    ///< The number of objects in this bin.
+} dmnsn_sah_bin;
+
+/// Use fewer bins for small nodes, so the cost per node stays O(n).
+static inline size_t
+dmnsn_sah_nbins(size_t n)
+{
+  return n < DMNSN_SAH_BINS ? n : DMNSN_SAH_BINS;
+}
+
+/// Which bin a centroid coordinate falls in.
+static inline size_t
+dmnsn_sah_bin_index(double c, double min, double scale, size_t nbins)
+{
+  size_t i = (c - min)*scale;
+  return i < nbins ? i : nbins - 1;
+}
+
+/// A split of a node's objects into two children.
+typedef struct dmnsn_sah_split {
+  unsigned int axis; ///< The axis to split along.
+  size_t bin;        ///< The last bin in the left child.
+  double cost;       ///< The expected cost of the split.
+} dmnsn_sah_split;
+
+/// Find the cheapest split.  Returns false if every centroid is identical.
+static bool
+dmnsn_sah_find_split(const dmnsn_sah_ref *refs, size_t n, dmnsn_aabb aabb, dmnsn_aabb centroids, dmnsn_sah_split *split)
+{
+  bool found = false;
+  split->cost = INFINITY;
+  size_t nbins = dmnsn_sah_nbins(n);
+  double area = dmnsn_bvh_area(aabb);
+  double area_inv = area > 0.0 ? 1.0/area : 0.0;
+
+  for (unsigned int axis = 0; axis < 3; ++axis) {
+    double min = centroids.min.n[axis];
+    double extent = centroids.max.n[axis] - min;
+    if (!(extent > 0.0)) {
+      continue;
+    }
+    double scale = nbins/extent;
+
+    dmnsn_sah_bin bins[DMNSN_SAH_BINS];
+    for (size_t i = 0; i < nbins; ++i) {
+      bins[i].aabb = dmnsn_zero_aabb();
+      bins[i].count = 0;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      dmnsn_sah_bin *bin = &bins[dmnsn_sah_bin_index(refs[i].centroid.n[axis], min, scale, nbins)];
+      bin->aabb = dmnsn_bvh_union(bin->aabb, refs[i].aabb);
+      ++bin->count;
+    }
+
+    // Sweep from the right to find the cost of every right child
+    double right_cost[DMNSN_SAH_BINS];
+    dmnsn_aabb right = dmnsn_zero_aabb();
+    size_t nright = 0;
+    for (size_t i = nbins - 1; i > 0; --i) {
+      right = dmnsn_bvh_union(right, bins[i].aabb);
+      nright += bins[i].count;
+      right_cost[i] = nright ? nright*dmnsn_bvh_area(right) : 0.0;
+    }
+
+    // Then from the left to evaluate every split
+    dmnsn_aabb left = dmnsn_zero_aabb();
+    size_t nleft = 0;
+    for (size_t i = 0; i < nbins - 1; ++i) {
+      left = dmnsn_bvh_union(left, bins[i].aabb);
+      nleft += bins[i].count;
+      if (nleft == 0 || nleft == n) {
+        continue;
+      }
+
+      double cost = DMNSN_SAH_TRAVERSAL_COST
+        + (nleft*dmnsn_bvh_area(left) + right_cost[i + 1])*area_inv;
+      if (cost < split->cost) {
+        split->axis = axis;
+        split->bin = i;
+        split->cost = cost;
+        found = true;
+      }
+    }
+  }
+
+  return found;
+}
+
+/// Move the objects on the left of a split to the front.  Returns the number
+/// of objects on the left.
+static size_t
+dmnsn_sah_partition(dmnsn_sah_ref *refs, size_t n, dmnsn_aabb centroids, const dmnsn_sah_split *split)
+{
+  unsigned int axis = split->axis;
+  double min = centroids.min.n[axis];
+  size_t nbins = dmnsn_sah_nbins(n);
+  double scale = nbins/(centroids.max.n[axis] - min);
+
+  size_t i = 0, j = n;
+  while (i < j) {
+    if (dmnsn_sah_bin_index(refs[i].centroid.n[axis], min, scale, nbins) <= split->bin) {
+      ++i;
+    } else {
+      --j;
+      dmnsn_sah_ref temp = refs[i];
+      refs[i] = refs[j];
+      refs[j] = temp;
+    }
+  }
+
+  return i;
+}
+
+/// Make a leaf holding some objects.
+static dmnsn_bvh_node *
+dmnsn_sah_leaf(const dmnsn_sah_ref *refs, size_t n)
+{
+  if (n == 1) {
+    return dmnsn_new_bvh_leaf_node(refs[0].object);
+  }
+
+  dmnsn_bvh_node *node = dmnsn_new_bvh_node(n);
+  for (size_t i = 0; i < n; ++i) {
+    dmnsn_bvh_node_add(node, dmnsn_new_bvh_leaf_node(refs[i].object));
+  }
+  return node;
+}
+
+static dmnsn_bvh_node *dmnsn_sah_build(dmnsn_sah_ref *refs, size_t n);
+
+/// Payload for building a subtree in parallel.
+typedef struct dmnsn_sah_payload {
+  dmnsn_sah_ref *refs;    ///< The subtree's objects.
+  size_t n;               ///< The number of objects.
+  dmnsn_bvh_node *result; ///< The built subtree.
+} dmnsn_sah_payload;
+
+/// Subtree building task.
+static void
+dmnsn_sah_build_task(void *ptr)
+{
+  dmnsn_sah_payload *payload = ptr;
+  payload->result = dmnsn_sah_build(payload->refs, payload->n);
+}
+
+/// Recursively build a subtree.
+static dmnsn_bvh_node *
+dmnsn_sah_build(dmnsn_sah_ref *refs, size_t n)
+{
+  if (n == 1) {
+    return dmnsn_sah_leaf(refs, n);
+  }
+
+  dmnsn_aabb aabb = dmnsn_zero_aabb();
+  dmnsn_aabb centroids = dmnsn_zero_aabb();
+  for (size_t i = 0; i < n; ++i) {
+    aabb = dmnsn_bvh_union(aabb, refs[i].aabb);
+    centroids = dmnsn_aabb_swallow(centroids, refs[i].centroid);
+  }
+
+  // A leaf costs one intersection per object
+  dmnsn_sah_split split;
+  bool found = dmnsn_sah_find_split(refs, n, aabb, centroids, &split);
+  if (n <= DMNSN_SAH_MAX_LEAF && (!found || split.cost >= n)) {
+    return dmnsn_sah_leaf(refs, n);
+  }
+
+  size_t mid;
+  if (found) {
+    mid = dmnsn_sah_partition(refs, n, centroids, &split);
+  } else {
+    // Every centroid is the same, so any split is as good as any other
+    mid = n/2;
+  }
+
+  dmnsn_bvh_node *left, *right;
+  if (n >= DMNSN_SAH_PARALLEL_THRESHOLD) {
+    dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+    dmnsn_sah_payload payload = {
+      .refs = refs,
+      .n = mid,
+    };
+    dmnsn_spawn(&group, dmnsn_sah_build_task, &payload);
+    right = dmnsn_sah_build(refs + mid, n - mid);
+    dmnsn_sync(&group);
+    left = payload.result;
+  } else {
+    left = dmnsn_sah_build(refs, mid);
+    right = dmnsn_sah_build(refs + mid, n - mid);
+  }
+
+  dmnsn_bvh_node *node = dmnsn_new_bvh_node(2);
+  dmnsn_bvh_node_add(node, left);
+  dmnsn_bvh_node_add(node, right);
+  return node;
+}
+
+dmnsn_bvh_node *
+dmnsn_new_sah_bvh(const dmnsn_array *objects)
+{
+  size_t n = dmnsn_array_size(objects);
+  if (n == 0) {
+    return NULL;
+  }
+
+  dmnsn_sah_ref *refs = dmnsn_malloc(n*sizeof(dmnsn_sah_ref));
+  dmnsn_object **array = dmnsn_array_first(objects);
+  for (size_t i = 0; i < n; ++i) {
+    refs[i].aabb = array[i]->aabb;
+    refs[i].centroid = dmnsn_vector_mul(0.5, dmnsn_vector_add(array[i]->aabb.min, array[i]->aabb.max));
+    refs[i].object = array[i];
+  }
+
+  dmnsn_bvh_node *root = dmnsn_sah_build(refs, n);
+
+  dmnsn_free(refs);
+  return root;
+}
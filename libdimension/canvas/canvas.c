@@ -23,23 +23,437 @@
  * Canveses.
  */
 
-#include "dimension/canvas.h"
+#include "internal/canvas.h"
+#include "internal/concurrency.h"
+#include "internal/future.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Row completion tracker.
+typedef struct dmnsn_canvas_rows {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;  ///< Signalled when a row is finished, or tracking ends.
+  bool active;          ///< Whether the canvas is being rendered.
+  size_t generation;    ///< The number of times tracking has ended.
+  bool interrupted;     ///< Whether the last render left rows unfinished.
+  atomic_size_t *pending; ///< The number of unfinished pixels in each row.
+} dmnsn_canvas_rows;
+
+/// A canvas, with the state that doesn't belong in the public struct.
+typedef struct dmnsn_canvas_impl {
+  dmnsn_canvas canvas;
+  dmnsn_canvas_rows rows; ///< Which rows are finished, while rendering.
+} dmnsn_canvas_impl;
+
+/// Get a canvas's row tracker.
+static inline dmnsn_canvas_rows *
+dmnsn_canvas_get_rows(const dmnsn_canvas *canvas)
+{
+  dmnsn_canvas_impl *impl = (dmnsn_canvas_impl *)canvas;
+  return &impl->rows;
+}
+
+/// Canvas destructor callback.
+static void
+dmnsn_canvas_cleanup(void *ptr)
+{
+  dmnsn_canvas_impl *impl = ptr;
+  dmnsn_destroy_cond(&impl->rows.cond);
+  dmnsn_destroy_mutex(&impl->rows.mutex);
+}
+
+///////////////////
+// Pixel storage //
+///////////////////
+
+/// Side length of the tiles of a DMNSN_CANVAS_TILED canvas.
+#define DMNSN_CANVAS_TILE_SIZE 16
+
+/// The storage format of a canvas, without the layout flags.
+static inline dmnsn_canvas_format
+dmnsn_canvas_storage(const dmnsn_canvas *canvas)
+{
+  return canvas->format & ~DMNSN_CANVAS_TILED;
+}
+
+/// The number of bytes per pixel in a given storage format.
+static size_t
+dmnsn_canvas_pixel_size(dmnsn_canvas_format storage)
+{
+  switch (storage) {
+  case DMNSN_CANVAS_DOUBLE:
+    return sizeof(dmnsn_tcolor);
+  case DMNSN_CANVAS_FLOAT:
+    return 5*sizeof(float);
+  case DMNSN_CANVAS_HALF:
+  case DMNSN_CANVAS_LINEAR16:
+    return 5*sizeof(uint16_t);
+  default:
+    dmnsn_error("Invalid canvas format.");
+  }
+}
+
+/// The number of tiles across a tiled canvas.
+static inline size_t
+dmnsn_canvas_tile_columns(const dmnsn_canvas *canvas)
+{
+  return (canvas->width + DMNSN_CANVAS_TILE_SIZE - 1)/DMNSN_CANVAS_TILE_SIZE;
+}
+
+/// The storage index of pixel (x, y).
+static inline size_t
+dmnsn_canvas_index(const dmnsn_canvas *canvas, size_t x, size_t y)
+{
+  if (canvas->format & DMNSN_CANVAS_TILED) {
+    size_t tile = (y/DMNSN_CANVAS_TILE_SIZE)*dmnsn_canvas_tile_columns(canvas)
+      + x/DMNSN_CANVAS_TILE_SIZE;
+    return DMNSN_CANVAS_TILE_SIZE*(tile*DMNSN_CANVAS_TILE_SIZE + y%DMNSN_CANVAS_TILE_SIZE)
+      + x%DMNSN_CANVAS_TILE_SIZE;
+  } else {
+    return y*canvas->width + x;
+  }
+}
+
+/// The number of pixels (up to \p n) from column \p x that are contiguous.
+static inline size_t
+dmnsn_canvas_run(const dmnsn_canvas *canvas, size_t x, size_t n)
+{
+  if (canvas->format & DMNSN_CANVAS_TILED) {
+    size_t run = DMNSN_CANVAS_TILE_SIZE - x%DMNSN_CANVAS_TILE_SIZE;
+    return run < n ? run : n;
+  } else {
+    return n;
+  }
+}
+
+/// Convert a double to a half-precision float, rounding to nearest even.
+static uint16_t
+dmnsn_half_encode(double d)
+{
+  float f = d;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs = bits & 0x7FFFFFFF;
+  if (abs >= 0x7F800000) {
+    // Infinity or NaN
+    return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+  } else if (abs >= 0x477FF000) {
+    // Rounds to at least 65520, which overflows
+    return sign | 0x7C00;
+  } else if (abs < 0x38800000) {
+    // Subnormal; the unit in the last place is 2^-24, and the multiplication is
+    // exact
+    float af;
+    memcpy(&af, &abs, sizeof(af));
+    return sign | (uint16_t)lrintf(af*16777216.0f);
+  } else {
+    // Normal; re-bias the exponent, and round off the low 13 bits of the
+    // mantissa.  A carry into the exponent is still correct.
+    abs -= UINT32_C(112) << 23;
+    abs += 0xFFF + ((abs >> 13) & 1);
+    return sign | (abs >> 13);
+  }
+}
+
+/// Convert a half-precision float to a double.
+static double
+dmnsn_half_decode(uint16_t h)
+{
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = h & 0x7C00;
+  uint32_t mantissa = h & 0x3FF;
+
+  if (exponent == 0) {
+    // Zero or subnormal
+    double d = ldexp(mantissa, -24);
+    return sign ? -d : d;
+  }
+
+  uint32_t bits;
+  if (exponent == 0x7C00) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else {
+    bits = sign | (((uint32_t)(h & 0x7FFF) << 13) + (UINT32_C(112) << 23));
+  }
+
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/// Convert a channel to 16-bit fixed point.
+static inline uint16_t
+dmnsn_linear16_encode(double C)
+{
+  return dmnsn_clamp(C, 0.0, 1.0)*UINT16_MAX + 0.5;
+}
+
+/// Convert a channel from 16-bit fixed point.
+static inline double
+dmnsn_linear16_decode(uint16_t C)
+{
+  return C/(double)UINT16_MAX;
+}
+
+/// Store \p n contiguous pixels at storage index \p i.
+static void
+dmnsn_canvas_store(dmnsn_canvas *canvas, size_t i, const dmnsn_tcolor *tcolors, size_t n)
+{
+  switch (dmnsn_canvas_storage(canvas)) {
+  case DMNSN_CANVAS_DOUBLE:
+    memcpy((dmnsn_tcolor *)canvas->pixels + i, tcolors, n*sizeof(dmnsn_tcolor));
+    break;
+
+  case DMNSN_CANVAS_FLOAT:
+    {
+      float *pixels = (float *)canvas->pixels + 5*i;
+      for (size_t j = 0; j < n; ++j, pixels += 5) {
+        pixels[0] = tcolors[j].c.R;
+        pixels[1] = tcolors[j].c.G;
+        pixels[2] = tcolors[j].c.B;
+        pixels[3] = tcolors[j].T;
+        pixels[4] = tcolors[j].F;
+      }
+      break;
+    }
+
+  case DMNSN_CANVAS_HALF:
+    {
+      uint16_t *pixels = (uint16_t *)canvas->pixels + 5*i;
+      for (size_t j = 0; j < n; ++j, pixels += 5) {
+        pixels[0] = dmnsn_half_encode(tcolors[j].c.R);
+        pixels[1] = dmnsn_half_encode(tcolors[j].c.G);
+        pixels[2] = dmnsn_half_encode(tcolors[j].c.B);
+        pixels[3] = dmnsn_half_encode(tcolors[j].T);
+        pixels[4] = dmnsn_half_encode(tcolors[j].F);
+      }
+      break;
+    }
+
+  case DMNSN_CANVAS_LINEAR16:
+    {
+      uint16_t *pixels = (uint16_t *)canvas->pixels + 5*i;
+      for (size_t j = 0; j < n; ++j, pixels += 5) {
+        pixels[0] = dmnsn_linear16_encode(tcolors[j].c.R);
+        pixels[1] = dmnsn_linear16_encode(tcolors[j].c.G);
+        pixels[2] = dmnsn_linear16_encode(tcolors[j].c.B);
+        pixels[3] = dmnsn_linear16_encode(tcolors[j].T);
+        pixels[4] = dmnsn_linear16_encode(tcolors[j].F);
+      }
+      break;
+    }
+
+  default:
+    dmnsn_unreachable("Invalid canvas format.");
+  }
+}
+
+/// Load \p n contiguous pixels from storage index \p i.
+static void
+dmnsn_canvas_load(const dmnsn_canvas *canvas, size_t i, dmnsn_tcolor *tcolors, size_t n)
+{
+  switch (dmnsn_canvas_storage(canvas)) {
+  case DMNSN_CANVAS_DOUBLE:
+    memcpy(tcolors, (const dmnsn_tcolor *)canvas->pixels + i, n*sizeof(dmnsn_tcolor));
+    break;
+
+  case DMNSN_CANVAS_FLOAT:
+    {
+      const float *pixels = (const float *)canvas->pixels + 5*i;
+      for (size_t j = 0; j < n; ++j, pixels += 5) {
+        tcolors[j] = dmnsn_new_tcolor5(pixels[0], pixels[1], pixels[2], pixels[3], pixels[4]);
+      }
+      break;
+    }
+
+  case DMNSN_CANVAS_HALF:
+    {
+      const uint16_t *pixels = (const uint16_t *)canvas->pixels + 5*i;
+      for (size_t j = 0; j < n; ++j, pixels += 5) {
+        tcolors[j] = dmnsn_new_tcolor5(
+          dmnsn_half_decode(pixels[0]),
+          dmnsn_half_decode(pixels[1]),
+          dmnsn_half_decode(pixels[2]),
+          dmnsn_half_decode(pixels[3]),
+          dmnsn_half_decode(pixels[4])
+        );
+      }
+      break;
+    }
+
+  case DMNSN_CANVAS_LINEAR16:
+    {
+      const uint16_t *pixels = (const uint16_t *)canvas->pixels + 5*i;
+      for (size_t j = 0; j < n; ++j, pixels += 5) {
+        tcolors[j] = dmnsn_new_tcolor5(
+          dmnsn_linear16_decode(pixels[0]),
+          dmnsn_linear16_decode(pixels[1]),
+          dmnsn_linear16_decode(pixels[2]),
+          dmnsn_linear16_decode(pixels[3]),
+          dmnsn_linear16_decode(pixels[4])
+        );
+      }
+      break;
+    }
+
+  default:
+    dmnsn_unreachable("Invalid canvas format.");
+  }
+}
+
+//////////////
+// Canvases //
+//////////////
 
 dmnsn_canvas *
 dmnsn_new_canvas(dmnsn_pool *pool, size_t width, size_t height)
 {
-  dmnsn_canvas *canvas = DMNSN_PALLOC(pool, dmnsn_canvas);
+  return dmnsn_new_canvas_format(pool, width, height, DMNSN_CANVAS_DOUBLE);
+}
+
+dmnsn_canvas *
+dmnsn_new_canvas_format(dmnsn_pool *pool, size_t width, size_t height, dmnsn_canvas_format format)
+{
+  dmnsn_canvas_impl *impl = DMNSN_PALLOC_TIDY(pool, dmnsn_canvas_impl, dmnsn_canvas_cleanup);
+  dmnsn_canvas *canvas = &impl->canvas;
   canvas->width = width;
   canvas->height = height;
+  canvas->format = format;
   canvas->optimizers = DMNSN_PALLOC_ARRAY(pool, dmnsn_canvas_optimizer *);
-  canvas->pixels = dmnsn_palloc(pool, sizeof(dmnsn_tcolor)*width*height);
+
+  // Tiled canvases are padded out to whole tiles
+  size_t npixels = width*height;
+  if (format & DMNSN_CANVAS_TILED) {
+    size_t rows = (height + DMNSN_CANVAS_TILE_SIZE - 1)/DMNSN_CANVAS_TILE_SIZE;
+    npixels = dmnsn_canvas_tile_columns(canvas)*rows*DMNSN_CANVAS_TILE_SIZE*DMNSN_CANVAS_TILE_SIZE;
+  }
+  size_t pixel_size = dmnsn_canvas_pixel_size(dmnsn_canvas_storage(canvas));
+  canvas->pixels = dmnsn_palloc(pool, pixel_size*npixels);
+
+  dmnsn_canvas_rows *rows = &impl->rows;
+  dmnsn_initialize_mutex(&rows->mutex);
+  dmnsn_initialize_cond(&rows->cond);
+  rows->active = false;
+  rows->generation = 0;
+  rows->interrupted = false;
+  rows->pending = dmnsn_palloc(pool, sizeof(atomic_size_t)*height);
+  for (size_t y = 0; y < height; ++y) {
+    atomic_init(&rows->pending[y], 0);
+  }
+
   return canvas;
 }
 
+void
+dmnsn_canvas_begin_rows(dmnsn_canvas *canvas)
+{
+  dmnsn_canvas_rows *rows = dmnsn_canvas_get_rows(canvas);
+  dmnsn_lock_mutex(&rows->mutex);
+    dmnsn_assert(!rows->active, "Canvas rendered to twice at once.");
+    rows->active = true;
+    for (size_t y = 0; y < canvas->height; ++y) {
+      atomic_store_explicit(&rows->pending[y], canvas->width, memory_order_relaxed);
+    }
+  dmnsn_unlock_mutex(&rows->mutex);
+}
+
+void
+dmnsn_canvas_finish_span(dmnsn_canvas *canvas, size_t y, size_t n)
+{
+  dmnsn_canvas_rows *rows = dmnsn_canvas_get_rows(canvas);
+  // Release, so the pixels are visible to whoever sees the row finished
+  size_t pending = atomic_fetch_sub_explicit(&rows->pending[y], n, memory_order_release);
+  dmnsn_assert(pending >= n, "Canvas row finished too many times.");
+
+  if (pending == n) {
+    dmnsn_lock_mutex(&rows->mutex);
+      dmnsn_cond_broadcast(&rows->cond);
+    dmnsn_unlock_mutex(&rows->mutex);
+  }
+}
+
+void
+dmnsn_canvas_end_rows(dmnsn_canvas *canvas)
+{
+  dmnsn_canvas_rows *rows = dmnsn_canvas_get_rows(canvas);
+  dmnsn_lock_mutex(&rows->mutex);
+    // Abandon any unfinished rows, so exports started later don't wait for them
+    rows->interrupted = false;
+    for (size_t y = 0; y < canvas->height; ++y) {
+      if (atomic_exchange_explicit(&rows->pending[y], 0, memory_order_relaxed) != 0) {
+        rows->interrupted = true;
+      }
+    }
+    rows->active = false;
+    ++rows->generation;
+    dmnsn_cond_broadcast(&rows->cond);
+  dmnsn_unlock_mutex(&rows->mutex);
+}
+
+bool
+dmnsn_canvas_is_rendering(const dmnsn_canvas *canvas)
+{
+  dmnsn_canvas_rows *rows = dmnsn_canvas_get_rows(canvas);
+  bool active;
+  dmnsn_lock_mutex(&rows->mutex);
+    active = rows->active;
+  dmnsn_unlock_mutex(&rows->mutex);
+  return active;
+}
+
+bool
+dmnsn_canvas_wait_row(const dmnsn_canvas *canvas, size_t y, dmnsn_future *future)
+{
+  dmnsn_canvas_rows *rows = dmnsn_canvas_get_rows(canvas);
+  if (dmnsn_likely(atomic_load_explicit(&rows->pending[y], memory_order_acquire) == 0)) {
+    return true;
+  }
+
+  // Get woken up if the waiting task is cancelled
+  bool cancelled = false;
+  dmnsn_future_notifier notifier = {
+    .mutex = &rows->mutex,
+    .cond = &rows->cond,
+    .notified = &cancelled,
+  };
+  if (future && dmnsn_future_watch_cancel(future, &notifier)) {
+    return false;
+  }
+
+  bool finished;
+  dmnsn_lock_mutex(&rows->mutex);
+    size_t generation = rows->generation;
+    while (true) {
+      finished = atomic_load_explicit(&rows->pending[y], memory_order_acquire) == 0;
+      if (finished || !rows->active || cancelled) {
+        break;
+      }
+      dmnsn_cond_wait(&rows->cond, &rows->mutex);
+
+      // The rows are zeroed when tracking ends, so don't mistake an abandoned
+      // row for a finished one
+      if (rows->generation != generation) {
+        finished = !rows->interrupted;
+        break;
+      }
+    }
+  dmnsn_unlock_mutex(&rows->mutex);
+
+  if (future) {
+    dmnsn_future_unwatch_cancel(future, &notifier);
+  }
+
+  return finished;
+}
+
 void
 dmnsn_init_canvas_optimizer(dmnsn_canvas_optimizer *optimizer)
 {
   optimizer->optimizer_fn = NULL;
+  optimizer->span_optimizer_fn = NULL;
 }
 
 // Set a canvas optimizer
@@ -62,6 +476,32 @@ dmnsn_canvas_find_optimizer(const dmnsn_canvas *canvas, dmnsn_canvas_optimizer_f
   return NULL;
 }
 
+// Get the value of a pixel in any format
+dmnsn_tcolor
+dmnsn_canvas_load_pixel(const dmnsn_canvas *canvas, size_t x, size_t y)
+{
+  dmnsn_assert(x < canvas->width && y < canvas->height,
+               "Canvas access out of bounds.");
+
+  dmnsn_tcolor tcolor;
+  dmnsn_canvas_load(canvas, dmnsn_canvas_index(canvas, x, y), &tcolor, 1);
+  return tcolor;
+}
+
+// Get the values of a run of pixels
+void
+dmnsn_canvas_get_span(const dmnsn_canvas *canvas, size_t x, size_t y, size_t n,
+                      dmnsn_tcolor *tcolors)
+{
+  dmnsn_assert(x + n <= canvas->width && y < canvas->height,
+               "Canvas access out of bounds.");
+
+  for (size_t i = 0, run; i < n; i += run) {
+    run = dmnsn_canvas_run(canvas, x + i, n - i);
+    dmnsn_canvas_load(canvas, dmnsn_canvas_index(canvas, x + i, y), tcolors + i, run);
+  }
+}
+
 // Set the value of a pixel
 void
 dmnsn_canvas_set_pixel(dmnsn_canvas *canvas, size_t x, size_t y,
@@ -72,7 +512,7 @@ dmnsn_canvas_set_pixel(dmnsn_canvas *canvas, size_t x, size_t y,
   dmnsn_assert(!dmnsn_tcolor_isnan(tcolor), "Pixel has NaN component.");
 
   // Set the pixel
-  canvas->pixels[y*canvas->width + x] = tcolor;
+  dmnsn_canvas_store(canvas, dmnsn_canvas_index(canvas, x, y), &tcolor, 1);
 
   // Call the optimizers
   DMNSN_ARRAY_FOREACH (dmnsn_canvas_optimizer **, i, canvas->optimizers) {
@@ -80,13 +520,61 @@ dmnsn_canvas_set_pixel(dmnsn_canvas *canvas, size_t x, size_t y,
   }
 }
 
+// Set the value of a run of pixels
+void
+dmnsn_canvas_set_span(dmnsn_canvas *canvas, size_t x, size_t y, size_t n,
+                      const dmnsn_tcolor *tcolors)
+{
+  dmnsn_assert(x + n <= canvas->width && y < canvas->height,
+               "Canvas access out of bounds.");
+
+  for (size_t i = 0; i < n; ++i) {
+    dmnsn_assert(!dmnsn_tcolor_isnan(tcolors[i]), "Pixel has NaN component.");
+  }
+
+  // Set the pixels
+  for (size_t i = 0, run; i < n; i += run) {
+    run = dmnsn_canvas_run(canvas, x + i, n - i);
+    dmnsn_canvas_store(canvas, dmnsn_canvas_index(canvas, x + i, y), tcolors + i, run);
+  }
+
+  // Call the optimizers
+  DMNSN_ARRAY_FOREACH (dmnsn_canvas_optimizer **, i, canvas->optimizers) {
+    dmnsn_canvas_optimizer *optimizer = *i;
+    if (optimizer->span_optimizer_fn) {
+      optimizer->span_optimizer_fn(optimizer, canvas, x, y, n);
+    } else {
+      for (size_t j = x; j < x + n; ++j) {
+        optimizer->optimizer_fn(optimizer, canvas, j, y);
+      }
+    }
+  }
+}
+
+// Set the value of a row of pixels
+void
+dmnsn_canvas_set_row(dmnsn_canvas *canvas, size_t y, const dmnsn_tcolor *tcolors)
+{
+  dmnsn_canvas_set_span(canvas, 0, y, canvas->width, tcolors);
+}
+
 // Fill a canvas with a solid color
 void
 dmnsn_canvas_clear(dmnsn_canvas *canvas, dmnsn_tcolor tcolor)
 {
+  if (canvas->width == 0) {
+    return;
+  }
+
+  // Every row is the same, so build one and copy it
+  dmnsn_tcolor *row = dmnsn_malloc(canvas->width*sizeof(dmnsn_tcolor));
   for (size_t x = 0; x < canvas->width; ++x) {
-    for (size_t y = 0; y < canvas->height; ++y) {
-      dmnsn_canvas_set_pixel(canvas, x, y, tcolor);
-    }
+    row[x] = tcolor;
+  }
+
+  for (size_t y = 0; y < canvas->height; ++y) {
+    dmnsn_canvas_set_row(canvas, y, row);
   }
+
+  dmnsn_free(row);
 }
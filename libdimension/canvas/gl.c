@@ -23,6 +23,7 @@
  * OpenGL import/export.
  */
 
+#include "internal/canvas.h"
 #include "internal/rgba.h"
 #include "dimension/canvas.h"
 #include <GL/gl.h>
@@ -54,22 +55,12 @@ dmnsn_gl_write_canvas(const dmnsn_canvas *canvas)
 
   // We couldn't, so transform the canvas to RGB now
   GLubyte *pixels = dmnsn_malloc(4*width*height*sizeof(GLubyte));
-
+  dmnsn_tcolor *row = dmnsn_malloc(width*sizeof(dmnsn_tcolor));
   for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width; ++x) {
-      GLubyte *pixel = pixels + 4*(y*width + x);
-
-      dmnsn_tcolor tcolor = dmnsn_canvas_get_pixel(canvas, x, y);
-      tcolor = dmnsn_tcolor_remove_filter(tcolor);
-      tcolor.c = dmnsn_color_to_sRGB(tcolor.c);
-      tcolor = dmnsn_tcolor_clamp(tcolor);
-
-      pixel[0] = lround(tcolor.c.R*UINT8_MAX);
-      pixel[1] = lround(tcolor.c.G*UINT8_MAX);
-      pixel[2] = lround(tcolor.c.B*UINT8_MAX);
-      pixel[3] = lround(tcolor.T*UINT8_MAX);
-    }
+    const dmnsn_tcolor *tcolors = dmnsn_canvas_read_span(canvas, 0, y, width, row);
+    dmnsn_tcolors_to_rgba8(tcolors, width, pixels + 4*y*width);
   }
+  dmnsn_free(row);
 
   glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 
@@ -92,22 +83,14 @@ dmnsn_gl_read_canvas(dmnsn_canvas *canvas, size_t x0, size_t y0)
     return -1;
   }
 
-  for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width; ++x) {
-      GLushort *pixel = pixels + 4*(y*width + x);
+  dmnsn_tcolor *row = dmnsn_malloc(width*sizeof(dmnsn_tcolor));
 
-      dmnsn_tcolor tcolor = dmnsn_new_tcolor5(
-        (double)pixel[0]/UINT16_MAX,
-        (double)pixel[1]/UINT16_MAX,
-        (double)pixel[2]/UINT16_MAX,
-        (double)pixel[3]/UINT16_MAX,
-        0.0
-      );
-      tcolor.c = dmnsn_color_from_sRGB(tcolor.c);
-      dmnsn_canvas_set_pixel(canvas, x, y, tcolor);
-    }
+  for (size_t y = 0; y < height; ++y) {
+    dmnsn_rgba16_to_tcolors(pixels + 4*y*width, width, 4, row);
+    dmnsn_canvas_set_row(canvas, y, row);
   }
 
+  dmnsn_free(row);
   dmnsn_free(pixels);
   return 0;
 }
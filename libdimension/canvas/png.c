@@ -23,15 +23,19 @@
  * PNG import/export.
  */
 
+#include "internal/canvas.h"
 #include "internal/concurrency.h"
 #include "internal/platform.h"
 #include "internal/rgba.h"
 #include "dimension/canvas.h"
 #include <png.h>
+#include <zlib.h>
 #include <errno.h>
 #include <setjmp.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 int
 dmnsn_png_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas)
@@ -116,6 +120,369 @@ dmnsn_png_read_canvas_async(dmnsn_canvas **canvas, dmnsn_pool *pool, FILE *file)
 // Thread callbacks //
 //////////////////////
 
+/// Wait for a row of a canvas that may still be rendering.
+static void
+dmnsn_png_wait_row(png_structp png_ptr, const dmnsn_canvas *canvas, size_t y, dmnsn_future *future)
+{
+  if (!dmnsn_canvas_wait_row(canvas, y, future)) {
+    // The render failed or we were cancelled, so bail out like libpng would
+    png_longjmp(png_ptr, 1);
+  }
+}
+
+//////////////////////////////
+// Parallel stripe encoding //
+//////////////////////////////
+
+/// Target uncompressed size of each stripe, like pigz's blocks.
+#define DMNSN_PNG_STRIPE_SIZE 131072
+
+/// A horizontal stripe of a PNG image, deflated independently.
+typedef struct dmnsn_png_stripe {
+  size_t start, nrows;  ///< The first (PNG) row, and the number of rows.
+  Bytef *data;          ///< The compressed data.
+  size_t size;          ///< The size of the compressed data.
+  size_t capacity;      ///< The size of the data buffer.
+  uLong adler;          ///< The Adler-32 checksum of the uncompressed data.
+  uLong length;         ///< The length of the uncompressed data.
+} dmnsn_png_stripe;
+
+/// Payload for the stripe encoder threads.
+typedef struct dmnsn_png_encode_payload {
+  dmnsn_future *future;
+  const dmnsn_canvas *canvas;
+  const uint16_t *data;       ///< The RGBA16 optimizer buffer.
+  dmnsn_png_stripe *stripes;
+  size_t nstripes;
+  atomic_size_t next_stripe;  ///< The index of the next stripe to encode.
+} dmnsn_png_encode_payload;
+
+/// Per-thread encoder state.
+typedef struct dmnsn_png_encoder {
+  z_stream zstream;
+  bool initialized;       ///< Whether zstream needs deflateEnd().
+  size_t rowbytes;        ///< The number of bytes in an unfiltered row.
+  png_bytep prev, row;    ///< The previous and current unfiltered rows.
+  png_bytep filtered[5];  ///< The row, filtered each possible way.
+} dmnsn_png_encoder;
+
+/// Free an encoder's resources.
+static void
+dmnsn_png_encoder_cleanup(void *ptr)
+{
+  dmnsn_png_encoder *encoder = ptr;
+  if (encoder->initialized) {
+    deflateEnd(&encoder->zstream);
+  }
+  for (size_t i = 0; i < 5; ++i) {
+    dmnsn_free(encoder->filtered[i]);
+  }
+  dmnsn_free(encoder->row);
+  dmnsn_free(encoder->prev);
+}
+
+/// Convert a row of the RGBA16 buffer to PNG's big-endian RGBA format.
+static void
+dmnsn_png_convert_row(const dmnsn_png_encode_payload *payload, size_t y, png_bytep row)
+{
+  size_t width = payload->canvas->width;
+  const uint16_t *pixel = payload->data + 4*y*width;
+  for (size_t i = 0; i < 4*width; ++i, row += 2) {
+    uint16_t value = pixel[i];
+    if (i%4 == 3) {
+      // We think of transparency in the opposite way that PNG does
+      value = UINT16_MAX - value;
+    }
+    row[0] = value >> 8;
+    row[1] = value & 0xFF;
+  }
+}
+
+/// The Paeth predictor.
+static inline png_byte
+dmnsn_png_paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  } else if (pb <= pc) {
+    return b;
+  } else {
+    return c;
+  }
+}
+
+/// Filter a row with every filter type, and pick the best, like libpng does.
+static png_bytep
+dmnsn_png_filter_row(dmnsn_png_encoder *encoder)
+{
+  const size_t bpp = 8;
+  size_t rowbytes = encoder->rowbytes;
+  png_const_bytep row = encoder->row, prev = encoder->prev;
+
+  png_bytep best = NULL;
+  size_t best_sum = SIZE_MAX;
+  for (int type = PNG_FILTER_VALUE_NONE; type < PNG_FILTER_VALUE_LAST; ++type) {
+    png_bytep out = encoder->filtered[type];
+    out[0] = type;
+    size_t sum = 0;
+
+    for (size_t i = 0; i < rowbytes; ++i) {
+      int a = i >= bpp ? row[i - bpp] : 0;
+      int b = prev[i];
+      int c = i >= bpp ? prev[i - bpp] : 0;
+
+      png_byte predictor;
+      switch (type) {
+      case PNG_FILTER_VALUE_NONE:
+        predictor = 0;
+        break;
+      case PNG_FILTER_VALUE_SUB:
+        predictor = a;
+        break;
+      case PNG_FILTER_VALUE_UP:
+        predictor = b;
+        break;
+      case PNG_FILTER_VALUE_AVG:
+        predictor = (a + b)/2;
+        break;
+      default:
+        predictor = dmnsn_png_paeth(a, b, c);
+        break;
+      }
+
+      png_byte value = row[i] - predictor;
+      out[i + 1] = value;
+      // Minimum sum of absolute differences heuristic
+      sum += value < 128 ? value : 256 - value;
+    }
+
+    if (sum < best_sum) {
+      best = out;
+      best_sum = sum;
+    }
+  }
+
+  return best;
+}
+
+/// Compress some data into a stripe.
+static void
+dmnsn_png_deflate(dmnsn_png_encoder *encoder, dmnsn_png_stripe *stripe, png_bytep data, size_t size, int flush)
+{
+  z_stream *zstream = &encoder->zstream;
+  zstream->next_in = data;
+  zstream->avail_in = size;
+
+  do {
+    if (stripe->size == stripe->capacity) {
+      stripe->capacity *= 2;
+      stripe->data = dmnsn_realloc(stripe->data, stripe->capacity);
+    }
+    zstream->next_out = stripe->data + stripe->size;
+    zstream->avail_out = stripe->capacity - stripe->size;
+
+    if (deflate(zstream, flush) == Z_STREAM_ERROR) {
+      dmnsn_error("deflate() failed.");
+    }
+
+    stripe->size = stripe->capacity - zstream->avail_out;
+  } while (zstream->avail_in > 0 || zstream->avail_out == 0);
+}
+
+/// Filter and compress one stripe.
+static bool
+dmnsn_png_encode_stripe(dmnsn_png_encode_payload *payload, dmnsn_png_encoder *encoder, dmnsn_png_stripe *stripe)
+{
+  const dmnsn_canvas *canvas = payload->canvas;
+  size_t height = canvas->height;
+  z_stream *zstream = &encoder->zstream;
+
+  if (encoder->initialized) {
+    deflateReset(zstream);
+  } else {
+    zstream->zalloc = Z_NULL;
+    zstream->zfree = Z_NULL;
+    zstream->opaque = Z_NULL;
+    // Raw deflate; the zlib wrapper is added when the stripes are stitched
+    if (deflateInit2(zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK) {
+      dmnsn_error("Couldn't initialize zlib.");
+    }
+    encoder->initialized = true;
+  }
+
+  stripe->length = stripe->nrows*(encoder->rowbytes + 1);
+  stripe->capacity = deflateBound(zstream, stripe->length) + 16;
+  stripe->data = dmnsn_malloc(stripe->capacity);
+  stripe->size = 0;
+  stripe->adler = adler32(0, Z_NULL, 0);
+
+  // The filters look at the row above, even across stripe boundaries.  PNG
+  // coordinates are fourth quadrant, so the row above is at a higher y.
+  if (stripe->start > 0) {
+    size_t y = height - stripe->start;
+    if (!dmnsn_canvas_wait_row(canvas, y, payload->future)) {
+      return false;
+    }
+    dmnsn_png_convert_row(payload, y, encoder->prev);
+  } else {
+    memset(encoder->prev, 0, encoder->rowbytes);
+  }
+
+  for (size_t i = stripe->start; i < stripe->start + stripe->nrows; ++i) {
+    size_t y = height - i - 1;
+    if (!dmnsn_canvas_wait_row(canvas, y, payload->future)) {
+      return false;
+    }
+    dmnsn_png_convert_row(payload, y, encoder->row);
+
+    png_bytep filtered = dmnsn_png_filter_row(encoder);
+    stripe->adler = adler32(stripe->adler, filtered, encoder->rowbytes + 1);
+    dmnsn_png_deflate(encoder, stripe, filtered, encoder->rowbytes + 1, Z_NO_FLUSH);
+
+    png_bytep temp = encoder->prev;
+    encoder->prev = encoder->row;
+    encoder->row = temp;
+
+    dmnsn_future_increment(payload->future);
+  }
+
+  // Byte-align the end of each stripe so they can be concatenated, and
+  // terminate the deflate stream after the last one
+  bool last = stripe->start + stripe->nrows == height;
+  dmnsn_png_deflate(encoder, stripe, NULL, 0, last ? Z_FINISH : Z_SYNC_FLUSH);
+  return true;
+}
+
+/// Stripe encoder thread callback.
+static int
+dmnsn_png_encode_concurrent(void *ptr, unsigned int thread, unsigned int nthreads)
+{
+  dmnsn_png_encode_payload *payload = ptr;
+
+  dmnsn_png_encoder encoder;
+  encoder.initialized = false;
+  encoder.rowbytes = 8*payload->canvas->width;
+  encoder.prev = dmnsn_malloc(encoder.rowbytes);
+  encoder.row = dmnsn_malloc(encoder.rowbytes);
+  for (size_t i = 0; i < 5; ++i) {
+    encoder.filtered[i] = dmnsn_malloc(encoder.rowbytes + 1);
+  }
+
+  int ret = 0;
+  pthread_cleanup_push(dmnsn_png_encoder_cleanup, &encoder);
+    while (true) {
+      size_t i = atomic_fetch_add_explicit(&payload->next_stripe, 1, memory_order_relaxed);
+      if (i >= payload->nstripes) {
+        break;
+      }
+
+      if (!dmnsn_png_encode_stripe(payload, &encoder, &payload->stripes[i])) {
+        ret = -1;
+        break;
+      }
+    }
+  pthread_cleanup_pop(true);
+
+  return ret;
+}
+
+/// Free a set of stripes.
+static void
+dmnsn_png_delete_stripes(dmnsn_png_stripe *stripes, size_t nstripes)
+{
+  if (stripes) {
+    for (size_t i = 0; i < nstripes; ++i) {
+      dmnsn_free(stripes[i].data);
+    }
+    dmnsn_free(stripes);
+  }
+}
+
+/// Free the stripes if encoding fails or is cancelled.
+static void
+dmnsn_png_encode_cleanup(void *ptr)
+{
+  dmnsn_png_encode_payload *payload = ptr;
+  dmnsn_png_delete_stripes(payload->stripes, payload->nstripes);
+}
+
+/**
+ * Filter and deflate the image in horizontal stripes in parallel, pigz-style.
+ * The first stripe gets the zlib header, and the last gets the checksum.
+ */
+static dmnsn_png_stripe *
+dmnsn_png_encode_stripes(dmnsn_future *future, const dmnsn_canvas *canvas, const dmnsn_rgba16_optimizer *rgba16, size_t *nstripes)
+{
+  size_t height = canvas->height;
+  size_t stripe_rows = DMNSN_PNG_STRIPE_SIZE/(8*canvas->width + 1);
+  if (stripe_rows == 0) {
+    stripe_rows = 1;
+  }
+
+  dmnsn_png_encode_payload payload = {
+    .future = future,
+    .canvas = canvas,
+    .data = rgba16->data,
+    .nstripes = (height + stripe_rows - 1)/stripe_rows,
+  };
+  atomic_init(&payload.next_stripe, 0);
+
+  payload.stripes = dmnsn_malloc(payload.nstripes*sizeof(dmnsn_png_stripe));
+  for (size_t i = 0; i < payload.nstripes; ++i) {
+    dmnsn_png_stripe *stripe = &payload.stripes[i];
+    stripe->start = i*stripe_rows;
+    stripe->nrows = height - stripe->start < stripe_rows ? height - stripe->start : stripe_rows;
+    stripe->data = NULL;
+  }
+
+  // While the canvas is still being rendered, the render already has every
+  // core, and extra encoder threads would just block waiting for rows.  A
+  // single thread takes the stripes in order as they finish instead.
+  unsigned int nthreads = 1;
+  if (!dmnsn_canvas_is_rendering(canvas)) {
+    nthreads = dmnsn_ncpus();
+  }
+  if (nthreads > payload.nstripes) {
+    nthreads = payload.nstripes;
+  }
+
+  int ret;
+  pthread_cleanup_push(dmnsn_png_encode_cleanup, &payload);
+    ret = dmnsn_execute_concurrently(future, dmnsn_png_encode_concurrent, &payload, nthreads);
+  pthread_cleanup_pop(ret != 0);
+
+  if (ret != 0) {
+    return NULL;
+  }
+
+  // Stitch the stripes into a single zlib stream
+  dmnsn_png_stripe *first = &payload.stripes[0];
+  dmnsn_png_stripe *last = &payload.stripes[payload.nstripes - 1];
+
+  uLong adler = first->adler;
+  for (size_t i = 1; i < payload.nstripes; ++i) {
+    dmnsn_png_stripe *stripe = &payload.stripes[i];
+    adler = adler32_combine(adler, stripe->adler, stripe->length);
+  }
+
+  // Deflate, 32K window, default compression
+  static const Bytef header[2] = {0x78, 0x9C};
+  first->data = dmnsn_realloc(first->data, first->size + 2);
+  memmove(first->data + 2, first->data, first->size);
+  memcpy(first->data, header, 2);
+  first->size += 2;
+
+  last->data = dmnsn_realloc(last->data, last->size + 4);
+  for (int i = 0; i < 4; ++i) {
+    last->data[last->size++] = adler >> (24 - 8*i);
+  }
+
+  *nstripes = payload.nstripes;
+  return payload.stripes;
+}
+
 // Write a PNG file
 static int
 dmnsn_png_write_canvas_thread(void *ptr)
@@ -127,10 +494,23 @@ dmnsn_png_write_canvas_thread(void *ptr)
 
   dmnsn_future_set_total(payload->future, height);
 
+  // Check if we can optimize this, by compressing the image in parallel
+  dmnsn_rgba16_optimizer *rgba16 = (dmnsn_rgba16_optimizer *)dmnsn_canvas_find_optimizer(payload->canvas, dmnsn_rgba16_optimizer_fn);
+  dmnsn_png_stripe *stripes = NULL;
+  size_t nstripes = 0;
+  if (rgba16 && width > 0 && height > 0) {
+    stripes = dmnsn_png_encode_stripes(payload->future, payload->canvas, rgba16, &nstripes);
+    if (!stripes) {
+      dmnsn_free(payload);
+      return -1;
+    }
+  }
+
   png_structp png_ptr
     = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png_ptr) {
     // Couldn't create libpng write struct
+    dmnsn_png_delete_stripes(stripes, nstripes);
     dmnsn_free(payload);
     return -1;
   }
@@ -139,16 +519,20 @@ dmnsn_png_write_canvas_thread(void *ptr)
   if (!info_ptr) {
     // Couldn't create libpng info struct
     png_destroy_write_struct(&png_ptr, NULL);
+    dmnsn_png_delete_stripes(stripes, nstripes);
     dmnsn_free(payload);
     return -1;
   }
 
   // libpng will longjmp here if it encounters an error from here on
+  dmnsn_tcolor *tcolors = NULL;
   uint16_t *row = NULL;
   if (setjmp(png_jmpbuf(png_ptr))) {
-    // libpng error
+    // libpng error, or the canvas was abandoned
     dmnsn_free(row);
+    dmnsn_free(tcolors);
     png_destroy_write_struct(&png_ptr, &info_ptr);
+    dmnsn_png_delete_stripes(stripes, nstripes);
     dmnsn_free(payload);
     return -1;
   }
@@ -168,46 +552,35 @@ dmnsn_png_write_canvas_thread(void *ptr)
   // Write the info struct
   png_write_info(png_ptr, info_ptr);
 
-  if (dmnsn_is_little_endian()) {
-    // We are little-endian; swap the byte order of the pixels
-    png_set_swap(png_ptr);
-  }
-
-  // Check if we can optimize this
-  dmnsn_rgba16_optimizer *rgba16 = (dmnsn_rgba16_optimizer *)dmnsn_canvas_find_optimizer(payload->canvas, dmnsn_rgba16_optimizer_fn);
-  if (rgba16) {
-    for (size_t y = 0; y < height; ++y) {
-      // Invert the rows.  PNG coordinates are fourth quadrant.
-      uint16_t *row_opt = rgba16->data + 4*(height - y - 1)*width;
-      png_write_row(png_ptr, (png_bytep)row_opt);
-      dmnsn_future_increment(payload->future);
+  if (stripes) {
+    // The stripes are already a valid zlib stream
+    for (size_t i = 0; i < nstripes; ++i) {
+      png_write_chunk(png_ptr, (png_const_bytep)"IDAT", stripes[i].data, stripes[i].size);
     }
+    png_write_chunk(png_ptr, (png_const_bytep)"IEND", NULL, 0);
 
-    // Finish the PNG file
-    png_write_end(png_ptr, info_ptr);
     png_destroy_write_struct(&png_ptr, &info_ptr);
+    dmnsn_png_delete_stripes(stripes, nstripes);
     dmnsn_free(payload);
     return 0;
   }
 
-  // Allocate the temporary row of RGBA values
+  if (dmnsn_is_little_endian()) {
+    // We are little-endian; swap the byte order of the pixels
+    png_set_swap(png_ptr);
+  }
+
+  // Allocate the temporary rows of pixels and RGBA values
+  tcolors = dmnsn_malloc(width*sizeof(dmnsn_tcolor));
   row = dmnsn_malloc(4*sizeof(uint16_t)*width);
 
   // Write the pixels
   for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width; ++x) {
-      // Invert the rows.  PNG coordinates are fourth quadrant.
-      dmnsn_tcolor tcolor = dmnsn_canvas_get_pixel(payload->canvas,
-                                                   x, height - y - 1);
-      tcolor = dmnsn_tcolor_remove_filter(tcolor);
-      tcolor.c = dmnsn_color_to_sRGB(tcolor.c);
-      tcolor = dmnsn_tcolor_clamp(tcolor);
-
-      row[4*x]     = lround(tcolor.c.R*UINT16_MAX);
-      row[4*x + 1] = lround(tcolor.c.G*UINT16_MAX);
-      row[4*x + 2] = lround(tcolor.c.B*UINT16_MAX);
-      row[4*x + 3] = lround(tcolor.T*UINT16_MAX);
-    }
+    dmnsn_png_wait_row(png_ptr, payload->canvas, height - y - 1, payload->future);
+
+    // Invert the rows.  PNG coordinates are fourth quadrant.
+    const dmnsn_tcolor *span = dmnsn_canvas_read_span(payload->canvas, 0, height - y - 1, width, tcolors);
+    dmnsn_tcolors_to_rgba16(span, width, row);
 
     // Write the row
     png_write_row(png_ptr, (png_bytep)row);
@@ -218,6 +591,7 @@ dmnsn_png_write_canvas_thread(void *ptr)
   png_write_end(png_ptr, info_ptr);
 
   dmnsn_free(row);
+  dmnsn_free(tcolors);
   png_destroy_write_struct(&png_ptr, &info_ptr);
   dmnsn_free(payload);
   return 0;
@@ -272,8 +646,10 @@ dmnsn_png_read_canvas_thread(void *ptr)
   // libpng will longjmp here if it encounters an error from here on
   png_bytep image = NULL;
   png_bytep *row_pointers = NULL;
+  dmnsn_tcolor *canvas_row = NULL;
   if (setjmp(png_jmpbuf(png_ptr))) {
     // libpng error
+    dmnsn_free(canvas_row);
     dmnsn_free(row_pointers);
     dmnsn_free(image);
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
@@ -316,6 +692,11 @@ dmnsn_png_read_canvas_thread(void *ptr)
   }
   png_set_invert_alpha(png_ptr);
 
+  if (dmnsn_is_little_endian()) {
+    // We are little-endian; swap the byte order of 16-bit samples
+    png_set_swap(png_ptr);
+  }
+
   // Update the info struct
   png_read_update_info(png_ptr, info_ptr);
 
@@ -336,54 +717,28 @@ dmnsn_png_read_canvas_thread(void *ptr)
   // use, this handles interlacing for us.
   png_read_image(png_ptr, row_pointers);
 
-  // Allocate the canvas
+  // Allocate the canvas, and a row to build up before setting it
   *payload->canvas = dmnsn_new_canvas(payload->pool, width, height);
+  canvas_row = dmnsn_malloc(width*sizeof(dmnsn_tcolor));
 
   // Now we convert the image to our canvas format.  This depends on the image
   // bit depth (which has been scaled up to at least 8 or 16), and the presence
   // of an alpha channel.
+  png_byte channels = png_get_channels(png_ptr, info_ptr);
+  png_byte depth = png_get_bit_depth(png_ptr, info_ptr);
   for (size_t y = 0; y < height; ++y) {
-    for (size_t x = 0; x < width; ++x) {
-      dmnsn_tcolor tcolor;
-      tcolor.F = 0.0;
-
-      if (color_type & PNG_COLOR_MASK_ALPHA) {
-        if (bit_depth == 16) {
-          png_bytep png_pixel = image + 8*(y*width + x);
-          tcolor.c.R = (double)((png_pixel[0] << 8) + png_pixel[1])/UINT16_MAX;
-          tcolor.c.G = (double)((png_pixel[2] << 8) + png_pixel[3])/UINT16_MAX;
-          tcolor.c.B = (double)((png_pixel[4] << 8) + png_pixel[5])/UINT16_MAX;
-          tcolor.T   = (double)((png_pixel[6] << 8) + png_pixel[7])/UINT16_MAX;
-        } else {
-          png_bytep png_pixel = image + 4*(y*width + x);
-          tcolor.c.R = (double)png_pixel[0]/UINT8_MAX;
-          tcolor.c.G = (double)png_pixel[1]/UINT8_MAX;
-          tcolor.c.B = (double)png_pixel[2]/UINT8_MAX;
-          tcolor.T   = (double)png_pixel[3]/UINT8_MAX;
-        }
-      } else {
-        tcolor.T = 0.0;
-
-        if (bit_depth == 16) {
-          png_bytep png_pixel = image + 6*(y*width + x);
-          tcolor.c.R = (double)((png_pixel[0] << 8) + png_pixel[1])/UINT16_MAX;
-          tcolor.c.G = (double)((png_pixel[2] << 8) + png_pixel[3])/UINT16_MAX;
-          tcolor.c.B = (double)((png_pixel[4] << 8) + png_pixel[5])/UINT16_MAX;
-        } else {
-          png_bytep png_pixel = image + 3*(y*width + x);
-          tcolor.c.R = (double)png_pixel[0]/UINT8_MAX;
-          tcolor.c.G = (double)png_pixel[1]/UINT8_MAX;
-          tcolor.c.B = (double)png_pixel[2]/UINT8_MAX;
-        }
-      }
-
-      tcolor.c = dmnsn_color_from_sRGB(tcolor.c);
-      dmnsn_canvas_set_pixel(*payload->canvas, x, height - y - 1, tcolor);
+    png_bytep png_row = image + y*rowbytes;
+    if (depth == 16) {
+      dmnsn_rgba16_to_tcolors((const uint16_t *)png_row, width, channels, canvas_row);
+    } else {
+      dmnsn_rgba8_to_tcolors(png_row, width, channels, canvas_row);
     }
 
+    dmnsn_canvas_set_row(*payload->canvas, height - y - 1, canvas_row);
     dmnsn_future_increment(payload->future);
   }
 
+  dmnsn_free(canvas_row);
   dmnsn_free(row_pointers);
   dmnsn_free(image);
   png_read_end(png_ptr, NULL);
@@ -23,9 +23,18 @@
  * 16-bit RGBA canvas optimizer.
  */
 
+#include "internal/canvas.h"
+#include "internal/concurrency.h"
 #include "internal/rgba.h"
+#include <math.h>
 #include <stdint.h>
 
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
 void
 dmnsn_rgba8_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas)
 {
@@ -39,6 +48,7 @@ dmnsn_rgba8_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas)
   dmnsn_canvas_optimizer *optimizer = &rgba8->optimizer;
   dmnsn_init_canvas_optimizer(optimizer);
   optimizer->optimizer_fn = dmnsn_rgba8_optimizer_fn;
+  optimizer->span_optimizer_fn = dmnsn_rgba8_span_optimizer_fn;
 
   dmnsn_canvas_optimize(canvas, optimizer);
 }
@@ -56,6 +66,7 @@ dmnsn_rgba16_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas)
   dmnsn_canvas_optimizer *optimizer = &rgba16->optimizer;
   dmnsn_init_canvas_optimizer(optimizer);
   optimizer->optimizer_fn = dmnsn_rgba16_optimizer_fn;
+  optimizer->span_optimizer_fn = dmnsn_rgba16_span_optimizer_fn;
 
   dmnsn_canvas_optimize(canvas, optimizer);
 }
@@ -63,33 +74,317 @@ dmnsn_rgba16_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas)
 void
 dmnsn_rgba8_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y)
 {
-  dmnsn_rgba8_optimizer *rgba8 = (dmnsn_rgba8_optimizer *)optimizer;
+  dmnsn_rgba8_span_optimizer_fn(optimizer, canvas, x, y, 1);
+}
 
-  uint8_t *pixel = rgba8->data + 4*(y*canvas->width + x);
-  dmnsn_tcolor tcolor = dmnsn_canvas_get_pixel(canvas, x, y);
-  tcolor = dmnsn_tcolor_remove_filter(tcolor);
-  tcolor.c = dmnsn_color_to_sRGB(tcolor.c);
-  tcolor = dmnsn_tcolor_clamp(tcolor);
+void
+dmnsn_rgba16_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y)
+{
+  dmnsn_rgba16_span_optimizer_fn(optimizer, canvas, x, y, 1);
+}
 
-  pixel[0] = lround(tcolor.c.R*UINT8_MAX);
-  pixel[1] = lround(tcolor.c.G*UINT8_MAX);
-  pixel[2] = lround(tcolor.c.B*UINT8_MAX);
-  pixel[3] = lround(tcolor.T*UINT8_MAX);
+void
+dmnsn_rgba8_span_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y, size_t n)
+{
+  dmnsn_rgba8_optimizer *rgba8 = (dmnsn_rgba8_optimizer *)optimizer;
+  dmnsn_tcolor buffer[DMNSN_CANVAS_SPAN];
+  for (size_t i = 0, m; i < n; i += m) {
+    m = n - i < DMNSN_CANVAS_SPAN ? n - i : DMNSN_CANVAS_SPAN;
+    const dmnsn_tcolor *tcolors = dmnsn_canvas_read_span(canvas, x + i, y, m, buffer);
+    dmnsn_tcolors_to_rgba8(tcolors, m, rgba8->data + 4*(y*canvas->width + x + i));
+  }
 }
 
 void
-dmnsn_rgba16_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y)
+dmnsn_rgba16_span_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y, size_t n)
 {
   dmnsn_rgba16_optimizer *rgba16 = (dmnsn_rgba16_optimizer *)optimizer;
+  dmnsn_tcolor buffer[DMNSN_CANVAS_SPAN];
+  for (size_t i = 0, m; i < n; i += m) {
+    m = n - i < DMNSN_CANVAS_SPAN ? n - i : DMNSN_CANVAS_SPAN;
+    const dmnsn_tcolor *tcolors = dmnsn_canvas_read_span(canvas, x + i, y, m, buffer);
+    dmnsn_tcolors_to_rgba16(tcolors, m, rgba16->data + 4*(y*canvas->width + x + i));
+  }
+}
+
+/////////////////////////////
+// sRGB conversion kernels //
+/////////////////////////////
+
+/// The resolution of the gamma table.
+#define DMNSN_SRGB_TABLE_SIZE 1024
+
+/**
+ * The sRGB gamma curve, sampled at the squares of evenly spaced points.
+ * Indexing by sqrt(C) spreads the samples out where the curve bends the
+ * most, near 0.
+ */
+static double dmnsn_sRGB_gamma_table[DMNSN_SRGB_TABLE_SIZE + 1];
+/// Once control for dmnsn_sRGB_gamma_table.
+static pthread_once_t dmnsn_sRGB_gamma_once = PTHREAD_ONCE_INIT;
+
+/// Exact inverse gamma for every 8-bit value.
+static double dmnsn_sRGB8_inverse_table[UINT8_MAX + 1];
+/// Exact inverse gamma for every 16-bit value.
+static double dmnsn_sRGB16_inverse_table[UINT16_MAX + 1];
+/// Once control for the inverse gamma tables.
+static pthread_once_t dmnsn_sRGB_inverse_once = PTHREAD_ONCE_INIT;
+
+/// Fill in dmnsn_sRGB_gamma_table.
+static void
+dmnsn_initialize_sRGB_gamma(void)
+{
+  for (size_t i = 0; i <= DMNSN_SRGB_TABLE_SIZE; ++i) {
+    double t = (double)i/DMNSN_SRGB_TABLE_SIZE;
+    // Use the power curve even below the linear segment's threshold, so the
+    // cell that straddles it interpolates a smooth function
+    dmnsn_sRGB_gamma_table[i] = 1.055*pow(t*t, 1.0/2.4) - 0.055;
+  }
+}
+
+/// Fill in the inverse gamma tables.
+static void
+dmnsn_initialize_sRGB_inverse(void)
+{
+  for (size_t i = 0; i <= UINT8_MAX; ++i) {
+    dmnsn_sRGB8_inverse_table[i] = dmnsn_sRGB_inverse_gamma((double)i/UINT8_MAX);
+  }
+  for (size_t i = 0; i <= UINT16_MAX; ++i) {
+    dmnsn_sRGB16_inverse_table[i] = dmnsn_sRGB_inverse_gamma((double)i/UINT16_MAX);
+  }
+}
+
+/// Apply the sRGB gamma to a channel, and scale it to [0, max].
+static inline double
+dmnsn_sRGB_encode(double Clinear, double max)
+{
+  Clinear = dmnsn_clamp(Clinear, 0.0, 1.0);
+
+  double CsRGB;
+  if (Clinear <= 0.0031308) {
+    CsRGB = 12.92*Clinear;
+  } else {
+    double t = sqrt(Clinear)*DMNSN_SRGB_TABLE_SIZE;
+    size_t i = t;
+    if (i >= DMNSN_SRGB_TABLE_SIZE) {
+      i = DMNSN_SRGB_TABLE_SIZE - 1;
+    }
+    double lo = dmnsn_sRGB_gamma_table[i], hi = dmnsn_sRGB_gamma_table[i + 1];
+    CsRGB = lo + (t - i)*(hi - lo);
+  }
+
+  // Round to nearest; cheaper than lround() for non-negative values
+  return CsRGB*max + 0.5;
+}
+
+// The vectorized kernels encode a few pixels at once, one channel per vector,
+// and give exactly the same results as the scalar loops below.
+
+#if defined(__AVX2__)
+
+/// The number of pixels dmnsn_sRGB_encode_pixels() encodes at once.
+#define DMNSN_SRGB_LANES 4
 
-  uint16_t *pixel = rgba16->data + 4*(y*canvas->width + x);
-  dmnsn_tcolor tcolor = dmnsn_canvas_get_pixel(canvas, x, y);
-  tcolor = dmnsn_tcolor_remove_filter(tcolor);
-  tcolor.c = dmnsn_color_to_sRGB(tcolor.c);
-  tcolor = dmnsn_tcolor_clamp(tcolor);
+/// Clamp each lane to [0, 1].  Like dmnsn_clamp(), this turns NaN into 0.
+static inline __m256d
+dmnsn_sRGB_clamp_pd(__m256d C)
+{
+  return _mm256_min_pd(_mm256_max_pd(C, _mm256_setzero_pd()), _mm256_set1_pd(1.0));
+}
+
+/// dmnsn_sRGB_encode() for each lane.
+static inline __m128i
+dmnsn_sRGB_encode_pd(__m256d Clinear, double max)
+{
+  __m256d t = _mm256_mul_pd(_mm256_sqrt_pd(Clinear), _mm256_set1_pd(DMNSN_SRGB_TABLE_SIZE));
+  __m128i i = _mm_min_epi32(_mm256_cvttpd_epi32(t), _mm_set1_epi32(DMNSN_SRGB_TABLE_SIZE - 1));
+  __m256d lo = _mm256_i32gather_pd(dmnsn_sRGB_gamma_table, i, sizeof(double));
+  __m256d hi = _mm256_i32gather_pd(dmnsn_sRGB_gamma_table + 1, i, sizeof(double));
+  __m256d frac = _mm256_sub_pd(t, _mm256_cvtepi32_pd(i));
+  __m256d CsRGB = _mm256_add_pd(lo, _mm256_mul_pd(frac, _mm256_sub_pd(hi, lo)));
+
+  __m256d linear = _mm256_mul_pd(Clinear, _mm256_set1_pd(12.92));
+  __m256d is_linear = _mm256_cmp_pd(Clinear, _mm256_set1_pd(0.0031308), _CMP_LE_OQ);
+  CsRGB = _mm256_blendv_pd(CsRGB, linear, is_linear);
+
+  CsRGB = _mm256_add_pd(_mm256_mul_pd(CsRGB, _mm256_set1_pd(max)), _mm256_set1_pd(0.5));
+  return _mm256_cvttpd_epi32(CsRGB);
+}
+
+/// Scale and round each lane of a linear channel.
+static inline __m128i
+dmnsn_linear_encode_pd(__m256d C, double max)
+{
+  C = _mm256_add_pd(_mm256_mul_pd(C, _mm256_set1_pd(max)), _mm256_set1_pd(0.5));
+  return _mm256_cvttpd_epi32(C);
+}
+
+/// Encode DMNSN_SRGB_LANES pixels, scaling each channel to [0, max].
+static inline void
+dmnsn_sRGB_encode_pixels(const dmnsn_tcolor *tcolors, double max, int32_t *rgba)
+{
+  dmnsn_tcolor a = dmnsn_tcolor_remove_filter(tcolors[0]);
+  dmnsn_tcolor b = dmnsn_tcolor_remove_filter(tcolors[1]);
+  dmnsn_tcolor c = dmnsn_tcolor_remove_filter(tcolors[2]);
+  dmnsn_tcolor d = dmnsn_tcolor_remove_filter(tcolors[3]);
 
-  pixel[0] = lround(tcolor.c.R*UINT16_MAX);
-  pixel[1] = lround(tcolor.c.G*UINT16_MAX);
-  pixel[2] = lround(tcolor.c.B*UINT16_MAX);
-  pixel[3] = lround(tcolor.T*UINT16_MAX);
+  __m128i R = dmnsn_sRGB_encode_pd(dmnsn_sRGB_clamp_pd(_mm256_set_pd(d.c.R, c.c.R, b.c.R, a.c.R)), max);
+  __m128i G = dmnsn_sRGB_encode_pd(dmnsn_sRGB_clamp_pd(_mm256_set_pd(d.c.G, c.c.G, b.c.G, a.c.G)), max);
+  __m128i B = dmnsn_sRGB_encode_pd(dmnsn_sRGB_clamp_pd(_mm256_set_pd(d.c.B, c.c.B, b.c.B, a.c.B)), max);
+  __m128i T = dmnsn_linear_encode_pd(dmnsn_sRGB_clamp_pd(_mm256_set_pd(d.T, c.T, b.T, a.T)), max);
+
+  // Transpose back to RGBA order
+  __m128i RG_lo = _mm_unpacklo_epi32(R, G), RG_hi = _mm_unpackhi_epi32(R, G);
+  __m128i BT_lo = _mm_unpacklo_epi32(B, T), BT_hi = _mm_unpackhi_epi32(B, T);
+  _mm_storeu_si128((__m128i *)rgba, _mm_unpacklo_epi64(RG_lo, BT_lo));
+  _mm_storeu_si128((__m128i *)(rgba + 4), _mm_unpackhi_epi64(RG_lo, BT_lo));
+  _mm_storeu_si128((__m128i *)(rgba + 8), _mm_unpacklo_epi64(RG_hi, BT_hi));
+  _mm_storeu_si128((__m128i *)(rgba + 12), _mm_unpackhi_epi64(RG_hi, BT_hi));
+}
+
+#elif defined(__SSE2__)
+
+/// The number of pixels dmnsn_sRGB_encode_pixels() encodes at once.
+#define DMNSN_SRGB_LANES 2
+
+/// Clamp each lane to [0, 1].  Like dmnsn_clamp(), this turns NaN into 0.
+static inline __m128d
+dmnsn_sRGB_clamp_pd(__m128d C)
+{
+  return _mm_min_pd(_mm_max_pd(C, _mm_setzero_pd()), _mm_set1_pd(1.0));
+}
+
+/// dmnsn_sRGB_encode() for each lane.
+static inline __m128i
+dmnsn_sRGB_encode_pd(__m128d Clinear, double max)
+{
+  __m128d t = _mm_mul_pd(_mm_sqrt_pd(Clinear), _mm_set1_pd(DMNSN_SRGB_TABLE_SIZE));
+  // SSE2 has no 32-bit min, but the indices fit in 16 bits
+  __m128i i = _mm_min_epi16(_mm_cvttpd_epi32(t), _mm_set1_epi32(DMNSN_SRGB_TABLE_SIZE - 1));
+
+  // There are no gathers either, so look the table up one lane at a time
+  int i0 = _mm_cvtsi128_si32(i), i1 = _mm_cvtsi128_si32(_mm_shuffle_epi32(i, 1));
+  __m128d lo = _mm_set_pd(dmnsn_sRGB_gamma_table[i1], dmnsn_sRGB_gamma_table[i0]);
+  __m128d hi = _mm_set_pd(dmnsn_sRGB_gamma_table[i1 + 1], dmnsn_sRGB_gamma_table[i0 + 1]);
+  __m128d frac = _mm_sub_pd(t, _mm_cvtepi32_pd(i));
+  __m128d CsRGB = _mm_add_pd(lo, _mm_mul_pd(frac, _mm_sub_pd(hi, lo)));
+
+  __m128d linear = _mm_mul_pd(Clinear, _mm_set1_pd(12.92));
+  __m128d is_linear = _mm_cmple_pd(Clinear, _mm_set1_pd(0.0031308));
+  CsRGB = _mm_or_pd(_mm_and_pd(is_linear, linear), _mm_andnot_pd(is_linear, CsRGB));
+
+  CsRGB = _mm_add_pd(_mm_mul_pd(CsRGB, _mm_set1_pd(max)), _mm_set1_pd(0.5));
+  return _mm_cvttpd_epi32(CsRGB);
+}
+
+/// Scale and round each lane of a linear channel.
+static inline __m128i
+dmnsn_linear_encode_pd(__m128d C, double max)
+{
+  C = _mm_add_pd(_mm_mul_pd(C, _mm_set1_pd(max)), _mm_set1_pd(0.5));
+  return _mm_cvttpd_epi32(C);
+}
+
+/// Encode DMNSN_SRGB_LANES pixels, scaling each channel to [0, max].
+static inline void
+dmnsn_sRGB_encode_pixels(const dmnsn_tcolor *tcolors, double max, int32_t *rgba)
+{
+  dmnsn_tcolor a = dmnsn_tcolor_remove_filter(tcolors[0]);
+  dmnsn_tcolor b = dmnsn_tcolor_remove_filter(tcolors[1]);
+
+  __m128i R = dmnsn_sRGB_encode_pd(dmnsn_sRGB_clamp_pd(_mm_set_pd(b.c.R, a.c.R)), max);
+  __m128i G = dmnsn_sRGB_encode_pd(dmnsn_sRGB_clamp_pd(_mm_set_pd(b.c.G, a.c.G)), max);
+  __m128i B = dmnsn_sRGB_encode_pd(dmnsn_sRGB_clamp_pd(_mm_set_pd(b.c.B, a.c.B)), max);
+  __m128i T = dmnsn_linear_encode_pd(dmnsn_sRGB_clamp_pd(_mm_set_pd(b.T, a.T)), max);
+
+  // Transpose back to RGBA order
+  __m128i RG = _mm_unpacklo_epi32(R, G), BT = _mm_unpacklo_epi32(B, T);
+  _mm_storeu_si128((__m128i *)rgba, _mm_unpacklo_epi64(RG, BT));
+  _mm_storeu_si128((__m128i *)(rgba + 4), _mm_unpackhi_epi64(RG, BT));
+}
+
+#endif
+
+void
+dmnsn_tcolors_to_rgba8(const dmnsn_tcolor *tcolors, size_t n, uint8_t *rgba)
+{
+  dmnsn_once(&dmnsn_sRGB_gamma_once, dmnsn_initialize_sRGB_gamma);
+
+  size_t i = 0;
+#ifdef DMNSN_SRGB_LANES
+  for (; i + DMNSN_SRGB_LANES <= n; i += DMNSN_SRGB_LANES, rgba += 4*DMNSN_SRGB_LANES) {
+    int32_t pixels[4*DMNSN_SRGB_LANES];
+    dmnsn_sRGB_encode_pixels(tcolors + i, UINT8_MAX, pixels);
+    for (size_t j = 0; j < 4*DMNSN_SRGB_LANES; ++j) {
+      rgba[j] = pixels[j];
+    }
+  }
+#endif
+
+  for (; i < n; ++i, rgba += 4) {
+    dmnsn_tcolor tcolor = dmnsn_tcolor_remove_filter(tcolors[i]);
+    rgba[0] = dmnsn_sRGB_encode(tcolor.c.R, UINT8_MAX);
+    rgba[1] = dmnsn_sRGB_encode(tcolor.c.G, UINT8_MAX);
+    rgba[2] = dmnsn_sRGB_encode(tcolor.c.B, UINT8_MAX);
+    rgba[3] = dmnsn_clamp(tcolor.T, 0.0, 1.0)*UINT8_MAX + 0.5;
+  }
+}
+
+void
+dmnsn_tcolors_to_rgba16(const dmnsn_tcolor *tcolors, size_t n, uint16_t *rgba)
+{
+  dmnsn_once(&dmnsn_sRGB_gamma_once, dmnsn_initialize_sRGB_gamma);
+
+  size_t i = 0;
+#ifdef DMNSN_SRGB_LANES
+  for (; i + DMNSN_SRGB_LANES <= n; i += DMNSN_SRGB_LANES, rgba += 4*DMNSN_SRGB_LANES) {
+    int32_t pixels[4*DMNSN_SRGB_LANES];
+    dmnsn_sRGB_encode_pixels(tcolors + i, UINT16_MAX, pixels);
+    for (size_t j = 0; j < 4*DMNSN_SRGB_LANES; ++j) {
+      rgba[j] = pixels[j];
+    }
+  }
+#endif
+
+  for (; i < n; ++i, rgba += 4) {
+    dmnsn_tcolor tcolor = dmnsn_tcolor_remove_filter(tcolors[i]);
+    rgba[0] = dmnsn_sRGB_encode(tcolor.c.R, UINT16_MAX);
+    rgba[1] = dmnsn_sRGB_encode(tcolor.c.G, UINT16_MAX);
+    rgba[2] = dmnsn_sRGB_encode(tcolor.c.B, UINT16_MAX);
+    rgba[3] = dmnsn_clamp(tcolor.T, 0.0, 1.0)*UINT16_MAX + 0.5;
+  }
+}
+
+void
+dmnsn_rgba8_to_tcolors(const uint8_t *rgba, size_t n, unsigned int channels, dmnsn_tcolor *tcolors)
+{
+  dmnsn_assert(channels == 3 || channels == 4, "Invalid number of channels.");
+  dmnsn_once(&dmnsn_sRGB_inverse_once, dmnsn_initialize_sRGB_inverse);
+
+  for (size_t i = 0; i < n; ++i, rgba += channels) {
+    tcolors[i] = dmnsn_new_tcolor5(
+      dmnsn_sRGB8_inverse_table[rgba[0]],
+      dmnsn_sRGB8_inverse_table[rgba[1]],
+      dmnsn_sRGB8_inverse_table[rgba[2]],
+      channels == 4 ? (double)rgba[3]/UINT8_MAX : 0.0,
+      0.0
+    );
+  }
+}
+
+void
+dmnsn_rgba16_to_tcolors(const uint16_t *rgba, size_t n, unsigned int channels, dmnsn_tcolor *tcolors)
+{
+  dmnsn_assert(channels == 3 || channels == 4, "Invalid number of channels.");
+  dmnsn_once(&dmnsn_sRGB_inverse_once, dmnsn_initialize_sRGB_inverse);
+
+  for (size_t i = 0; i < n; ++i, rgba += channels) {
+    tcolors[i] = dmnsn_new_tcolor5(
+      dmnsn_sRGB16_inverse_table[rgba[0]],
+      dmnsn_sRGB16_inverse_table[rgba[1]],
+      dmnsn_sRGB16_inverse_table[rgba[2]],
+      channels == 4 ? (double)rgba[3]/UINT16_MAX : 0.0,
+      0.0
+    );
+  }
 }
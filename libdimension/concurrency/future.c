@@ -40,8 +40,12 @@ dmnsn_future *
 dmnsn_new_future(void)
 {
   dmnsn_future *future = DMNSN_MALLOC(dmnsn_future);
-  future->progress = 0;
-  future->total    = 1;
+  atomic_init(&future->progress, 0);
+  atomic_init(&future->total, 1);
+  atomic_init(&future->flags, 0);
+
+  future->finished = false;
+  future->retval   = -1;
 
   dmnsn_initialize_mutex(&future->mutex);
   dmnsn_initialize_cond(&future->cond);
@@ -54,6 +58,17 @@ dmnsn_new_future(void)
   dmnsn_initialize_cond(&future->all_running_cond);
   dmnsn_initialize_cond(&future->resume_cond);
 
+  future->notifiers = NULL;
+  future->cancel_notifiers = NULL;
+  future->parent = NULL;
+
+  future->first = NULL;
+  future->second = NULL;
+  future->continuation = NULL;
+  future->continuation_ptr = NULL;
+  future->paused_stage = NULL;
+  future->nstages = 1;
+
   return future;
 }
 
@@ -70,21 +85,39 @@ dmnsn_delete_future(dmnsn_future *future)
   }
 }
 
-// Join the worker thread and delete `future'.
+/// Wait for the background task to finish, and get its return value.
+static int
+dmnsn_future_wait_finished(const dmnsn_future *future)
+{
+  dmnsn_future *mfuture = MUTATE(future);
+  int retval;
+
+  dmnsn_lock_mutex(&mfuture->mutex);
+    while (!mfuture->finished) {
+      dmnsn_cond_wait(&mfuture->cond, &mfuture->mutex);
+    }
+    retval = mfuture->retval;
+  dmnsn_unlock_mutex(&mfuture->mutex);
+
+  return retval;
+}
+
+// Wait for the background task and delete `future'.
 int
 dmnsn_future_join(dmnsn_future *future)
 {
-  void *ptr;
   int retval = -1;
 
   if (future) {
     dmnsn_assert(future->npaused == 0, "Attempt to join future while paused");
 
-    // Get the thread's return value
-    dmnsn_join_thread(future->thread, &ptr);
-    if (ptr && ptr != PTHREAD_CANCELED) {
-      retval = *(int *)ptr;
-      dmnsn_free(ptr);
+    // Wait for the task to finish and get its return value
+    retval = dmnsn_future_wait_finished(future);
+
+    // Free the stages of a chain; they're finished already
+    if (future->first) {
+      dmnsn_future_join(future->first);
+      dmnsn_future_join(future->second);
     }
 
     // Free the future object
@@ -94,50 +127,169 @@ dmnsn_future_join(dmnsn_future *future)
   return retval;
 }
 
-// Cancel a background thread
+/// Wake up every thread in a list of notifiers.
+static void
+dmnsn_future_notify(dmnsn_future_notifier *notifiers)
+{
+  for (dmnsn_future_notifier *notifier = notifiers; notifier; notifier = notifier->next) {
+    dmnsn_lock_mutex(notifier->mutex);
+      *notifier->notified = true;
+      dmnsn_cond_broadcast(notifier->cond);
+    dmnsn_unlock_mutex(notifier->mutex);
+  }
+}
+
+/// Remove a notifier from a list.
+static void
+dmnsn_future_remove_notifier(dmnsn_future_notifier **list, dmnsn_future_notifier *notifier)
+{
+  for (dmnsn_future_notifier **i = list; *i; i = &(*i)->next) {
+    if (*i == notifier) {
+      *i = notifier->next;
+      break;
+    }
+  }
+}
+
+// Cancel a background task
 void
 dmnsn_future_cancel(dmnsn_future *future)
 {
-  pthread_cancel(future->thread);
+  dmnsn_future *stage = NULL;
+
+  dmnsn_lock_mutex(&future->mutex);
+    atomic_fetch_or(&future->flags, DMNSN_FUTURE_CANCELLED);
+    // Wake up anyone waiting on paused threads so they notice the cancellation
+    dmnsn_cond_broadcast(&future->resume_cond);
+    dmnsn_cond_broadcast(&future->none_running_cond);
+    dmnsn_cond_broadcast(&future->all_running_cond);
+    dmnsn_future_notify(future->cancel_notifiers);
+
+    if (future->first && !future->finished) {
+      stage = future->second ? future->second : future->first;
+    }
+  dmnsn_unlock_mutex(&future->mutex);
+
+  // Stages live until the chain is joined
+  if (stage) {
+    dmnsn_future_cancel(stage);
+  }
+}
+
+bool
+dmnsn_future_watch_cancel(dmnsn_future *future, dmnsn_future_notifier *notifier)
+{
+  bool cancelled;
+  dmnsn_lock_mutex(&future->mutex);
+    cancelled = atomic_load(&future->flags) & DMNSN_FUTURE_CANCELLED;
+    if (!cancelled) {
+      notifier->next = future->cancel_notifiers;
+      future->cancel_notifiers = notifier;
+    }
+  dmnsn_unlock_mutex(&future->mutex);
+  return cancelled;
 }
 
-/**
- * Get the current progress, without locking anything.
- *
- * future->mutex must be locked for this call to be safe.
- */
+void
+dmnsn_future_unwatch_cancel(dmnsn_future *future, dmnsn_future_notifier *notifier)
+{
+  dmnsn_lock_mutex(&future->mutex);
+    dmnsn_future_remove_notifier(&future->cancel_notifiers, notifier);
+  dmnsn_unlock_mutex(&future->mutex);
+}
+
+/// Get the current progress, without locking anything.
 static inline double
 dmnsn_future_progress_unlocked(const dmnsn_future *future)
 {
-  return (double)future->progress/future->total;
+  dmnsn_future *mfuture = MUTATE(future);
+  size_t progress = atomic_load(&mfuture->progress);
+  size_t total = atomic_load_explicit(&mfuture->total, memory_order_relaxed);
+  return (double)progress/total;
 }
 
-// Get the current progress of the worker thread, in [0.0, 1.0]
-double
-dmnsn_future_progress(const dmnsn_future *future)
+/// Get the progress of a chain, as a number of stages.
+static double
+dmnsn_future_chain_progress(const dmnsn_future *future)
 {
   dmnsn_future *mfuture = MUTATE(future);
-  double progress;
+  bool finished;
+  dmnsn_future *second;
 
   dmnsn_lock_mutex(&mfuture->mutex);
-    progress = dmnsn_future_progress_unlocked(mfuture);
+    finished = mfuture->finished;
+    second = mfuture->second;
   dmnsn_unlock_mutex(&mfuture->mutex);
 
+  if (finished) {
+    return future->nstages;
+  }
+
+  double progress = future->first->nstages*dmnsn_future_progress(future->first);
+  if (second) {
+    progress += dmnsn_future_progress(second);
+  }
   return progress;
 }
 
+// Get the current progress of the worker thread, in [0.0, 1.0]
+double
+dmnsn_future_progress(const dmnsn_future *future)
+{
+  if (future->first) {
+    return dmnsn_future_chain_progress(future)/future->nstages;
+  } else {
+    return dmnsn_future_progress_unlocked(future);
+  }
+}
+
 // Find out whether the task is complete.
 bool
 dmnsn_future_is_done(const dmnsn_future *future)
 {
   dmnsn_future *mfuture = MUTATE(future);
-  bool result;
 
+  if (future->first) {
+    bool finished;
+    dmnsn_lock_mutex(&mfuture->mutex);
+      finished = mfuture->finished;
+    dmnsn_unlock_mutex(&mfuture->mutex);
+    return finished;
+  }
+
+  size_t progress = atomic_load(&mfuture->progress);
+  size_t total = atomic_load_explicit(&mfuture->total, memory_order_relaxed);
+  return progress == total;
+}
+
+/// Wait for a certain amount of progress on a chain.
+static void
+dmnsn_future_chain_wait(const dmnsn_future *future, double progress)
+{
+  dmnsn_future *mfuture = MUTATE(future);
+
+  // Progress in units of stages
+  double stages = progress*future->nstages;
+  double first_stages = future->first->nstages;
+
+  double first_progress = stages/first_stages;
+  dmnsn_future_wait(future->first, first_progress < 1.0 ? first_progress : 1.0);
+  if (stages <= first_stages) {
+    return;
+  }
+
+  // Wait for the second stage to start
+  dmnsn_future *second;
   dmnsn_lock_mutex(&mfuture->mutex);
-    result = future->progress == future->total;
+    while (!mfuture->second && !mfuture->finished) {
+      dmnsn_cond_wait(&mfuture->cond, &mfuture->mutex);
+    }
+    second = mfuture->second;
   dmnsn_unlock_mutex(&mfuture->mutex);
 
-  return result;
+  if (second) {
+    dmnsn_future_wait(second, stages - first_stages);
+  }
 }
 
 // Wait until dmnsn_future_progress(future) >= progress
@@ -146,6 +298,11 @@ dmnsn_future_wait(const dmnsn_future *future, double progress)
 {
   dmnsn_future *mfuture = MUTATE(future);
 
+  if (future->first) {
+    dmnsn_future_chain_wait(future, progress);
+    return;
+  }
+
   dmnsn_lock_mutex(&mfuture->mutex);
     while (dmnsn_future_progress_unlocked(mfuture) < progress) {
       // Set the minimum waited-on value
@@ -153,22 +310,53 @@ dmnsn_future_wait(const dmnsn_future *future, double progress)
         mfuture->min_wait = progress;
       }
 
-      dmnsn_cond_wait_safely(&mfuture->cond, &mfuture->mutex);
+      // Ask the workers to wake us up, then check again in case they
+      // incremented before they could see the flag
+      atomic_fetch_or(&mfuture->flags, DMNSN_FUTURE_WAITING);
+      if (dmnsn_future_progress_unlocked(mfuture) >= progress) {
+        break;
+      }
+
+      dmnsn_cond_wait(&mfuture->cond, &mfuture->mutex);
     }
   dmnsn_unlock_mutex(&mfuture->mutex);
 }
 
+/// Whether a future's task has been cancelled.
+static inline bool
+dmnsn_future_is_cancelled(const dmnsn_future *future)
+{
+  unsigned int flags = atomic_load_explicit(&MUTATE(future)->flags, memory_order_relaxed);
+  return flags & DMNSN_FUTURE_CANCELLED;
+}
+
 // Pause all threads working on a future.
 void
 dmnsn_future_pause(dmnsn_future *future)
 {
+  if (future->first) {
+    // Pause whichever stage is running
+    dmnsn_future *stage;
+    dmnsn_lock_mutex(&future->mutex);
+      if (future->npaused++ == 0) {
+        future->paused_stage = future->second ? future->second : future->first;
+      }
+      stage = future->paused_stage;
+    dmnsn_unlock_mutex(&future->mutex);
+
+    dmnsn_future_pause(stage);
+    return;
+  }
+
   dmnsn_lock_mutex(&future->mutex);
-    while (future->nrunning < future->nthreads) {
-      dmnsn_cond_wait_safely(&future->all_running_cond, &future->mutex);
+    while (future->nrunning < future->nthreads && !dmnsn_future_is_cancelled(future)) {
+      dmnsn_cond_wait(&future->all_running_cond, &future->mutex);
+    }
+    if (future->npaused++ == 0) {
+      atomic_fetch_or(&future->flags, DMNSN_FUTURE_PAUSED);
     }
-    ++future->npaused;
-    while (future->nrunning > 0) {
-      dmnsn_cond_wait_safely(&future->none_running_cond, &future->mutex);
+    while (future->nrunning > 0 && !dmnsn_future_is_cancelled(future)) {
+      dmnsn_cond_wait(&future->none_running_cond, &future->mutex);
     }
   dmnsn_unlock_mutex(&future->mutex);
 }
@@ -177,9 +365,24 @@ dmnsn_future_pause(dmnsn_future *future)
 void
 dmnsn_future_resume(dmnsn_future *future)
 {
+  if (future->first) {
+    dmnsn_future *stage;
+    dmnsn_lock_mutex(&future->mutex);
+      dmnsn_assert(future->npaused > 0, "dmnsn_future_resume() without matching dmnsn_future_pause()");
+      stage = future->paused_stage;
+      if (--future->npaused == 0) {
+        future->paused_stage = NULL;
+      }
+    dmnsn_unlock_mutex(&future->mutex);
+
+    dmnsn_future_resume(stage);
+    return;
+  }
+
   dmnsn_lock_mutex(&future->mutex);
     dmnsn_assert(future->npaused > 0, "dmnsn_future_resume() without matching dmnsn_future_pause()");
     if (--future->npaused == 0) {
+      atomic_fetch_and(&future->flags, ~DMNSN_FUTURE_PAUSED);
       dmnsn_cond_broadcast(&future->resume_cond);
     }
   dmnsn_unlock_mutex(&future->mutex);
@@ -189,34 +392,80 @@ dmnsn_future_resume(dmnsn_future *future)
 void
 dmnsn_future_set_total(dmnsn_future *future, size_t total)
 {
-  dmnsn_lock_mutex(&future->mutex);
-    future->total = total;
-  dmnsn_unlock_mutex(&future->mutex);
+  atomic_store(&future->total, total);
 }
 
+/// Exit the calling thread if its task has been cancelled.
+static inline void
+dmnsn_future_testcancel(dmnsn_future *future)
+{
+  if (dmnsn_future_is_cancelled(future)) {
+    // Worker threads are pooled, so we can't use pthread_cancel(), but
+    // pthread_exit() unwinds the same cleanup handlers
+    pthread_exit(PTHREAD_CANCELED);
+  }
+}
+
+/**
+ * The number of batches a thread splits the progress into.  This bounds the
+ * progress that dmnsn_future_progress() can miss to 1/1024 of the total per
+ * worker thread.
+ */
+#define DMNSN_FUTURE_BATCHES 1024
+/// The most increments a thread will sit on, so progress keeps moving.
+#define DMNSN_FUTURE_MAX_BATCH 256
+
+/// Progress made by the calling thread but not yet published.
+static __thread struct {
+  dmnsn_future *future; ///< The future being incremented.
+  size_t pending;       ///< Unpublished increments.
+  size_t batch;         ///< How many increments to accumulate.
+} dmnsn_tl_progress;
+
+/// Start batching increments to a future.
 static void
-dmnsn_future_increment_cleanup(void *ptr)
+dmnsn_future_start_batch(dmnsn_future *future)
 {
-  dmnsn_future *future = ptr;
-  ++future->nrunning;
-  dmnsn_unlock_mutex_impl(&future->mutex);
+  size_t total = atomic_load_explicit(&future->total, memory_order_relaxed);
+  dmnsn_tl_progress.future = future;
+  dmnsn_tl_progress.pending = 0;
+  dmnsn_tl_progress.batch = total/DMNSN_FUTURE_BATCHES;
+  if (dmnsn_tl_progress.batch == 0) {
+    dmnsn_tl_progress.batch = 1;
+  } else if (dmnsn_tl_progress.batch > DMNSN_FUTURE_MAX_BATCH) {
+    dmnsn_tl_progress.batch = DMNSN_FUTURE_MAX_BATCH;
+  }
 }
 
-// Increment the number of completed loop iterations
-void
-dmnsn_future_increment(dmnsn_future *future)
+/// Add the calling thread's pending increments to its future.
+static inline void
+dmnsn_future_publish(void)
 {
+  if (dmnsn_tl_progress.pending > 0) {
+    atomic_fetch_add(&dmnsn_tl_progress.future->progress, dmnsn_tl_progress.pending);
+    dmnsn_tl_progress.pending = 0;
+  }
+}
+
+/// Handle the flags raised on a future.
+static void
+dmnsn_future_increment_slow(dmnsn_future *future)
+{
+  // Anyone who raised a flag wants to see accurate progress
+  dmnsn_future_publish();
+
   // Allow a thread to be canceled whenever it increments a future object --
   // this is close to PTHREAD_CANCEL_ASYNCHRONOUS but allows consistent state
   // on cancellation
-  pthread_testcancel();
+  dmnsn_future_testcancel(future);
 
   dmnsn_lock_mutex(&future->mutex);
-    ++future->progress;
-
-    if (dmnsn_future_progress_unlocked(future) >= future->min_wait) {
-      future->min_wait = 1.0;
-      dmnsn_cond_broadcast(&future->cond);
+    if (atomic_load(&future->flags) & DMNSN_FUTURE_WAITING) {
+      if (dmnsn_future_progress_unlocked(future) >= future->min_wait) {
+        future->min_wait = 1.0;
+        atomic_fetch_and(&future->flags, ~DMNSN_FUTURE_WAITING);
+        dmnsn_cond_broadcast(&future->cond);
+      }
     }
 
     if (future->npaused > 0) {
@@ -226,30 +475,210 @@ dmnsn_future_increment(dmnsn_future *future)
         dmnsn_cond_broadcast(&future->none_running_cond);
       }
 
-      pthread_cleanup_push(dmnsn_future_increment_cleanup, future);
-        do {
-          dmnsn_cond_wait(&future->resume_cond, &future->mutex);
-        } while (future->npaused > 0);
-      pthread_cleanup_pop(false);
+      do {
+        dmnsn_cond_wait(&future->resume_cond, &future->mutex);
+      } while (future->npaused > 0 && !dmnsn_future_is_cancelled(future));
 
       if (++future->nrunning == future->nthreads) {
         dmnsn_cond_broadcast(&future->all_running_cond);
       }
     }
   dmnsn_unlock_mutex(&future->mutex);
+
+  // We may have been cancelled while paused
+  dmnsn_future_testcancel(future);
+}
+
+// Increment the number of completed loop iterations
+void
+dmnsn_future_increment(dmnsn_future *future)
+{
+  if (dmnsn_unlikely(dmnsn_tl_progress.future != future)) {
+    dmnsn_future_flush();
+    dmnsn_future_start_batch(future);
+  }
+
+  if (++dmnsn_tl_progress.pending >= dmnsn_tl_progress.batch) {
+    dmnsn_future_publish();
+
+    // After publishing, the flag check must be sequentially consistent to
+    // pair with the flag setting in dmnsn_future_wait()
+    if (dmnsn_unlikely(atomic_load(&future->flags) != 0)) {
+      dmnsn_future_increment_slow(future);
+    }
+  } else {
+    // Nothing is published, so no waiter can be missed; a relaxed load is
+    // enough to notice requests within one batch
+    unsigned int flags = atomic_load_explicit(&future->flags, memory_order_relaxed);
+    if (dmnsn_unlikely(flags != 0)) {
+      dmnsn_future_increment_slow(future);
+    }
+  }
+}
+
+// Publish the calling thread's batched progress
+void
+dmnsn_future_flush(void)
+{
+  dmnsn_future_publish();
+  dmnsn_tl_progress.future = NULL;
+}
+
+/// Notify a chain that one of its stages finished.
+static void dmnsn_future_stage_finished(dmnsn_future *chain, dmnsn_future *stage);
+
+/// Make \p parent a chain that \p stage belongs to.
+static void
+dmnsn_future_set_parent(dmnsn_future *stage, dmnsn_future *parent)
+{
+  bool finished;
+  dmnsn_lock_mutex(&stage->mutex);
+    dmnsn_assert(!stage->parent, "Future chained twice.");
+    finished = stage->finished;
+    if (!finished) {
+      stage->parent = parent;
+    }
+  dmnsn_unlock_mutex(&stage->mutex);
+
+  if (finished) {
+    dmnsn_future_stage_finished(parent, stage);
+  }
+}
+
+static void
+dmnsn_future_stage_finished(dmnsn_future *chain, dmnsn_future *stage)
+{
+  // The stage is finished, so its return value is stable
+  int retval = stage->retval;
+
+  if (stage == chain->first && retval == 0 && !dmnsn_future_is_cancelled(chain)) {
+    dmnsn_future *second = chain->continuation(chain->continuation_ptr);
+    if (second) {
+      dmnsn_lock_mutex(&chain->mutex);
+        chain->second = second;
+        dmnsn_cond_broadcast(&chain->cond);
+      dmnsn_unlock_mutex(&chain->mutex);
+
+      // Catch cancellations that raced with starting the second stage
+      if (dmnsn_future_is_cancelled(chain)) {
+        dmnsn_future_cancel(second);
+      }
+
+      dmnsn_future_set_parent(second, chain);
+      return;
+    }
+  }
+
+  if (stage == chain->first && retval == 0) {
+    // Cancelled, or the continuation failed
+    retval = -1;
+  }
+  dmnsn_future_finish(chain, retval);
+}
+
+dmnsn_future *
+dmnsn_future_then(dmnsn_future *future, dmnsn_future_fn *continuation, void *ptr)
+{
+  dmnsn_future *chain = dmnsn_new_future();
+  chain->first = future;
+  chain->continuation = continuation;
+  chain->continuation_ptr = ptr;
+  chain->nstages = future->nstages + 1;
+
+  dmnsn_future_set_parent(future, chain);
+  return chain;
+}
+
+void
+dmnsn_future_wait_all(dmnsn_future *const *futures, size_t nfutures)
+{
+  for (size_t i = 0; i < nfutures; ++i) {
+    dmnsn_future_wait_finished(futures[i]);
+  }
+}
+
+size_t
+dmnsn_future_wait_any(dmnsn_future *const *futures, size_t nfutures)
+{
+  dmnsn_assert(nfutures > 0, "Attempt to wait for any of 0 futures.");
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool notified = false;
+  dmnsn_initialize_mutex(&mutex);
+  dmnsn_initialize_cond(&cond);
+
+  // Register with every future, stopping early if one is already finished
+  dmnsn_future_notifier notifiers[nfutures];
+  size_t nregistered, found = nfutures;
+  for (nregistered = 0; nregistered < nfutures && found == nfutures; ++nregistered) {
+    dmnsn_future *future = futures[nregistered];
+    dmnsn_future_notifier *notifier = &notifiers[nregistered];
+    notifier->mutex = &mutex;
+    notifier->cond = &cond;
+    notifier->notified = &notified;
+
+    dmnsn_lock_mutex(&future->mutex);
+      if (future->finished) {
+        found = nregistered;
+      } else {
+        notifier->next = future->notifiers;
+        future->notifiers = notifier;
+      }
+    dmnsn_unlock_mutex(&future->mutex);
+  }
+
+  if (found == nfutures) {
+    dmnsn_lock_mutex(&mutex);
+      while (!notified) {
+        dmnsn_cond_wait(&cond, &mutex);
+      }
+    dmnsn_unlock_mutex(&mutex);
+  }
+
+  // Unregister, and find out who finished
+  for (size_t i = 0; i < nregistered; ++i) {
+    dmnsn_future *future = futures[i];
+    dmnsn_lock_mutex(&future->mutex);
+      dmnsn_future_remove_notifier(&future->notifiers, &notifiers[i]);
+
+      if (future->finished && found == nfutures) {
+        found = i;
+      }
+    dmnsn_unlock_mutex(&future->mutex);
+  }
+
+  dmnsn_destroy_cond(&cond);
+  dmnsn_destroy_mutex(&mutex);
+
+  dmnsn_assert(found < nfutures, "No future finished.");
+  return found;
 }
 
 // Immediately set to 100% completion
 void
-dmnsn_future_finish(dmnsn_future *future)
+dmnsn_future_finish(dmnsn_future *future, int retval)
 {
+  dmnsn_future *parent;
+
   dmnsn_lock_mutex(&future->mutex);
-    future->progress = future->total;
+    future->finished = true;
+    future->retval = retval;
+    atomic_store(&future->progress, atomic_load(&future->total));
     future->nthreads = future->nrunning = 0;
     dmnsn_cond_broadcast(&future->cond);
     dmnsn_cond_broadcast(&future->none_running_cond);
     dmnsn_cond_broadcast(&future->all_running_cond);
+
+    dmnsn_future_notify(future->notifiers);
+
+    parent = future->parent;
   dmnsn_unlock_mutex(&future->mutex);
+
+  // Don't touch future after this, since the chain might join it
+  if (parent) {
+    dmnsn_future_stage_finished(parent, future);
+  }
 }
 
 // Set the number of threads
@@ -267,6 +696,8 @@ dmnsn_future_set_nthreads(dmnsn_future *future, unsigned int nthreads)
 void
 dmnsn_future_finish_thread(dmnsn_future *future)
 {
+  dmnsn_future_flush();
+
   dmnsn_lock_mutex(&future->mutex);
     dmnsn_assert(future->nthreads > 0,
                  "dmnsn_future_finish_thread() called with no threads");
@@ -0,0 +1,156 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Parallel LSD radix sort.
+ */
+
+#include "internal/concurrency.h"
+#include "internal/sort.h"
+#include <string.h>
+
+/// Bits per radix sort digit.
+#define DMNSN_RADIX_BITS 8
+/// Number of buckets per digit.
+#define DMNSN_RADIX_BUCKETS (1 << DMNSN_RADIX_BITS)
+/// Number of pairs handled by each parallel task.
+#define DMNSN_RADIX_CHUNK 65536
+
+/// A slice of the array, handled by one task.
+typedef struct dmnsn_radix_chunk {
+  const dmnsn_sort_pair *src; ///< The pairs to read.
+  dmnsn_sort_pair *dest;      ///< Where to scatter them.
+  size_t start, end;          ///< The range of this chunk.
+  unsigned int shift;         ///< The position of the current digit.
+  uint64_t diff;              ///< The bits that differ from the first key.
+  size_t offsets[DMNSN_RADIX_BUCKETS]; ///< Digit counts, then destinations.
+} dmnsn_radix_chunk;
+
+/// Run a task over every chunk in parallel.
+static void
+dmnsn_radix_foreach(dmnsn_radix_chunk *chunks, size_t nchunks, dmnsn_callback_fn *task_fn)
+{
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  for (size_t i = 1; i < nchunks; ++i) {
+    dmnsn_spawn(&group, task_fn, &chunks[i]);
+  }
+  task_fn(&chunks[0]);
+  dmnsn_sync(&group);
+}
+
+/// Find which key bits vary within a chunk.
+static void
+dmnsn_radix_diff_task(void *ptr)
+{
+  dmnsn_radix_chunk *chunk = ptr;
+  uint64_t first = chunk->src[0].key;
+  uint64_t diff = 0;
+  for (size_t i = chunk->start; i < chunk->end; ++i) {
+    diff |= chunk->src[i].key ^ first;
+  }
+  chunk->diff = diff;
+}
+
+/// Count the digits in a chunk.
+static void
+dmnsn_radix_count_task(void *ptr)
+{
+  dmnsn_radix_chunk *chunk = ptr;
+  memset(chunk->offsets, 0, sizeof(chunk->offsets));
+  for (size_t i = chunk->start; i < chunk->end; ++i) {
+    ++chunk->offsets[(chunk->src[i].key >> chunk->shift) & (DMNSN_RADIX_BUCKETS - 1)];
+  }
+}
+
+/// Scatter a chunk to its destinations.
+static void
+dmnsn_radix_scatter_task(void *ptr)
+{
+  dmnsn_radix_chunk *chunk = ptr;
+  for (size_t i = chunk->start; i < chunk->end; ++i) {
+    size_t digit = (chunk->src[i].key >> chunk->shift) & (DMNSN_RADIX_BUCKETS - 1);
+    chunk->dest[chunk->offsets[digit]++] = chunk->src[i];
+  }
+}
+
+void
+dmnsn_radix_sort(dmnsn_sort_pair *pairs, size_t n)
+{
+  if (n < 2) {
+    return;
+  }
+
+  size_t nchunks = (n + DMNSN_RADIX_CHUNK - 1)/DMNSN_RADIX_CHUNK;
+  dmnsn_radix_chunk *chunks = dmnsn_malloc(nchunks*sizeof(dmnsn_radix_chunk));
+  for (size_t i = 0; i < nchunks; ++i) {
+    chunks[i].src = pairs;
+    chunks[i].start = i*DMNSN_RADIX_CHUNK;
+    chunks[i].end = i + 1 < nchunks ? (i + 1)*DMNSN_RADIX_CHUNK : n;
+  }
+
+  // Skip the digits that are the same for every key
+  dmnsn_radix_foreach(chunks, nchunks, dmnsn_radix_diff_task);
+  uint64_t diff = 0;
+  for (size_t i = 0; i < nchunks; ++i) {
+    diff |= chunks[i].diff;
+  }
+
+  dmnsn_sort_pair *buffer = dmnsn_malloc(n*sizeof(dmnsn_sort_pair));
+  dmnsn_sort_pair *src = pairs, *dest = buffer;
+
+  for (unsigned int shift = 0; shift < 64; shift += DMNSN_RADIX_BITS) {
+    if (((diff >> shift) & (DMNSN_RADIX_BUCKETS - 1)) == 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < nchunks; ++i) {
+      chunks[i].src = src;
+      chunks[i].dest = dest;
+      chunks[i].shift = shift;
+    }
+
+    dmnsn_radix_foreach(chunks, nchunks, dmnsn_radix_count_task);
+
+    // Turn the counts into destination offsets.  Each digit's slots are
+    // divided between the chunks in order, which keeps the sort stable.
+    size_t offset = 0;
+    for (size_t digit = 0; digit < DMNSN_RADIX_BUCKETS; ++digit) {
+      for (size_t i = 0; i < nchunks; ++i) {
+        size_t count = chunks[i].offsets[digit];
+        chunks[i].offsets[digit] = offset;
+        offset += count;
+      }
+    }
+
+    dmnsn_radix_foreach(chunks, nchunks, dmnsn_radix_scatter_task);
+
+    dmnsn_sort_pair *temp = src;
+    src = dest;
+    dest = temp;
+  }
+
+  if (src != pairs) {
+    memcpy(pairs, src, n*sizeof(dmnsn_sort_pair));
+  }
+
+  dmnsn_free(buffer);
+  dmnsn_free(chunks);
+}
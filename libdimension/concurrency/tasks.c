@@ -0,0 +1,324 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+/**
+ * @file
+ * Work-stealing task runtime.
+ */
+
+#include "internal.h"
+#include "internal/concurrency.h"
+#include "internal/platform.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/// A spawned task.
+typedef struct dmnsn_spawned_task {
+  dmnsn_callback_fn *task_fn; ///< The task callback.
+  void *arg;                  ///< The argument to pass to the callback.
+  dmnsn_task_group *group;    ///< The group the task belongs to.
+} dmnsn_spawned_task;
+
+/**
+ * A double-ended task queue.  The owner pushes and pops tasks at the tail,
+ * while idle threads steal the oldest (and typically largest) tasks from the
+ * head.
+ */
+typedef struct dmnsn_task_deque {
+  pthread_mutex_t mutex;     ///< Mutex guarding the deque.
+  dmnsn_spawned_task *tasks; ///< Ring buffer of tasks.
+  size_t capacity;           ///< Size of the ring buffer (a power of two).
+  size_t head, tail;         ///< Indices of the oldest and next task.
+} dmnsn_task_deque;
+
+/// The library-wide task runtime.
+static struct {
+  unsigned int nworkers;     ///< The maximum number of worker threads.
+  /// One deque per worker, plus one shared by all other threads.
+  dmnsn_task_deque *deques;
+  bool *claimed;             ///< Which worker deques are in use.
+  unsigned int ndeques;      ///< The number of deques.
+
+  atomic_size_t nqueued;     ///< The number of tasks waiting in deques.
+  atomic_uint nactive;       ///< The number of running worker threads.
+  atomic_size_t nsleeping;   ///< The number of threads waiting for work.
+  pthread_mutex_t mutex;     ///< Mutex for sleeping and claiming deques.
+  pthread_cond_t cond;       ///< Signalled when new work or a sync arrives.
+} dmnsn_tasks;
+
+/// Once control for the runtime.
+static pthread_once_t dmnsn_tasks_once = PTHREAD_ONCE_INIT;
+
+/// The calling thread's deque, if it is a worker.
+static __thread dmnsn_task_deque *dmnsn_tl_deque = NULL;
+
+/// Initialize a task deque.
+static void
+dmnsn_initialize_task_deque(dmnsn_task_deque *deque)
+{
+  dmnsn_initialize_mutex(&deque->mutex);
+  deque->capacity = 64;
+  deque->tasks = dmnsn_malloc(deque->capacity*sizeof(dmnsn_spawned_task));
+  deque->head = deque->tail = 0;
+}
+
+/// Push a task onto the tail of a deque.
+static void
+dmnsn_task_deque_push(dmnsn_task_deque *deque, dmnsn_spawned_task task)
+{
+  dmnsn_lock_mutex(&deque->mutex);
+    if (deque->tail - deque->head == deque->capacity) {
+      // Grow and linearize the ring buffer
+      size_t capacity = 2*deque->capacity;
+      dmnsn_spawned_task *tasks = dmnsn_malloc(capacity*sizeof(dmnsn_spawned_task));
+      for (size_t i = deque->head; i != deque->tail; ++i) {
+        tasks[i - deque->head] = deque->tasks[i & (deque->capacity - 1)];
+      }
+      dmnsn_free(deque->tasks);
+      deque->tasks = tasks;
+      deque->tail -= deque->head;
+      deque->head = 0;
+      deque->capacity = capacity;
+    }
+
+    deque->tasks[deque->tail++ & (deque->capacity - 1)] = task;
+    atomic_fetch_add(&dmnsn_tasks.nqueued, 1);
+  dmnsn_unlock_mutex(&deque->mutex);
+}
+
+/// Take a task from one end of a deque.
+static bool
+dmnsn_task_deque_take(dmnsn_task_deque *deque, bool steal, dmnsn_spawned_task *task)
+{
+  bool found = false;
+
+  dmnsn_lock_mutex(&deque->mutex);
+    if (deque->head != deque->tail) {
+      if (steal) {
+        *task = deque->tasks[deque->head++ & (deque->capacity - 1)];
+      } else {
+        *task = deque->tasks[--deque->tail & (deque->capacity - 1)];
+      }
+      atomic_fetch_sub(&dmnsn_tasks.nqueued, 1);
+      found = true;
+    }
+  dmnsn_unlock_mutex(&deque->mutex);
+
+  return found;
+}
+
+/// The deque that the calling thread pushes to.
+static dmnsn_task_deque *
+dmnsn_own_deque(void)
+{
+  if (dmnsn_tl_deque) {
+    return dmnsn_tl_deque;
+  } else {
+    return &dmnsn_tasks.deques[dmnsn_tasks.nworkers];
+  }
+}
+
+/// Find a task to run, from our own deque first and then from the others.
+static bool
+dmnsn_find_task(dmnsn_spawned_task *task)
+{
+  if (atomic_load(&dmnsn_tasks.nqueued) == 0) {
+    return false;
+  }
+
+  dmnsn_task_deque *own = dmnsn_own_deque();
+  if (dmnsn_task_deque_take(own, false, task)) {
+    return true;
+  }
+
+  // Steal, starting with our neighbour so thieves spread out
+  unsigned int start = own - dmnsn_tasks.deques;
+  for (unsigned int i = 1; i < dmnsn_tasks.ndeques; ++i) {
+    dmnsn_task_deque *victim = &dmnsn_tasks.deques[(start + i)%dmnsn_tasks.ndeques];
+    if (dmnsn_task_deque_take(victim, true, task)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Wake up any sleeping threads.
+static void
+dmnsn_wake_sleepers(void)
+{
+  if (atomic_load(&dmnsn_tasks.nsleeping) > 0) {
+    dmnsn_lock_mutex(&dmnsn_tasks.mutex);
+      dmnsn_cond_broadcast(&dmnsn_tasks.cond);
+    dmnsn_unlock_mutex(&dmnsn_tasks.mutex);
+  }
+}
+
+/// Run a task and notify its group.
+static void
+dmnsn_run_task(dmnsn_spawned_task task)
+{
+  task.task_fn(task.arg);
+  if (atomic_fetch_sub(&task.group->pending, 1) == 1) {
+    // Wake up anyone syncing on the group
+    dmnsn_wake_sleepers();
+  }
+}
+
+/// Reserve a slot for another worker, if there's room for one.
+static bool
+dmnsn_reserve_worker(void)
+{
+  unsigned int nactive = atomic_load(&dmnsn_tasks.nactive);
+  while (nactive < dmnsn_tasks.nworkers) {
+    if (atomic_compare_exchange_weak(&dmnsn_tasks.nactive, &nactive, nactive + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Worker main loop.  Workers borrow threads from the shared pool in
+ * threads.c, and give them back as soon as they run out of tasks, so the
+ * runtime never holds on to idle cores.
+ */
+static void
+dmnsn_task_worker(void *ptr)
+{
+  do {
+    // Claim a free deque
+    dmnsn_task_deque *deque = NULL;
+    dmnsn_lock_mutex(&dmnsn_tasks.mutex);
+      for (unsigned int i = 0; i < dmnsn_tasks.nworkers; ++i) {
+        if (!dmnsn_tasks.claimed[i]) {
+          dmnsn_tasks.claimed[i] = true;
+          deque = &dmnsn_tasks.deques[i];
+          break;
+        }
+      }
+    dmnsn_unlock_mutex(&dmnsn_tasks.mutex);
+    dmnsn_assert(deque, "Too many task workers.");
+    dmnsn_tl_deque = deque;
+
+    dmnsn_spawned_task task;
+    while (dmnsn_find_task(&task)) {
+      dmnsn_run_task(task);
+    }
+
+    // Our own deque is empty, since only we push to it
+    dmnsn_tl_deque = NULL;
+    dmnsn_lock_mutex(&dmnsn_tasks.mutex);
+      dmnsn_tasks.claimed[deque - dmnsn_tasks.deques] = false;
+    dmnsn_unlock_mutex(&dmnsn_tasks.mutex);
+
+    // Retire, unless work arrived after a spawner saw us still running
+    atomic_fetch_sub(&dmnsn_tasks.nactive, 1);
+  } while (atomic_load(&dmnsn_tasks.nqueued) > 0 && dmnsn_reserve_worker());
+}
+
+/// Start another worker if there's work for it and a core to run it on.
+static void
+dmnsn_start_worker(void)
+{
+  if (dmnsn_reserve_worker()) {
+    dmnsn_submit_task(dmnsn_task_worker, NULL);
+  }
+}
+
+/// Start the runtime.
+static void
+dmnsn_initialize_tasks(void)
+{
+  // The thread calling dmnsn_sync() makes up the last core
+  size_t ncpus = dmnsn_ncpus();
+  dmnsn_tasks.nworkers = ncpus > 1 ? ncpus - 1 : 0;
+  dmnsn_tasks.ndeques = dmnsn_tasks.nworkers + 1;
+
+  dmnsn_tasks.deques = dmnsn_malloc(dmnsn_tasks.ndeques*sizeof(dmnsn_task_deque));
+  dmnsn_tasks.claimed = dmnsn_malloc(dmnsn_tasks.ndeques*sizeof(bool));
+  for (unsigned int i = 0; i < dmnsn_tasks.ndeques; ++i) {
+    dmnsn_initialize_task_deque(&dmnsn_tasks.deques[i]);
+    dmnsn_tasks.claimed[i] = false;
+  }
+
+  atomic_init(&dmnsn_tasks.nqueued, 0);
+  atomic_init(&dmnsn_tasks.nactive, 0);
+  atomic_init(&dmnsn_tasks.nsleeping, 0);
+  dmnsn_initialize_mutex(&dmnsn_tasks.mutex);
+  dmnsn_initialize_cond(&dmnsn_tasks.cond);
+}
+
+/// Free the runtime at exit.
+DMNSN_DESTRUCTOR static void
+dmnsn_shutdown_tasks(void)
+{
+  if (!dmnsn_tasks.deques || atomic_load(&dmnsn_tasks.nactive) > 0) {
+    // Never started, or workers are still running; let the OS clean up
+    return;
+  }
+
+  for (unsigned int i = 0; i < dmnsn_tasks.ndeques; ++i) {
+    dmnsn_free(dmnsn_tasks.deques[i].tasks);
+    dmnsn_destroy_mutex(&dmnsn_tasks.deques[i].mutex);
+  }
+  dmnsn_free(dmnsn_tasks.deques);
+  dmnsn_free(dmnsn_tasks.claimed);
+
+  dmnsn_destroy_cond(&dmnsn_tasks.cond);
+  dmnsn_destroy_mutex(&dmnsn_tasks.mutex);
+}
+
+void
+dmnsn_spawn(dmnsn_task_group *group, dmnsn_callback_fn *task_fn, void *arg)
+{
+  dmnsn_once(&dmnsn_tasks_once, dmnsn_initialize_tasks);
+
+  dmnsn_spawned_task task = {
+    .task_fn = task_fn,
+    .arg = arg,
+    .group = group,
+  };
+  atomic_fetch_add(&group->pending, 1);
+  dmnsn_task_deque_push(dmnsn_own_deque(), task);
+  dmnsn_start_worker();
+  dmnsn_wake_sleepers();
+}
+
+void
+dmnsn_sync(dmnsn_task_group *group)
+{
+  while (atomic_load(&group->pending) > 0) {
+    // Help out while we wait, rather than blocking a core
+    dmnsn_spawned_task task;
+    if (dmnsn_find_task(&task)) {
+      dmnsn_run_task(task);
+      continue;
+    }
+
+    // The remaining tasks are running elsewhere
+    dmnsn_lock_mutex(&dmnsn_tasks.mutex);
+      atomic_fetch_add(&dmnsn_tasks.nsleeping, 1);
+      while (atomic_load(&group->pending) > 0 && atomic_load(&dmnsn_tasks.nqueued) == 0) {
+        dmnsn_cond_wait(&dmnsn_tasks.cond, &dmnsn_tasks.mutex);
+      }
+      atomic_fetch_sub(&dmnsn_tasks.nsleeping, 1);
+    dmnsn_unlock_mutex(&dmnsn_tasks.mutex);
+  }
+}
@@ -26,13 +26,235 @@
 #include "internal.h"
 #include "internal/concurrency.h"
 #include "internal/future.h"
+#include "internal/platform.h"
 #include <pthread.h>
 
+////////////////////////
+// Worker thread pool //
+////////////////////////
+
+/// A task waiting for a worker thread.
+typedef struct dmnsn_task {
+  dmnsn_callback_fn *task_fn; ///< The task callback.
+  void *arg;                  ///< The argument to pass to the callback.
+  struct dmnsn_task *next;    ///< The next task in the queue.
+} dmnsn_task;
+
+/// A persistent worker thread.
+typedef struct dmnsn_worker {
+  pthread_t thread;           ///< The thread itself.
+  bool busy;                  ///< Whether the worker is running a task.
+  bool exited;                ///< Whether the thread has exited.
+  bool detached;              ///< Whether the pool has abandoned the worker.
+  struct dmnsn_worker *next;  ///< The next worker in the pool.
+} dmnsn_worker;
+
+/// The library-wide pool of worker threads.
+static struct {
+  pthread_mutex_t mutex;      ///< Mutex guarding the pool.
+  pthread_cond_t cond;        ///< Signalled when tasks are queued.
+  dmnsn_task *head, *tail;    ///< The task queue.
+  size_t nqueued;             ///< The number of queued tasks.
+  size_t nidle;               ///< The number of idle workers.
+  size_t max_idle;            ///< The number of idle workers to keep around.
+  dmnsn_worker *workers;      ///< All the workers.
+  bool shutdown;              ///< Whether the pool is shutting down.
+} dmnsn_thread_pool = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .cond  = PTHREAD_COND_INITIALIZER,
+};
+
+/// Mark a worker as exited.  Called with the pool mutex held.
+static void
+dmnsn_worker_exit(dmnsn_worker *worker)
+{
+  worker->exited = true;
+  if (worker->detached) {
+    // The worker was abandoned by dmnsn_thread_pool_shutdown()
+    dmnsn_free(worker);
+  }
+}
+
+/// Clean up after a worker whose task exited the thread.
+static void
+dmnsn_worker_cleanup(void *ptr)
+{
+  dmnsn_lock_mutex(&dmnsn_thread_pool.mutex);
+    dmnsn_worker_exit(ptr);
+  dmnsn_unlock_mutex(&dmnsn_thread_pool.mutex);
+}
+
+/// Worker thread main loop.
+static void *
+dmnsn_worker_thread(void *ptr)
+{
+  dmnsn_worker *worker = ptr;
+
+  while (true) {
+    dmnsn_task *task = NULL;
+
+    dmnsn_lock_mutex(&dmnsn_thread_pool.mutex);
+      worker->busy = false;
+
+      // Retire if there's no work and already enough idle workers
+      if (dmnsn_thread_pool.head || dmnsn_thread_pool.nidle < dmnsn_thread_pool.max_idle) {
+        ++dmnsn_thread_pool.nidle;
+        while (!dmnsn_thread_pool.head && !dmnsn_thread_pool.shutdown) {
+          dmnsn_cond_wait(&dmnsn_thread_pool.cond, &dmnsn_thread_pool.mutex);
+        }
+        --dmnsn_thread_pool.nidle;
+
+        if (!dmnsn_thread_pool.shutdown) {
+          task = dmnsn_thread_pool.head;
+          dmnsn_thread_pool.head = task->next;
+          if (!dmnsn_thread_pool.head) {
+            dmnsn_thread_pool.tail = NULL;
+          }
+          --dmnsn_thread_pool.nqueued;
+          worker->busy = true;
+        }
+      }
+
+      if (!task) {
+        dmnsn_worker_exit(worker);
+      }
+    dmnsn_unlock_mutex(&dmnsn_thread_pool.mutex);
+
+    if (!task) {
+      break;
+    }
+
+    dmnsn_callback_fn *task_fn = task->task_fn;
+    void *arg = task->arg;
+    dmnsn_free(task);
+
+    // If the task exits the thread (i.e. it was cancelled), the pool will
+    // replace this worker
+    pthread_cleanup_push(dmnsn_worker_cleanup, worker);
+      task_fn(arg);
+    pthread_cleanup_pop(false);
+  }
+
+  return NULL;
+}
+
+/// Join and free any workers that have exited.  Called with the pool mutex held.
+static void
+dmnsn_reap_workers(void)
+{
+  dmnsn_worker **prev = &dmnsn_thread_pool.workers;
+  while (*prev) {
+    dmnsn_worker *worker = *prev;
+    if (worker->exited) {
+      *prev = worker->next;
+      dmnsn_join_thread(worker->thread, NULL);
+      dmnsn_free(worker);
+    } else {
+      prev = &worker->next;
+    }
+  }
+}
+
+/// Start a new worker.  Called with the pool mutex held.
+static void
+dmnsn_spawn_worker(void)
+{
+  dmnsn_worker *worker = DMNSN_MALLOC(dmnsn_worker);
+  worker->busy = false;
+  worker->exited = false;
+  worker->detached = false;
+  if (pthread_create(&worker->thread, NULL, dmnsn_worker_thread, worker) != 0) {
+    dmnsn_error("Couldn't start worker thread.");
+  }
+
+  worker->next = dmnsn_thread_pool.workers;
+  dmnsn_thread_pool.workers = worker;
+}
+
+void
+dmnsn_submit_task(dmnsn_callback_fn *task_fn, void *arg)
+{
+  dmnsn_task *task = DMNSN_MALLOC(dmnsn_task);
+  task->task_fn = task_fn;
+  task->arg = arg;
+  task->next = NULL;
+
+  dmnsn_lock_mutex(&dmnsn_thread_pool.mutex);
+    dmnsn_assert(!dmnsn_thread_pool.shutdown, "Thread pool used after shutdown.");
+
+    if (dmnsn_thread_pool.max_idle == 0) {
+      dmnsn_thread_pool.max_idle = dmnsn_ncpus();
+    }
+
+    dmnsn_reap_workers();
+
+    if (dmnsn_thread_pool.tail) {
+      dmnsn_thread_pool.tail->next = task;
+    } else {
+      dmnsn_thread_pool.head = task;
+    }
+    dmnsn_thread_pool.tail = task;
+    ++dmnsn_thread_pool.nqueued;
+
+    // Grow the pool if every idle worker already has a task
+    if (dmnsn_thread_pool.nqueued > dmnsn_thread_pool.nidle) {
+      dmnsn_spawn_worker();
+    }
+
+    dmnsn_cond_broadcast(&dmnsn_thread_pool.cond);
+  dmnsn_unlock_mutex(&dmnsn_thread_pool.mutex);
+}
+
+/// Stop the worker threads at exit.
+DMNSN_DESTRUCTOR static void
+dmnsn_thread_pool_shutdown(void)
+{
+  dmnsn_worker *workers;
+  dmnsn_lock_mutex(&dmnsn_thread_pool.mutex);
+    dmnsn_thread_pool.shutdown = true;
+    dmnsn_cond_broadcast(&dmnsn_thread_pool.cond);
+
+    workers = dmnsn_thread_pool.workers;
+    dmnsn_thread_pool.workers = NULL;
+
+    // Don't wait for workers still running tasks; they free themselves
+    dmnsn_worker **prev = &workers;
+    while (*prev) {
+      dmnsn_worker *worker = *prev;
+      if (worker->busy && !worker->exited) {
+        *prev = worker->next;
+        worker->detached = true;
+        pthread_detach(worker->thread);
+      } else {
+        prev = &worker->next;
+      }
+    }
+  dmnsn_unlock_mutex(&dmnsn_thread_pool.mutex);
+
+  while (workers) {
+    dmnsn_worker *next = workers->next;
+    dmnsn_join_thread(workers->thread, NULL);
+    dmnsn_free(workers);
+    workers = next;
+  }
+
+  while (dmnsn_thread_pool.head) {
+    dmnsn_task *next = dmnsn_thread_pool.head->next;
+    dmnsn_free(dmnsn_thread_pool.head);
+    dmnsn_thread_pool.head = next;
+  }
+}
+
+////////////////////////
+// Background threads //
+////////////////////////
+
 /// The payload to pass to the pthread callback.
 typedef struct dmnsn_thread_payload {
   dmnsn_thread_fn *thread_fn;
   void *arg;
   dmnsn_future *future;
+  int ret;
 } dmnsn_thread_payload;
 
 /// Clean up after a thread.
@@ -41,23 +263,22 @@ dmnsn_thread_cleanup(void *arg)
 {
   dmnsn_thread_payload *payload = arg;
   dmnsn_future *future = payload->future;
+  int ret = payload->ret;
   dmnsn_free(payload);
 
-  dmnsn_future_finish(future);
+  dmnsn_future_flush();
+  dmnsn_future_finish(future, ret);
 }
 
-/// pthread callback -- call the real thread callback.
-static void *
+/// Task callback -- call the real thread callback.
+static void
 dmnsn_thread(void *arg)
 {
   dmnsn_thread_payload *payload = arg;
-  int *ret;
 
   pthread_cleanup_push(dmnsn_thread_cleanup, payload);
-    ret  = DMNSN_MALLOC(int);
-    *ret = payload->thread_fn(payload->arg);
+    payload->ret = payload->thread_fn(payload->arg);
   pthread_cleanup_pop(true);
-  return ret;
 }
 
 void
@@ -67,60 +288,82 @@ dmnsn_new_thread(dmnsn_future *future, dmnsn_thread_fn *thread_fn, void *arg)
   payload->thread_fn = thread_fn;
   payload->arg       = arg;
   payload->future    = future;
+  payload->ret       = -1;
 
-  if (pthread_create(&future->thread, NULL, dmnsn_thread, payload) != 0) {
-    dmnsn_error("Couldn't start thread.");
-  }
+  dmnsn_submit_task(dmnsn_thread, payload);
 }
 
+/// Shared state for the threads run by dmnsn_execute_concurrently().
+typedef struct dmnsn_ccthread_group {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;       ///< Signalled when a thread completes.
+  unsigned int nrunning;     ///< The number of pooled threads still running.
+  dmnsn_future *future;
+} dmnsn_ccthread_group;
+
 /// Payload for threads executed by dmnsn_execute_concurrently().
 typedef struct dmnsn_ccthread_payload {
-  dmnsn_future *future;
+  dmnsn_ccthread_group *group;
   dmnsn_ccthread_fn *ccthread_fn;
   void *arg;
   unsigned int thread, nthreads;
   int ret;
-  bool running;
 } dmnsn_ccthread_payload;
 
-static void *
-dmnsn_concurrent_thread(void *ptr)
+/// Run one of the concurrent threads.
+static void
+dmnsn_run_ccthread(dmnsn_ccthread_payload *payload)
 {
-  dmnsn_ccthread_payload *payload = ptr;
   payload->ret = payload->ccthread_fn(payload->arg, payload->thread,
                                       payload->nthreads);
-  if (payload->future) {
-    dmnsn_future_finish_thread(payload->future);
+  if (payload->group->future) {
+    dmnsn_future_finish_thread(payload->group->future);
   }
-  return NULL;
 }
 
-typedef struct dmnsn_ccthread_cleanup_payload {
-  dmnsn_future *future;
-  pthread_t *threads;
-  dmnsn_ccthread_payload *payloads;
-  unsigned int nthreads;
-} dmnsn_ccthread_cleanup_payload;
+/// Notify the group that a pooled thread is done.
+static void
+dmnsn_ccthread_done(void *ptr)
+{
+  dmnsn_ccthread_group *group = ptr;
 
+  // Don't leave batched progress behind if we were cancelled
+  dmnsn_future_flush();
+
+  dmnsn_lock_mutex(&group->mutex);
+    if (--group->nrunning == 0) {
+      dmnsn_cond_broadcast(&group->cond);
+    }
+  dmnsn_unlock_mutex(&group->mutex);
+}
+
+/// Task callback for pooled concurrent threads.
+static void
+dmnsn_concurrent_thread(void *ptr)
+{
+  dmnsn_ccthread_payload *payload = ptr;
+  pthread_cleanup_push(dmnsn_ccthread_done, payload->group);
+    dmnsn_run_ccthread(payload);
+  pthread_cleanup_pop(true);
+}
+
+/// Wait for the pooled threads to finish.
 static void
 dmnsn_ccthread_cleanup(void *ptr)
 {
-  dmnsn_ccthread_cleanup_payload *payload = ptr;
+  dmnsn_ccthread_group *group = ptr;
 
-  for (unsigned int i = 0; i < payload->nthreads; ++i) {
-    if (payload->payloads[i].running) {
-      pthread_cancel(payload->threads[i]);
+  dmnsn_lock_mutex(&group->mutex);
+    while (group->nrunning > 0) {
+      dmnsn_cond_wait(&group->cond, &group->mutex);
     }
-  }
+  dmnsn_unlock_mutex(&group->mutex);
 
-  for (unsigned int i = 0; i < payload->nthreads; ++i) {
-    if (payload->payloads[i].running) {
-      dmnsn_join_thread(payload->threads[i], NULL);
-    }
-  }
+  dmnsn_destroy_cond(&group->cond);
+  dmnsn_destroy_mutex(&group->mutex);
 
-  if (payload->future) {
-    dmnsn_future_set_nthreads(payload->future, 1);
+  if (group->future) {
+    dmnsn_future_set_nthreads(group->future, 1);
   }
 }
 
@@ -134,48 +377,37 @@ dmnsn_execute_concurrently(dmnsn_future *future, dmnsn_ccthread_fn *ccthread_fn,
     dmnsn_future_set_nthreads(future, nthreads);
   }
 
-  pthread_t threads[nthreads];
+  dmnsn_ccthread_group group = {
+    .nrunning = nthreads - 1,
+    .future = future,
+  };
+  dmnsn_initialize_mutex(&group.mutex);
+  dmnsn_initialize_cond(&group.cond);
+
   dmnsn_ccthread_payload payloads[nthreads];
   for (unsigned int i = 0; i < nthreads; ++i) {
-    payloads[i].running = false;
+    payloads[i].group       = &group;
+    payloads[i].ccthread_fn = ccthread_fn;
+    payloads[i].arg         = arg;
+    payloads[i].thread      = i;
+    payloads[i].nthreads    = nthreads;
+    payloads[i].ret         = -1;
   }
 
-  int ret = 0;
-  dmnsn_ccthread_cleanup_payload cleanup_payload = {
-    .future = future,
-    .threads = threads,
-    .payloads = payloads,
-    .nthreads = nthreads,
-  };
-  pthread_cleanup_push(dmnsn_ccthread_cleanup, &cleanup_payload);
-    for (unsigned int i = 0; i < nthreads; ++i) {
-      payloads[i].future      = future;
-      payloads[i].ccthread_fn = ccthread_fn;
-      payloads[i].arg         = arg;
-      payloads[i].thread      = i;
-      payloads[i].nthreads    = nthreads;
-      payloads[i].ret         = -1;
-      if (pthread_create(&threads[i], NULL, dmnsn_concurrent_thread,
-                         &payloads[i]) != 0)
-      {
-        dmnsn_error("Couldn't start worker thread.");
-      }
-      payloads[i].running = true;
+  // The calling thread does the work of thread 0 itself
+  pthread_cleanup_push(dmnsn_ccthread_cleanup, &group);
+    for (unsigned int i = 1; i < nthreads; ++i) {
+      dmnsn_submit_task(dmnsn_concurrent_thread, &payloads[i]);
     }
+    dmnsn_run_ccthread(&payloads[0]);
+  pthread_cleanup_pop(true);
 
-    for (unsigned int i = 0; i < nthreads; ++i) {
-      dmnsn_join_thread(threads[i], NULL);
-      payloads[i].running = false;
-      if (payloads[i].ret != 0) {
-        ret = payloads[i].ret;
-      }
+  int ret = 0;
+  for (unsigned int i = 0; i < nthreads; ++i) {
+    if (payloads[i].ret != 0) {
+      ret = payloads[i].ret;
     }
-  pthread_cleanup_pop(false);
-
-  if (future) {
-    dmnsn_future_set_nthreads(future, 1);
   }
-
   return ret;
 }
 
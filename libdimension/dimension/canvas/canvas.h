@@ -29,7 +29,28 @@
 
 #include <stddef.h>
 
-/** A canvas, or image. */
+/** Canvas pixel storage formats. */
+typedef enum dmnsn_canvas_format {
+  DMNSN_CANVAS_DOUBLE,   /**< Double-precision RGBTF, 40 bytes per pixel. */
+  DMNSN_CANVAS_FLOAT,    /**< Single-precision RGBTF, 20 bytes per pixel. */
+  DMNSN_CANVAS_HALF,     /**< Half-precision RGBTF, 10 bytes per pixel. */
+  DMNSN_CANVAS_LINEAR16, /**< 16-bit linear RGBTF, clamped to [0, 1], 10 bytes
+                              per pixel. */
+
+  /**
+   * Flag: store the pixels in square tiles instead of rows, for better
+   * locality when rendering tile-by-tile.  Bitwise-or with a storage format.
+   */
+  DMNSN_CANVAS_TILED = 1 << 8,
+} dmnsn_canvas_format;
+
+/**
+ * A canvas, or image.
+ *
+ * The \c format field and the untyped \c pixels storage changed this
+ * structure's layout, which breaks the ABI for code built against older
+ * versions of this header.
+ */
 typedef struct dmnsn_canvas {
   size_t width;  /**< Canvas width. */
   size_t height; /**< Canvas height. */
@@ -37,12 +58,18 @@ typedef struct dmnsn_canvas {
   /** An array of <tt>dmnsn_canvas_optimizer</tt>s. */
   dmnsn_array *optimizers;
 
+  /** The pixel storage format. */
+  dmnsn_canvas_format format;
+
   /**
    * @internal
-   * Stored in first-quadrant representation (origin is bottom-left).  The pixel
-   * at (a,b) is accessible as pixels[b*width + a].
+   * Stored in first-quadrant representation (origin is bottom-left), in the
+   * layout given by \c format.  This used to be a <tt>dmnsn_tcolor *</tt>
+   * indexed as <tt>pixels[y*width + x]</tt>; that no longer holds for any
+   * format other than untiled DMNSN_CANVAS_DOUBLE, so never index it directly.
+   * dmnsn_canvas_get_pixel() is the only supported way to read a pixel.
    */
-  dmnsn_tcolor *pixels;
+  void *pixels;
 } dmnsn_canvas;
 
 /* Forward-declare dmnsn_canvas_optimizer. */
@@ -57,13 +84,25 @@ typedef struct dmnsn_canvas_optimizer dmnsn_canvas_optimizer;
  */
 typedef void dmnsn_canvas_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y);
 
+/**
+ * Canvas span optimizer callback type.
+ * @param[in] optimizer  The canvas optimizer.
+ * @param[in] canvas  The canvas that was just updated.
+ * @param[in] x  The x-coordinate of the first pixel that was just updated.
+ * @param[in] y  The y-coordinate of the row that was just updated.
+ * @param[in] n  The number of consecutive pixels that were just updated.
+ */
+typedef void dmnsn_canvas_span_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y, size_t n);
+
 /** Canvas optimizer. */
 struct dmnsn_canvas_optimizer {
   dmnsn_canvas_optimizer_fn *optimizer_fn; /**< Optimizer callback. */
+  /** Span optimizer callback; if NULL, optimizer_fn is called per pixel. */
+  dmnsn_canvas_span_optimizer_fn *span_optimizer_fn;
 };
 
 /**
- * Allocate a new canvas.
+ * Allocate a new canvas, with double-precision pixels stored in rows.
  * @param[in] pool  The memory pool to allocate from.
  * @param[in] width  The width of the canvas to allocate (in pixels).
  * @param[in] height  The height of the canvas to allocate (in pixels).
@@ -71,6 +110,19 @@ struct dmnsn_canvas_optimizer {
  */
 dmnsn_canvas *dmnsn_new_canvas(dmnsn_pool *pool, size_t width, size_t height);
 
+/**
+ * Allocate a new canvas with a particular pixel storage format.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in] width  The width of the canvas to allocate (in pixels).
+ * @param[in] height  The height of the canvas to allocate (in pixels).
+ * @param[in] format  The pixel storage format, optionally combined with
+ *                    DMNSN_CANVAS_TILED.
+ * @return The allocated canvas.
+ */
+dmnsn_canvas *dmnsn_new_canvas_format(dmnsn_pool *pool,
+                                      size_t width, size_t height,
+                                      dmnsn_canvas_format format);
+
 /**
  * Initialize a dmnsn_canvas_optimizer field
  * @param[in] optimizer  The optimizer to initialize.
@@ -99,7 +151,16 @@ dmnsn_canvas_find_optimizer(const dmnsn_canvas *canvas,
 /* Pixel accessors */
 
 /**
- * Get the color of a pixel.
+ * @internal
+ * Get the color of a pixel in any storage format.  Use
+ * dmnsn_canvas_get_pixel() instead.
+ */
+dmnsn_tcolor dmnsn_canvas_load_pixel(const dmnsn_canvas *canvas,
+                                     size_t x, size_t y);
+
+/**
+ * Get the color of a pixel.  This is the only supported way to read a pixel,
+ * whatever the canvas's storage format.
  * @param[in] canvas  The canvas to access.
  * @param[in] x       The x coordinate.
  * @param[in] y       The y coordinate.
@@ -110,9 +171,24 @@ dmnsn_canvas_get_pixel(const dmnsn_canvas *canvas, size_t x, size_t y)
 {
   dmnsn_assert(x < canvas->width && y < canvas->height,
                "Canvas access out of bounds.");
-  return canvas->pixels[y*canvas->width + x];
+  if (canvas->format == DMNSN_CANVAS_DOUBLE) {
+    return ((const dmnsn_tcolor *)canvas->pixels)[y*canvas->width + x];
+  } else {
+    return dmnsn_canvas_load_pixel(canvas, x, y);
+  }
 }
 
+/**
+ * Get the colors of a horizontal run of pixels.
+ * @param[in]  canvas  The canvas to access.
+ * @param[in]  x       The x coordinate of the first pixel.
+ * @param[in]  y       The y coordinate of the row.
+ * @param[in]  n       The number of pixels to get.
+ * @param[out] tcolors Where to store the \p n pixel values.
+ */
+void dmnsn_canvas_get_span(const dmnsn_canvas *canvas, size_t x, size_t y,
+                           size_t n, dmnsn_tcolor *tcolors);
+
 /**
  * Set the value of a pixel.
  * @param[in,out] canvas  The canvas to modify.
@@ -123,6 +199,27 @@ dmnsn_canvas_get_pixel(const dmnsn_canvas *canvas, size_t x, size_t y)
 void dmnsn_canvas_set_pixel(dmnsn_canvas *canvas, size_t x, size_t y,
                             dmnsn_tcolor tcolor);
 
+/**
+ * Set the values of a horizontal run of pixels.  This is much faster than
+ * setting each pixel individually.
+ * @param[in,out] canvas  The canvas to modify.
+ * @param[in]     x       The x coordinate of the first pixel.
+ * @param[in]     y       The y coordinate of the row.
+ * @param[in]     n       The number of pixels to set.
+ * @param[in]     tcolors The \p n values to set the pixels to.
+ */
+void dmnsn_canvas_set_span(dmnsn_canvas *canvas, size_t x, size_t y, size_t n,
+                           const dmnsn_tcolor *tcolors);
+
+/**
+ * Set the values of a whole row of pixels.
+ * @param[in,out] canvas  The canvas to modify.
+ * @param[in]     y       The y coordinate of the row.
+ * @param[in]     tcolors The <tt>canvas->width</tt> values to set the row to.
+ */
+void dmnsn_canvas_set_row(dmnsn_canvas *canvas, size_t y,
+                          const dmnsn_tcolor *tcolors);
+
 /**
  * Clear a canvas uniformly with a given color.
  * @param[in,out] canvas  The canvas to erase.
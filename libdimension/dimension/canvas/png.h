@@ -46,7 +46,10 @@ int dmnsn_png_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas);
 int dmnsn_png_write_canvas(const dmnsn_canvas *canvas, FILE *file);
 
 /**
- * Write a canvas to a PNG file in the background.
+ * Write a canvas to a PNG file in the background.  If \p canvas is still being
+ * rendered, each row is written as soon as it is finished, so exporting
+ * overlaps with rendering.  In that case, start the render first; if it fails,
+ * so does the export.
  * @param[in] canvas  The canvas to write.
  * @param[in,out] file  The file to write to.
  * @return A \ref dmnsn_future object, or NULL on failure.
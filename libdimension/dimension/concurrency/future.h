@@ -44,7 +44,8 @@ typedef struct dmnsn_future dmnsn_future;
 int dmnsn_future_join(dmnsn_future *future);
 
 /**
- * Interrupt the execution of a background thread.
+ * Interrupt the execution of a background thread.  The task stops the next
+ * time it reports progress.
  * @param[in,out] future  The background task to cancel.
  */
 void dmnsn_future_cancel(dmnsn_future *future);
@@ -83,3 +84,41 @@ void dmnsn_future_pause(dmnsn_future *future);
  * @param[in,out] future  The background task to resume.
  */
 void dmnsn_future_resume(dmnsn_future *future);
+
+/**
+ * Continuation callback type.
+ * @param[in,out] ptr  The pointer passed to dmnsn_future_then().
+ * @return A future for the next stage of the task, or NULL on failure.
+ */
+typedef dmnsn_future *dmnsn_future_fn(void *ptr);
+
+/**
+ * Chain another stage onto a background task.  When \p future completes
+ * successfully, \p continuation is called from the thread that completed it,
+ * so no thread has to block in between the stages.  The returned future
+ * covers both stages: its progress is aggregated across them, cancelling or
+ * pausing it affects whichever stage is running, and joining it returns the
+ * first failure or the return value of the last stage.
+ * @param[in,out] future        The first stage.  It is consumed, so join the
+ *                              returned future instead.
+ * @param[in]     continuation  The callback that starts the next stage.
+ * @param[in,out] ptr           The pointer to pass to \p continuation.
+ * @return A future for the whole chain.
+ */
+dmnsn_future *dmnsn_future_then(dmnsn_future *future,
+                                dmnsn_future_fn *continuation, void *ptr);
+
+/**
+ * Wait for several background tasks to finish.
+ * @param[in] futures   The background tasks to wait for.
+ * @param[in] nfutures  The number of tasks.
+ */
+void dmnsn_future_wait_all(dmnsn_future *const *futures, size_t nfutures);
+
+/**
+ * Wait for any of several background tasks to finish.
+ * @param[in] futures   The background tasks to wait for.
+ * @param[in] nfutures  The number of tasks.
+ * @return The index of a task that has finished.
+ */
+size_t dmnsn_future_wait_any(dmnsn_future *const *futures, size_t nfutures);
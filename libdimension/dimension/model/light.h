@@ -54,12 +54,21 @@ typedef dmnsn_color dmnsn_light_illumination_fn(const dmnsn_light *light,
  */
 typedef bool dmnsn_light_shadow_fn(const dmnsn_light *light, double t);
 
+/**
+ * Light shadow distance callback.  Optional; enables cheaper shadow tests.
+ * @param[in] light  The light itself.
+ * @return The line index below which shadow ray intersections cast shadows, in
+ *         agreement with the shadow callback.
+ */
+typedef double dmnsn_light_shadow_distance_fn(const dmnsn_light *light);
+
 /** A light. */
 struct dmnsn_light {
   /* Callbacks */
   dmnsn_light_direction_fn *direction_fn; /**< Direction callback. */
   dmnsn_light_illumination_fn *illumination_fn; /**< Illumination callback. */
   dmnsn_light_shadow_fn *shadow_fn; /**< Shadow callback. */
+  dmnsn_light_shadow_distance_fn *shadow_distance_fn; /**< Shadow distance callback. */
 };
 
 /**
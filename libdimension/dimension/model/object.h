@@ -38,10 +38,25 @@ typedef struct dmnsn_intersection {
 
   /** The object of intersection. */
   const dmnsn_object *object;
+
+  /**
+   * Whether \p object is part of an instance's prototype, so its pigment is
+   * placed relative to the instance.
+   */
+  bool instanced;
+  /** The intersection point in the instance's space, if \p instanced. */
+  dmnsn_vector instance_point;
+
+  /* Scratch space for passing data to the finalize callback. */
+  double u;     /**< First surface coordinate of the intersection. */
+  double v;     /**< Second surface coordinate of the intersection. */
+  size_t index; /**< Which part of the object was intersected. */
 } dmnsn_intersection;
 
 /**
- * Ray-object intersection callback.
+ * Ray-object intersection callback.  If the object has a finalize callback,
+ * only the line index (and any scratch space the finalize callback needs) must
+ * be filled in; otherwise, the normal must be too.
  * @param[in]  object        The object to test.
  * @param[in]  ray           The ray to test.
  * @param[out] intersection  Where to store the intersection details of the
@@ -50,6 +65,43 @@ typedef struct dmnsn_intersection {
  */
 typedef bool dmnsn_object_intersection_fn(const dmnsn_object *object, dmnsn_ray ray, dmnsn_intersection *intersection);
 
+/** The most rays that can be intersected with an object at once. */
+#define DMNSN_OBJECT_PACKET_SIZE 4
+
+/**
+ * Packet ray-object intersection callback.  Optional; intersects several rays
+ * with the object at once, with exactly the same results as calling the
+ * intersection callback for each of them.
+ * @param[in]  object         The object to test.
+ * @param[in]  rays           The rays to test.  Rays not selected by \p mask
+ *                            are copies of selected ones.
+ * @param[in]  mask           A bitmask of the rays to test.
+ * @param[out] intersections  Where to store the intersection details of the
+ *                            closest (if any) intersection of each ray.
+ * @return A bitmask of the rays that intersected \p object.
+ */
+typedef unsigned int dmnsn_object_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[DMNSN_OBJECT_PACKET_SIZE], unsigned int mask, dmnsn_intersection intersections[DMNSN_OBJECT_PACKET_SIZE]);
+
+/**
+ * Intersection finalize callback.  Optional; computes the surface normal for an
+ * intersection found by the intersection callback.  Only called for the
+ * closest of possibly many candidate intersections.
+ * @param[in]     object        The object that was intersected.
+ * @param[in]     ray           The ray that intersected, in object space.
+ * @param[in,out] intersection  The intersection to finalize.
+ */
+typedef void dmnsn_object_finalize_fn(const dmnsn_object *object, dmnsn_ray ray, dmnsn_intersection *intersection);
+
+/**
+ * Ray-object occlusion callback.  Optional; a cheaper alternative to the
+ * intersection callback when only the existence of an intersection matters.
+ * @param[in] object  The object to test.
+ * @param[in] ray     The ray to test.
+ * @param[in] t       The line index past which intersections don't count.
+ * @return Whether \p ray intersected \p object before \p t.
+ */
+typedef bool dmnsn_object_occlusion_fn(const dmnsn_object *object, dmnsn_ray ray, double t);
+
 /**
  * Object inside callback.
  * @param[in] object  The object to test.
@@ -67,7 +119,9 @@ typedef bool dmnsn_object_inside_fn(const dmnsn_object *object, dmnsn_vector poi
 typedef dmnsn_aabb dmnsn_object_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans);
 
 /**
- * Object precomputation callback.
+ * Object precomputation callback.  Objects that can represent their
+ * transformation directly may apply it to themselves and reset \p trans_inv to
+ * the identity, so that no rays need to be transformed.
  * @param[in,out] object  The object to precompute.
  */
 typedef void dmnsn_object_precompute_fn(dmnsn_object *object);
@@ -75,11 +129,22 @@ typedef void dmnsn_object_precompute_fn(dmnsn_object *object);
 /** Object callbacks. */
 typedef struct dmnsn_object_vtable {
   dmnsn_object_intersection_fn *intersection_fn; /**< Intersection callback. */
+  dmnsn_object_packet_fn *packet_fn; /**< Packet intersection callback. */
+  dmnsn_object_finalize_fn *finalize_fn; /**< Intersection finalize callback. */
+  dmnsn_object_occlusion_fn *occlusion_fn; /**< Occlusion callback. */
   dmnsn_object_inside_fn *inside_fn; /**< Inside callback. */
   dmnsn_object_bounding_fn *bounding_fn; /**< Bounding callback. */
   dmnsn_object_precompute_fn *precompute_fn; /**< Precomputation callback. */
 } dmnsn_object_vtable;
 
+/** The kinds of transformation an object's trans_inv can be. */
+typedef enum dmnsn_transform_kind {
+  DMNSN_TRANSFORM_IDENTITY,  /**< No transformation at all. */
+  DMNSN_TRANSFORM_TRANSLATE, /**< A translation. */
+  DMNSN_TRANSFORM_SCALE,     /**< A positive uniform scale, then a translation. */
+  DMNSN_TRANSFORM_GENERAL    /**< Any other affine transformation. */
+} dmnsn_transform_kind;
+
 /** An object. */
 struct dmnsn_object {
   const dmnsn_object_vtable *vtable; /**< Callbacks. */
@@ -96,6 +161,7 @@ struct dmnsn_object {
   /* Precomputed values */
   bool precomputed; /**< @internal Whether the object is precomputed yet. */
   dmnsn_matrix trans_inv; /**< Inverse of the transformation matrix. */
+  dmnsn_transform_kind trans_kind; /**< @internal The kind of trans_inv. */
   dmnsn_matrix pigment_trans; /**< Inverse transformation for the texture. */
   dmnsn_aabb aabb; /**< Bounding box in world coordinates. */
 };
@@ -120,30 +186,103 @@ void dmnsn_init_object(dmnsn_object *object);
 void dmnsn_object_precompute(dmnsn_object *object);
 
 /**
- * Appropriately transform a ray, then test for an intersection.
+ * Transform a ray into an object's coordinate system.  Cheaper special cases
+ * are used for the common transformations that dmnsn_object_precompute()
+ * detects.
+ * @param[in] object  The object whose coordinates to use.
+ * @param[in] ray     The ray to transform.
+ * @return The transformed ray.
+ */
+DMNSN_INLINE dmnsn_ray
+dmnsn_object_transform_ray(const dmnsn_object *object, dmnsn_ray ray)
+{
+  const dmnsn_matrix *M = &object->trans_inv;
+  unsigned int i;
+
+  switch (object->trans_kind) {
+  case DMNSN_TRANSFORM_IDENTITY:
+    break;
+
+  case DMNSN_TRANSFORM_TRANSLATE:
+    for (i = 0; i < 3; ++i) {
+      ray.x0.n[i] += M->n[i][3];
+    }
+    break;
+
+  case DMNSN_TRANSFORM_SCALE:
+    for (i = 0; i < 3; ++i) {
+      ray.x0.n[i] = M->n[0][0]*ray.x0.n[i] + M->n[i][3];
+      ray.n.n[i] *= M->n[0][0];
+    }
+    break;
+
+  default:
+    ray = dmnsn_transform_ray(*M, ray);
+    break;
+  }
+
+  return ray;
+}
+
+/**
+ * Transform a point into an object's coordinate system.
+ * @param[in] object  The object whose coordinates to use.
+ * @param[in] point   The point to transform.
+ * @return The transformed point.
+ */
+DMNSN_INLINE dmnsn_vector
+dmnsn_object_transform_point(const dmnsn_object *object, dmnsn_vector point)
+{
+  const dmnsn_matrix *M = &object->trans_inv;
+  unsigned int i;
+
+  switch (object->trans_kind) {
+  case DMNSN_TRANSFORM_IDENTITY:
+    break;
+
+  case DMNSN_TRANSFORM_TRANSLATE:
+    for (i = 0; i < 3; ++i) {
+      point.n[i] += M->n[i][3];
+    }
+    break;
+
+  case DMNSN_TRANSFORM_SCALE:
+    for (i = 0; i < 3; ++i) {
+      point.n[i] = M->n[0][0]*point.n[i] + M->n[i][3];
+    }
+    break;
+
+  default:
+    point = dmnsn_transform_point(*M, point);
+    break;
+  }
+
+  return point;
+}
+
+/**
+ * Appropriately transform a ray, then find the closest intersection, without
+ * computing its normal.  Use this to cheaply compare many candidate
+ * intersections, then call dmnsn_object_finalize() on the closest one.
  * @param[in]  object        The object to test.
  * @param[in]  ray           The ray to test.
  * @param[out] intersection  Where to store the intersection details.
  * @return Whether there was an intersection.
  */
 DMNSN_INLINE bool
-dmnsn_object_intersection(const dmnsn_object *object, dmnsn_ray ray,
-                          dmnsn_intersection *intersection)
+dmnsn_object_hit(const dmnsn_object *object, dmnsn_ray ray,
+                 dmnsn_intersection *intersection)
 {
-  dmnsn_ray ray_trans = dmnsn_transform_ray(object->trans_inv, ray);
+  dmnsn_ray ray_trans = dmnsn_object_transform_ray(object, ray);
   intersection->object = NULL;
+  intersection->instanced = false;
   if (object->vtable->intersection_fn(object, ray_trans, intersection)) {
-    /* Get us back into world coordinates */
     intersection->ray = ray;
-    intersection->normal = dmnsn_vector_normalized(
-      dmnsn_transform_normal(object->trans_inv, intersection->normal)
-    );
     if (!intersection->object) {
       intersection->object = object;
     }
 
     dmnsn_assert(!dmnsn_isnan(intersection->t), "Intersection point is NaN.");
-    dmnsn_assert(!dmnsn_vector_isnan(intersection->normal), "Intersection normal is NaN.");
 
     return true;
   } else {
@@ -151,6 +290,132 @@ dmnsn_object_intersection(const dmnsn_object *object, dmnsn_ray ray,
   }
 }
 
+/**
+ * Like dmnsn_object_hit(), but for several rays at once.
+ * @param[in]  object         The object to test.
+ * @param[in]  rays           The rays to test.
+ * @param[in]  mask           A bitmask of the rays to test.
+ * @param[out] intersections  Where to store the intersection details.
+ * @return A bitmask of the rays that intersected \p object.
+ */
+DMNSN_INLINE unsigned int
+dmnsn_object_hit_packet(const dmnsn_object *object,
+                        const dmnsn_ray rays[DMNSN_OBJECT_PACKET_SIZE],
+                        unsigned int mask,
+                        dmnsn_intersection intersections[DMNSN_OBJECT_PACKET_SIZE])
+{
+  dmnsn_ray rays_trans[DMNSN_OBJECT_PACKET_SIZE];
+  unsigned int i, first = DMNSN_OBJECT_PACKET_SIZE, hits = 0;
+
+  if (!object->vtable->packet_fn) {
+    for (i = 0; i < DMNSN_OBJECT_PACKET_SIZE; ++i) {
+      if ((mask & (1U << i)) && dmnsn_object_hit(object, rays[i], &intersections[i])) {
+        hits |= 1U << i;
+      }
+    }
+    return hits;
+  }
+
+  for (i = 0; i < DMNSN_OBJECT_PACKET_SIZE; ++i) {
+    if (mask & (1U << i)) {
+      rays_trans[i] = dmnsn_object_transform_ray(object, rays[i]);
+      intersections[i].object = NULL;
+      intersections[i].instanced = false;
+      if (first == DMNSN_OBJECT_PACKET_SIZE) {
+        first = i;
+      }
+    }
+  }
+  if (first == DMNSN_OBJECT_PACKET_SIZE) {
+    return 0;
+  }
+
+  /* Fill the unused slots, so the callback can process every ray uniformly */
+  for (i = 0; i < DMNSN_OBJECT_PACKET_SIZE; ++i) {
+    if (!(mask & (1U << i))) {
+      rays_trans[i] = rays_trans[first];
+    }
+  }
+
+  hits = object->vtable->packet_fn(object, rays_trans, mask, intersections) & mask;
+  for (i = 0; i < DMNSN_OBJECT_PACKET_SIZE; ++i) {
+    if (hits & (1U << i)) {
+      intersections[i].ray = rays[i];
+      if (!intersections[i].object) {
+        intersections[i].object = object;
+      }
+
+      dmnsn_assert(!dmnsn_isnan(intersections[i].t), "Intersection point is NaN.");
+    }
+  }
+  return hits;
+}
+
+/**
+ * Compute the world-space normal of an intersection from dmnsn_object_hit().
+ * @param[in]     object        The object passed to dmnsn_object_hit().
+ * @param[in,out] intersection  The intersection to finalize.
+ */
+DMNSN_INLINE void
+dmnsn_object_finalize(const dmnsn_object *object,
+                      dmnsn_intersection *intersection)
+{
+  if (object->vtable->finalize_fn) {
+    dmnsn_ray ray_trans = dmnsn_object_transform_ray(object, intersection->ray);
+    object->vtable->finalize_fn(object, ray_trans, intersection);
+  }
+
+  /* Get us back into world coordinates.  Translations and positive uniform
+     scales don't change the direction of the normal. */
+  if (object->trans_kind == DMNSN_TRANSFORM_GENERAL) {
+    intersection->normal = dmnsn_transform_normal(object->trans_inv, intersection->normal);
+  }
+  intersection->normal = dmnsn_vector_normalized(intersection->normal);
+
+  dmnsn_assert(!dmnsn_vector_isnan(intersection->normal), "Intersection normal is NaN.");
+}
+
+/**
+ * Appropriately transform a ray, then test for an intersection.
+ * @param[in]  object        The object to test.
+ * @param[in]  ray           The ray to test.
+ * @param[out] intersection  Where to store the intersection details.
+ * @return Whether there was an intersection.
+ */
+DMNSN_INLINE bool
+dmnsn_object_intersection(const dmnsn_object *object, dmnsn_ray ray,
+                          dmnsn_intersection *intersection)
+{
+  if (dmnsn_object_hit(object, ray, intersection)) {
+    dmnsn_object_finalize(object, intersection);
+    return true;
+  } else {
+    return false;
+  }
+}
+
+/**
+ * Appropriately transform a ray, then test whether it intersects an object
+ * before a given line index.  Unlike dmnsn_object_intersection(), no normal is
+ * computed.
+ * @param[in] object  The object to test.
+ * @param[in] ray     The ray to test.
+ * @param[in] t       The line index past which intersections don't count.
+ * @return Whether there was an intersection before \p t.
+ */
+DMNSN_INLINE bool
+dmnsn_object_occlusion(const dmnsn_object *object, dmnsn_ray ray, double t)
+{
+  dmnsn_ray ray_trans = dmnsn_object_transform_ray(object, ray);
+  if (object->vtable->occlusion_fn) {
+    return object->vtable->occlusion_fn(object, ray_trans, t);
+  } else {
+    dmnsn_intersection intersection;
+    return object->vtable->intersection_fn(object, ray_trans, &intersection)
+      && intersection.t < t;
+  }
+}
+
 /**
  * Appropriately transform a point, then test for containment.
  * @param[in] object  The object to test.
@@ -160,6 +425,6 @@ dmnsn_object_intersection(const dmnsn_object *object, dmnsn_ray ray,
 DMNSN_INLINE bool
 dmnsn_object_inside(const dmnsn_object *object, dmnsn_vector point)
 {
-  point = dmnsn_transform_point(object->trans_inv, point);
+  point = dmnsn_object_transform_point(object, point);
   return object->vtable->inside_fn(object, point);
 }
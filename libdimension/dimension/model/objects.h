@@ -24,6 +24,8 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /**
  * A flat triangle.
@@ -61,6 +63,46 @@ dmnsn_object *dmnsn_new_triangle_fan(dmnsn_pool *pool, dmnsn_vector vertices[],
  */
 dmnsn_object *dmnsn_new_smooth_triangle_fan(dmnsn_pool *pool, dmnsn_vector vertices[], dmnsn_vector normals[], size_t nvertices);
 
+/**
+ * An indexed triangle mesh.  All the triangles share a single object, and a
+ * bounding hierarchy over them is built immediately.  Vertices and normals are
+ * stored in single precision.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in] vertices  The vertices of the mesh.
+ * @param[in] normals  The normal vector for each vertex, or NULL for a mesh of
+ *                     flat triangles.
+ * @param[in] nvertices  The number of vertices (and normals).
+ * @param[in] indices  Three vertex indices for each triangle.
+ * @param[in] ntriangles  The number of triangles.
+ * @return A triangle mesh, or NULL with errno set to EINVAL if the mesh is
+ *         empty, too big, has an index out of range, or has a coordinate that
+ *         isn't finite in single precision.
+ */
+dmnsn_object *dmnsn_new_mesh(dmnsn_pool *pool, const dmnsn_vector vertices[], const dmnsn_vector normals[], size_t nvertices, const uint32_t indices[], size_t ntriangles);
+
+/**
+ * Load a triangle mesh from a Wavefront OBJ or binary PLY file.  The format is
+ * detected from the contents of the file, which is memory-mapped if possible
+ * and parsed in parallel.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in,out] file  The file to read from.
+ * @return A triangle mesh, or NULL on failure, with errno set.
+ */
+dmnsn_object *dmnsn_read_mesh(dmnsn_pool *pool, FILE *file);
+
+/**
+ * An instance of another object.  Every instance of a prototype shares its
+ * geometry and bounding hierarchy, so many copies of a complex object cost
+ * little more than one.  Instances are textured like CSG objects: parts of the
+ * prototype with their own texture keep it, placed relative to the instance,
+ * and the rest take the instance's texture, which defaults to the prototype's.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in,out] prototype  The object to instance.  It must not be added to
+ *                           a scene itself.
+ * @return An instance of \p prototype.
+ */
+dmnsn_object *dmnsn_new_instance(dmnsn_pool *pool, dmnsn_object *prototype);
+
 /**
  * A plane.
  * @param[in] pool  The memory pool to allocate from.
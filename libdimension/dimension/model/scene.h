@@ -37,6 +37,27 @@ enum {
 /** Render quality. */
 typedef unsigned int dmnsn_quality;
 
+/** Order in which image tiles are handed out to render threads. */
+typedef enum dmnsn_tile_order {
+  DMNSN_TILE_SCANLINE,   /**< Left to right, top to bottom. */
+  DMNSN_TILE_HILBERT,    /**< Along a Hilbert curve, for cache locality. */
+  DMNSN_TILE_CENTER_OUT, /**< Outwards from the center of the image. */
+} dmnsn_tile_order;
+
+/** Bounding volume hierarchy builders. */
+typedef enum dmnsn_bvh_kind {
+  DMNSN_BVH_NONE,   /**< No hierarchy; test every object. */
+  DMNSN_BVH_PRTREE, /**< Priority R-tree, optimal for worst-case queries. */
+  DMNSN_BVH_SAH,    /**< Binned surface area heuristic, for cheap rays. */
+  DMNSN_BVH_LBVH,   /**< Linear BVH, for fast builds. */
+} dmnsn_bvh_kind;
+
+/** Orders in which rays visit the nodes of a bounding hierarchy. */
+typedef enum dmnsn_bvh_traversal {
+  DMNSN_BVH_PREORDER, /**< In the order the hierarchy was built. */
+  DMNSN_BVH_ORDERED,  /**< Nearest children first, skipping farther ones. */
+} dmnsn_bvh_traversal;
+
 /** An entire scene. */
 typedef struct dmnsn_scene {
   /* World attributes */
@@ -74,10 +95,23 @@ typedef struct dmnsn_scene {
   /** Number of parallel threads. */
   unsigned int nthreads;
 
+  /* Render scheduling. */
+  size_t tile_width;  /**< Width of a render tile, or 0 for the whole row. */
+  size_t tile_height; /**< Height of a render tile, or 0 for the whole column. */
+  dmnsn_tile_order tile_order; /**< Order in which tiles are rendered. */
+
+  /* Bounding hierarchy. */
+  dmnsn_bvh_kind bvh_kind;           /**< Bounding hierarchy builder. */
+  dmnsn_bvh_traversal bvh_traversal; /**< Bounding hierarchy traversal. */
+
   /** Timers. */
   dmnsn_timer bounding_timer;
   dmnsn_timer render_timer;
 
+  /* Shadow statistics. */
+  size_t shadow_cache_lookups; /**< Shadow rays that tried a cached occluder. */
+  size_t shadow_cache_hits;    /**< Shadow rays blocked by a cached occluder. */
+
   bool initialized; /**< @internal Whether the scene is initialized. */
 } dmnsn_scene;
 
@@ -26,9 +26,17 @@
 #include "internal.h"
 #include "dimension.h"
 #include "internal/bvh.h"
+#include "internal/canvas.h"
 #include "internal/concurrency.h"
 #include "internal/future.h"
+#include "internal/lbvh.h"
+#include "internal/mesh.h"
+#include "internal/object.h"
+#include "internal/packet.h"
 #include "internal/platform.h"
 #include "internal/polynomial.h"
 #include "internal/prtree.h"
 #include "internal/rgba.h"
+#include "internal/sah.h"
+#include "internal/sort.h"
+#include "internal/tiles.h"
@@ -36,22 +36,43 @@
 /// A bounding volume hierarchy.
 typedef struct dmnsn_bvh dmnsn_bvh;
 
-/// Available BVH implementations.
-typedef enum dmnsn_bvh_kind {
-  DMNSN_BVH_NONE,
-  DMNSN_BVH_PRTREE,
-} dmnsn_bvh_kind;
-
 /// Create a BVH.
 DMNSN_INTERNAL dmnsn_bvh *dmnsn_new_bvh(const dmnsn_array *objects,
-                                        dmnsn_bvh_kind kind);
+                                        dmnsn_bvh_kind kind,
+                                        dmnsn_bvh_traversal traversal);
 /// Delete a BVH.
 DMNSN_INTERNAL void dmnsn_delete_bvh(dmnsn_bvh *bvh);
 
-/// Find the closest ray-object intersection in the tree.
-DMNSN_INTERNAL bool dmnsn_bvh_intersection(const dmnsn_bvh *bvh, dmnsn_ray ray, dmnsn_intersection *intersection, bool reset);
+/// Per-thread state for BVH queries.
+typedef struct dmnsn_intersection_cache dmnsn_intersection_cache;
+
+/// Create an intersection cache, for queries against \p bvh from one thread.
+DMNSN_INTERNAL dmnsn_intersection_cache *dmnsn_new_intersection_cache(const dmnsn_bvh *bvh);
+/// Delete an intersection cache.
+DMNSN_INTERNAL void dmnsn_delete_intersection_cache(dmnsn_intersection_cache *cache);
+/// Start a new ray tree, as if the next query were made with reset = true.
+DMNSN_INTERNAL void dmnsn_intersection_cache_reset(dmnsn_intersection_cache *cache);
+
+// The queries below take an intersection cache created for the same BVH.  If
+// it is NULL, a thread-local cache is used instead, at the cost of a lookup.
+
+/// Find the closest ray-object intersection in the tree.  If \p object is
+/// non-NULL, it is set to the top-level object that was hit, since
+/// intersection->object may be nested inside it.
+DMNSN_INTERNAL bool dmnsn_bvh_intersection(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, dmnsn_ray ray, dmnsn_intersection *intersection, dmnsn_object **object, bool reset);
+/// The number of rays traced together by dmnsn_bvh_intersection_packet().
+#define DMNSN_BVH_PACKET_SIZE DMNSN_OBJECT_PACKET_SIZE
+/// Find the closest intersection of each ray selected by the bitmask \p mask,
+/// traversing the tree once for the whole packet.  Rays that don't share a
+/// direction octant are traced individually.  Returns a bitmask of the rays
+/// that hit something.  If \p objects is non-NULL, each objects[k] is tested
+/// first, and then set to the top-level object hit by the k'th ray, or NULL.
+DMNSN_INTERNAL unsigned int dmnsn_bvh_intersection_packet(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, const dmnsn_ray rays[DMNSN_BVH_PACKET_SIZE], unsigned int mask, dmnsn_intersection intersections[DMNSN_BVH_PACKET_SIZE], dmnsn_object *objects[DMNSN_BVH_PACKET_SIZE]);
+/// Determine whether a ray hits any object in the tree before \p t.  If
+/// \p occluder is non-NULL, *occluder is tested first, and updated on a hit.
+DMNSN_INTERNAL bool dmnsn_bvh_occluded(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, dmnsn_ray ray, double t, dmnsn_object **occluder);
 /// Determine whether a point is inside any object in the tree.
-DMNSN_INTERNAL bool dmnsn_bvh_inside(const dmnsn_bvh *bvh, dmnsn_vector point);
+DMNSN_INTERNAL bool dmnsn_bvh_inside(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache, dmnsn_vector point);
 /// Return the bounding box of the whole hierarchy.
 DMNSN_INTERNAL dmnsn_aabb dmnsn_bvh_aabb(const dmnsn_bvh *bvh);
 
@@ -76,4 +97,22 @@ DMNSN_INTERNAL void dmnsn_delete_bvh_node(dmnsn_bvh_node *node);
 /// Add a child to a BVH node.
 DMNSN_INTERNAL void dmnsn_bvh_node_add(dmnsn_bvh_node *parent, dmnsn_bvh_node *child);
 
+/// Recompute the bounding box of a node from its children.
+DMNSN_INTERNAL void dmnsn_bvh_node_refit(dmnsn_bvh_node *node);
+
+/// Smallest box containing both \p a and \p b.
+DMNSN_INLINE dmnsn_aabb
+dmnsn_bvh_union(dmnsn_aabb a, dmnsn_aabb b)
+{
+  return dmnsn_new_aabb(dmnsn_vector_min(a.min, b.min), dmnsn_vector_max(a.max, b.max));
+}
+
+/// Half the surface area of a box; the builders only compare areas.
+DMNSN_INLINE double
+dmnsn_bvh_area(dmnsn_aabb box)
+{
+  dmnsn_vector d = dmnsn_vector_sub(box.max, box.min);
+  return d.X*d.Y + d.Y*d.Z + d.Z*d.X;
+}
+
 #endif // DMNSN_INTERNAL_BVH_H
@@ -0,0 +1,84 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Canvas internals: direct pixel reads, and row completion tracking for
+ * streaming canvases while they're rendered.
+ */
+
+#ifndef DMNSN_INTERNAL_CANVAS_H
+#define DMNSN_INTERNAL_CANVAS_H
+
+#include "internal.h"
+#include "dimension/canvas.h"
+#include <stdbool.h>
+
+/// A good buffer size for reading pixels in chunks with dmnsn_canvas_read_span().
+#define DMNSN_CANVAS_SPAN 64
+
+/**
+ * Read a run of pixels.
+ * @param[in] canvas  The canvas to read.
+ * @param[in] x  The x coordinate of the first pixel.
+ * @param[in] y  The y coordinate of the row.
+ * @param[in] n  The number of pixels to read.
+ * @param[out] buffer  Space for \p n pixels, if they need to be converted.
+ * @return The \p n pixels, either in \p buffer or pointing straight into the
+ *         canvas if it already stores them contiguously as tcolors.
+ */
+DMNSN_INLINE const dmnsn_tcolor *
+dmnsn_canvas_read_span(const dmnsn_canvas *canvas, size_t x, size_t y, size_t n, dmnsn_tcolor *buffer)
+{
+  if (canvas->format == DMNSN_CANVAS_DOUBLE) {
+    dmnsn_assert(x + n <= canvas->width && y < canvas->height,
+                 "Canvas access out of bounds.");
+    return (const dmnsn_tcolor *)canvas->pixels + y*canvas->width + x;
+  } else {
+    dmnsn_canvas_get_span(canvas, x, y, n, buffer);
+    return buffer;
+  }
+}
+
+/// Mark every row of a canvas as unfinished, before rendering to it.
+DMNSN_INTERNAL void dmnsn_canvas_begin_rows(dmnsn_canvas *canvas);
+
+/// Mark \p n pixels of row \p y as finished.
+DMNSN_INTERNAL void dmnsn_canvas_finish_span(dmnsn_canvas *canvas, size_t y, size_t n);
+
+/// Stop tracking rows, because rendering has ended (successfully or not).
+/// Unfinished rows are abandoned, so later waits don't block or fail.
+DMNSN_INTERNAL void dmnsn_canvas_end_rows(dmnsn_canvas *canvas);
+
+/// Whether a canvas is currently being rendered to.
+DMNSN_INTERNAL bool dmnsn_canvas_is_rendering(const dmnsn_canvas *canvas);
+
+/**
+ * Wait for a row to be finished.
+ * @param[in] canvas  The canvas to wait on.
+ * @param[in] y  The row to wait for.
+ * @param[in,out] future  The waiting task's future, to stop waiting if it is
+ *                        cancelled.  May be NULL.
+ * @return Whether the row was finished, rather than abandoned by a failed
+ *         render or a cancelled wait.
+ */
+DMNSN_INTERNAL bool dmnsn_canvas_wait_row(const dmnsn_canvas *canvas, size_t y, dmnsn_future *future);
+
+#endif // DMNSN_INTERNAL_CANVAS_H
@@ -29,16 +29,28 @@
 #include "internal.h"
 #include "dimension/concurrency.h"
 #include <pthread.h>
+#include <stdatomic.h>
 
 /// Allocate a new future object.
 DMNSN_INTERNAL dmnsn_future *dmnsn_new_future(void);
 
 /// Set the total number of loop iterations.
 DMNSN_INTERNAL void dmnsn_future_set_total(dmnsn_future *future, size_t total);
-/// Increment the progress of a background task.
+/**
+ * Increment the progress of a background task.  Increments are batched per
+ * thread, and only published every so often, or whenever the future is
+ * paused, cancelled, or waited on.
+ */
 DMNSN_INTERNAL void dmnsn_future_increment(dmnsn_future *future);
+/**
+ * Publish the calling thread's batched increments.  Threads must call this
+ * before they stop working on a future; dmnsn_new_thread(),
+ * dmnsn_execute_concurrently(), and dmnsn_future_finish_thread() do it for
+ * you.
+ */
+DMNSN_INTERNAL void dmnsn_future_flush(void);
 /// Instantly complete the background teask.
-DMNSN_INTERNAL void dmnsn_future_finish(dmnsn_future *future);
+DMNSN_INTERNAL void dmnsn_future_finish(dmnsn_future *future, int retval);
 /// Set the number of worker threads.
 DMNSN_INTERNAL void dmnsn_future_set_nthreads(dmnsn_future *future, unsigned int nthreads);
 /// Notify completion of a worker thread.
@@ -52,7 +64,19 @@ DMNSN_INTERNAL void dmnsn_future_finish_thread(dmnsn_future *future);
 typedef int dmnsn_thread_fn(void *ptr);
 
 /**
- * Create a thread that cleans up after itself on errors.
+ * Run a task on a pooled worker thread.  A worker is always available
+ * immediately, so tasks may safely wait on each other.
+ * @param[in]     task_fn  The task callback.
+ * @param[in,out] arg      The pointer to pass to the task callback.
+ */
+DMNSN_INTERNAL void dmnsn_submit_task(dmnsn_callback_fn *task_fn, void *arg);
+
+/**
+ * Create a thread that cleans up after itself on errors.  The thread runs on a
+ * pooled worker, so it can't be cancelled asynchronously; dmnsn_future_cancel()
+ * only takes effect when the thread calls dmnsn_future_increment(), or when it
+ * is woken from a wait registered with dmnsn_future_watch_cancel().  Threads
+ * that never report progress run to completion.
  * @param[in,out] future     The future object to associate with the thread.
  * @param[in]     thread_fn  The thread callback.
  * @param[in,out] arg        The pointer to pass to the thread callback.
@@ -71,7 +95,8 @@ typedef int dmnsn_ccthread_fn(void *ptr, unsigned int thread,
                               unsigned int nthreads);
 
 /**
- * Run \p nthreads threads in parallel.
+ * Run \p nthreads threads in parallel.  Like dmnsn_new_thread(), the threads
+ * are only cancelled from dmnsn_future_increment().
  * @param[in,out] future       The future object to associate with the threads,
  *                             possibly NULL.
  * @param[in]     ccthread_fn  The routine to run in each concurrent thread.
@@ -83,6 +108,38 @@ DMNSN_INTERNAL int dmnsn_execute_concurrently(dmnsn_future *future,
                                               dmnsn_ccthread_fn *ccthread_fn,
                                               void *arg, unsigned int nthreads);
 
+/**
+ * A group of spawned tasks that can be waited for together.  Initialize with
+ * DMNSN_TASK_GROUP_INITIALIZER.
+ */
+typedef struct dmnsn_task_group {
+  atomic_size_t pending; ///< The number of unfinished tasks.
+} dmnsn_task_group;
+
+/// Initializer for a dmnsn_task_group.
+#define DMNSN_TASK_GROUP_INITIALIZER { ATOMIC_VAR_INIT(0) }
+
+/**
+ * Spawn a task on the work-stealing runtime.  Tasks may spawn and sync tasks
+ * of their own, and nested tasks share the same workers.  At most
+ * dmnsn_ncpus() - 1 workers run at once, borrowed from the same thread pool as
+ * dmnsn_new_thread(), and they return to it when they run out of work.  Tasks
+ * must not block or report progress to a cancellable future; use
+ * dmnsn_execute_concurrently() for that.
+ * @param[in,out] group    The group to add the task to.
+ * @param[in]     task_fn  The task callback.
+ * @param[in,out] arg      The pointer to pass to the task callback.
+ */
+DMNSN_INTERNAL void dmnsn_spawn(dmnsn_task_group *group,
+                                dmnsn_callback_fn *task_fn, void *arg);
+
+/**
+ * Wait for every task in a group to complete.  The calling thread runs
+ * pending tasks while it waits.
+ * @param[in,out] group  The group to wait for.
+ */
+DMNSN_INTERNAL void dmnsn_sync(dmnsn_task_group *group);
+
 /**
  * Initialize a mutex, bailing out on failure.
  * @param[out] mutex  The mutex to initialize.
@@ -170,19 +227,6 @@ DMNSN_INTERNAL void dmnsn_initialize_cond(pthread_cond_t *cond);
 DMNSN_INTERNAL void dmnsn_cond_wait(pthread_cond_t *cond,
                                     pthread_mutex_t *mutex);
 
-/**
- * Wait on a condition variable, bailing out on error, and unlock the mutex if
- * cancelled.
- * @param[in] cond   The condition variable to wait on.
- * @param[in] mutex  The associated mutex.
- */
-#define dmnsn_cond_wait_safely(cond, mutex)                     \
-  do {                                                          \
-    pthread_cleanup_push(dmnsn_unlock_mutex_impl, (mutex));     \
-    dmnsn_cond_wait((cond), (mutex));                           \
-    pthread_cleanup_pop(false);                                 \
-  } while (0)
-
 /**
  * Signal a condition variable, bailing out on error.
  * @param[in] cond   The condition variable to signal.
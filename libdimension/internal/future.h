@@ -27,15 +27,36 @@
 #define DMNSN_INTERNAL_FUTURE_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+
+/// Flags that send dmnsn_future_increment() down its slow path.
+enum {
+  DMNSN_FUTURE_PAUSED    = 1 << 0, ///< Worker threads should pause.
+  DMNSN_FUTURE_CANCELLED = 1 << 1, ///< Worker threads should exit.
+  DMNSN_FUTURE_WAITING   = 1 << 2, ///< Someone is waiting for progress.
+};
+
+/// A thread blocked in dmnsn_future_wait_any().
+typedef struct dmnsn_future_notifier {
+  pthread_mutex_t *mutex; ///< Mutex guarding \p notified.
+  pthread_cond_t *cond;   ///< Condition variable to signal.
+  bool *notified;         ///< Set when any of the futures finishes.
+  struct dmnsn_future_notifier *next; ///< The next notifier in the list.
+} dmnsn_future_notifier;
 
 struct dmnsn_future {
-  size_t progress; ///< Completed loop iterations.
-  size_t total;    ///< Total expected loop iterations.
+  atomic_size_t progress; ///< Completed loop iterations.
+  atomic_size_t total;    ///< Total expected loop iterations.
 
-  /// The worker thread.
-  pthread_t thread;
+  /// Pending requests for the worker threads, checked on every increment.
+  atomic_uint flags;
 
-  /// Mutex to guard progress and total.
+  /// Whether the background task has finished.
+  bool finished;
+  /// The return value of the background task.
+  int retval;
+
+  /// Mutex to guard the remaining fields.
   pthread_mutex_t mutex;
 
   /// Condition variable for waiting for a particular amount of progress.
@@ -56,6 +77,40 @@ struct dmnsn_future {
   pthread_cond_t all_running_cond;
   /// Condition variable for waiting for npaused == 0.
   pthread_cond_t resume_cond;
+
+  /// Threads waiting for any of several futures, including this one.
+  dmnsn_future_notifier *notifiers;
+  /// Threads that want to be woken up if this future is cancelled.
+  dmnsn_future_notifier *cancel_notifiers;
+  /// The chain this future is a stage of, if any.
+  dmnsn_future *parent;
+
+  /// For chains created by dmnsn_future_then(), the first stage.
+  dmnsn_future *first;
+  /// For chains, the second stage, once it has started.
+  dmnsn_future *second;
+  /// For chains, the callback that starts the second stage.
+  dmnsn_future_fn *continuation;
+  /// For chains, the pointer to pass to \p continuation.
+  void *continuation_ptr;
+  /// For chains, the stage that dmnsn_future_pause() paused.
+  dmnsn_future *paused_stage;
+  /// The number of stages this future is made of.
+  unsigned int nstages;
 };
 
+/**
+ * Ask to be woken up when a future is cancelled, for threads that block on
+ * something other than the future itself.
+ * @param[in,out] future    The future to watch.
+ * @param[in,out] notifier  The notifier to set, with its mutex held, and
+ *                          broadcast to on cancellation.
+ * @return Whether the future was already cancelled, in which case \p notifier
+ *         is not registered.
+ */
+DMNSN_INTERNAL bool dmnsn_future_watch_cancel(dmnsn_future *future, dmnsn_future_notifier *notifier);
+
+/// Unregister a notifier added by dmnsn_future_watch_cancel().
+DMNSN_INTERNAL void dmnsn_future_unwatch_cancel(dmnsn_future *future, dmnsn_future_notifier *notifier);
+
 #endif // DMNSN_INTERNAL_FUTURE_H
@@ -0,0 +1,38 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Linear BVHs.  These are built by sorting the objects along a Morton (Z-order)
+ * curve, and splitting them wherever the Morton codes of their centroids first
+ * differ.  This is much faster than building a PR-tree or SAH tree, at the
+ * cost of some traversal speed, which local tree rotations win some of back.
+ */
+
+#ifndef DMNSN_INTERNAL_LBVH_H
+#define DMNSN_INTERNAL_LBVH_H
+
+#include "internal.h"
+#include "internal/bvh.h"
+
+/// Create a linear BVH.
+DMNSN_INTERNAL dmnsn_bvh_node *dmnsn_new_lbvh(const dmnsn_array *objects);
+
+#endif // DMNSN_INTERNAL_LBVH_H
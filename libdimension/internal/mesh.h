@@ -0,0 +1,82 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Triangle mesh construction and loading.
+ */
+
+#ifndef DMNSN_INTERNAL_MESH_H
+#define DMNSN_INTERNAL_MESH_H
+
+#include "internal.h"
+#include "dimension/model.h"
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// The most vertices or triangles a loaded mesh may have, leaving room for
+/// sentinel indices.
+#define DMNSN_MESH_MAX_SIZE (UINT32_MAX/2)
+
+/**
+ * Create a mesh from arrays in its internal format.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in] vertices  The vertices, allocated with dmnsn_malloc().  The mesh
+ *                      takes ownership.
+ * @param[in] normals  The unit normal for each vertex, allocated with
+ *                     dmnsn_malloc(), or NULL.  The mesh takes ownership.
+ * @param[in] nvertices  The number of vertices.
+ * @param[in] triangles  The vertex indices of each triangle, allocated with
+ *                       dmnsn_malloc().  The mesh takes ownership, and the
+ *                       indices must all be in range.
+ * @param[in] ntriangles  The number of triangles.
+ * @return A triangle mesh, or NULL with errno set to EINVAL if the mesh is
+ *         empty or too big.  The arrays are freed either way.
+ */
+DMNSN_INTERNAL dmnsn_object *dmnsn_new_mesh_arrays(dmnsn_pool *pool, float (*vertices)[3], float (*normals)[3], size_t nvertices, uint32_t (*triangles)[3], size_t ntriangles);
+
+/**
+ * Parse a mesh from a Wavefront OBJ file.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in] data  The contents of the file.
+ * @param[in] size  The size of the file.
+ * @return The mesh, or NULL with errno set on failure.
+ */
+DMNSN_INTERNAL dmnsn_object *dmnsn_parse_obj_mesh(dmnsn_pool *pool, const char *data, size_t size);
+
+/**
+ * Parse a mesh from a binary PLY file.
+ * @param[in] pool  The memory pool to allocate from.
+ * @param[in] data  The contents of the file.
+ * @param[in] size  The size of the file.
+ * @return The mesh, or NULL with errno set on failure.
+ */
+DMNSN_INTERNAL dmnsn_object *dmnsn_parse_ply_mesh(dmnsn_pool *pool, const char *data, size_t size);
+
+/// Whether a loaded coordinate is finite, even in single precision.
+DMNSN_INLINE bool
+dmnsn_mesh_coordinate_valid(double x)
+{
+  return fabs(x) <= FLT_MAX;
+}
+
+#endif // DMNSN_INTERNAL_MESH_H
@@ -0,0 +1,50 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Internal object precomputation interface.
+ */
+
+#ifndef DMNSN_INTERNAL_OBJECT_H
+#define DMNSN_INTERNAL_OBJECT_H
+
+#include "internal.h"
+#include "internal/concurrency.h"
+#include "dimension/model.h"
+
+/**
+ * Precompute the textures and transformations of an object and its children.
+ * This must be done serially, since textures may be shared between objects.
+ * @param[in,out] object  The object to precompute.
+ */
+DMNSN_INTERNAL void dmnsn_object_precompute_serial(dmnsn_object *object);
+
+/**
+ * Finish precomputing an object in parallel, e.g. by building the bounding
+ * hierarchies of unions.  dmnsn_object_precompute_serial() must be called
+ * first.
+ * @param[in,out] group   The task group to spawn work in.
+ * @param[in,out] object  The object to precompute.
+ */
+DMNSN_INTERNAL void dmnsn_object_precompute_spawn(dmnsn_task_group *group,
+                                                  dmnsn_object *object);
+
+#endif // DMNSN_INTERNAL_OBJECT_H
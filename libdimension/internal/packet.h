@@ -0,0 +1,136 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Helpers for vectorized packet intersection callbacks.  The kernels built on
+ * these must produce bit-for-bit the same results as the scalar intersection
+ * callbacks, so they perform the same double-precision operations in the same
+ * order, two rays at a time.
+ */
+
+#ifndef DMNSN_INTERNAL_PACKET_H
+#define DMNSN_INTERNAL_PACKET_H
+
+#include "internal.h"
+#include "dimension/model.h"
+#include <stdint.h>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+/// A packet of rays in structure-of-arrays layout.
+typedef struct dmnsn_ray_packet {
+  double x0[3][DMNSN_OBJECT_PACKET_SIZE]; ///< The origins, by component.
+  double n[3][DMNSN_OBJECT_PACKET_SIZE];  ///< The directions, by component.
+} dmnsn_ray_packet;
+
+/// Transpose an array of rays into a packet.
+DMNSN_INTERNAL DMNSN_INLINE void
+dmnsn_ray_packet_load(dmnsn_ray_packet *packet,
+                      const dmnsn_ray rays[DMNSN_OBJECT_PACKET_SIZE])
+{
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    for (size_t i = 0; i < 3; ++i) {
+      packet->x0[i][k] = rays[k].x0.n[i];
+      packet->n[i][k] = rays[k].n.n[i];
+    }
+  }
+}
+
+#ifdef __SSE2__
+
+/// Load rays \p k and <tt>k + 1</tt> of a packet.
+DMNSN_INTERNAL DMNSN_INLINE void
+dmnsn_ray_packet_get(const dmnsn_ray_packet *packet, size_t k,
+                     __m128d x0[3], __m128d n[3])
+{
+  for (size_t i = 0; i < 3; ++i) {
+    x0[i] = _mm_loadu_pd(&packet->x0[i][k]);
+    n[i] = _mm_loadu_pd(&packet->n[i][k]);
+  }
+}
+
+/// Negate each lane, exactly like unary minus (unlike subtraction from zero).
+DMNSN_INTERNAL DMNSN_INLINE __m128d
+dmnsn_neg_pd(__m128d x)
+{
+  return _mm_xor_pd(x, _mm_set1_pd(-0.0));
+}
+
+/// Pick lanes from \p a where \p mask is set, and from \p b elsewhere.
+DMNSN_INTERNAL DMNSN_INLINE __m128d
+dmnsn_select_pd(__m128d mask, __m128d a, __m128d b)
+{
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+/// Dot product of lanes, in the same order as dmnsn_vector_dot().
+DMNSN_INTERNAL DMNSN_INLINE __m128d
+dmnsn_dot_pd(const __m128d a[3], const __m128d b[3])
+{
+  __m128d result = _mm_setzero_pd();
+  for (size_t i = 0; i < 3; ++i) {
+    result = _mm_add_pd(result, _mm_mul_pd(a[i], b[i]));
+  }
+  return result;
+}
+
+/**
+ * Solve quadratics exactly as dmnsn_polynomial_solve() does, for the common
+ * case where neither the leading nor the constant coefficient is negligible.
+ * @param[in]  poly  The coefficients of each quadratic.
+ * @param[out] x     The roots, larger first, as dmnsn_polynomial_solve() would
+ *                   store them.
+ * @param[out] one   Which lanes have at least one positive root (in x[0]).
+ * @param[out] two   Which lanes have two positive roots.
+ * @return Which lanes must be solved by dmnsn_polynomial_solve() instead.
+ */
+DMNSN_INTERNAL DMNSN_INLINE __m128d
+dmnsn_solve_quadratic_pd(const __m128d poly[3], __m128d x[2],
+                         __m128d *one, __m128d *two)
+{
+  __m128d abs = _mm_castsi128_pd(_mm_set1_epi64x(INT64_MAX));
+  __m128d epsilon = _mm_set1_pd(dmnsn_epsilon);
+
+  // Normalize the leading coefficient to 1.0
+  __m128d p1 = _mm_div_pd(poly[1], poly[2]);
+  __m128d p0 = _mm_div_pd(poly[0], poly[2]);
+  __m128d slow = _mm_or_pd(
+    _mm_cmpnge_pd(_mm_and_pd(poly[2], abs), epsilon),
+    _mm_cmpnge_pd(_mm_and_pd(p0, abs), epsilon)
+  );
+
+  __m128d disc = _mm_sub_pd(_mm_mul_pd(p1, p1), _mm_mul_pd(_mm_set1_pd(4.0), p0));
+  __m128d real = _mm_cmpge_pd(disc, _mm_setzero_pd());
+  __m128d s = _mm_sqrt_pd(disc);
+  __m128d mp1 = dmnsn_neg_pd(p1);
+  x[0] = _mm_div_pd(_mm_add_pd(mp1, s), _mm_set1_pd(2.0));
+  x[1] = _mm_div_pd(_mm_sub_pd(mp1, s), _mm_set1_pd(2.0));
+
+  *two = _mm_and_pd(real, _mm_cmpge_pd(x[1], epsilon));
+  *one = _mm_or_pd(*two, _mm_and_pd(real, _mm_cmpge_pd(x[0], epsilon)));
+  return slow;
+}
+
+#endif // __SSE2__
+
+#endif // DMNSN_INTERNAL_PACKET_H
@@ -64,4 +64,27 @@ DMNSN_INTERNAL size_t dmnsn_ncpus(void);
  */
 DMNSN_INTERNAL void dmnsn_get_times(dmnsn_timer *timer);
 
+/// The contents of a file, mapped into memory.
+typedef struct dmnsn_mapped_file {
+  const char *data; ///< The contents of the file.
+  size_t size;      ///< The size of the file.
+  void *mapping;    ///< The mmap()ed region, or NULL if the file was read.
+  size_t length;    ///< The length of the mmap()ed region.
+} dmnsn_mapped_file;
+
+/**
+ * Map the contents of a file into memory, with mmap() if possible, or by
+ * reading the whole thing otherwise.
+ * @param[in]  file  The file to map, from its current position.
+ * @param[out] map   The mapped contents.
+ * @return 0 on success, non-zero with errno set on failure.
+ */
+DMNSN_INTERNAL int dmnsn_map_file(FILE *file, dmnsn_mapped_file *map);
+
+/**
+ * Release a file mapped with dmnsn_map_file().
+ * @param[in,out] map  The mapping to release.
+ */
+DMNSN_INTERNAL void dmnsn_unmap_file(dmnsn_mapped_file *map);
+
 #endif // DMNSN_INTERNAL_PLATFORM_H
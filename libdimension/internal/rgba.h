@@ -42,6 +42,29 @@ typedef struct dmnsn_rgba16_optimizer {
   uint16_t data[];
 } dmnsn_rgba16_optimizer;
 
+/**
+ * @name sRGB conversion kernels
+ *
+ * These convert runs of pixels between linear tcolors and gamma-encoded RGBA
+ * integers (with transparency, not opacity, in the alpha channel).  Encoding
+ * interpolates a table instead of calling pow(); the interpolated gamma curve
+ * is within 6e-7 of the exact one, or 1/25 of a 16-bit step, so channels are
+ * at most one step away from exact rounding.  With SSE2 or AVX2, encoding works
+ * on a few pixels at once, with identical results.  Decoding is exact.
+ * @{
+ */
+
+/// Convert linear tcolors to 8-bit sRGBA.
+DMNSN_INTERNAL void dmnsn_tcolors_to_rgba8(const dmnsn_tcolor *tcolors, size_t n, uint8_t *rgba);
+/// Convert linear tcolors to 16-bit sRGBA.
+DMNSN_INTERNAL void dmnsn_tcolors_to_rgba16(const dmnsn_tcolor *tcolors, size_t n, uint16_t *rgba);
+/// Convert 8-bit sRGB(A) to linear tcolors.  \p channels is 3 or 4.
+DMNSN_INTERNAL void dmnsn_rgba8_to_tcolors(const uint8_t *rgba, size_t n, unsigned int channels, dmnsn_tcolor *tcolors);
+/// Convert 16-bit sRGB(A) to linear tcolors.  \p channels is 3 or 4.
+DMNSN_INTERNAL void dmnsn_rgba16_to_tcolors(const uint16_t *rgba, size_t n, unsigned int channels, dmnsn_tcolor *tcolors);
+
+/// @}
+
 /// Apply the RGBA8 optimizer to a canvas.
 DMNSN_INTERNAL void dmnsn_rgba8_optimize_canvas(dmnsn_pool *pool, dmnsn_canvas *canvas);
 /// Apply the RGBA16 optimizer to a canvas.
@@ -52,4 +75,9 @@ DMNSN_INTERNAL void dmnsn_rgba8_optimizer_fn(dmnsn_canvas_optimizer *optimizer,
 /// RGBA16 optimizer callback.
 DMNSN_INTERNAL void dmnsn_rgba16_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y);
 
+/// RGBA8 span optimizer callback.
+DMNSN_INTERNAL void dmnsn_rgba8_span_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y, size_t n);
+/// RGBA16 span optimizer callback.
+DMNSN_INTERNAL void dmnsn_rgba16_span_optimizer_fn(dmnsn_canvas_optimizer *optimizer, const dmnsn_canvas *canvas, size_t x, size_t y, size_t n);
+
 #endif // DMNSN_INTERNAL_RGBA_H
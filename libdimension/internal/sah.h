@@ -0,0 +1,39 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Surface area heuristic BVHs.  These are binary trees whose splits are chosen
+ * to minimize the expected cost of tracing a ray through them, by assuming the
+ * probability of hitting a node is proportional to its surface area.  Splits
+ * are only evaluated at a fixed number of bins along each axis, which makes
+ * building them fast.
+ */
+
+#ifndef DMNSN_INTERNAL_SAH_H
+#define DMNSN_INTERNAL_SAH_H
+
+#include "internal.h"
+#include "internal/bvh.h"
+
+/// Create a binned SAH BVH.
+DMNSN_INTERNAL dmnsn_bvh_node *dmnsn_new_sah_bvh(const dmnsn_array *objects);
+
+#endif // DMNSN_INTERNAL_SAH_H
@@ -0,0 +1,63 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Parallel radix sorting.
+ */
+
+#ifndef DMNSN_INTERNAL_SORT_H
+#define DMNSN_INTERNAL_SORT_H
+
+#include "internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// A value to sort, and the key to sort it by.
+typedef struct dmnsn_sort_pair {
+  uint64_t key; ///< The sort key.
+  void *value;  ///< The associated value.
+} dmnsn_sort_pair;
+
+/**
+ * Make a sort key for a double.  Keys compare in the same order as the doubles
+ * themselves (with -0.0 before 0.0).
+ * @param[in] x  The double to convert, which must not be NaN.
+ * @return An order-preserving integer key for \p x.
+ */
+DMNSN_INTERNAL DMNSN_INLINE uint64_t
+dmnsn_double_sort_key(double x)
+{
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  // Flip negative numbers' bits, so they sort backwards and below positives
+  return (bits >> 63) ? ~bits : bits | (UINT64_C(1) << 63);
+}
+
+/**
+ * Sort an array of pairs by their keys, in parallel.  The sort is stable, and
+ * only makes passes over the bytes of the keys that actually differ.
+ * @param[in,out] pairs  The pairs to sort.
+ * @param[in] n  The number of pairs.
+ */
+DMNSN_INTERNAL void dmnsn_radix_sort(dmnsn_sort_pair *pairs, size_t n);
+
+#endif // DMNSN_INTERNAL_SORT_H
@@ -0,0 +1,51 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Division of the canvas into tiles for rendering.
+ */
+
+#ifndef DMNSN_INTERNAL_TILES_H
+#define DMNSN_INTERNAL_TILES_H
+
+#include "internal.h"
+#include "dimension/canvas.h"
+#include "dimension/model.h"
+
+/// A rectangular region of the canvas, rendered as a unit.
+typedef struct dmnsn_render_tile {
+  size_t x, y;          ///< Bottom-left corner of the tile.
+  size_t width, height; ///< Dimensions of the tile.
+} dmnsn_render_tile;
+
+/**
+ * Divide a canvas into tiles.
+ * @param[in]  canvas       The canvas to divide.
+ * @param[in]  tile_width   The width of each tile, or 0 for the whole width.
+ * @param[in]  tile_height  The height of each tile, or 0 for the whole height.
+ * @param[in]  order        The order to put the tiles in.
+ * @param[out] ntiles       The number of tiles.
+ * @return The tiles, allocated with dmnsn_malloc(), or NULL if the canvas is
+ *         empty.
+ */
+DMNSN_INTERNAL dmnsn_render_tile *dmnsn_new_render_tiles(const dmnsn_canvas *canvas, size_t tile_width, size_t tile_height, dmnsn_tile_order order, size_t *ntiles);
+
+#endif // DMNSN_INTERNAL_TILES_H
@@ -312,13 +312,19 @@ dmnsn_transform_aabb(dmnsn_matrix M, dmnsn_aabb box)
     }
   }
 
-  dmnsn_vector Mt = dmnsn_matrix_column(M, 3);
-  dmnsn_aabb ret = { Mt, Mt };
+  // Transform the center, and bound the transformed half-extents
+  dmnsn_vector center = dmnsn_vector_mul(0.5, dmnsn_vector_add(box.min, box.max));
+  dmnsn_vector extent = dmnsn_vector_mul(0.5, dmnsn_vector_sub(box.max, box.min));
+  center = dmnsn_transform_point(M, center);
 
+  dmnsn_vector half = dmnsn_zero;
   for (unsigned int i = 0; i < 3; ++i) {
-    ret.min = dmnsn_vector_add(ret.min, dmnsn_vector_mul(box.min.n[i], Mabs[i]));
-    ret.max = dmnsn_vector_add(ret.max, dmnsn_vector_mul(box.max.n[i], Mabs[i]));
+    half = dmnsn_vector_add(half, dmnsn_vector_mul(extent.n[i], Mabs[i]));
   }
 
+  dmnsn_aabb ret = {
+    dmnsn_vector_sub(center, half),
+    dmnsn_vector_add(center, half),
+  };
   return ret;
 }
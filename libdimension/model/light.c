@@ -43,4 +43,5 @@ dmnsn_init_light(dmnsn_light *light)
   light->direction_fn = NULL;
   light->illumination_fn = NULL;
   light->shadow_fn = NULL;
+  light->shadow_distance_fn = NULL;
 }
@@ -56,6 +56,14 @@ dmnsn_point_light_shadow_fn(const dmnsn_light *light, double t)
   return t < 1.0;
 }
 
+/// Point light shadow distance callback.
+static double
+dmnsn_point_light_shadow_distance_fn(const dmnsn_light *light)
+{
+  // The shadow ray ends at the light
+  return 1.0;
+}
+
 dmnsn_light *
 dmnsn_new_point_light(dmnsn_pool *pool, dmnsn_vector x0, dmnsn_color color)
 {
@@ -68,5 +76,6 @@ dmnsn_new_point_light(dmnsn_pool *pool, dmnsn_vector x0, dmnsn_color color)
   light->direction_fn = dmnsn_point_light_direction_fn;
   light->illumination_fn = dmnsn_point_light_illumination_fn;
   light->shadow_fn = dmnsn_point_light_shadow_fn;
+  light->shadow_distance_fn = dmnsn_point_light_shadow_distance_fn;
   return light;
 }
@@ -24,6 +24,7 @@
  */
 
 #include "internal.h"
+#include "internal/object.h"
 #include "dimension/model.h"
 #include <stdlib.h>
 
@@ -48,9 +49,10 @@ dmnsn_init_object(dmnsn_object *object)
   object->children = NULL;
   object->split_children = false;
   object->precomputed = false;
+  object->trans_kind = DMNSN_TRANSFORM_GENERAL;
 }
 
-/// Recursively precompute objects.
+/// Recursively precompute object textures and transformations.
 static void
 dmnsn_object_precompute_recursive(dmnsn_object *object, dmnsn_matrix pigment_trans)
 {
@@ -96,8 +98,82 @@ dmnsn_object_precompute_recursive(dmnsn_object *object, dmnsn_matrix pigment_tra
   if (vtable->bounding_fn) {
     object->aabb = vtable->bounding_fn(object, total_trans);
   }
-  if (vtable->precompute_fn) {
-    vtable->precompute_fn(object);
+}
+
+void
+dmnsn_object_precompute_serial(dmnsn_object *object)
+{
+  dmnsn_matrix pigment_trans = dmnsn_matrix_inverse(object->trans);
+  dmnsn_object_precompute_recursive(object, pigment_trans);
+}
+
+/// Classify an inverse transformation, to pick the fast paths in
+/// dmnsn_object_hit() and friends.  Only exact matches count, so the fast
+/// paths compute the same thing as the general one.
+static dmnsn_transform_kind
+dmnsn_classify_transform(dmnsn_matrix trans_inv)
+{
+  double scale = trans_inv.n[0][0];
+  for (unsigned int i = 0; i < 3; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      double expected = i == j ? scale : 0.0;
+      if (trans_inv.n[i][j] != expected) {
+        return DMNSN_TRANSFORM_GENERAL;
+      }
+    }
+  }
+
+  // A negative scale would flip the normals
+  if (!(scale > 0.0)) {
+    return DMNSN_TRANSFORM_GENERAL;
+  } else if (scale != 1.0) {
+    return DMNSN_TRANSFORM_SCALE;
+  }
+
+  for (unsigned int i = 0; i < 3; ++i) {
+    if (trans_inv.n[i][3] != 0.0) {
+      return DMNSN_TRANSFORM_TRANSLATE;
+    }
+  }
+  return DMNSN_TRANSFORM_IDENTITY;
+}
+
+/// Run an object's precompute callback, once its children are done.
+static void
+dmnsn_object_precompute_finish(dmnsn_object *object)
+{
+  if (object->vtable->precompute_fn) {
+    object->vtable->precompute_fn(object);
+  }
+
+  // The callback may have moved the transformation into the object itself
+  object->trans_kind = dmnsn_classify_transform(object->trans_inv);
+}
+
+/// Task to run the precompute callbacks of an object's subtree.
+static void
+dmnsn_object_precompute_task(void *ptr)
+{
+  dmnsn_object *object = ptr;
+
+  // Children must be complete before their parent
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  DMNSN_ARRAY_FOREACH (dmnsn_object **, child, object->children) {
+    dmnsn_object_precompute_spawn(&group, *child);
+  }
+  dmnsn_sync(&group);
+
+  dmnsn_object_precompute_finish(object);
+}
+
+void
+dmnsn_object_precompute_spawn(dmnsn_task_group *group, dmnsn_object *object)
+{
+  if (object->children) {
+    // Only subtrees are worth a task
+    dmnsn_spawn(group, dmnsn_object_precompute_task, object);
+  } else {
+    dmnsn_object_precompute_finish(object);
   }
 }
 
@@ -105,6 +181,9 @@ dmnsn_object_precompute_recursive(dmnsn_object *object, dmnsn_matrix pigment_tra
 void
 dmnsn_object_precompute(dmnsn_object *object)
 {
-  dmnsn_matrix pigment_trans = dmnsn_matrix_inverse(object->trans);
-  dmnsn_object_precompute_recursive(object, pigment_trans);
+  dmnsn_object_precompute_serial(object);
+
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  dmnsn_object_precompute_spawn(&group, object);
+  dmnsn_sync(&group);
 }
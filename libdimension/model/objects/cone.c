@@ -23,6 +23,7 @@
  * Cones/cylinders.
  */
 
+#include "internal/packet.h"
 #include "internal/polynomial.h"
 #include "dimension/model.h"
 #include <math.h>
@@ -67,10 +68,7 @@ dmnsn_cone_intersection_fn(const dmnsn_object *object, dmnsn_ray l,
     }
 
     if (t >= 0.0 && p.Y >= -1.0 && p.Y <= 1.0) {
-      double r = ((r2 - r1)*p.Y + r1 + r2)/2.0;
-      dmnsn_vector norm = dmnsn_new_vector(p.X, -r*(r2 - r1)/2.0, p.Z);
-      intersection->t      = t;
-      intersection->normal = norm;
+      intersection->t = t;
       return true;
     }
   }
@@ -78,6 +76,91 @@ dmnsn_cone_intersection_fn(const dmnsn_object *object, dmnsn_ray l,
   return false;
 }
 
+#ifdef __SSE2__
+/// Packet intersection callback for a cone.
+static unsigned int
+dmnsn_cone_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[],
+                     unsigned int mask, dmnsn_intersection intersections[])
+{
+  const dmnsn_cone *cone = (const dmnsn_cone *)object;
+  __m128d r1 = _mm_set1_pd(cone->r1), r2 = _mm_set1_pd(cone->r2);
+  __m128d dr = _mm_sub_pd(r2, r1);
+
+  dmnsn_ray_packet packet;
+  dmnsn_ray_packet_load(&packet, rays);
+
+  unsigned int hits = 0, slow = 0;
+  double t[DMNSN_OBJECT_PACKET_SIZE];
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; k += 2) {
+    __m128d x0[3], n[3];
+    dmnsn_ray_packet_get(&packet, k, x0, n);
+
+    // The same polynomial as dmnsn_cone_intersection_fn(), term for term
+    __m128d w = _mm_add_pd(_mm_add_pd(_mm_mul_pd(x0[1], dr), r2), r1);
+    __m128d poly[3], x[2], one, two;
+    poly[2] = _mm_sub_pd(
+      _mm_add_pd(_mm_mul_pd(n[0], n[0]), _mm_mul_pd(n[2], n[2])),
+      _mm_div_pd(_mm_mul_pd(_mm_mul_pd(_mm_mul_pd(n[1], n[1]), dr), dr), _mm_set1_pd(4.0))
+    );
+    poly[1] = _mm_sub_pd(
+      _mm_mul_pd(_mm_set1_pd(2.0), _mm_add_pd(_mm_mul_pd(n[0], x0[0]), _mm_mul_pd(n[2], x0[2]))),
+      _mm_div_pd(_mm_mul_pd(_mm_mul_pd(n[1], dr), w), _mm_set1_pd(2.0))
+    );
+    poly[0] = _mm_sub_pd(
+      _mm_add_pd(_mm_mul_pd(x0[0], x0[0]), _mm_mul_pd(x0[2], x0[2])),
+      _mm_div_pd(_mm_mul_pd(w, w), _mm_set1_pd(4.0))
+    );
+    __m128d slow_k = dmnsn_solve_quadratic_pd(poly, x, &one, &two);
+
+    // Try the closer root first, unless it's outside the cone's height
+    __m128d tmin = dmnsn_select_pd(_mm_cmplt_pd(x[0], x[1]), x[0], x[1]);
+    __m128d tmax = dmnsn_select_pd(_mm_cmpgt_pd(x[0], x[1]), x[0], x[1]);
+    __m128d t_k = dmnsn_select_pd(two, tmin, x[0]);
+    __m128d y = _mm_add_pd(x0[1], _mm_mul_pd(t_k, n[1]));
+    __m128d outside = _mm_or_pd(
+      _mm_cmple_pd(y, _mm_set1_pd(-1.0)),
+      _mm_cmpge_pd(y, _mm_set1_pd(1.0))
+    );
+    t_k = dmnsn_select_pd(_mm_and_pd(two, outside), tmax, t_k);
+    y = _mm_add_pd(x0[1], _mm_mul_pd(t_k, n[1]));
+
+    __m128d hit = _mm_and_pd(
+      _mm_and_pd(one, _mm_cmpge_pd(t_k, _mm_setzero_pd())),
+      _mm_and_pd(_mm_cmpge_pd(y, _mm_set1_pd(-1.0)), _mm_cmple_pd(y, _mm_set1_pd(1.0)))
+    );
+    _mm_storeu_pd(&t[k], t_k);
+    hits |= _mm_movemask_pd(_mm_andnot_pd(slow_k, hit)) << k;
+    slow |= _mm_movemask_pd(slow_k) << k;
+  }
+  hits &= mask;
+  slow &= mask;
+
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    if (slow & (1U << k)) {
+      if (dmnsn_cone_intersection_fn(object, rays[k], &intersections[k])) {
+        hits |= 1U << k;
+      }
+    } else if (hits & (1U << k)) {
+      intersections[k].t = t[k];
+    }
+  }
+  return hits;
+}
+#endif
+
+/// Finalize callback for a cone.
+static void
+dmnsn_cone_finalize_fn(const dmnsn_object *object, dmnsn_ray l,
+                       dmnsn_intersection *intersection)
+{
+  const dmnsn_cone *cone = (const dmnsn_cone *)object;
+  double r1 = cone->r1, r2 = cone->r2;
+
+  dmnsn_vector p = dmnsn_ray_point(l, intersection->t);
+  double r = ((r2 - r1)*p.Y + r1 + r2)/2.0;
+  intersection->normal = dmnsn_new_vector(p.X, -r*(r2 - r1)/2.0, p.Z);
+}
+
 /// Inside callback for a cone.
 static bool
 dmnsn_cone_inside_fn(const dmnsn_object *object, dmnsn_vector point)
@@ -103,6 +186,10 @@ dmnsn_cone_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
 /// Cone vtable.
 static const dmnsn_object_vtable dmnsn_cone_vtable = {
   .intersection_fn = dmnsn_cone_intersection_fn,
+#ifdef __SSE2__
+  .packet_fn = dmnsn_cone_packet_fn,
+#endif
+  .finalize_fn = dmnsn_cone_finalize_fn,
   .inside_fn = dmnsn_cone_inside_fn,
   .bounding_fn = dmnsn_cone_bounding_fn,
 };
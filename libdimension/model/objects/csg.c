@@ -44,7 +44,15 @@ dmnsn_csg_union_intersection_fn(const dmnsn_object *object,
                                 dmnsn_intersection *intersection)
 {
   const dmnsn_csg_union *csg = (const dmnsn_csg_union *)object;
-  return dmnsn_bvh_intersection(csg->bvh, ray, intersection, true);
+  return dmnsn_bvh_intersection(csg->bvh, NULL, ray, intersection, NULL, true);
+}
+
+/// CSG union occlusion callback.
+static bool
+dmnsn_csg_union_occlusion_fn(const dmnsn_object *object, dmnsn_ray ray, double t)
+{
+  const dmnsn_csg_union *csg = (const dmnsn_csg_union *)object;
+  return dmnsn_bvh_occluded(csg->bvh, NULL, ray, t, NULL);
 }
 
 /// CSG union inside callback.
@@ -52,7 +60,7 @@ static bool
 dmnsn_csg_union_inside_fn(const dmnsn_object *object, dmnsn_vector point)
 {
   const dmnsn_csg_union *csg = (const dmnsn_csg_union *)object;
-  return dmnsn_bvh_inside(csg->bvh, point);
+  return dmnsn_bvh_inside(csg->bvh, NULL, point);
 }
 
 /// CSG union precomputation callback.
@@ -62,7 +70,7 @@ dmnsn_csg_union_precompute_fn(dmnsn_object *object)
   dmnsn_csg_union *csg = (dmnsn_csg_union *)object;
   csg->object.trans_inv = dmnsn_identity_matrix();
 
-  dmnsn_bvh *bvh = dmnsn_new_bvh(csg->object.children, DMNSN_BVH_PRTREE);
+  dmnsn_bvh *bvh = dmnsn_new_bvh(csg->object.children, DMNSN_BVH_PRTREE, DMNSN_BVH_ORDERED);
   csg->bvh = bvh;
   csg->object.aabb = dmnsn_bvh_aabb(bvh);
 }
@@ -70,6 +78,7 @@ dmnsn_csg_union_precompute_fn(dmnsn_object *object)
 /// CSG union vtable.
 static const dmnsn_object_vtable dmnsn_csg_union_vtable = {
   .intersection_fn = dmnsn_csg_union_intersection_fn,
+  .occlusion_fn = dmnsn_csg_union_occlusion_fn,
   .inside_fn = dmnsn_csg_union_inside_fn,
   .precompute_fn = dmnsn_csg_union_precompute_fn,
 };
@@ -118,58 +127,59 @@ dmnsn_csg_intersection_fn(const dmnsn_object *csg, dmnsn_ray ray,
   const dmnsn_object *A = *(dmnsn_object **)dmnsn_array_first(csg->children);
   const dmnsn_object *B = *(dmnsn_object **)dmnsn_array_last(csg->children);
 
+  // Skipping over intersections can take a few tries, so leave the normals
+  // until we know which one is closest
   dmnsn_intersection i1, i2;
-  bool is_i1 = dmnsn_object_intersection(A, ray, &i1);
-  bool is_i2 = dmnsn_object_intersection(B, ray, &i2);
+  bool is_i1 = dmnsn_object_hit(A, ray, &i1);
+  bool is_i2 = dmnsn_object_hit(B, ray, &i2);
 
+  double t1 = 0.0;
   double oldt = 0.0;
   while (is_i1) {
-    i1.ray = ray;
-    i1.t += oldt;
-    oldt = i1.t + dmnsn_epsilon;
+    t1 = i1.t + oldt;
+    oldt = t1 + dmnsn_epsilon;
 
-    dmnsn_vector point = dmnsn_ray_point(i1.ray, i1.t);
+    dmnsn_vector point = dmnsn_ray_point(ray, t1);
     if (inside2 ^ dmnsn_object_inside(B, point)) {
       dmnsn_ray newray = ray;
-      newray.x0 = dmnsn_ray_point(ray, i1.t);
+      newray.x0 = dmnsn_ray_point(ray, t1);
       newray    = dmnsn_ray_add_epsilon(newray);
-      is_i1 = dmnsn_object_intersection(A, newray, &i1);
+      is_i1 = dmnsn_object_hit(A, newray, &i1);
     } else {
       break;
     }
   }
 
+  double t2 = 0.0;
   oldt = 0.0;
   while (is_i2) {
-    i2.ray = ray;
-    i2.t += oldt;
-    oldt = i2.t + dmnsn_epsilon;
+    t2 = i2.t + oldt;
+    oldt = t2 + dmnsn_epsilon;
 
-    dmnsn_vector point = dmnsn_ray_point(i2.ray, i2.t);
+    dmnsn_vector point = dmnsn_ray_point(ray, t2);
     if (inside1 ^ dmnsn_object_inside(A, point)) {
       dmnsn_ray newray = ray;
-      newray.x0 = dmnsn_ray_point(ray, i2.t);
+      newray.x0 = dmnsn_ray_point(ray, t2);
       newray    = dmnsn_ray_add_epsilon(newray);
-      is_i2 = dmnsn_object_intersection(B, newray, &i2);
+      is_i2 = dmnsn_object_hit(B, newray, &i2);
     } else {
       break;
     }
   }
 
-  if (is_i1 && is_i2) {
-    if (i1.t < i2.t) {
-      *intersection = i1;
-    } else {
-      *intersection = i2;
-    }
-  } else if (is_i1) {
+  if (is_i1 && (!is_i2 || t1 < t2)) {
+    dmnsn_object_finalize(A, &i1);
     *intersection = i1;
+    intersection->t = t1;
   } else if (is_i2) {
+    dmnsn_object_finalize(B, &i2);
     *intersection = i2;
+    intersection->t = t2;
   } else {
     return false;
   }
 
+  intersection->ray = ray;
   return true;
 }
 
@@ -24,110 +24,185 @@
  */
 
 #include "internal.h"
+#include "internal/packet.h"
 #include "dimension/model.h"
 #include <math.h>
 
-/// Intersection callback for a cube.
-static bool
-dmnsn_cube_intersection_fn(const dmnsn_object *cube, dmnsn_ray ray,
-                           dmnsn_intersection *intersection)
-{
-  // Clip the given ray against the X, Y, and Z slabs
+/// Cube type.
+typedef struct {
+  dmnsn_object object;
+  dmnsn_aabb box; ///< The extent of the cube.
+} dmnsn_cube;
 
-  dmnsn_vector nmin, nmax;
-  double tmin, tmax;
-
-  double tx1 = (-1.0 - ray.x0.X)/ray.n.X;
-  double tx2 = (+1.0 - ray.x0.X)/ray.n.X;
+/**
+ * Clip a ray against the X, Y, and Z slabs of a cube.
+ * @param[in]  cube    The cube to test.
+ * @param[in]  ray     The ray to test.
+ * @param[out] t       The distance to the intersection.
+ * @param[out] normal  The normal at the intersection.  If NULL, the normals are
+ *                     not tracked at all.
+ * @return Whether there was an intersection.
+ */
+static inline bool
+dmnsn_cube_clip(const dmnsn_cube *cube, dmnsn_ray ray, double *t, dmnsn_vector *normal)
+{
+  dmnsn_aabb box = cube->box;
 
-  if (tx1 < tx2) {
-    tmin = tx1;
-    tmax = tx2;
-    nmin = dmnsn_new_vector(-1.0, 0.0, 0.0);
-    nmax = dmnsn_new_vector(+1.0, 0.0, 0.0);
-  } else {
-    tmin = tx2;
-    tmax = tx1;
-    nmin = dmnsn_new_vector(+1.0, 0.0, 0.0);
-    nmax = dmnsn_new_vector(-1.0, 0.0, 0.0);
-  }
+  dmnsn_vector nmin = dmnsn_zero, nmax = dmnsn_zero;
+  double tmin = 0.0, tmax = 0.0;
 
-  if (tmin > tmax)
-    return false;
+  for (int i = 0; i < 3; ++i) {
+    double t1 = (box.min.n[i] - ray.x0.n[i])/ray.n.n[i];
+    double t2 = (box.max.n[i] - ray.x0.n[i])/ray.n.n[i];
 
-  double ty1 = (-1.0 - ray.x0.Y)/ray.n.Y;
-  double ty2 = (+1.0 - ray.x0.Y)/ray.n.Y;
+    bool ordered = t1 < t2;
+    double near = ordered ? t1 : t2;
+    double far = ordered ? t2 : t1;
+    double sign = ordered ? -1.0 : +1.0;
 
-  if (ty1 < ty2) {
-    if (ty1 > tmin) {
-      tmin = ty1;
-      nmin = dmnsn_new_vector(0.0, -1.0, 0.0);
-    }
-    if (ty2 < tmax) {
-      tmax = ty2;
-      nmax = dmnsn_new_vector(0.0, +1.0, 0.0);
+    if (i == 0 || near > tmin) {
+      tmin = near;
+      if (normal) {
+        nmin = dmnsn_zero;
+        nmin.n[i] = sign;
+      }
     }
-  } else {
-    if (ty2 > tmin) {
-      tmin = ty2;
-      nmin = dmnsn_new_vector(0.0, +1.0, 0.0);
-    }
-    if (ty1 < tmax) {
-      tmax = ty1;
-      nmax = dmnsn_new_vector(0.0, -1.0, 0.0);
+    if (i == 0 || far < tmax) {
+      tmax = far;
+      if (normal) {
+        nmax = dmnsn_zero;
+        nmax.n[i] = -sign;
+      }
     }
-  }
-
-  if (tmin > tmax)
-    return false;
-
-  double tz1 = (-1.0 - ray.x0.Z)/ray.n.Z;
-  double tz2 = (+1.0 - ray.x0.Z)/ray.n.Z;
 
-  if (tz1 < tz2) {
-    if (tz1 > tmin) {
-      tmin = tz1;
-      nmin = dmnsn_new_vector(0.0, 0.0, -1.0);
-    }
-    if (tz2 < tmax) {
-      tmax = tz2;
-      nmax = dmnsn_new_vector(0.0, 0.0, +1.0);
-    }
-  } else {
-    if (tz2 > tmin) {
-      tmin = tz2;
-      nmin = dmnsn_new_vector(0.0, 0.0, +1.0);
-    }
-    if (tz1 < tmax) {
-      tmax = tz1;
-      nmax = dmnsn_new_vector(0.0, 0.0, -1.0);
-    }
+    if (tmin > tmax)
+      return false;
   }
 
-  if (tmin > tmax)
-    return false;
-
   if (tmin < 0.0) {
     tmin = tmax;
     nmin = nmax;
   }
 
   if (tmin >= 0.0) {
-    intersection->t      = tmin;
-    intersection->normal = nmin;
+    *t = tmin;
+    if (normal) {
+      *normal = nmin;
+    }
     return true;
   } else {
     return false;
   }
 }
 
+/// Intersection callback for a cube.
+static bool
+dmnsn_cube_intersection_fn(const dmnsn_object *object, dmnsn_ray ray,
+                           dmnsn_intersection *intersection)
+{
+  const dmnsn_cube *cube = (const dmnsn_cube *)object;
+  return dmnsn_cube_clip(cube, ray, &intersection->t, &intersection->normal);
+}
+
+#ifdef __SSE2__
+/// Packet intersection callback for a cube.  The same slab test as
+/// dmnsn_cube_clip(), with each branch turned into a select.  The normals are
+/// tracked as an axis and a sign.
+static unsigned int
+dmnsn_cube_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[],
+                     unsigned int mask, dmnsn_intersection intersections[])
+{
+  dmnsn_ray_packet packet;
+  dmnsn_ray_packet_load(&packet, rays);
+
+  const dmnsn_cube *cube = (const dmnsn_cube *)object;
+  const __m128d minus_one = _mm_set1_pd(-1.0), plus_one = _mm_set1_pd(+1.0);
+  __m128d mins[3], maxs[3];
+  for (int i = 0; i < 3; ++i) {
+    mins[i] = _mm_set1_pd(cube->box.min.n[i]);
+    maxs[i] = _mm_set1_pd(cube->box.max.n[i]);
+  }
+
+  unsigned int hits = 0;
+  double t[DMNSN_OBJECT_PACKET_SIZE], axes[DMNSN_OBJECT_PACKET_SIZE], signs[DMNSN_OBJECT_PACKET_SIZE];
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; k += 2) {
+    __m128d x0[3], n[3];
+    dmnsn_ray_packet_get(&packet, k, x0, n);
+
+    __m128d tmin, tmax, nmin_axis, nmin_sign, nmax_axis, nmax_sign, alive;
+    for (int i = 0; i < 3; ++i) {
+      __m128d t1 = _mm_div_pd(_mm_sub_pd(mins[i], x0[i]), n[i]);
+      __m128d t2 = _mm_div_pd(_mm_sub_pd(maxs[i], x0[i]), n[i]);
+      __m128d ordered = _mm_cmplt_pd(t1, t2);
+      __m128d near = dmnsn_select_pd(ordered, t1, t2);
+      __m128d far = dmnsn_select_pd(ordered, t2, t1);
+      __m128d sign = dmnsn_select_pd(ordered, minus_one, plus_one);
+      __m128d axis = _mm_set1_pd(i);
+
+      if (i == 0) {
+        tmin = near;
+        tmax = far;
+        nmin_axis = nmax_axis = axis;
+        nmin_sign = sign;
+        nmax_sign = dmnsn_neg_pd(sign);
+        alive = _mm_cmpngt_pd(tmin, tmax);
+        continue;
+      }
+
+      __m128d closer = _mm_cmpgt_pd(near, tmin);
+      tmin = dmnsn_select_pd(closer, near, tmin);
+      nmin_axis = dmnsn_select_pd(closer, axis, nmin_axis);
+      nmin_sign = dmnsn_select_pd(closer, sign, nmin_sign);
+
+      __m128d farther = _mm_cmplt_pd(far, tmax);
+      tmax = dmnsn_select_pd(farther, far, tmax);
+      nmax_axis = dmnsn_select_pd(farther, axis, nmax_axis);
+      nmax_sign = dmnsn_select_pd(farther, dmnsn_neg_pd(sign), nmax_sign);
+
+      alive = _mm_and_pd(alive, _mm_cmpngt_pd(tmin, tmax));
+    }
+
+    __m128d inside = _mm_cmplt_pd(tmin, _mm_setzero_pd());
+    tmin = dmnsn_select_pd(inside, tmax, tmin);
+    nmin_axis = dmnsn_select_pd(inside, nmax_axis, nmin_axis);
+    nmin_sign = dmnsn_select_pd(inside, nmax_sign, nmin_sign);
+
+    _mm_storeu_pd(&t[k], tmin);
+    _mm_storeu_pd(&axes[k], nmin_axis);
+    _mm_storeu_pd(&signs[k], nmin_sign);
+    hits |= _mm_movemask_pd(_mm_and_pd(alive, _mm_cmpge_pd(tmin, _mm_setzero_pd()))) << k;
+  }
+  hits &= mask;
+
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    if (hits & (1U << k)) {
+      intersections[k].t = t[k];
+      intersections[k].normal = dmnsn_zero;
+      intersections[k].normal.n[(size_t)axes[k]] = signs[k];
+    }
+  }
+  return hits;
+}
+#endif
+
+/// Occlusion callback for a cube.
+static bool
+dmnsn_cube_occlusion_fn(const dmnsn_object *object, dmnsn_ray ray, double t)
+{
+  const dmnsn_cube *cube = (const dmnsn_cube *)object;
+  double tcube;
+  return dmnsn_cube_clip(cube, ray, &tcube, NULL) && tcube < t;
+}
+
 /// Inside callback for a cube.
 static bool
-dmnsn_cube_inside_fn(const dmnsn_object *cube, dmnsn_vector point)
+dmnsn_cube_inside_fn(const dmnsn_object *object, dmnsn_vector point)
 {
-  return point.X > -1.0 && point.X < 1.0
-      && point.Y > -1.0 && point.Y < 1.0
-      && point.Z > -1.0 && point.Z < 1.0;
+  const dmnsn_cube *cube = (const dmnsn_cube *)object;
+  dmnsn_aabb box = cube->box;
+  return point.X > box.min.X && point.X < box.max.X
+      && point.Y > box.min.Y && point.Y < box.max.Y
+      && point.Z > box.min.Z && point.Z < box.max.Z;
 }
 
 /// Boundary callback for a cube.
@@ -138,18 +213,54 @@ dmnsn_cube_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
   return dmnsn_transform_aabb(trans, box);
 }
 
+/// Precomputation callback for a cube.
+static void
+dmnsn_cube_precompute_fn(dmnsn_object *object)
+{
+  dmnsn_cube *cube = (dmnsn_cube *)object;
+  dmnsn_matrix trans_inv = object->trans_inv;
+
+  // A cube that's only scaled and translated is still an axis-aligned box,
+  // which can be stored in world space
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if ((i == j) == (trans_inv.n[i][j] == 0.0)) {
+        return;
+      }
+    }
+  }
+
+  // Solve trans_inv*x == +/-1 along each axis
+  for (int i = 0; i < 3; ++i) {
+    double a = (-1.0 - trans_inv.n[i][3])/trans_inv.n[i][i];
+    double b = (+1.0 - trans_inv.n[i][3])/trans_inv.n[i][i];
+    cube->box.min.n[i] = dmnsn_min(a, b);
+    cube->box.max.n[i] = dmnsn_max(a, b);
+  }
+  object->trans_inv = dmnsn_identity_matrix();
+}
+
 /// Cube vtable.
 static const dmnsn_object_vtable dmnsn_cube_vtable = {
   .intersection_fn = dmnsn_cube_intersection_fn,
+#ifdef __SSE2__
+  .packet_fn = dmnsn_cube_packet_fn,
+#endif
+  .occlusion_fn = dmnsn_cube_occlusion_fn,
   .inside_fn = dmnsn_cube_inside_fn,
   .bounding_fn = dmnsn_cube_bounding_fn,
+  .precompute_fn = dmnsn_cube_precompute_fn,
 };
 
 // Allocate a new cube object
 dmnsn_object *
 dmnsn_new_cube(dmnsn_pool *pool)
 {
-  dmnsn_object *cube = dmnsn_new_object(pool);
-  cube->vtable = &dmnsn_cube_vtable;
-  return cube;
+  dmnsn_cube *cube = DMNSN_PALLOC(pool, dmnsn_cube);
+  cube->box = dmnsn_symmetric_aabb(dmnsn_new_vector(1.0, 1.0, 1.0));
+
+  dmnsn_object *object = &cube->object;
+  dmnsn_init_object(object);
+  object->vtable = &dmnsn_cube_vtable;
+  return object;
 }
@@ -0,0 +1,146 @@
+/*************************************************************************
+ * Copyright (C) 2010-2014 Tavian Barnes <tavianator@tavianator.com>     *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Object instances.  An instance places a shared prototype object somewhere in
+ * the scene with its own transformation.  The prototype is precomputed once,
+ * and its bounding hierarchy (if it has one) is shared between every instance,
+ * so each instance only adds one leaf to the scene's BVH.
+ */
+
+#include "internal.h"
+#include "dimension/model.h"
+
+/// Instance type.
+typedef struct dmnsn_instance {
+  dmnsn_object object;
+  dmnsn_object *prototype;
+} dmnsn_instance;
+
+/// Instance intersection callback.
+static bool
+dmnsn_instance_intersection_fn(const dmnsn_object *object, dmnsn_ray ray, dmnsn_intersection *intersection)
+{
+  const dmnsn_instance *instance = (const dmnsn_instance *)object;
+  if (dmnsn_object_hit(instance->prototype, ray, intersection)) {
+    // Like CSG children, parts of the prototype with their own texture keep
+    // it, and the rest take the instance's
+    if (intersection->object->texture == instance->prototype->texture) {
+      intersection->object = object;
+      intersection->instanced = false;
+    }
+    return true;
+  } else {
+    return false;
+  }
+}
+
+/// Instance finalize callback.
+static void
+dmnsn_instance_finalize_fn(const dmnsn_object *object, dmnsn_ray ray, dmnsn_intersection *intersection)
+{
+  const dmnsn_instance *instance = (const dmnsn_instance *)object;
+
+  // Finalize the prototype's hit with the ray it saw
+  dmnsn_ray world_ray = intersection->ray;
+  intersection->ray = ray;
+  dmnsn_object_finalize(instance->prototype, intersection);
+  intersection->ray = world_ray;
+
+  // Place the pigment of a part of the prototype relative to the instance,
+  // unless a nested instance already did
+  if (intersection->object != object && !intersection->instanced) {
+    intersection->instanced = true;
+    intersection->instance_point = dmnsn_ray_point(ray, intersection->t);
+  }
+}
+
+/// Instance occlusion callback.
+static bool
+dmnsn_instance_occlusion_fn(const dmnsn_object *object, dmnsn_ray ray, double t)
+{
+  const dmnsn_instance *instance = (const dmnsn_instance *)object;
+  return dmnsn_object_occlusion(instance->prototype, ray, t);
+}
+
+/// Instance inside callback.
+static bool
+dmnsn_instance_inside_fn(const dmnsn_object *object, dmnsn_vector point)
+{
+  const dmnsn_instance *instance = (const dmnsn_instance *)object;
+  return dmnsn_object_inside(instance->prototype, point);
+}
+
+/// Instance bounding callback.
+static dmnsn_aabb
+dmnsn_instance_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
+{
+  const dmnsn_instance *instance = (const dmnsn_instance *)object;
+  dmnsn_object *prototype = instance->prototype;
+
+  // Bounding callbacks run during the serial part of precomputation, so this
+  // is the one place the first instance can precompute the prototype without
+  // racing the others
+  if (!prototype->precomputed) {
+    dmnsn_texture_cascade(object->texture, &prototype->texture);
+    dmnsn_interior_cascade(object->interior, &prototype->interior);
+    dmnsn_object_precompute(prototype);
+  }
+
+  return dmnsn_transform_aabb(trans, prototype->aabb);
+}
+
+/// Instance precomputation callback.
+static void
+dmnsn_instance_precompute_fn(dmnsn_object *object)
+{
+  dmnsn_instance *instance = (dmnsn_instance *)object;
+  dmnsn_object *prototype = instance->prototype;
+
+  // A texture shared with the prototype keeps its placement on the prototype
+  if (object->texture == prototype->texture) {
+    object->pigment_trans = dmnsn_matrix_mul(prototype->pigment_trans, object->pigment_trans);
+  }
+}
+
+/// Instance vtable.
+static const dmnsn_object_vtable dmnsn_instance_vtable = {
+  .intersection_fn = dmnsn_instance_intersection_fn,
+  .finalize_fn = dmnsn_instance_finalize_fn,
+  .occlusion_fn = dmnsn_instance_occlusion_fn,
+  .inside_fn = dmnsn_instance_inside_fn,
+  .bounding_fn = dmnsn_instance_bounding_fn,
+  .precompute_fn = dmnsn_instance_precompute_fn,
+};
+
+dmnsn_object *
+dmnsn_new_instance(dmnsn_pool *pool, dmnsn_object *prototype)
+{
+  dmnsn_instance *instance = DMNSN_PALLOC(pool, dmnsn_instance);
+  instance->prototype = prototype;
+
+  dmnsn_object *object = &instance->object;
+  dmnsn_init_object(object);
+  object->vtable = &dmnsn_instance_vtable;
+  object->texture = prototype->texture;
+  object->interior = prototype->interior;
+  return object;
+}
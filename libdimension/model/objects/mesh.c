@@ -0,0 +1,677 @@
+/*************************************************************************
+ * Copyright (C) 2009-2014 Tavian Barnes <tavianator@tavianator.com>     *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Indexed triangle meshes.  Unlike triangle fans, every triangle shares one
+ * object, so a mesh costs about 40 bytes per triangle instead of a whole
+ * dmnsn_object each.  Rays are intersected with the watertight algorithm from
+ * http://jcgt.org/published/0002/01/05/, so they can't slip between triangles
+ * that share an edge.
+ */
+
+#include "internal.h"
+#include "internal/mesh.h"
+#include "internal/platform.h"
+#include "dimension/model.h"
+#include <errno.h>
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+/// The number of bins used to approximate the SAH.
+#define DMNSN_MESH_BINS 16
+/// Ranges of this many triangles or fewer always become leaves.
+#define DMNSN_MESH_MIN_LEAF 2
+/// Ranges of more than this many triangles are always split.
+#define DMNSN_MESH_MAX_LEAF 16
+/// The depth past which nodes are split at the median instead of by the SAH.
+#define DMNSN_MESH_SAH_DEPTH 64
+/// Enough stack for the SAH depth plus a median split of 2^32 triangles.
+#define DMNSN_MESH_STACK_SIZE (DMNSN_MESH_SAH_DEPTH + 33)
+
+/// A node in a mesh's BVH.  The left child always immediately follows.
+typedef struct dmnsn_mesh_node {
+  float min[3];   ///< The minimum corner of the bounding box.
+  float max[3];   ///< The maximum corner of the bounding box.
+  uint32_t index; ///< The first triangle of a leaf, or the right child.
+  uint16_t count; ///< The number of triangles in a leaf, or 0.
+  uint16_t axis;  ///< The split axis of an inner node.
+} dmnsn_mesh_node;
+
+/// Mesh type.
+typedef struct dmnsn_mesh {
+  dmnsn_object object;
+  float (*vertices)[3];     ///< The vertex positions.
+  float (*normals)[3];      ///< The vertex normals, or NULL for flat meshes.
+  size_t nvertices;         ///< The number of vertices.
+  uint32_t (*triangles)[3]; ///< The vertex indices, in BVH leaf order.
+  size_t ntriangles;        ///< The number of triangles.
+  dmnsn_mesh_node *nodes;   ///< The BVH, in depth-first order.
+  size_t nnodes;            ///< The number of BVH nodes.
+} dmnsn_mesh;
+
+/// A ray, prepared for mesh traversal.
+typedef struct dmnsn_mesh_ray {
+  dmnsn_vector x0;      ///< The origin of the ray.
+  dmnsn_vector n_inv;   ///< The inverse of each component of the ray's slope.
+  unsigned int sign[3]; ///< Whether each component of the slope is negative.
+  unsigned int kx, ky, kz; ///< The axes permuted so that kz is dominant.
+  double Sx, Sy, Sz;    ///< The shear that maps the ray onto the +z axis.
+} dmnsn_mesh_ray;
+
+/// Precompute the ray-invariant parts of the box and triangle tests.
+static inline dmnsn_mesh_ray
+dmnsn_mesh_optimize_ray(dmnsn_ray ray)
+{
+  dmnsn_mesh_ray mray = {
+    .x0    = ray.x0,
+    .n_inv = dmnsn_new_vector(1.0/ray.n.X, 1.0/ray.n.Y, 1.0/ray.n.Z),
+  };
+
+  for (unsigned int i = 0; i < 3; ++i) {
+    mray.sign[i] = ray.n.n[i] < 0.0;
+  }
+
+  unsigned int kz = 0;
+  if (fabs(ray.n.Y) > fabs(ray.n.n[kz])) {
+    kz = 1;
+  }
+  if (fabs(ray.n.Z) > fabs(ray.n.n[kz])) {
+    kz = 2;
+  }
+  unsigned int kx = (kz + 1)%3;
+  unsigned int ky = (kx + 1)%3;
+  // Preserve the winding order, so the sign of the determinant is consistent
+  if (ray.n.n[kz] < 0.0) {
+    unsigned int temp = kx;
+    kx = ky;
+    ky = temp;
+  }
+
+  mray.kx = kx;
+  mray.ky = ky;
+  mray.kz = kz;
+  mray.Sx = ray.n.n[kx]/ray.n.n[kz];
+  mray.Sy = ray.n.n[ky]/ray.n.n[kz];
+  mray.Sz = 1.0/ray.n.n[kz];
+  return mray;
+}
+
+/// Ray-node intersection test, widened slightly so rounding can't make a ray
+/// miss a triangle on the boundary of a box.
+static inline bool
+dmnsn_ray_mesh_node_intersection(const dmnsn_mesh_ray *mray, const dmnsn_mesh_node *node, double t)
+{
+  // As with dmnsn_ray_box_intersection(), the infinities from axis-parallel
+  // rays compare correctly
+  double tmin = -INFINITY, tmax = INFINITY;
+  for (unsigned int i = 0; i < 3; ++i) {
+    double t1 = (node->min[i] - mray->x0.n[i])*mray->n_inv.n[i];
+    double t2 = (node->max[i] - mray->x0.n[i])*mray->n_inv.n[i];
+    tmin = dmnsn_max(tmin, dmnsn_min(t1, t2));
+    tmax = dmnsn_min(tmax, dmnsn_max(t1, t2));
+  }
+
+  tmax *= 1.0 + 4.0*DBL_EPSILON;
+  return tmax >= dmnsn_max(0.0, tmin) && tmin < t;
+}
+
+/// Watertight ray-triangle intersection test.
+static inline bool
+dmnsn_ray_mesh_triangle_intersection(const dmnsn_mesh_ray *mray, const dmnsn_mesh *mesh, const uint32_t triangle[3], double t, double *t_hit, double *u, double *v)
+{
+  const float *a = mesh->vertices[triangle[0]];
+  const float *b = mesh->vertices[triangle[1]];
+  const float *c = mesh->vertices[triangle[2]];
+  unsigned int kx = mray->kx, ky = mray->ky, kz = mray->kz;
+
+  // Translate the vertices relative to the ray origin
+  double Az = a[kz] - mray->x0.n[kz];
+  double Bz = b[kz] - mray->x0.n[kz];
+  double Cz = c[kz] - mray->x0.n[kz];
+
+  // Shear them so the ray lies along the z axis
+  double Ax = a[kx] - mray->x0.n[kx] - mray->Sx*Az;
+  double Ay = a[ky] - mray->x0.n[ky] - mray->Sy*Az;
+  double Bx = b[kx] - mray->x0.n[kx] - mray->Sx*Bz;
+  double By = b[ky] - mray->x0.n[ky] - mray->Sy*Bz;
+  double Cx = c[kx] - mray->x0.n[kx] - mray->Sx*Cz;
+  double Cy = c[ky] - mray->x0.n[ky] - mray->Sy*Cz;
+
+  // The scaled barycentric coordinates.  A shared edge gets exactly opposite
+  // values in its two triangles, so no ray can miss both.
+  double U = Cx*By - Cy*Bx;
+  double V = Ax*Cy - Ay*Cx;
+  double W = Bx*Ay - By*Ax;
+  if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0)) {
+    return false;
+  }
+
+  double det = U + V + W;
+  if (det == 0.0) {
+    return false;
+  }
+
+  double T = mray->Sz*(U*Az + V*Bz + W*Cz);
+  double det_inv = 1.0/det;
+  *t_hit = T*det_inv;
+  if (!(*t_hit >= 0.0 && *t_hit < t)) {
+    return false;
+  }
+
+  *u = V*det_inv;
+  *v = W*det_inv;
+  return true;
+}
+
+/// Mesh intersection callback.
+DMNSN_HOT static bool
+dmnsn_mesh_intersection_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
+{
+  const dmnsn_mesh *mesh = (const dmnsn_mesh *)object;
+  dmnsn_mesh_ray mray = dmnsn_mesh_optimize_ray(l);
+
+  uint32_t stack[DMNSN_MESH_STACK_SIZE];
+  size_t top = 0;
+  stack[top++] = 0;
+
+  double t = INFINITY, u = 0.0, v = 0.0;
+  size_t index = 0;
+  while (top > 0) {
+    uint32_t i = stack[--top];
+    const dmnsn_mesh_node *node = &mesh->nodes[i];
+    if (!dmnsn_ray_mesh_node_intersection(&mray, node, t)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (size_t j = node->index; j < node->index + node->count; ++j) {
+        double t_hit, u_hit, v_hit;
+        if (dmnsn_ray_mesh_triangle_intersection(&mray, mesh, mesh->triangles[j], t, &t_hit, &u_hit, &v_hit)) {
+          t = t_hit;
+          u = u_hit;
+          v = v_hit;
+          index = j;
+        }
+      }
+    } else {
+      // Visit the nearer child first
+      uint32_t near = i + 1, far = node->index;
+      if (mray.sign[node->axis]) {
+        near = far;
+        far = i + 1;
+      }
+      stack[top++] = far;
+      stack[top++] = near;
+    }
+  }
+
+  if (isinf(t)) {
+    return false;
+  }
+
+  intersection->t = t;
+  intersection->u = u;
+  intersection->v = v;
+  intersection->index = index;
+  return true;
+}
+
+/// Mesh finalize callback.
+static void
+dmnsn_mesh_finalize_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
+{
+  const dmnsn_mesh *mesh = (const dmnsn_mesh *)object;
+  const uint32_t *triangle = mesh->triangles[intersection->index];
+  double u = intersection->u, v = intersection->v;
+
+  if (mesh->normals) {
+    const float *na = mesh->normals[triangle[0]];
+    const float *nb = mesh->normals[triangle[1]];
+    const float *nc = mesh->normals[triangle[2]];
+    double w = 1.0 - u - v;
+    intersection->normal = dmnsn_new_vector(
+      w*na[0] + u*nb[0] + v*nc[0],
+      w*na[1] + u*nb[1] + v*nc[1],
+      w*na[2] + u*nb[2] + v*nc[2]
+    );
+  } else {
+    const float *a = mesh->vertices[triangle[0]];
+    const float *b = mesh->vertices[triangle[1]];
+    const float *c = mesh->vertices[triangle[2]];
+    dmnsn_vector ab = dmnsn_new_vector(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+    dmnsn_vector ac = dmnsn_new_vector(c[0] - a[0], c[1] - a[1], c[2] - a[2]);
+    intersection->normal = dmnsn_vector_cross(ab, ac);
+  }
+}
+
+/// Mesh occlusion callback.
+DMNSN_HOT static bool
+dmnsn_mesh_occlusion_fn(const dmnsn_object *object, dmnsn_ray l, double t)
+{
+  const dmnsn_mesh *mesh = (const dmnsn_mesh *)object;
+  dmnsn_mesh_ray mray = dmnsn_mesh_optimize_ray(l);
+
+  uint32_t stack[DMNSN_MESH_STACK_SIZE];
+  size_t top = 0;
+  stack[top++] = 0;
+
+  // Any hit will do, so skip the front-to-back ordering
+  while (top > 0) {
+    uint32_t i = stack[--top];
+    const dmnsn_mesh_node *node = &mesh->nodes[i];
+    if (!dmnsn_ray_mesh_node_intersection(&mray, node, t)) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (size_t j = node->index; j < node->index + node->count; ++j) {
+        double t_hit, u, v;
+        if (dmnsn_ray_mesh_triangle_intersection(&mray, mesh, mesh->triangles[j], t, &t_hit, &u, &v)) {
+          return true;
+        }
+      }
+    } else {
+      stack[top++] = node->index;
+      stack[top++] = i + 1;
+    }
+  }
+
+  return false;
+}
+
+/// Mesh inside callback.
+static bool
+dmnsn_mesh_inside_fn(const dmnsn_object *object, dmnsn_vector point)
+{
+  return false;
+}
+
+/// Mesh bounding callback.
+static dmnsn_aabb
+dmnsn_mesh_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
+{
+  const dmnsn_mesh *mesh = (const dmnsn_mesh *)object;
+
+  dmnsn_aabb box = dmnsn_zero_aabb();
+  for (size_t i = 0; i < mesh->nvertices; ++i) {
+    const float *vertex = mesh->vertices[i];
+    dmnsn_vector point = dmnsn_transform_point(trans, dmnsn_new_vector(vertex[0], vertex[1], vertex[2]));
+    box = dmnsn_aabb_swallow(box, point);
+  }
+  return box;
+}
+
+/// Mesh vtable.
+static const dmnsn_object_vtable dmnsn_mesh_vtable = {
+  .intersection_fn = dmnsn_mesh_intersection_fn,
+  .finalize_fn = dmnsn_mesh_finalize_fn,
+  .occlusion_fn = dmnsn_mesh_occlusion_fn,
+  .inside_fn = dmnsn_mesh_inside_fn,
+  .bounding_fn = dmnsn_mesh_bounding_fn,
+};
+
+/// Mesh destruction callback.
+static void
+dmnsn_mesh_cleanup(void *ptr)
+{
+  dmnsn_mesh *mesh = ptr;
+  dmnsn_free(mesh->nodes);
+  dmnsn_free(mesh->triangles);
+  dmnsn_free(mesh->normals);
+  dmnsn_free(mesh->vertices);
+}
+
+/// A bin for the SAH sweep.
+typedef struct dmnsn_mesh_bin {
+  size_t count;
+  float min[3], max[3];
+} dmnsn_mesh_bin;
+
+/// An empty bounding box.
+static void
+dmnsn_mesh_empty_box(float min[3], float max[3])
+{
+  for (unsigned int i = 0; i < 3; ++i) {
+    min[i] = INFINITY;
+    max[i] = -INFINITY;
+  }
+}
+
+/// Grow a bounding box to contain another one.
+static void
+dmnsn_mesh_swallow_box(float min[3], float max[3], const float bmin[3], const float bmax[3])
+{
+  for (unsigned int i = 0; i < 3; ++i) {
+    min[i] = dmnsn_min(min[i], bmin[i]);
+    max[i] = dmnsn_max(max[i], bmax[i]);
+  }
+}
+
+/// Grow a bounding box to contain a triangle.
+static void
+dmnsn_mesh_swallow_triangle(const dmnsn_mesh *mesh, const uint32_t triangle[3], float min[3], float max[3])
+{
+  for (unsigned int i = 0; i < 3; ++i) {
+    const float *vertex = mesh->vertices[triangle[i]];
+    dmnsn_mesh_swallow_box(min, max, vertex, vertex);
+  }
+}
+
+/// The surface area of a bounding box, or 0 if it's empty.
+static double
+dmnsn_mesh_box_area(const float min[3], const float max[3])
+{
+  if (min[0] > max[0]) {
+    return 0.0;
+  }
+
+  double dx = (double)max[0] - min[0];
+  double dy = (double)max[1] - min[1];
+  double dz = (double)max[2] - min[2];
+  return dx*dy + dy*dz + dz*dx;
+}
+
+/// Three times the centroid of a triangle, along one axis.
+static double
+dmnsn_mesh_centroid(const dmnsn_mesh *mesh, const uint32_t triangle[3], unsigned int axis)
+{
+  return (double)mesh->vertices[triangle[0]][axis]
+    + mesh->vertices[triangle[1]][axis]
+    + mesh->vertices[triangle[2]][axis];
+}
+
+/// State for building a mesh's BVH.
+typedef struct dmnsn_mesh_builder {
+  dmnsn_mesh *mesh;
+  size_t capacity; ///< The allocated length of mesh->nodes.
+} dmnsn_mesh_builder;
+
+/// Which bin a triangle's centroid falls into.
+static inline size_t
+dmnsn_mesh_bin_index(double centroid, double cmin, double scale)
+{
+  size_t bin = (centroid - cmin)*scale;
+  return dmnsn_min(bin, DMNSN_MESH_BINS - 1);
+}
+
+/// Recursively build the BVH over triangles [begin, end), returning the index
+/// of the new node.
+static uint32_t
+dmnsn_mesh_build(dmnsn_mesh_builder *builder, size_t begin, size_t end, unsigned int depth)
+{
+  dmnsn_mesh *mesh = builder->mesh;
+  uint32_t (*triangles)[3] = mesh->triangles;
+
+  if (mesh->nnodes == builder->capacity) {
+    builder->capacity *= 2;
+    mesh->nodes = dmnsn_realloc(mesh->nodes, builder->capacity*sizeof(dmnsn_mesh_node));
+  }
+  uint32_t i = mesh->nnodes++;
+
+  // Bound the triangles and their centroids
+  float min[3], max[3];
+  dmnsn_mesh_empty_box(min, max);
+  double cmin[3] = { INFINITY, INFINITY, INFINITY };
+  double cmax[3] = { -INFINITY, -INFINITY, -INFINITY };
+  for (size_t j = begin; j < end; ++j) {
+    dmnsn_mesh_swallow_triangle(mesh, triangles[j], min, max);
+    for (unsigned int k = 0; k < 3; ++k) {
+      double centroid = dmnsn_mesh_centroid(mesh, triangles[j], k);
+      cmin[k] = dmnsn_min(cmin[k], centroid);
+      cmax[k] = dmnsn_max(cmax[k], centroid);
+    }
+  }
+
+  dmnsn_mesh_node *node = &mesh->nodes[i];
+  for (unsigned int k = 0; k < 3; ++k) {
+    node->min[k] = min[k];
+    node->max[k] = max[k];
+  }
+
+  size_t count = end - begin;
+  unsigned int axis = 0;
+  for (unsigned int k = 1; k < 3; ++k) {
+    if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis]) {
+      axis = k;
+    }
+  }
+  double extent = cmax[axis] - cmin[axis];
+
+  size_t mid = begin + count/2;
+  bool leaf = count <= DMNSN_MESH_MIN_LEAF;
+  if (!leaf && extent == 0.0) {
+    // Coincident centroids can't be separated, so don't bother trying
+    leaf = count <= DMNSN_MESH_MAX_LEAF;
+  } else if (!leaf && depth < DMNSN_MESH_SAH_DEPTH) {
+    // Bin the centroids and sweep for the cheapest split
+    dmnsn_mesh_bin bins[DMNSN_MESH_BINS];
+    for (size_t b = 0; b < DMNSN_MESH_BINS; ++b) {
+      bins[b].count = 0;
+      dmnsn_mesh_empty_box(bins[b].min, bins[b].max);
+    }
+
+    double scale = DMNSN_MESH_BINS/extent;
+    for (size_t j = begin; j < end; ++j) {
+      double centroid = dmnsn_mesh_centroid(mesh, triangles[j], axis);
+      dmnsn_mesh_bin *bin = &bins[dmnsn_mesh_bin_index(centroid, cmin[axis], scale)];
+      ++bin->count;
+      dmnsn_mesh_swallow_triangle(mesh, triangles[j], bin->min, bin->max);
+    }
+
+    double right_costs[DMNSN_MESH_BINS];
+    dmnsn_mesh_bin right = { .count = 0 };
+    dmnsn_mesh_empty_box(right.min, right.max);
+    for (size_t b = DMNSN_MESH_BINS - 1; b > 0; --b) {
+      right.count += bins[b].count;
+      dmnsn_mesh_swallow_box(right.min, right.max, bins[b].min, bins[b].max);
+      right_costs[b] = right.count*dmnsn_mesh_box_area(right.min, right.max);
+    }
+
+    size_t best_split = 0;
+    double best_cost = INFINITY;
+    dmnsn_mesh_bin left = { .count = 0 };
+    dmnsn_mesh_empty_box(left.min, left.max);
+    for (size_t b = 1; b < DMNSN_MESH_BINS; ++b) {
+      left.count += bins[b - 1].count;
+      dmnsn_mesh_swallow_box(left.min, left.max, bins[b - 1].min, bins[b - 1].max);
+      double cost = left.count*dmnsn_mesh_box_area(left.min, left.max) + right_costs[b];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_split = b;
+      }
+    }
+
+    // One traversal step costs about as much as one triangle test
+    double area = dmnsn_mesh_box_area(min, max);
+    if (count <= DMNSN_MESH_MAX_LEAF && count*area <= area + best_cost) {
+      leaf = true;
+    } else {
+      size_t j = begin, k = end;
+      while (j < k) {
+        double centroid = dmnsn_mesh_centroid(mesh, triangles[j], axis);
+        if (dmnsn_mesh_bin_index(centroid, cmin[axis], scale) < best_split) {
+          ++j;
+        } else {
+          --k;
+          for (unsigned int l = 0; l < 3; ++l) {
+            uint32_t temp = triangles[j][l];
+            triangles[j][l] = triangles[k][l];
+            triangles[k][l] = temp;
+          }
+        }
+      }
+
+      if (j > begin && j < end) {
+        mid = j;
+      }
+    }
+  }
+
+  if (leaf) {
+    node->index = begin;
+    node->count = count;
+    node->axis = 0;
+    return i;
+  }
+
+  // Past the SAH depth limit, splitting in half bounds the total depth
+  dmnsn_mesh_build(builder, begin, mid, depth + 1);
+  uint32_t right_child = dmnsn_mesh_build(builder, mid, end, depth + 1);
+
+  node = &mesh->nodes[i];
+  node->index = right_child;
+  node->count = 0;
+  node->axis = axis;
+  return i;
+}
+
+/// Check that a mesh isn't empty, and that its indices fit in a uint32_t.
+static bool
+dmnsn_mesh_size_valid(size_t nvertices, size_t ntriangles)
+{
+  // A leaf with no triangles would look like an inner node
+  if (nvertices == 0 || ntriangles == 0) {
+    return false;
+  }
+
+  // Written so it can't overflow with a 32-bit size_t
+  return nvertices - 1 <= UINT32_MAX && ntriangles <= UINT32_MAX/2;
+}
+
+/// Check that every coordinate of an array of vectors fits in a float.
+static bool
+dmnsn_mesh_vectors_valid(const dmnsn_vector vectors[], size_t n)
+{
+  for (size_t i = 0; i < n; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      if (!dmnsn_mesh_coordinate_valid(vectors[i].n[j])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+dmnsn_object *
+dmnsn_new_mesh_arrays(dmnsn_pool *pool, float (*vertices)[3], float (*normals)[3], size_t nvertices, uint32_t (*triangles)[3], size_t ntriangles)
+{
+  if (!dmnsn_mesh_size_valid(nvertices, ntriangles)) {
+    dmnsn_free(triangles);
+    dmnsn_free(normals);
+    dmnsn_free(vertices);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  dmnsn_mesh *mesh = DMNSN_PALLOC_TIDY(pool, dmnsn_mesh, dmnsn_mesh_cleanup);
+
+  dmnsn_object *object = &mesh->object;
+  dmnsn_init_object(object);
+  object->vtable = &dmnsn_mesh_vtable;
+
+  mesh->vertices = vertices;
+  mesh->normals = normals;
+  mesh->nvertices = nvertices;
+  mesh->triangles = triangles;
+  mesh->ntriangles = ntriangles;
+
+  // A binary tree over n triangles has at most 2*n - 1 nodes, but usually
+  // far fewer, so grow as needed and trim the excess afterwards
+  dmnsn_mesh_builder builder = {
+    .mesh = mesh,
+    .capacity = ntriangles/DMNSN_MESH_MIN_LEAF + 1,
+  };
+  mesh->nodes = dmnsn_malloc(builder.capacity*sizeof(dmnsn_mesh_node));
+  mesh->nnodes = 0;
+  dmnsn_mesh_build(&builder, 0, ntriangles, 0);
+  mesh->nodes = dmnsn_realloc(mesh->nodes, mesh->nnodes*sizeof(dmnsn_mesh_node));
+
+  return object;
+}
+
+dmnsn_object *
+dmnsn_new_mesh(dmnsn_pool *pool, const dmnsn_vector vertices[], const dmnsn_vector normals[], size_t nvertices, const uint32_t indices[], size_t ntriangles)
+{
+  if (!dmnsn_mesh_size_valid(nvertices, ntriangles)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  for (size_t i = 0; i < 3*ntriangles; ++i) {
+    if (indices[i] >= nvertices) {
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+  if (!dmnsn_mesh_vectors_valid(vertices, nvertices)
+      || (normals && !dmnsn_mesh_vectors_valid(normals, nvertices))) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  float (*fvertices)[3] = dmnsn_malloc(nvertices*sizeof(float[3]));
+  for (size_t i = 0; i < nvertices; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      fvertices[i][j] = vertices[i].n[j];
+    }
+  }
+
+  float (*fnormals)[3] = NULL;
+  if (normals) {
+    fnormals = dmnsn_malloc(nvertices*sizeof(float[3]));
+    for (size_t i = 0; i < nvertices; ++i) {
+      dmnsn_vector normal = dmnsn_vector_normalized(normals[i]);
+      for (unsigned int j = 0; j < 3; ++j) {
+        fnormals[i][j] = normal.n[j];
+      }
+    }
+  }
+
+  uint32_t (*triangles)[3] = dmnsn_malloc(ntriangles*sizeof(uint32_t[3]));
+  for (size_t i = 0; i < ntriangles; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      triangles[i][j] = indices[3*i + j];
+    }
+  }
+
+  return dmnsn_new_mesh_arrays(pool, fvertices, fnormals, nvertices, triangles, ntriangles);
+}
+
+dmnsn_object *
+dmnsn_read_mesh(dmnsn_pool *pool, FILE *file)
+{
+  dmnsn_mapped_file map;
+  if (dmnsn_map_file(file, &map) != 0) {
+    return NULL;
+  }
+
+  dmnsn_object *mesh;
+  if (map.size >= 4 && memcmp(map.data, "ply", 3) == 0 && (map.data[3] == '\n' || map.data[3] == '\r')) {
+    mesh = dmnsn_parse_ply_mesh(pool, map.data, map.size);
+  } else {
+    mesh = dmnsn_parse_obj_mesh(pool, map.data, map.size);
+  }
+
+  int err = errno;
+  dmnsn_unmap_file(&map);
+  errno = err;
+  return mesh;
+}
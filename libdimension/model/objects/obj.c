@@ -0,0 +1,478 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Wavefront OBJ mesh loading.  The file is split into chunks at line
+ * boundaries, and each chunk is parsed by its own thread: once to count the
+ * vertices and faces it holds, and again to store them at offsets found from
+ * the counts of the chunks before it.
+ */
+
+#include "internal.h"
+#include "internal/concurrency.h"
+#include "internal/mesh.h"
+#include "internal/platform.h"
+#include "dimension/model.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Chunks smaller than this aren't worth their own thread.
+#define DMNSN_OBJ_CHUNK_SIZE (1 << 20)
+
+/// A marker for a face corner with no normal.
+#define DMNSN_OBJ_NO_NORMAL UINT32_MAX
+
+/// A chunk of an OBJ file.
+typedef struct dmnsn_obj_chunk {
+  const char *begin, *end; ///< The lines in this chunk.
+
+  size_t nvertices;  ///< The number of vertices in this chunk.
+  size_t nnormals;   ///< The number of normals in this chunk.
+  size_t ntriangles; ///< The number of triangles in this chunk.
+
+  size_t vertex_offset;   ///< The number of vertices before this chunk.
+  size_t normal_offset;   ///< The number of normals before this chunk.
+  size_t triangle_offset; ///< The number of triangles before this chunk.
+
+  bool all_normals; ///< Whether every face corner had a normal.
+  int error;        ///< The errno value for a malformed chunk, or 0.
+} dmnsn_obj_chunk;
+
+/// Shared state for parsing an OBJ file.
+typedef struct dmnsn_obj_parser {
+  dmnsn_obj_chunk *chunks;
+  bool counted; ///< Whether the first pass is complete.
+
+  size_t nvertices, nnormals;
+
+  float (*vertices)[3];
+  float (*normals)[3];
+  uint32_t (*triangles)[3];
+  uint32_t (*triangle_normals)[3]; ///< The normal index of each corner.
+} dmnsn_obj_parser;
+
+/// A NUL-terminated copy of a line, since strtod() and friends need one.
+typedef struct dmnsn_obj_line {
+  char *str;
+  size_t capacity;
+} dmnsn_obj_line;
+
+/// Copy a line into the buffer, stripping comments.
+static char *
+dmnsn_obj_copy_line(dmnsn_obj_line *line, const char *begin, const char *end)
+{
+  const char *hash = memchr(begin, '#', end - begin);
+  if (hash) {
+    end = hash;
+  }
+
+  size_t size = end - begin;
+  if (size + 1 > line->capacity) {
+    line->capacity = 2*(size + 1);
+    line->str = dmnsn_realloc(line->str, line->capacity);
+  }
+
+  memcpy(line->str, begin, size);
+  line->str[size] = '\0';
+  return line->str;
+}
+
+/// Skip over whitespace.
+static char *
+dmnsn_obj_skip_space(char *str)
+{
+  while (isspace((unsigned char)*str)) {
+    ++str;
+  }
+  return str;
+}
+
+/// Check for a keyword at the start of a line, and skip past it.
+static bool
+dmnsn_obj_keyword(char **str, const char *keyword)
+{
+  size_t len = strlen(keyword);
+  if (strncmp(*str, keyword, len) == 0 && isspace((unsigned char)(*str)[len])) {
+    *str += len;
+    return true;
+  }
+  return false;
+}
+
+/// Count the corners of a face.
+static size_t
+dmnsn_obj_count_corners(char *str)
+{
+  size_t ncorners = 0;
+  while (*(str = dmnsn_obj_skip_space(str))) {
+    ++ncorners;
+    while (*str && !isspace((unsigned char)*str)) {
+      ++str;
+    }
+  }
+  return ncorners;
+}
+
+/// Parse three finite coordinates.
+static bool
+dmnsn_obj_parse_vector(char *str, float vector[3])
+{
+  for (unsigned int i = 0; i < 3; ++i) {
+    char *endptr;
+    double x = strtod(str, &endptr);
+    if (endptr == str || !dmnsn_mesh_coordinate_valid(x)) {
+      return false;
+    }
+    vector[i] = x;
+    str = endptr;
+  }
+  return true;
+}
+
+/// Resolve a 1-based, possibly negative OBJ index.
+static bool
+dmnsn_obj_resolve_index(long index, size_t before, size_t total, uint32_t *result)
+{
+  if (index > 0 && (size_t)index <= total) {
+    *result = index - 1;
+    return true;
+  } else if (index < 0 && (size_t)-index <= before) {
+    *result = before + index;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+/// Parse a face corner, of the form v, v/vt, v//vn, or v/vt/vn.
+static bool
+dmnsn_obj_parse_corner(const dmnsn_obj_parser *parser, char **str, size_t vertices_before, size_t normals_before, uint32_t *vertex, uint32_t *normal)
+{
+  char *endptr;
+  long v = strtol(*str, &endptr, 10);
+  if (endptr == *str || !dmnsn_obj_resolve_index(v, vertices_before, parser->nvertices, vertex)) {
+    return false;
+  }
+  *str = endptr;
+
+  *normal = DMNSN_OBJ_NO_NORMAL;
+  if (**str == '/') {
+    ++*str;
+    if (**str != '/') {
+      // Skip the texture coordinate
+      strtol(*str, &endptr, 10);
+      if (endptr == *str) {
+        return false;
+      }
+      *str = endptr;
+    }
+
+    if (**str == '/') {
+      ++*str;
+      long vn = strtol(*str, &endptr, 10);
+      if (endptr == *str || !dmnsn_obj_resolve_index(vn, normals_before, parser->nnormals, normal)) {
+        return false;
+      }
+      *str = endptr;
+    }
+  }
+
+  return **str == '\0' || isspace((unsigned char)**str);
+}
+
+/// Parse a chunk of the file, either to count or to store its contents.
+static int
+dmnsn_obj_parse_chunk(dmnsn_obj_parser *parser, dmnsn_obj_chunk *chunk)
+{
+  dmnsn_obj_line line = { .str = NULL, .capacity = 0 };
+  size_t nvertices = 0, nnormals = 0, ntriangles = 0;
+  chunk->all_normals = true;
+
+  const char *next;
+  for (const char *begin = chunk->begin; begin < chunk->end; begin = next) {
+    const char *end = memchr(begin, '\n', chunk->end - begin);
+    if (end) {
+      next = end + 1;
+    } else {
+      end = next = chunk->end;
+    }
+
+    char *str = dmnsn_obj_skip_space(dmnsn_obj_copy_line(&line, begin, end));
+    if (dmnsn_obj_keyword(&str, "v")) {
+      if (parser->counted && !dmnsn_obj_parse_vector(str, parser->vertices[chunk->vertex_offset + nvertices])) {
+        goto error;
+      }
+      ++nvertices;
+    } else if (dmnsn_obj_keyword(&str, "vn")) {
+      if (parser->counted && !dmnsn_obj_parse_vector(str, parser->normals[chunk->normal_offset + nnormals])) {
+        goto error;
+      }
+      ++nnormals;
+    } else if (dmnsn_obj_keyword(&str, "f")) {
+      if (!parser->counted) {
+        size_t ncorners = dmnsn_obj_count_corners(str);
+        if (ncorners < 3) {
+          goto error;
+        }
+        ntriangles += ncorners - 2;
+        continue;
+      }
+
+      // Triangulate the face as a fan around its first corner
+      size_t vertices_before = chunk->vertex_offset + nvertices;
+      size_t normals_before = chunk->normal_offset + nnormals;
+      uint32_t first[2] = { 0, 0 }, prev[2] = { 0, 0 }, cur[2];
+      for (size_t i = 0; *(str = dmnsn_obj_skip_space(str)); ++i) {
+        if (!dmnsn_obj_parse_corner(parser, &str, vertices_before, normals_before, &cur[0], &cur[1])) {
+          goto error;
+        }
+        if (cur[1] == DMNSN_OBJ_NO_NORMAL) {
+          chunk->all_normals = false;
+        }
+
+        if (i == 0) {
+          first[0] = cur[0];
+          first[1] = cur[1];
+        } else if (i >= 2) {
+          size_t t = chunk->triangle_offset + ntriangles++;
+          uint32_t *triangle = parser->triangles[t];
+          triangle[0] = first[0];
+          triangle[1] = prev[0];
+          triangle[2] = cur[0];
+
+          uint32_t *normals = parser->triangle_normals[t];
+          normals[0] = first[1];
+          normals[1] = prev[1];
+          normals[2] = cur[1];
+        }
+
+        prev[0] = cur[0];
+        prev[1] = cur[1];
+      }
+    }
+  }
+
+  dmnsn_free(line.str);
+  chunk->nvertices = nvertices;
+  chunk->nnormals = nnormals;
+  chunk->ntriangles = ntriangles;
+  return 0;
+
+ error:
+  dmnsn_free(line.str);
+  chunk->error = EINVAL;
+  return -1;
+}
+
+/// Thread callback for parsing chunks.
+static int
+dmnsn_obj_parse_thread(void *ptr, unsigned int thread, unsigned int nthreads)
+{
+  dmnsn_obj_parser *parser = ptr;
+  return dmnsn_obj_parse_chunk(parser, &parser->chunks[thread]);
+}
+
+/**
+ * Give every vertex a single normal.  OBJ files index positions and normals
+ * separately, so a position used with several normals (along a crease, say)
+ * is split into one vertex per normal.  Returns NULL if that makes too many
+ * vertices.
+ */
+static float (*
+dmnsn_obj_vertex_normals(dmnsn_obj_parser *parser, size_t *nvertices, size_t ntriangles))[3]
+{
+  size_t capacity = *nvertices;
+  uint32_t *vertex_normals = dmnsn_malloc(capacity*sizeof(uint32_t));
+  uint32_t *next = dmnsn_malloc(capacity*sizeof(uint32_t));
+  for (size_t i = 0; i < capacity; ++i) {
+    vertex_normals[i] = DMNSN_OBJ_NO_NORMAL;
+    next[i] = UINT32_MAX;
+  }
+
+  for (size_t i = 0; i < ntriangles; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      uint32_t normal = parser->triangle_normals[i][j];
+      uint32_t vertex = parser->triangles[i][j];
+
+      // Walk the copies of this vertex, looking for one with the same normal
+      while (vertex_normals[vertex] != normal) {
+        if (vertex_normals[vertex] == DMNSN_OBJ_NO_NORMAL) {
+          vertex_normals[vertex] = normal;
+        } else if (next[vertex] != UINT32_MAX) {
+          vertex = next[vertex];
+        } else {
+          if (*nvertices == DMNSN_MESH_MAX_SIZE) {
+            // Too many vertices after splitting
+            dmnsn_free(next);
+            dmnsn_free(vertex_normals);
+            return NULL;
+          } else if (*nvertices == capacity) {
+            capacity *= 2;
+            parser->vertices = dmnsn_realloc(parser->vertices, capacity*sizeof(float[3]));
+            vertex_normals = dmnsn_realloc(vertex_normals, capacity*sizeof(uint32_t));
+            next = dmnsn_realloc(next, capacity*sizeof(uint32_t));
+          }
+
+          uint32_t copy = (*nvertices)++;
+          memcpy(parser->vertices[copy], parser->vertices[vertex], sizeof(float[3]));
+          vertex_normals[copy] = normal;
+          next[copy] = UINT32_MAX;
+          next[vertex] = copy;
+          vertex = copy;
+        }
+      }
+
+      parser->triangles[i][j] = vertex;
+    }
+  }
+
+  float (*normals)[3] = dmnsn_malloc(*nvertices*sizeof(float[3]));
+  for (size_t i = 0; i < *nvertices; ++i) {
+    if (vertex_normals[i] == DMNSN_OBJ_NO_NORMAL) {
+      // An unused vertex
+      normals[i][0] = normals[i][1] = normals[i][2] = 0.0f;
+      continue;
+    }
+
+    const float *n = parser->normals[vertex_normals[i]];
+    dmnsn_vector normal = dmnsn_new_vector(n[0], n[1], n[2]);
+    if (dmnsn_vector_norm(normal) > 0.0) {
+      normal = dmnsn_vector_normalized(normal);
+    }
+    for (unsigned int j = 0; j < 3; ++j) {
+      normals[i][j] = normal.n[j];
+    }
+  }
+
+  dmnsn_free(next);
+  dmnsn_free(vertex_normals);
+  return normals;
+}
+
+dmnsn_object *
+dmnsn_parse_obj_mesh(dmnsn_pool *pool, const char *data, size_t size)
+{
+  size_t nthreads = size/DMNSN_OBJ_CHUNK_SIZE + 1;
+  if (nthreads > dmnsn_ncpus()) {
+    nthreads = dmnsn_ncpus();
+  }
+
+  // Split the file at line boundaries
+  dmnsn_obj_chunk chunks[nthreads];
+  const char *begin = data, *end = data + size;
+  for (size_t i = 0; i < nthreads; ++i) {
+    const char *chunk_end = end;
+    if (i + 1 < nthreads) {
+      chunk_end = data + (i + 1)*(size/nthreads);
+      if (chunk_end < begin) {
+        chunk_end = begin;
+      }
+      const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+      chunk_end = newline ? newline + 1 : end;
+    }
+
+    chunks[i] = (dmnsn_obj_chunk){
+      .begin = begin,
+      .end = chunk_end,
+      .error = 0,
+    };
+    begin = chunk_end;
+  }
+
+  dmnsn_obj_parser parser = {
+    .chunks = chunks,
+    .counted = false,
+    .vertices = NULL,
+    .normals = NULL,
+    .triangles = NULL,
+    .triangle_normals = NULL,
+  };
+  dmnsn_object *mesh = NULL;
+  int err = EINVAL;
+
+  // Count everything, then allocate space for it
+  if (dmnsn_execute_concurrently(NULL, dmnsn_obj_parse_thread, &parser, nthreads) != 0) {
+    goto error;
+  }
+
+  size_t nvertices = 0, nnormals = 0, ntriangles = 0;
+  for (size_t i = 0; i < nthreads; ++i) {
+    chunks[i].vertex_offset = nvertices;
+    chunks[i].normal_offset = nnormals;
+    chunks[i].triangle_offset = ntriangles;
+    nvertices += chunks[i].nvertices;
+    nnormals += chunks[i].nnormals;
+    ntriangles += chunks[i].ntriangles;
+  }
+  if (ntriangles == 0 || ntriangles > DMNSN_MESH_MAX_SIZE || nvertices > DMNSN_MESH_MAX_SIZE || nnormals > DMNSN_MESH_MAX_SIZE) {
+    goto error;
+  }
+
+  parser.counted = true;
+  parser.nvertices = nvertices;
+  parser.nnormals = nnormals;
+  parser.vertices = dmnsn_malloc(nvertices*sizeof(float[3]));
+  parser.normals = dmnsn_malloc(nnormals*sizeof(float[3]));
+  parser.triangles = dmnsn_malloc(ntriangles*sizeof(uint32_t[3]));
+  parser.triangle_normals = dmnsn_malloc(ntriangles*sizeof(uint32_t[3]));
+
+  // Now parse it for real
+  if (dmnsn_execute_concurrently(NULL, dmnsn_obj_parse_thread, &parser, nthreads) != 0) {
+    goto error;
+  }
+
+  // Smooth the mesh only if every face has normals
+  bool smooth = nnormals > 0;
+  for (size_t i = 0; i < nthreads; ++i) {
+    smooth = smooth && chunks[i].all_normals;
+  }
+
+  float (*normals)[3] = NULL;
+  if (smooth) {
+    normals = dmnsn_obj_vertex_normals(&parser, &nvertices, ntriangles);
+    if (!normals) {
+      goto error;
+    }
+  }
+
+  mesh = dmnsn_new_mesh_arrays(pool, parser.vertices, normals, nvertices, parser.triangles, ntriangles);
+  parser.vertices = NULL;
+  parser.triangles = NULL;
+  err = mesh ? 0 : errno;
+
+ error:
+  for (size_t i = 0; i < nthreads; ++i) {
+    if (chunks[i].error) {
+      err = chunks[i].error;
+    }
+  }
+
+  dmnsn_free(parser.triangle_normals);
+  dmnsn_free(parser.triangles);
+  dmnsn_free(parser.normals);
+  dmnsn_free(parser.vertices);
+  if (!mesh) {
+    errno = err;
+  }
+  return mesh;
+}
@@ -23,6 +23,8 @@
  * Planes.
  */
 
+#include "internal.h"
+#include "internal/packet.h"
 #include "dimension/model.h"
 #include <math.h>
 #include <stdlib.h>
@@ -31,6 +33,7 @@
 typedef struct {
   dmnsn_object object;
   dmnsn_vector normal;
+  double offset; ///< The plane is where x.normal + offset == 0.
 } dmnsn_plane;
 
 /// Returns the closest intersection of `ray' with `plane'.
@@ -43,7 +46,7 @@ dmnsn_plane_intersection_fn(const dmnsn_object *object, dmnsn_ray ray,
 
   double den = dmnsn_vector_dot(ray.n, normal);
   if (den != 0.0) {
-    double t = -dmnsn_vector_dot(ray.x0, normal)/den;
+    double t = -(dmnsn_vector_dot(ray.x0, normal) + plane->offset)/den;
     if (t >= 0.0) {
       intersection->t      = t;
       intersection->normal = normal;
@@ -53,12 +56,57 @@ dmnsn_plane_intersection_fn(const dmnsn_object *object, dmnsn_ray ray,
   return false;
 }
 
+#ifdef __SSE2__
+/// Plane packet intersection callback.
+static unsigned int
+dmnsn_plane_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[],
+                      unsigned int mask, dmnsn_intersection intersections[])
+{
+  const dmnsn_plane *plane = (const dmnsn_plane *)object;
+  dmnsn_vector normal = plane->normal;
+  __m128d normals[3];
+  for (size_t i = 0; i < 3; ++i) {
+    normals[i] = _mm_set1_pd(normal.n[i]);
+  }
+  __m128d offset = _mm_set1_pd(plane->offset);
+
+  dmnsn_ray_packet packet;
+  dmnsn_ray_packet_load(&packet, rays);
+
+  unsigned int hits = 0;
+  double t[DMNSN_OBJECT_PACKET_SIZE];
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; k += 2) {
+    __m128d x0[3], n[3];
+    dmnsn_ray_packet_get(&packet, k, x0, n);
+
+    __m128d den = dmnsn_dot_pd(n, normals);
+    __m128d t_k = _mm_div_pd(dmnsn_neg_pd(_mm_add_pd(dmnsn_dot_pd(x0, normals), offset)), den);
+    _mm_storeu_pd(&t[k], t_k);
+
+    __m128d hit = _mm_and_pd(
+      _mm_cmpneq_pd(den, _mm_setzero_pd()),
+      _mm_cmpge_pd(t_k, _mm_setzero_pd())
+    );
+    hits |= _mm_movemask_pd(hit) << k;
+  }
+  hits &= mask;
+
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    if (hits & (1U << k)) {
+      intersections[k].t      = t[k];
+      intersections[k].normal = normal;
+    }
+  }
+  return hits;
+}
+#endif
+
 /// Return whether a point is inside a plane.
 static bool
 dmnsn_plane_inside_fn(const dmnsn_object *object, dmnsn_vector point)
 {
   const dmnsn_plane *plane = (const dmnsn_plane *)object;
-  return dmnsn_vector_dot(point, plane->normal) < 0.0;
+  return dmnsn_vector_dot(point, plane->normal) + plane->offset < 0.0;
 }
 
 /// Plane bounding callback.
@@ -68,11 +116,29 @@ dmnsn_plane_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
   return dmnsn_infinite_aabb();
 }
 
+/// Plane precomputation callback.
+static void
+dmnsn_plane_precompute_fn(dmnsn_object *object)
+{
+  dmnsn_plane *plane = (dmnsn_plane *)object;
+  dmnsn_matrix trans_inv = object->trans_inv;
+
+  // Any transformed plane is still a plane, so store it in world space
+  dmnsn_vector t = dmnsn_matrix_column(trans_inv, 3);
+  plane->offset = dmnsn_vector_dot(t, plane->normal);
+  plane->normal = dmnsn_transform_normal(trans_inv, plane->normal);
+  object->trans_inv = dmnsn_identity_matrix();
+}
+
 /// Plane vtable.
 static const dmnsn_object_vtable dmnsn_plane_vtable = {
   .intersection_fn = dmnsn_plane_intersection_fn,
+#ifdef __SSE2__
+  .packet_fn = dmnsn_plane_packet_fn,
+#endif
   .inside_fn = dmnsn_plane_inside_fn,
   .bounding_fn = dmnsn_plane_bounding_fn,
+  .precompute_fn = dmnsn_plane_precompute_fn,
 };
 
 dmnsn_object *
@@ -80,6 +146,7 @@ dmnsn_new_plane(dmnsn_pool *pool, dmnsn_vector normal)
 {
   dmnsn_plane *plane = DMNSN_PALLOC(pool, dmnsn_plane);
   plane->normal = normal;
+  plane->offset = 0.0;
 
   dmnsn_object *object = &plane->object;
   dmnsn_init_object(object);
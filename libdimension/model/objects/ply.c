@@ -0,0 +1,567 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Binary PLY mesh loading.  Vertex records all have the same size, so they are
+ * decoded in parallel; face records vary in length, so they are decoded in a
+ * single pass.
+ */
+
+#include "internal.h"
+#include "internal/concurrency.h"
+#include "internal/mesh.h"
+#include "internal/platform.h"
+#include "dimension/model.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/// The most elements a PLY file may have.
+#define DMNSN_PLY_MAX_ELEMENTS 16
+/// The most properties a PLY element may have.
+#define DMNSN_PLY_MAX_PROPERTIES 32
+/// The longest header line we parse.
+#define DMNSN_PLY_MAX_LINE 256
+/// Vertices per thread below which decoding isn't worth parallelizing.
+#define DMNSN_PLY_CHUNK_SIZE (1 << 16)
+
+/// PLY scalar types.
+typedef enum dmnsn_ply_type {
+  DMNSN_PLY_INT8,
+  DMNSN_PLY_UINT8,
+  DMNSN_PLY_INT16,
+  DMNSN_PLY_UINT16,
+  DMNSN_PLY_INT32,
+  DMNSN_PLY_UINT32,
+  DMNSN_PLY_FLOAT32,
+  DMNSN_PLY_FLOAT64,
+  DMNSN_PLY_NTYPES
+} dmnsn_ply_type;
+
+/// PLY type names, with their modern aliases.
+static const struct {
+  const char *name, *alias;
+  size_t size;
+} dmnsn_ply_types[DMNSN_PLY_NTYPES] = {
+  [DMNSN_PLY_INT8]    = { "char",   "int8",    1 },
+  [DMNSN_PLY_UINT8]   = { "uchar",  "uint8",   1 },
+  [DMNSN_PLY_INT16]   = { "short",  "int16",   2 },
+  [DMNSN_PLY_UINT16]  = { "ushort", "uint16",  2 },
+  [DMNSN_PLY_INT32]   = { "int",    "int32",   4 },
+  [DMNSN_PLY_UINT32]  = { "uint",   "uint32",  4 },
+  [DMNSN_PLY_FLOAT32] = { "float",  "float32", 4 },
+  [DMNSN_PLY_FLOAT64] = { "double", "float64", 8 },
+};
+
+/// The vertex properties we care about.
+enum {
+  DMNSN_PLY_X, DMNSN_PLY_Y, DMNSN_PLY_Z,
+  DMNSN_PLY_NX, DMNSN_PLY_NY, DMNSN_PLY_NZ,
+  DMNSN_PLY_NROLES
+};
+
+/// The names of the vertex properties we care about.
+static const char *dmnsn_ply_roles[DMNSN_PLY_NROLES] = {
+  "x", "y", "z", "nx", "ny", "nz",
+};
+
+/// A property of a PLY element.
+typedef struct dmnsn_ply_property {
+  char name[DMNSN_PLY_MAX_LINE];
+  dmnsn_ply_type type;       ///< The type of the value, or of each list item.
+  bool list;                 ///< Whether this is a list property.
+  dmnsn_ply_type count_type; ///< The type of the list length.
+} dmnsn_ply_property;
+
+/// An element of a PLY file.
+typedef struct dmnsn_ply_element {
+  char name[DMNSN_PLY_MAX_LINE];
+  size_t count;
+  dmnsn_ply_property properties[DMNSN_PLY_MAX_PROPERTIES];
+  size_t nproperties;
+} dmnsn_ply_element;
+
+/// Look up a type by name.
+static bool
+dmnsn_ply_parse_type(const char *name, dmnsn_ply_type *type)
+{
+  for (int i = 0; i < DMNSN_PLY_NTYPES; ++i) {
+    if (strcmp(name, dmnsn_ply_types[i].name) == 0 || strcmp(name, dmnsn_ply_types[i].alias) == 0) {
+      *type = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Load a scalar, fixing its byte order if necessary.
+static inline void
+dmnsn_ply_load(void *dest, const char *src, size_t size, bool swap)
+{
+  if (swap) {
+    unsigned char *bytes = dest;
+    for (size_t i = 0; i < size; ++i) {
+      bytes[i] = src[size - i - 1];
+    }
+  } else {
+    memcpy(dest, src, size);
+  }
+}
+
+/// Read a scalar as a double.
+static inline double
+dmnsn_ply_read_double(const char *src, dmnsn_ply_type type, bool swap)
+{
+  switch (type) {
+  case DMNSN_PLY_INT8:    { int8_t x;   dmnsn_ply_load(&x, src, 1, swap); return x; }
+  case DMNSN_PLY_UINT8:   { uint8_t x;  dmnsn_ply_load(&x, src, 1, swap); return x; }
+  case DMNSN_PLY_INT16:   { int16_t x;  dmnsn_ply_load(&x, src, 2, swap); return x; }
+  case DMNSN_PLY_UINT16:  { uint16_t x; dmnsn_ply_load(&x, src, 2, swap); return x; }
+  case DMNSN_PLY_INT32:   { int32_t x;  dmnsn_ply_load(&x, src, 4, swap); return x; }
+  case DMNSN_PLY_UINT32:  { uint32_t x; dmnsn_ply_load(&x, src, 4, swap); return x; }
+  case DMNSN_PLY_FLOAT32: { float x;    dmnsn_ply_load(&x, src, 4, swap); return x; }
+  case DMNSN_PLY_FLOAT64: { double x;   dmnsn_ply_load(&x, src, 8, swap); return x; }
+  default:
+    dmnsn_unreachable("Invalid PLY type.");
+  }
+}
+
+/// Read an integer scalar, failing for negative or non-integer values.
+static inline bool
+dmnsn_ply_read_index(const char *src, dmnsn_ply_type type, bool swap, uint32_t *index)
+{
+  switch (type) {
+  case DMNSN_PLY_INT8:
+  case DMNSN_PLY_INT16:
+  case DMNSN_PLY_INT32:
+  case DMNSN_PLY_UINT8:
+  case DMNSN_PLY_UINT16:
+  case DMNSN_PLY_UINT32:
+    {
+      // Every integer type fits exactly in a double
+      double x = dmnsn_ply_read_double(src, type, swap);
+      if (x < 0.0) {
+        return false;
+      }
+      *index = x;
+      return true;
+    }
+  default:
+    return false;
+  }
+}
+
+/// Read one line of the header.
+static bool
+dmnsn_ply_read_line(const char **pos, const char *end, char line[DMNSN_PLY_MAX_LINE])
+{
+  const char *newline = memchr(*pos, '\n', end - *pos);
+  if (!newline) {
+    return false;
+  }
+
+  size_t size = newline - *pos;
+  if (size > 0 && (*pos)[size - 1] == '\r') {
+    --size;
+  }
+  if (size >= DMNSN_PLY_MAX_LINE) {
+    // Only comments are allowed to be long
+    size = DMNSN_PLY_MAX_LINE - 1;
+    if (strncmp(*pos, "comment", 7) != 0 && strncmp(*pos, "obj_info", 8) != 0) {
+      return false;
+    }
+  }
+
+  memcpy(line, *pos, size);
+  line[size] = '\0';
+  *pos = newline + 1;
+  return true;
+}
+
+/// Parse the header, leaving *pos at the start of the body.
+static bool
+dmnsn_ply_parse_header(const char **pos, const char *end, bool *swap, dmnsn_ply_element elements[DMNSN_PLY_MAX_ELEMENTS], size_t *nelements)
+{
+  char line[DMNSN_PLY_MAX_LINE];
+  if (!dmnsn_ply_read_line(pos, end, line) || strcmp(line, "ply") != 0) {
+    return false;
+  }
+
+  bool format = false;
+  *nelements = 0;
+  while (dmnsn_ply_read_line(pos, end, line)) {
+    char keyword[DMNSN_PLY_MAX_LINE], arg1[DMNSN_PLY_MAX_LINE], arg2[DMNSN_PLY_MAX_LINE], arg3[DMNSN_PLY_MAX_LINE];
+    char name[DMNSN_PLY_MAX_LINE];
+    int nargs = sscanf(line, "%255s %255s %255s %255s %255s", keyword, arg1, arg2, arg3, name);
+
+    if (nargs < 1 || strcmp(keyword, "comment") == 0 || strcmp(keyword, "obj_info") == 0) {
+      continue;
+    } else if (strcmp(keyword, "end_header") == 0) {
+      // Records with no properties take up no space, so a count for them
+      // can't be checked against the file size
+      for (size_t i = 0; i < *nelements; ++i) {
+        if (elements[i].nproperties == 0 && elements[i].count > 0) {
+          return false;
+        }
+      }
+      return format;
+    } else if (strcmp(keyword, "format") == 0 && nargs == 3) {
+      // Only binary files are supported
+      if (strcmp(arg1, "binary_little_endian") == 0) {
+        *swap = !dmnsn_is_little_endian();
+      } else if (strcmp(arg1, "binary_big_endian") == 0) {
+        *swap = dmnsn_is_little_endian();
+      } else {
+        return false;
+      }
+      format = true;
+    } else if (strcmp(keyword, "element") == 0 && nargs == 3) {
+      if (*nelements == DMNSN_PLY_MAX_ELEMENTS) {
+        return false;
+      }
+
+      dmnsn_ply_element *element = &elements[(*nelements)++];
+      unsigned long long count;
+      char *endptr;
+      errno = 0;
+      count = strtoull(arg2, &endptr, 10);
+      if (*endptr || errno || arg2[0] == '-' || count > SIZE_MAX) {
+        return false;
+      }
+
+      strcpy(element->name, arg1);
+      element->count = count;
+      element->nproperties = 0;
+    } else if (strcmp(keyword, "property") == 0 && *nelements > 0) {
+      dmnsn_ply_element *element = &elements[*nelements - 1];
+      if (element->nproperties == DMNSN_PLY_MAX_PROPERTIES) {
+        return false;
+      }
+
+      dmnsn_ply_property *property = &element->properties[element->nproperties++];
+      if (nargs == 3 && dmnsn_ply_parse_type(arg1, &property->type)) {
+        property->list = false;
+        strcpy(property->name, arg2);
+      } else if (nargs == 5 && strcmp(arg1, "list") == 0
+                 && dmnsn_ply_parse_type(arg2, &property->count_type)
+                 && dmnsn_ply_parse_type(arg3, &property->type)) {
+        property->list = true;
+        strcpy(property->name, name);
+      } else {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+/// Find a property by name.
+static const dmnsn_ply_property *
+dmnsn_ply_find_property(const dmnsn_ply_element *element, const char *name)
+{
+  for (size_t i = 0; i < element->nproperties; ++i) {
+    if (strcmp(element->properties[i].name, name) == 0) {
+      return &element->properties[i];
+    }
+  }
+  return NULL;
+}
+
+/// The size of a fixed-size record, or 0 if it contains lists.
+static size_t
+dmnsn_ply_stride(const dmnsn_ply_element *element)
+{
+  size_t stride = 0;
+  for (size_t i = 0; i < element->nproperties; ++i) {
+    if (element->properties[i].list) {
+      return 0;
+    }
+    stride += dmnsn_ply_types[element->properties[i].type].size;
+  }
+  return stride;
+}
+
+/**
+ * Walk over one variable-size record, noting where the items of the list
+ * property \p target (if any) are.  Returns the end of the record, or NULL if
+ * the record is truncated or malformed.
+ */
+static const char *
+dmnsn_ply_skip_record(const char *pos, const char *end, const dmnsn_ply_element *element, bool swap, const dmnsn_ply_property *target, const char **items, size_t *nitems)
+{
+  for (size_t i = 0; i < element->nproperties; ++i) {
+    const dmnsn_ply_property *property = &element->properties[i];
+    size_t size = dmnsn_ply_types[property->type].size;
+    size_t count = 1;
+
+    if (property->list) {
+      size_t count_size = dmnsn_ply_types[property->count_type].size;
+      uint32_t n;
+      if ((size_t)(end - pos) < count_size || !dmnsn_ply_read_index(pos, property->count_type, swap, &n)) {
+        return NULL;
+      }
+      pos += count_size;
+      count = n;
+    }
+
+    if ((size_t)(end - pos)/size < count) {
+      return NULL;
+    }
+    if (property == target) {
+      *items = pos;
+      *nitems = count;
+    }
+    pos += count*size;
+  }
+  return pos;
+}
+
+/// Shared state for decoding vertices in parallel.
+typedef struct dmnsn_ply_vertex_payload {
+  const char *data;
+  size_t count, stride;
+  bool swap, smooth;
+  size_t offsets[DMNSN_PLY_NROLES];
+  dmnsn_ply_type types[DMNSN_PLY_NROLES];
+  float (*vertices)[3];
+  float (*normals)[3];
+} dmnsn_ply_vertex_payload;
+
+/// Thread callback for decoding vertices.
+static int
+dmnsn_ply_vertex_thread(void *ptr, unsigned int thread, unsigned int nthreads)
+{
+  const dmnsn_ply_vertex_payload *payload = ptr;
+  size_t begin = thread*(payload->count/nthreads);
+  size_t end = thread + 1 == nthreads ? payload->count : begin + payload->count/nthreads;
+
+  for (size_t i = begin; i < end; ++i) {
+    const char *record = payload->data + i*payload->stride;
+    for (unsigned int j = 0; j < 3; ++j) {
+      double x = dmnsn_ply_read_double(record + payload->offsets[j], payload->types[j], payload->swap);
+      if (!dmnsn_mesh_coordinate_valid(x)) {
+        return -1;
+      }
+      payload->vertices[i][j] = x;
+    }
+
+    if (payload->smooth) {
+      dmnsn_vector normal;
+      for (unsigned int j = 0; j < 3; ++j) {
+        normal.n[j] = dmnsn_ply_read_double(record + payload->offsets[3 + j], payload->types[3 + j], payload->swap);
+        if (!dmnsn_mesh_coordinate_valid(normal.n[j])) {
+          return -1;
+        }
+      }
+      if (dmnsn_vector_norm(normal) > 0.0) {
+        normal = dmnsn_vector_normalized(normal);
+      }
+      for (unsigned int j = 0; j < 3; ++j) {
+        payload->normals[i][j] = normal.n[j];
+      }
+    }
+  }
+
+  return 0;
+}
+
+/// Decode the vertex element.
+static bool
+dmnsn_ply_parse_vertices(const char *data, const char *end, const dmnsn_ply_element *element, bool swap, dmnsn_ply_vertex_payload *payload)
+{
+  size_t stride = dmnsn_ply_stride(element);
+  if (stride == 0 || (size_t)(end - data)/stride < element->count) {
+    return false;
+  }
+
+  payload->data = data;
+  payload->count = element->count;
+  payload->stride = stride;
+  payload->swap = swap;
+
+  payload->smooth = true;
+  for (unsigned int i = 0; i < DMNSN_PLY_NROLES; ++i) {
+    const dmnsn_ply_property *property = dmnsn_ply_find_property(element, dmnsn_ply_roles[i]);
+    if (!property) {
+      if (i < DMNSN_PLY_NX) {
+        return false;
+      }
+      payload->smooth = false;
+      continue;
+    }
+
+    size_t offset = 0;
+    for (const dmnsn_ply_property *p = element->properties; p != property; ++p) {
+      offset += dmnsn_ply_types[p->type].size;
+    }
+    payload->offsets[i] = offset;
+    payload->types[i] = property->type;
+  }
+
+  payload->vertices = dmnsn_malloc(element->count*sizeof(float[3]));
+  if (payload->smooth) {
+    payload->normals = dmnsn_malloc(element->count*sizeof(float[3]));
+  }
+
+  size_t nthreads = element->count/DMNSN_PLY_CHUNK_SIZE + 1;
+  if (nthreads > dmnsn_ncpus()) {
+    nthreads = dmnsn_ncpus();
+  }
+  return dmnsn_execute_concurrently(NULL, dmnsn_ply_vertex_thread, payload, nthreads) == 0;
+}
+
+/// Decode the face element, returning the end of it or NULL on failure.
+static const char *
+dmnsn_ply_parse_faces(const char *data, const char *end, const dmnsn_ply_element *element, bool swap, uint32_t (**triangles)[3], size_t *ntriangles)
+{
+  const dmnsn_ply_property *indices = dmnsn_ply_find_property(element, "vertex_indices");
+  if (!indices) {
+    indices = dmnsn_ply_find_property(element, "vertex_index");
+  }
+  if (!indices || !indices->list) {
+    return NULL;
+  }
+  size_t size = dmnsn_ply_types[indices->type].size;
+
+  // Count the triangles first, so they can be stored without reallocating
+  *ntriangles = 0;
+  const char *pos = data;
+  for (size_t i = 0; i < element->count; ++i) {
+    const char *items;
+    size_t nitems = 0;
+    pos = dmnsn_ply_skip_record(pos, end, element, swap, indices, &items, &nitems);
+    if (!pos) {
+      return NULL;
+    }
+    if (nitems >= 3) {
+      *ntriangles += nitems - 2;
+    }
+  }
+
+  if (*ntriangles == 0 || *ntriangles > DMNSN_MESH_MAX_SIZE) {
+    return NULL;
+  }
+  *triangles = dmnsn_malloc(*ntriangles*sizeof(uint32_t[3]));
+
+  // Triangulate each face as a fan around its first corner
+  size_t t = 0;
+  pos = data;
+  for (size_t i = 0; i < element->count; ++i) {
+    const char *items;
+    size_t nitems = 0;
+    pos = dmnsn_ply_skip_record(pos, end, element, swap, indices, &items, &nitems);
+
+    uint32_t first = 0, prev = 0, cur;
+    for (size_t j = 0; j < nitems; ++j) {
+      if (!dmnsn_ply_read_index(items + j*size, indices->type, swap, &cur)) {
+        return NULL;
+      }
+
+      if (j == 0) {
+        first = cur;
+      } else if (j >= 2) {
+        (*triangles)[t][0] = first;
+        (*triangles)[t][1] = prev;
+        (*triangles)[t][2] = cur;
+        ++t;
+      }
+      prev = cur;
+    }
+  }
+
+  return pos;
+}
+
+dmnsn_object *
+dmnsn_parse_ply_mesh(dmnsn_pool *pool, const char *data, size_t size)
+{
+  const char *pos = data, *end = data + size;
+  bool swap = false;
+  dmnsn_ply_element elements[DMNSN_PLY_MAX_ELEMENTS];
+  size_t nelements;
+  if (!dmnsn_ply_parse_header(&pos, end, &swap, elements, &nelements)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  dmnsn_ply_vertex_payload vertices = { .vertices = NULL, .normals = NULL };
+  uint32_t (*triangles)[3] = NULL;
+  size_t nvertices = 0, ntriangles = 0;
+  bool have_vertices = false, have_faces = false;
+
+  for (size_t i = 0; i < nelements; ++i) {
+    const dmnsn_ply_element *element = &elements[i];
+
+    if (strcmp(element->name, "vertex") == 0 && !have_vertices) {
+      if (!dmnsn_ply_parse_vertices(pos, end, element, swap, &vertices)) {
+        goto error;
+      }
+      nvertices = element->count;
+      pos += nvertices*vertices.stride;
+      have_vertices = true;
+    } else if (strcmp(element->name, "face") == 0 && !have_faces) {
+      pos = dmnsn_ply_parse_faces(pos, end, element, swap, &triangles, &ntriangles);
+      if (!pos) {
+        goto error;
+      }
+      have_faces = true;
+    } else {
+      // Skip anything else
+      size_t stride = dmnsn_ply_stride(element);
+      if (stride > 0) {
+        if ((size_t)(end - pos)/stride < element->count) {
+          goto error;
+        }
+        pos += element->count*stride;
+      } else {
+        for (size_t j = 0; j < element->count; ++j) {
+          pos = dmnsn_ply_skip_record(pos, end, element, swap, NULL, NULL, NULL);
+          if (!pos) {
+            goto error;
+          }
+        }
+      }
+    }
+  }
+
+  if (!have_vertices || !have_faces || nvertices > DMNSN_MESH_MAX_SIZE) {
+    goto error;
+  }
+  for (size_t i = 0; i < ntriangles; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      if (triangles[i][j] >= nvertices) {
+        goto error;
+      }
+    }
+  }
+
+  return dmnsn_new_mesh_arrays(pool, vertices.vertices, vertices.normals, nvertices, triangles, ntriangles);
+
+ error:
+  dmnsn_free(triangles);
+  dmnsn_free(vertices.normals);
+  dmnsn_free(vertices.vertices);
+  errno = EINVAL;
+  return NULL;
+}
@@ -24,18 +24,31 @@
  */
 
 #include "internal.h"
+#include "internal/packet.h"
 #include "internal/polynomial.h"
 #include "dimension/model.h"
+#include <float.h>
+#include <math.h>
+
+/// Sphere type.
+typedef struct {
+  dmnsn_object object;
+  dmnsn_vector center; ///< The center of the sphere.
+  double radius2;      ///< The squared radius of the sphere.
+} dmnsn_sphere;
 
 /// Sphere intersection callback.
 static bool
-dmnsn_sphere_intersection_fn(const dmnsn_object *sphere, dmnsn_ray l, dmnsn_intersection *intersection)
+dmnsn_sphere_intersection_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
 {
-  // Solve (x0 + nx*t)^2 + (y0 + ny*t)^2 + (z0 + nz*t)^2 == 1
+  const dmnsn_sphere *sphere = (const dmnsn_sphere *)object;
+  dmnsn_vector x0 = dmnsn_vector_sub(l.x0, sphere->center);
+
+  // Solve (x0 + nx*t)^2 + (y0 + ny*t)^2 + (z0 + nz*t)^2 == r^2
   double poly[3], x[2];
   poly[2] = dmnsn_vector_dot(l.n, l.n);
-  poly[1] = 2.0*dmnsn_vector_dot(l.n, l.x0);
-  poly[0] = dmnsn_vector_dot(l.x0, l.x0) - 1.0;
+  poly[1] = 2.0*dmnsn_vector_dot(l.n, x0);
+  poly[0] = dmnsn_vector_dot(x0, x0) - sphere->radius2;
 
   size_t n = dmnsn_polynomial_solve(poly, 2, x);
   if (n == 0) {
@@ -49,15 +62,103 @@ dmnsn_sphere_intersection_fn(const dmnsn_object *sphere, dmnsn_ray l, dmnsn_inte
   }
 
   intersection->t = t;
-  intersection->normal = dmnsn_ray_point(l, t);
   return true;
 }
 
+#ifdef __SSE2__
+/// Sphere packet intersection callback.
+static unsigned int
+dmnsn_sphere_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[], unsigned int mask, dmnsn_intersection intersections[])
+{
+  const dmnsn_sphere *sphere = (const dmnsn_sphere *)object;
+  __m128d center[3];
+  for (size_t i = 0; i < 3; ++i) {
+    center[i] = _mm_set1_pd(sphere->center.n[i]);
+  }
+
+  dmnsn_ray_packet packet;
+  dmnsn_ray_packet_load(&packet, rays);
+
+  unsigned int hits = 0, slow = 0;
+  double t[DMNSN_OBJECT_PACKET_SIZE];
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; k += 2) {
+    __m128d x0[3], n[3];
+    dmnsn_ray_packet_get(&packet, k, x0, n);
+    for (size_t i = 0; i < 3; ++i) {
+      x0[i] = _mm_sub_pd(x0[i], center[i]);
+    }
+
+    __m128d poly[3], x[2], one, two;
+    poly[2] = dmnsn_dot_pd(n, n);
+    poly[1] = _mm_mul_pd(_mm_set1_pd(2.0), dmnsn_dot_pd(n, x0));
+    poly[0] = _mm_sub_pd(dmnsn_dot_pd(x0, x0), _mm_set1_pd(sphere->radius2));
+    __m128d slow_k = dmnsn_solve_quadratic_pd(poly, x, &one, &two);
+
+    __m128d tmin = dmnsn_select_pd(_mm_cmplt_pd(x[0], x[1]), x[0], x[1]);
+    _mm_storeu_pd(&t[k], dmnsn_select_pd(two, tmin, x[0]));
+    hits |= _mm_movemask_pd(_mm_andnot_pd(slow_k, one)) << k;
+    slow |= _mm_movemask_pd(slow_k) << k;
+  }
+  hits &= mask;
+  slow &= mask;
+
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    if (slow & (1U << k)) {
+      if (dmnsn_sphere_intersection_fn(object, rays[k], &intersections[k])) {
+        hits |= 1U << k;
+      }
+    } else if (hits & (1U << k)) {
+      intersections[k].t = t[k];
+    }
+  }
+  return hits;
+}
+#endif
+
+/// Sphere occlusion callback.
+static bool
+dmnsn_sphere_occlusion_fn(const dmnsn_object *object, dmnsn_ray l, double t)
+{
+  const dmnsn_sphere *sphere = (const dmnsn_sphere *)object;
+  dmnsn_vector x0 = dmnsn_vector_sub(l.x0, sphere->center);
+
+  // Most shadow rays miss, so reject them without the full root-finding.  The
+  // coefficients are normalized the same way dmnsn_polynomial_solve() does, so
+  // this never rejects a ray that dmnsn_sphere_intersection_fn() would accept.
+  double a = dmnsn_vector_dot(l.n, l.n);
+  if (dmnsn_likely(a >= dmnsn_epsilon)) {
+    double b = 2.0*dmnsn_vector_dot(l.n, x0)/a;
+    double c = (dmnsn_vector_dot(x0, x0) - sphere->radius2)/a;
+    if (b*b - 4.0*c < 0.0) {
+      // The line misses the sphere
+      return false;
+    }
+    if (b > 0.0 && c > 0.0) {
+      // Both roots are negative, so the sphere is behind the ray
+      return false;
+    }
+  }
+
+  dmnsn_intersection intersection;
+  return dmnsn_sphere_intersection_fn(object, l, &intersection)
+    && intersection.t < t;
+}
+
+/// Sphere finalize callback.
+static void
+dmnsn_sphere_finalize_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
+{
+  const dmnsn_sphere *sphere = (const dmnsn_sphere *)object;
+  intersection->normal = dmnsn_vector_sub(dmnsn_ray_point(l, intersection->t), sphere->center);
+}
+
 /// Sphere inside callback.
 static bool
-dmnsn_sphere_inside_fn(const dmnsn_object *sphere, dmnsn_vector point)
+dmnsn_sphere_inside_fn(const dmnsn_object *object, dmnsn_vector point)
 {
-  return point.X*point.X + point.Y*point.Y + point.Z*point.Z < 1.0;
+  const dmnsn_sphere *sphere = (const dmnsn_sphere *)object;
+  dmnsn_vector v = dmnsn_vector_sub(point, sphere->center);
+  return v.X*v.X + v.Y*v.Y + v.Z*v.Z < sphere->radius2;
 }
 
 /// Helper for sphere bounding box calculation.
@@ -99,17 +200,60 @@ dmnsn_sphere_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
   return box;
 }
 
+/// Sphere precomputation callback.
+static void
+dmnsn_sphere_precompute_fn(dmnsn_object *object)
+{
+  dmnsn_sphere *sphere = (dmnsn_sphere *)object;
+  dmnsn_matrix trans_inv = object->trans_inv;
+
+  // Rotations and uniform scales keep a sphere a sphere, so it can be stored
+  // in world space.  That's the case when the rows of trans_inv are orthogonal
+  // and equally long.
+  double k2 = dmnsn_implicit_dot(trans_inv.n[0]);
+  const double epsilon = 16.0*DBL_EPSILON*k2;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      double dot = 0.0;
+      for (int k = 0; k < 3; ++k) {
+        dot += trans_inv.n[i][k]*trans_inv.n[j][k];
+      }
+      if (fabs(dot - (i == j ? k2 : 0.0)) > epsilon) {
+        return;
+      }
+    }
+  }
+
+  // The center is where trans_inv*x == 0, and inverting trans_inv is just
+  // transposing and dividing by k2
+  dmnsn_vector t = dmnsn_matrix_column(trans_inv, 3);
+  sphere->center = dmnsn_vector_mul(-1.0/k2, dmnsn_transform_normal(trans_inv, t));
+  sphere->radius2 = 1.0/k2;
+  object->trans_inv = dmnsn_identity_matrix();
+}
+
 /// Sphere vtable.
 static const dmnsn_object_vtable dmnsn_sphere_vtable = {
   .intersection_fn = dmnsn_sphere_intersection_fn,
+#ifdef __SSE2__
+  .packet_fn = dmnsn_sphere_packet_fn,
+#endif
+  .finalize_fn = dmnsn_sphere_finalize_fn,
+  .occlusion_fn = dmnsn_sphere_occlusion_fn,
   .inside_fn = dmnsn_sphere_inside_fn,
   .bounding_fn = dmnsn_sphere_bounding_fn,
+  .precompute_fn = dmnsn_sphere_precompute_fn,
 };
 
 dmnsn_object *
 dmnsn_new_sphere(dmnsn_pool *pool)
 {
-  dmnsn_object *sphere = dmnsn_new_object(pool);
-  sphere->vtable = &dmnsn_sphere_vtable;
-  return sphere;
+  dmnsn_sphere *sphere = DMNSN_PALLOC(pool, dmnsn_sphere);
+  sphere->center = dmnsn_zero;
+  sphere->radius2 = 1.0;
+
+  dmnsn_object *object = &sphere->object;
+  dmnsn_init_object(object);
+  object->vtable = &dmnsn_sphere_vtable;
+  return object;
 }
@@ -120,16 +120,23 @@ dmnsn_torus_intersection_fn(const dmnsn_object *object, dmnsn_ray l,
     return false;
   }
 
-  dmnsn_vector p = dmnsn_ray_point(l, t);
+  intersection->t = t;
+  return true;
+}
+
+/// Torus finalize callback.
+static void
+dmnsn_torus_finalize_fn(const dmnsn_object *object, dmnsn_ray l,
+                        dmnsn_intersection *intersection)
+{
+  const dmnsn_torus *torus = (const dmnsn_torus *)object;
+
+  dmnsn_vector p = dmnsn_ray_point(l, intersection->t);
   dmnsn_vector center = dmnsn_vector_mul(
-    R,
+    torus->major,
     dmnsn_vector_normalized(dmnsn_new_vector(p.X, 0.0, p.Z))
   );
-  dmnsn_vector normal = dmnsn_vector_sub(p, center);
-
-  intersection->t      = t;
-  intersection->normal = normal;
-  return true;
+  intersection->normal = dmnsn_vector_sub(p, center);
 }
 
 /// Torus inside callback.
@@ -155,6 +162,7 @@ dmnsn_torus_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
 /// Torus vtable.
 static const dmnsn_object_vtable dmnsn_torus_vtable = {
   .intersection_fn = dmnsn_torus_intersection_fn,
+  .finalize_fn = dmnsn_torus_finalize_fn,
   .inside_fn = dmnsn_torus_inside_fn,
   .bounding_fn = dmnsn_torus_bounding_fn,
 };
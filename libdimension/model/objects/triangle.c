@@ -26,6 +26,7 @@
  */
 
 #include "internal.h"
+#include "internal/packet.h"
 #include "dimension/model.h"
 
 /// Optimized ray/triangle intersection test.
@@ -39,6 +40,37 @@ dmnsn_ray_triangle_intersection(dmnsn_ray l, double *t, double *u, double *v)
   return *t >= 0.0 && *u >= 0.0 && *v >= 0.0 && *u + *v <= 1.0;
 }
 
+#ifdef __SSE2__
+/// Optimized ray/triangle intersection test for a packet of rays.
+static inline unsigned int
+dmnsn_ray_triangle_packet_intersection(const dmnsn_ray rays[], double t[], double u[], double v[])
+{
+  dmnsn_ray_packet packet;
+  dmnsn_ray_packet_load(&packet, rays);
+
+  unsigned int hits = 0;
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; k += 2) {
+    __m128d x0[3], n[3];
+    dmnsn_ray_packet_get(&packet, k, x0, n);
+
+    __m128d t_k = _mm_div_pd(dmnsn_neg_pd(x0[2]), n[2]);
+    __m128d u_k = _mm_add_pd(x0[0], _mm_mul_pd(t_k, n[0]));
+    __m128d v_k = _mm_add_pd(x0[1], _mm_mul_pd(t_k, n[1]));
+    _mm_storeu_pd(&t[k], t_k);
+    _mm_storeu_pd(&u[k], u_k);
+    _mm_storeu_pd(&v[k], v_k);
+
+    __m128d zero = _mm_setzero_pd();
+    __m128d hit = _mm_and_pd(
+      _mm_and_pd(_mm_cmpge_pd(t_k, zero), _mm_cmpge_pd(u_k, zero)),
+      _mm_and_pd(_mm_cmpge_pd(v_k, zero), _mm_cmple_pd(_mm_add_pd(u_k, v_k), _mm_set1_pd(1.0)))
+    );
+    hits |= _mm_movemask_pd(hit) << k;
+  }
+  return hits;
+}
+#endif
+
 /// Triangle intersection callback.
 DMNSN_HOT static bool
 dmnsn_triangle_intersection_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
@@ -53,6 +85,32 @@ dmnsn_triangle_intersection_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_in
   return false;
 }
 
+#ifdef __SSE2__
+/// Triangle packet intersection callback.
+DMNSN_HOT static unsigned int
+dmnsn_triangle_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[],
+                         unsigned int mask, dmnsn_intersection intersections[])
+{
+  double t[DMNSN_OBJECT_PACKET_SIZE], u[DMNSN_OBJECT_PACKET_SIZE], v[DMNSN_OBJECT_PACKET_SIZE];
+  unsigned int hits = dmnsn_ray_triangle_packet_intersection(rays, t, u, v) & mask;
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    if (hits & (1U << k)) {
+      intersections[k].t = t[k];
+      intersections[k].normal = dmnsn_z;
+    }
+  }
+  return hits;
+}
+#endif
+
+/// Triangle occlusion callback, shared with smooth triangles.
+DMNSN_HOT static bool
+dmnsn_triangle_occlusion_fn(const dmnsn_object *object, dmnsn_ray l, double t)
+{
+  double t_hit, u, v;
+  return dmnsn_ray_triangle_intersection(l, &t_hit, &u, &v) && t_hit < t;
+}
+
 /// Triangle inside callback.
 static bool
 dmnsn_triangle_inside_fn(const dmnsn_object *object, dmnsn_vector point)
@@ -77,6 +135,10 @@ dmnsn_triangle_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
 /// Triangle vtable.
 static const dmnsn_object_vtable dmnsn_triangle_vtable = {
   .intersection_fn = dmnsn_triangle_intersection_fn,
+#ifdef __SSE2__
+  .packet_fn = dmnsn_triangle_packet_fn,
+#endif
+  .occlusion_fn = dmnsn_triangle_occlusion_fn,
   .inside_fn = dmnsn_triangle_inside_fn,
   .bounding_fn = dmnsn_triangle_bounding_fn,
 };
@@ -92,27 +154,60 @@ DMNSN_HOT static bool
 dmnsn_smooth_triangle_intersection_fn(const dmnsn_object *object, dmnsn_ray l,
                                       dmnsn_intersection *intersection)
 {
-  const dmnsn_smooth_triangle *triangle = (const dmnsn_smooth_triangle *)object;
-
   double t, u, v;
   if (dmnsn_ray_triangle_intersection(l, &t, &u, &v)) {
     intersection->t = t;
-    intersection->normal = dmnsn_vector_add(
-      triangle->na,
-      dmnsn_vector_add(
-        dmnsn_vector_mul(u, triangle->nab),
-        dmnsn_vector_mul(v, triangle->nac)
-      )
-    );
+    intersection->u = u;
+    intersection->v = v;
     return true;
   }
 
   return false;
 }
 
+#ifdef __SSE2__
+/// Smooth triangle packet intersection callback.
+DMNSN_HOT static unsigned int
+dmnsn_smooth_triangle_packet_fn(const dmnsn_object *object, const dmnsn_ray rays[],
+                                unsigned int mask, dmnsn_intersection intersections[])
+{
+  double t[DMNSN_OBJECT_PACKET_SIZE], u[DMNSN_OBJECT_PACKET_SIZE], v[DMNSN_OBJECT_PACKET_SIZE];
+  unsigned int hits = dmnsn_ray_triangle_packet_intersection(rays, t, u, v) & mask;
+  for (size_t k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+    if (hits & (1U << k)) {
+      intersections[k].t = t[k];
+      intersections[k].u = u[k];
+      intersections[k].v = v[k];
+    }
+  }
+  return hits;
+}
+#endif
+
+/// Smooth triangle finalize callback.
+static void
+dmnsn_smooth_triangle_finalize_fn(const dmnsn_object *object, dmnsn_ray l,
+                                  dmnsn_intersection *intersection)
+{
+  const dmnsn_smooth_triangle *triangle = (const dmnsn_smooth_triangle *)object;
+
+  intersection->normal = dmnsn_vector_add(
+    triangle->na,
+    dmnsn_vector_add(
+      dmnsn_vector_mul(intersection->u, triangle->nab),
+      dmnsn_vector_mul(intersection->v, triangle->nac)
+    )
+  );
+}
+
 /// Smooth triangle vtable.
 static const dmnsn_object_vtable dmnsn_smooth_triangle_vtable = {
   .intersection_fn = dmnsn_smooth_triangle_intersection_fn,
+#ifdef __SSE2__
+  .packet_fn = dmnsn_smooth_triangle_packet_fn,
+#endif
+  .finalize_fn = dmnsn_smooth_triangle_finalize_fn,
+  .occlusion_fn = dmnsn_triangle_occlusion_fn,
   .inside_fn = dmnsn_triangle_inside_fn,
   .bounding_fn = dmnsn_triangle_bounding_fn,
 };
@@ -114,33 +114,43 @@ dmnsn_triangle_fan_intersection_fn(const dmnsn_object *object, dmnsn_ray l, dmns
   double t, u, v;
 
   double best_t = INFINITY;
+  size_t best_i = 0;
   if (dmnsn_ray_triangle_intersection(l, &t, &u, &v)) {
     best_t = t;
   }
 
-  dmnsn_vector normal = dmnsn_z;
-  dmnsn_vector best_normal = normal;
-
   for (size_t i = 0; i < fan->ncoeffs; ++i) {
     const double *coeffs = fan->coeffs[i];
     l = dmnsn_change_ray_basis(coeffs, l);
-    normal = dmnsn_change_normal_basis(coeffs, normal);
 
     if (dmnsn_ray_triangle_intersection(l, &t, &u, &v) && t < best_t) {
       best_t = t;
-      best_normal = normal;
+      best_i = i + 1;
     }
   }
 
   if (!isinf(best_t)) {
-    intersection->t = t;
-    intersection->normal = best_normal;
+    intersection->t = best_t;
+    intersection->index = best_i;
     return true;
   }
 
   return false;
 }
 
+/// Triangle fan finalize callback.
+static void
+dmnsn_triangle_fan_finalize_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
+{
+  const dmnsn_triangle_fan *fan = (const dmnsn_triangle_fan *)object;
+
+  dmnsn_vector normal = dmnsn_z;
+  for (size_t i = 0; i < intersection->index; ++i) {
+    normal = dmnsn_change_normal_basis(fan->coeffs[i], normal);
+  }
+  intersection->normal = normal;
+}
+
 /// Triangle fan inside callback.
 static bool
 dmnsn_triangle_fan_inside_fn(const dmnsn_object *object, dmnsn_vector point)
@@ -184,6 +194,7 @@ dmnsn_triangle_fan_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
 /// Triangle fan vtable.
 static dmnsn_object_vtable dmnsn_triangle_fan_vtable = {
   .intersection_fn = dmnsn_triangle_fan_intersection_fn,
+  .finalize_fn = dmnsn_triangle_fan_finalize_fn,
   .inside_fn = dmnsn_triangle_fan_inside_fn,
   .bounding_fn = dmnsn_triangle_fan_bounding_fn,
 };
@@ -202,39 +213,60 @@ dmnsn_smooth_triangle_fan_intersection_fn(const dmnsn_object *object, dmnsn_ray
 {
   const dmnsn_smooth_triangle_fan *fan = (const dmnsn_smooth_triangle_fan *)object;
 
-  dmnsn_vector nab = fan->nab;
-  dmnsn_vector nac = fan->nac;
-
   double t, u, v;
 
-  double best_t = INFINITY;
-  dmnsn_vector best_normal;
+  double best_t = INFINITY, best_u = 0.0, best_v = 0.0;
+  size_t best_i = 0;
   if (dmnsn_ray_triangle_intersection(l, &t, &u, &v)) {
     best_t = t;
-    best_normal = dmnsn_vector_add(dmnsn_vector_mul(u, nab), dmnsn_vector_mul(v, nac));
+    best_u = u;
+    best_v = v;
   }
 
   for (size_t i = 0; i < fan->ncoeffs; ++i) {
     const double *coeffs = fan->coeffs[i];
     l = dmnsn_change_ray_basis(coeffs, l);
-    nab = nac;
-    nac = dmnsn_new_vector(coeffs[6], coeffs[7], coeffs[8]);
 
     if (dmnsn_ray_triangle_intersection(l, &t, &u, &v) && t < best_t) {
       best_t = t;
-      best_normal = dmnsn_vector_add(dmnsn_vector_mul(u, nab), dmnsn_vector_mul(v, nac));
+      best_u = u;
+      best_v = v;
+      best_i = i + 1;
     }
   }
 
   if (!isinf(best_t)) {
-    intersection->t = t;
-    intersection->normal = dmnsn_vector_add(fan->na, best_normal);
+    intersection->t = best_t;
+    intersection->u = best_u;
+    intersection->v = best_v;
+    intersection->index = best_i;
     return true;
   }
 
   return false;
 }
 
+/// Smooth triangle fan finalize callback.
+static void
+dmnsn_smooth_triangle_fan_finalize_fn(const dmnsn_object *object, dmnsn_ray l, dmnsn_intersection *intersection)
+{
+  const dmnsn_smooth_triangle_fan *fan = (const dmnsn_smooth_triangle_fan *)object;
+
+  dmnsn_vector nab = fan->nab;
+  dmnsn_vector nac = fan->nac;
+  for (size_t i = 0; i < intersection->index; ++i) {
+    const double *coeffs = fan->coeffs[i];
+    nab = nac;
+    nac = dmnsn_new_vector(coeffs[6], coeffs[7], coeffs[8]);
+  }
+
+  dmnsn_vector normal = dmnsn_vector_add(
+    dmnsn_vector_mul(intersection->u, nab),
+    dmnsn_vector_mul(intersection->v, nac)
+  );
+  intersection->normal = dmnsn_vector_add(fan->na, normal);
+}
+
 /// Smooth triangle fan bounding callback.
 static dmnsn_aabb
 dmnsn_smooth_triangle_fan_bounding_fn(const dmnsn_object *object, dmnsn_matrix trans)
@@ -256,6 +288,7 @@ dmnsn_smooth_triangle_fan_bounding_fn(const dmnsn_object *object, dmnsn_matrix t
 /// Smooth triangle fan vtable.
 static dmnsn_object_vtable dmnsn_smooth_triangle_fan_vtable = {
   .intersection_fn = dmnsn_smooth_triangle_fan_intersection_fn,
+  .finalize_fn = dmnsn_smooth_triangle_fan_finalize_fn,
   .inside_fn = dmnsn_triangle_fan_inside_fn,
   .bounding_fn = dmnsn_smooth_triangle_fan_bounding_fn,
 };
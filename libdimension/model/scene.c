@@ -24,6 +24,7 @@
  */
 
 #include "internal.h"
+#include "internal/object.h"
 #include "internal/platform.h"
 #include "dimension/model.h"
 #include <stdlib.h>
@@ -49,6 +50,13 @@ dmnsn_new_scene(dmnsn_pool *pool)
   scene->reclimit         = 5;
   scene->adc_bailout      = 1.0/255.0;
   scene->nthreads         = dmnsn_ncpus();
+  scene->tile_width       = 32;
+  scene->tile_height      = 32;
+  scene->tile_order       = DMNSN_TILE_SCANLINE;
+  scene->bvh_kind         = DMNSN_BVH_PRTREE;
+  scene->bvh_traversal    = DMNSN_BVH_ORDERED;
+  scene->shadow_cache_lookups = 0;
+  scene->shadow_cache_hits    = 0;
   scene->initialized      = false;
 
   return scene;
@@ -74,6 +82,13 @@ dmnsn_scene_initialize(dmnsn_scene *scene)
   DMNSN_ARRAY_FOREACH (dmnsn_object **, object, scene->objects) {
     dmnsn_texture_cascade(scene->default_texture, &(*object)->texture);
     dmnsn_interior_cascade(scene->default_interior, &(*object)->interior);
-    dmnsn_object_precompute(*object);
+    dmnsn_object_precompute_serial(*object);
   }
+
+  // Build the objects' bounding hierarchies in parallel
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  DMNSN_ARRAY_FOREACH (dmnsn_object **, object, scene->objects) {
+    dmnsn_object_precompute_spawn(&group, *object);
+  }
+  dmnsn_sync(&group);
 }
@@ -50,6 +50,10 @@
   #include <sys/time.h>
   #include <sys/resource.h>
 #endif
+#if DMNSN_MMAP
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
 void
 dmnsn_backtrace(FILE *file)
@@ -185,3 +189,62 @@ dmnsn_get_times(dmnsn_timer *timer)
   timer->real = timer->user = timer->system = 0.0;
 #endif
 }
+
+int
+dmnsn_map_file(FILE *file, dmnsn_mapped_file *map)
+{
+  long pos = ftell(file);
+
+#if DMNSN_MMAP
+  // Only regular files can be mapped; anything else gets read below
+  struct stat buf;
+  int fd = fileno(file);
+  if (pos >= 0 && fd != -1 && fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode) && buf.st_size > pos) {
+    void *ptr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      map->data = (const char *)ptr + pos;
+      map->size = buf.st_size - pos;
+      map->mapping = ptr;
+      map->length = buf.st_size;
+      return 0;
+    }
+  }
+#endif
+
+  size_t capacity = 1 << 16, size = 0;
+  char *data = dmnsn_malloc(capacity);
+  while (true) {
+    size += fread(data + size, 1, capacity - size, file);
+    if (size < capacity) {
+      break;
+    }
+    capacity *= 2;
+    data = dmnsn_realloc(data, capacity);
+  }
+
+  if (ferror(file)) {
+    dmnsn_free(data);
+    return -1;
+  }
+
+  map->data = data;
+  map->size = size;
+  map->mapping = NULL;
+  map->length = 0;
+  return 0;
+}
+
+void
+dmnsn_unmap_file(dmnsn_mapped_file *map)
+{
+#if DMNSN_MMAP
+  if (map->mapping) {
+    if (munmap(map->mapping, map->length) != 0) {
+      dmnsn_warning("munmap() failed.");
+    }
+    return;
+  }
+#endif
+
+  dmnsn_free((char *)map->data);
+}
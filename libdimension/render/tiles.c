@@ -0,0 +1,174 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Library.                           *
+ *                                                                       *
+ * The Dimension Library is free software; you can redistribute it and/  *
+ * or modify it under the terms of the GNU Lesser General Public License *
+ * as published by the Free Software Foundation; either version 3 of the *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Library is distributed in the hope that it will be      *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * Lesser General Public License for more details.                       *
+ *                                                                       *
+ * You should have received a copy of the GNU Lesser General Public      *
+ * License along with this program.  If not, see                         *
+ * <http://www.gnu.org/licenses/>.                                       *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tile ordering.
+ */
+
+#include "internal/tiles.h"
+#include <stdlib.h>
+
+/// Convert a distance along a Hilbert curve filling an n*n grid to (x, y).
+static void
+dmnsn_hilbert_d2xy(size_t n, size_t d, size_t *x, size_t *y)
+{
+  *x = 0;
+  *y = 0;
+  for (size_t s = 1; s < n; s *= 2) {
+    size_t rx = 1 & (d/2);
+    size_t ry = 1 & (d ^ rx);
+
+    // Rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        *x = s - 1 - *x;
+        *y = s - 1 - *y;
+      }
+      size_t temp = *x;
+      *x = *y;
+      *y = temp;
+    }
+
+    *x += s*rx;
+    *y += s*ry;
+    d /= 4;
+  }
+}
+
+/// Sort key for center-out tile ordering.
+typedef struct dmnsn_tile_key {
+  double distance2; ///< Squared distance from the center of the canvas.
+  size_t index;     ///< Scanline index, to break ties deterministically.
+} dmnsn_tile_key;
+
+/// Comparator for center-out tile ordering.
+static int
+dmnsn_tile_key_comparator(const void *a, const void *b)
+{
+  const dmnsn_tile_key *lhs = a, *rhs = b;
+  if (lhs->distance2 < rhs->distance2) {
+    return -1;
+  } else if (lhs->distance2 > rhs->distance2) {
+    return 1;
+  } else {
+    return (lhs->index > rhs->index) - (lhs->index < rhs->index);
+  }
+}
+
+/// Compute the tile at column \p tx and row \p ty (counted from the top).
+static dmnsn_render_tile
+dmnsn_render_tile_at(const dmnsn_canvas *canvas, size_t tile_width,
+                     size_t tile_height, size_t tx, size_t ty)
+{
+  dmnsn_render_tile tile;
+  tile.x = tx*tile_width;
+  size_t right = canvas->width - tile.x;
+  tile.width = right < tile_width ? right : tile_width;
+
+  size_t top = canvas->height - ty*tile_height;
+  tile.height = top < tile_height ? top : tile_height;
+  tile.y = top - tile.height;
+  return tile;
+}
+
+dmnsn_render_tile *
+dmnsn_new_render_tiles(const dmnsn_canvas *canvas, size_t tile_width, size_t tile_height, dmnsn_tile_order order, size_t *ntilesp)
+{
+  if (tile_width == 0 || tile_width > canvas->width) {
+    tile_width = canvas->width;
+  }
+  if (tile_height == 0 || tile_height > canvas->height) {
+    tile_height = canvas->height;
+  }
+
+  size_t ncols = 0, nrows = 0;
+  if (tile_width > 0 && tile_height > 0) {
+    ncols = (canvas->width + tile_width - 1)/tile_width;
+    nrows = (canvas->height + tile_height - 1)/tile_height;
+  }
+
+  size_t ntiles = ncols*nrows;
+  *ntilesp = ntiles;
+  if (ntiles == 0) {
+    return NULL;
+  }
+
+  dmnsn_render_tile *tiles = dmnsn_malloc(ntiles*sizeof(dmnsn_render_tile));
+
+  switch (order) {
+  case DMNSN_TILE_SCANLINE:
+    for (size_t ty = 0, i = 0; ty < nrows; ++ty) {
+      for (size_t tx = 0; tx < ncols; ++tx, ++i) {
+        tiles[i] = dmnsn_render_tile_at(canvas, tile_width, tile_height, tx, ty);
+      }
+    }
+    break;
+
+  case DMNSN_TILE_HILBERT:
+    {
+      size_t n = 1;
+      while (n < ncols || n < nrows) {
+        n *= 2;
+      }
+
+      // Walk the enclosing power-of-two curve, skipping the tiles outside
+      // the canvas
+      for (size_t d = 0, i = 0; i < ntiles; ++d) {
+        size_t tx, ty;
+        dmnsn_hilbert_d2xy(n, d, &tx, &ty);
+        if (tx < ncols && ty < nrows) {
+          tiles[i++] = dmnsn_render_tile_at(canvas, tile_width, tile_height, tx, ty);
+        }
+      }
+      break;
+    }
+
+  case DMNSN_TILE_CENTER_OUT:
+    {
+      dmnsn_tile_key *keys = dmnsn_malloc(ntiles*sizeof(dmnsn_tile_key));
+      double cx = canvas->width/2.0, cy = canvas->height/2.0;
+      for (size_t ty = 0, i = 0; ty < nrows; ++ty) {
+        for (size_t tx = 0; tx < ncols; ++tx, ++i) {
+          dmnsn_render_tile tile = dmnsn_render_tile_at(canvas, tile_width, tile_height, tx, ty);
+          double dx = tile.x + tile.width/2.0 - cx;
+          double dy = tile.y + tile.height/2.0 - cy;
+          keys[i].distance2 = dx*dx + dy*dy;
+          keys[i].index = i;
+        }
+      }
+
+      qsort(keys, ntiles, sizeof(dmnsn_tile_key), dmnsn_tile_key_comparator);
+
+      for (size_t i = 0; i < ntiles; ++i) {
+        size_t index = keys[i].index;
+        tiles[i] = dmnsn_render_tile_at(canvas, tile_width, tile_height, index%ncols, index/ncols);
+      }
+
+      dmnsn_free(keys);
+      break;
+    }
+
+  default:
+    dmnsn_unreachable("Invalid tile order.");
+  }
+
+  return tiles;
+}
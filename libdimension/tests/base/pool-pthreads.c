@@ -0,0 +1,65 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests for memory pools used from plain pthreads.
+ */
+
+#include "tests.h"
+#include <pthread.h>
+
+#define NTHREADS 64
+
+static dmnsn_pool *pool;
+
+DMNSN_TEST_SETUP(pool_pthreads)
+{
+  pool = dmnsn_new_pool();
+}
+
+DMNSN_TEST_TEARDOWN(pool_pthreads)
+{
+  dmnsn_delete_pool(pool);
+}
+
+static void *
+alloc_thread(void *ptr)
+{
+  unsigned int thread = *(unsigned int *)ptr;
+  for (unsigned int i = thread; i < 10000; i += NTHREADS) {
+    int *p = DMNSN_PALLOC(pool, int);
+    *p = i;
+  }
+  return NULL;
+}
+
+// Threads that aren't pooled workers exit before the pool is deleted
+DMNSN_TEST(pool_pthreads, threaded)
+{
+  pthread_t threads[NTHREADS];
+  unsigned int ids[NTHREADS];
+  for (unsigned int i = 0; i < NTHREADS; ++i) {
+    ids[i] = i;
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, alloc_thread, &ids[i]), 0);
+  }
+  for (unsigned int i = 0; i < NTHREADS; ++i) {
+    ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+  }
+}
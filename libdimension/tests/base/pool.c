@@ -22,6 +22,7 @@
  * Tests for memory pools.
  */
 
+#include "../../platform/platform.c"
 #include "../../concurrency/future.c"
 #include "../../concurrency/threads.c"
 #include "../../internal.h"
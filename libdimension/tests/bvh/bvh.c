@@ -0,0 +1,397 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests of BVH traversal and queries against brute force, for every kind of
+ * BVH.  This file is also built without SSE, to test the scalar fallback of the
+ * wide, single-precision node tests.
+ */
+
+#include "../../platform/platform.c"
+#include "../../concurrency/threads.c"
+#include "../../concurrency/future.c"
+#include "../../concurrency/sort.c"
+#include "../../concurrency/tasks.c"
+#include "../../bvh/bvh.c"
+#include "../../bvh/lbvh.c"
+#include "../../bvh/prtree.c"
+#include "../../bvh/sah.c"
+#include "tests.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned int calls = 0, finalizations = 0;
+
+/**
+ * Intersect the object's bounding box in double precision, rounding exactly
+ * like the leaf test in dmnsn_ray_box_intersection(), so that any difference
+ * from brute force comes from the wide nodes.
+ */
+static bool
+dmnsn_box_intersection_fn(const dmnsn_object *object, dmnsn_ray ray,
+                          dmnsn_intersection *intersection)
+{
+  ++calls;
+
+  dmnsn_optimized_ray optray = dmnsn_optimize_ray(ray);
+  dmnsn_aabb box = object->aabb;
+
+  double tx1 = (box.min.X - optray.x0.X)*optray.n_inv.X;
+  double tx2 = (box.max.X - optray.x0.X)*optray.n_inv.X;
+  double tmin = dmnsn_min(tx1, tx2);
+  double tmax = dmnsn_max(tx1, tx2);
+
+  for (unsigned int i = 1; i < 3; ++i) {
+    double t1 = (box.min.n[i] - optray.x0.n[i])*optray.n_inv.n[i];
+    double t2 = (box.max.n[i] - optray.x0.n[i])*optray.n_inv.n[i];
+    tmin = dmnsn_max(tmin, dmnsn_min(t1, t2));
+    tmax = dmnsn_min(tmax, dmnsn_max(t1, t2));
+  }
+
+  if (tmax < dmnsn_max(0.0, tmin)) {
+    return false;
+  }
+
+  intersection->t = dmnsn_max(0.0, tmin);
+  return true;
+}
+
+static void
+dmnsn_box_finalize_fn(const dmnsn_object *object, dmnsn_ray ray,
+                      dmnsn_intersection *intersection)
+{
+  intersection->normal = dmnsn_x;
+  ++finalizations;
+}
+
+static bool
+dmnsn_box_inside_fn(const dmnsn_object *object, dmnsn_vector point)
+{
+  return point.X >= object->aabb.min.X && point.X <= object->aabb.max.X
+    && point.Y >= object->aabb.min.Y && point.Y <= object->aabb.max.Y
+    && point.Z >= object->aabb.min.Z && point.Z <= object->aabb.max.Z;
+}
+
+static const dmnsn_object_vtable dmnsn_box_vtable = {
+  .intersection_fn = dmnsn_box_intersection_fn,
+  .finalize_fn = dmnsn_box_finalize_fn,
+  .inside_fn = dmnsn_box_inside_fn,
+};
+
+/// A small box with arbitrary (not float-representable) coordinates.
+static dmnsn_object *
+dmnsn_new_box_object(dmnsn_pool *pool, dmnsn_vector offset)
+{
+  dmnsn_vector a, b;
+  for (unsigned int i = 0; i < 3; ++i) {
+    a.n[i] = offset.n[i] + dmnsn_test_random(1.0);
+    b.n[i] = a.n[i] + 0.1*dmnsn_test_random(1.0);
+  }
+
+  dmnsn_object *object = dmnsn_new_object(pool);
+  object->aabb.min = dmnsn_vector_min(a, b);
+  object->aabb.max = dmnsn_vector_max(a, b);
+  object->vtable = &dmnsn_box_vtable;
+  object->trans_inv = dmnsn_identity_matrix();
+  return object;
+}
+
+/// Find the closest intersection by testing every object.
+static bool
+dmnsn_brute_force(const dmnsn_array *objects, dmnsn_ray ray, double *t)
+{
+  bool found = false;
+  DMNSN_ARRAY_FOREACH (dmnsn_object **, object, objects) {
+    dmnsn_intersection intersection;
+    if (dmnsn_object_hit(*object, ray, &intersection)) {
+      if (!found || intersection.t < *t) {
+        *t = intersection.t;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+/// Move \p x by \p ulps units in the last place.
+static double
+dmnsn_nudge(double x, int ulps)
+{
+  for (; ulps > 0; --ulps) {
+    x = nextafter(x, INFINITY);
+  }
+  for (; ulps < 0; ++ulps) {
+    x = nextafter(x, -INFINITY);
+  }
+  return x;
+}
+
+/**
+ * A ray that just grazes a box.  It aims at a point on the boundary (a face,
+ * edge, or corner), nudged a few ulps in or out, so that any rounding in the
+ * wrong direction would cull the box.  Some of the rays are axis-aligned.
+ */
+static dmnsn_ray
+dmnsn_grazing_ray(const dmnsn_object *object, unsigned int i)
+{
+  dmnsn_aabb box = object->aabb;
+
+  int ulps = (int)(i%5) - 2;
+  if (i%3 == 0 && ulps == 0) {
+    // An axis-aligned ray lying exactly in the plane of a face computes 0*inf
+    // in the slab test, so whether it hits is unspecified
+    ulps = 1;
+  }
+
+  dmnsn_vector target;
+  for (unsigned int j = 0; j < 3; ++j) {
+    double r = dmnsn_test_random(1.0);
+    if (r < -0.3) {
+      target.n[j] = dmnsn_nudge(box.min.n[j], ulps);
+    } else if (r > 0.3) {
+      target.n[j] = dmnsn_nudge(box.max.n[j], ulps);
+    } else {
+      target.n[j] = (box.min.n[j] + box.max.n[j])/2.0;
+    }
+  }
+
+  dmnsn_vector n;
+  switch (i%3) {
+  case 0:
+    // Axis-aligned, so some slabs are infinitely wide or empty
+    n = dmnsn_zero;
+    n.n[(i/3)%3] = i%2 ? 1.0 : -1.0;
+    break;
+  case 1:
+    // Nearly axis-aligned
+    n = dmnsn_new_vector(1.0e-9*dmnsn_test_random(1.0), 1.0e-9*dmnsn_test_random(1.0), 1.0);
+    break;
+  default:
+    n = dmnsn_new_vector(dmnsn_test_random(1.0), dmnsn_test_random(1.0), dmnsn_test_random(1.0));
+    break;
+  }
+
+  return dmnsn_new_ray(dmnsn_vector_sub(target, dmnsn_vector_mul(3.0, n)), n);
+}
+
+/**
+ * Check a BVH against brute force for one ray.  Only the closest intersection
+ * may be finalized, and occlusion queries must agree whether or not they start
+ * with the last ray's occluder.
+ * @param[in]     reset     Whether to start a new ray tree in the cache.
+ * @param[in,out] occluder  The last occluder.
+ * @param[in,out] ncalls    Incremented by the number of intersection tests.
+ */
+static bool
+dmnsn_check_ray(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache,
+                const dmnsn_array *objects, dmnsn_ray ray, bool reset,
+                dmnsn_object **occluder, unsigned int *ncalls)
+{
+  double t = INFINITY;
+  bool expected = dmnsn_brute_force(objects, ray, &t);
+
+  dmnsn_intersection intersection;
+  calls = 0;
+  finalizations = 0;
+  bool found = dmnsn_bvh_intersection(bvh, cache, ray, &intersection, NULL, reset);
+  *ncalls += calls;
+  if (found != expected || (found && intersection.t != t)) {
+    return false;
+  }
+  if (finalizations != (found ? 1 : 0)) {
+    return false;
+  }
+
+  // Occlusion just before and just after the closest hit
+  double before = expected ? dmnsn_nudge(t, -1) : INFINITY;
+  if (dmnsn_bvh_occluded(bvh, NULL, ray, before, NULL)
+      || dmnsn_bvh_occluded(bvh, cache, ray, before, occluder)) {
+    return false;
+  }
+  if (expected) {
+    double after = dmnsn_nudge(t, 1);
+    if (!dmnsn_bvh_occluded(bvh, NULL, ray, after, NULL)
+        || !dmnsn_bvh_occluded(bvh, cache, ray, after, occluder)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Check a packet against brute force.  The rays are spread out along the x
+ * axis; if \p coherent is false, their slopes have mixed signs, so the packet
+ * can't be traced together.
+ */
+static bool
+dmnsn_check_packet(const dmnsn_bvh *bvh, dmnsn_intersection_cache *cache,
+                   const dmnsn_array *objects, dmnsn_vector x0, bool coherent,
+                   unsigned int mask, dmnsn_object *hints[DMNSN_BVH_PACKET_SIZE])
+{
+  dmnsn_ray rays[DMNSN_BVH_PACKET_SIZE];
+  for (unsigned int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    double dx = 0.1*dmnsn_test_random(1.0), dy = 0.1*dmnsn_test_random(1.0);
+    if (coherent) {
+      dx = fabs(dx);
+      dy = fabs(dy);
+    }
+    rays[k] = dmnsn_new_ray(
+      dmnsn_vector_add(x0, dmnsn_new_vector(0.01*k, 0.0, 0.0)),
+      dmnsn_new_vector(dx, dy, 1.0)
+    );
+  }
+
+  dmnsn_intersection intersections[DMNSN_BVH_PACKET_SIZE];
+  finalizations = 0;
+  unsigned int hits = dmnsn_bvh_intersection_packet(bvh, cache, rays, mask, intersections, hints);
+
+  unsigned int nhits = 0;
+  for (unsigned int k = 0; k < DMNSN_BVH_PACKET_SIZE; ++k) {
+    double t = INFINITY;
+    bool expected = (mask & (1U << k)) && dmnsn_brute_force(objects, rays[k], &t);
+    bool found = hits & (1U << k);
+    if (found != expected || (found && intersections[k].t != t)) {
+      return false;
+    }
+    nhits += found;
+  }
+
+  // Only the closest intersection of each ray should be finalized
+  return finalizations == nhits;
+}
+
+int
+main(void)
+{
+  // Treat warnings as errors for tests
+  dmnsn_die_on_warnings(true);
+
+#ifdef __SSE__
+  printf("Testing the SSE BVH traversal\n");
+#else
+  printf("Testing the scalar BVH traversal\n");
+#endif
+
+  static const dmnsn_bvh_kind kinds[] = {
+    DMNSN_BVH_NONE,
+    DMNSN_BVH_PRTREE,
+    DMNSN_BVH_SAH,
+    DMNSN_BVH_LBVH,
+  };
+
+  // Far from the origin, rounding the ray origin to single precision matters
+  static const double offsets[] = { 0.0, 1000.0 };
+
+  int ret = EXIT_SUCCESS;
+
+  for (size_t o = 0; o < sizeof(offsets)/sizeof(offsets[0]); ++o) {
+    dmnsn_pool *pool = dmnsn_new_pool();
+    dmnsn_vector offset = dmnsn_new_vector(offsets[o], -offsets[o], offsets[o]);
+
+    const size_t nobjects = 1024;
+    dmnsn_array *objects = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+    for (size_t i = 0; i < nobjects; ++i) {
+      dmnsn_object *object = dmnsn_new_box_object(pool, offset);
+      dmnsn_array_push(objects, &object);
+    }
+
+    for (size_t k = 0; k < sizeof(kinds)/sizeof(kinds[0]); ++k) {
+      dmnsn_bvh *bvh = dmnsn_new_bvh(objects, kinds[k], DMNSN_BVH_ORDERED);
+      dmnsn_bvh *preorder = dmnsn_new_bvh(objects, kinds[k], DMNSN_BVH_PREORDER);
+      dmnsn_intersection_cache *cache = dmnsn_new_intersection_cache(bvh);
+      dmnsn_intersection_cache *preorder_cache = dmnsn_new_intersection_cache(preorder);
+      dmnsn_object *occluder = NULL, *preorder_occluder = NULL;
+
+      // Random rays through the scene.  Only some of them start a new ray tree,
+      // so the rest are tested against the cached object from an earlier ray
+      // first.  Ordered traversal must find the same intersections as
+      // preorder traversal, with no more work.
+      unsigned int ordered_calls = 0, preorder_calls = 0;
+      for (unsigned int i = 0; i < 1000 && ret == EXIT_SUCCESS; ++i) {
+        dmnsn_vector x0 = dmnsn_vector_add(offset, dmnsn_new_vector(dmnsn_test_random(1.0), dmnsn_test_random(1.0), -2.0));
+        dmnsn_vector n = dmnsn_new_vector(0.5*dmnsn_test_random(1.0), 0.5*dmnsn_test_random(1.0), 1.0);
+        dmnsn_ray ray = dmnsn_new_ray(x0, n);
+        bool reset = i%4 == 0;
+        if (!dmnsn_check_ray(bvh, cache, objects, ray, reset, &occluder, &ordered_calls)
+            || !dmnsn_check_ray(preorder, preorder_cache, objects, ray, reset, &preorder_occluder, &preorder_calls)) {
+          fprintf(stderr, "--- Wrong result for BVH %zu, offset %g, ray %u! ---\n", k, offsets[o], i);
+          ret = EXIT_FAILURE;
+        }
+      }
+
+      // The flat tree of DMNSN_BVH_NONE has nothing to order
+      if (ret == EXIT_SUCCESS && kinds[k] != DMNSN_BVH_NONE
+          && ordered_calls > preorder_calls) {
+        fprintf(stderr,
+                "--- Ordered traversal made more calls for BVH %zu: %u (vs. %u)! ---\n",
+                k, ordered_calls, preorder_calls);
+        ret = EXIT_FAILURE;
+      }
+
+      // Near misses at node boundaries
+      for (unsigned int i = 0; i < 5000 && ret == EXIT_SUCCESS; ++i) {
+        dmnsn_object *object = *(dmnsn_object **)dmnsn_array_at(objects, rand()%nobjects);
+        dmnsn_ray ray = dmnsn_grazing_ray(object, i);
+        if (!dmnsn_check_ray(bvh, cache, objects, ray, true, &occluder, &ordered_calls)
+            || !dmnsn_check_ray(preorder, preorder_cache, objects, ray, true, &preorder_occluder, &preorder_calls)) {
+          fprintf(stderr, "--- Wrong result for BVH %zu, offset %g, grazing ray %u! ---\n", k, offsets[o], i);
+          ret = EXIT_FAILURE;
+        }
+      }
+
+      // Packets must find the same intersections as single rays, whether
+      // they're coherent enough to be traced together or not
+      dmnsn_object *hints[DMNSN_BVH_PACKET_SIZE] = { NULL };
+      for (unsigned int i = 0; i < 250 && ret == EXIT_SUCCESS; ++i) {
+        dmnsn_vector x0 = dmnsn_vector_add(offset, dmnsn_new_vector(dmnsn_test_random(1.0), dmnsn_test_random(1.0), -2.0));
+        unsigned int mask = i%4 == 2 ? 0xB : 0xF;
+        if (!dmnsn_check_packet(bvh, cache, objects, x0, i%2 == 0, mask, hints)) {
+          fprintf(stderr, "--- Wrong result for BVH %zu, offset %g, packet %u! ---\n", k, offsets[o], i);
+          ret = EXIT_FAILURE;
+        }
+      }
+
+      // Points on and near the boundaries
+      for (unsigned int i = 0; i < 1000 && ret == EXIT_SUCCESS; ++i) {
+        dmnsn_object *object = *(dmnsn_object **)dmnsn_array_at(objects, rand()%nobjects);
+        dmnsn_vector point = dmnsn_ray_point(dmnsn_grazing_ray(object, i), 3.0);
+
+        bool expected = false;
+        DMNSN_ARRAY_FOREACH (dmnsn_object **, j, objects) {
+          expected = expected || dmnsn_box_inside_fn(*j, point);
+        }
+        if (dmnsn_bvh_inside(bvh, cache, point) != expected) {
+          fprintf(stderr, "--- Wrong insideness for BVH %zu, offset %g, point %u! ---\n", k, offsets[o], i);
+          ret = EXIT_FAILURE;
+        }
+      }
+
+      dmnsn_delete_intersection_cache(preorder_cache);
+      dmnsn_delete_intersection_cache(cache);
+      dmnsn_delete_bvh(preorder);
+      dmnsn_delete_bvh(bvh);
+    }
+
+    dmnsn_delete_pool(pool);
+  }
+
+  return ret;
+}
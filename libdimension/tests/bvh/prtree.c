@@ -25,8 +25,12 @@
 #include "../../platform/platform.c"
 #include "../../concurrency/threads.c"
 #include "../../concurrency/future.c"
+#include "../../concurrency/sort.c"
+#include "../../concurrency/tasks.c"
 #include "../../bvh/bvh.c"
+#include "../../bvh/lbvh.c"
 #include "../../bvh/prtree.c"
+#include "../../bvh/sah.c"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -86,7 +90,7 @@ main(void)
     dmnsn_array_push(objects, &object);
   }
 
-  dmnsn_bvh *bvh = dmnsn_new_bvh(objects, DMNSN_BVH_PRTREE);
+  dmnsn_bvh *bvh = dmnsn_new_bvh(objects, DMNSN_BVH_PRTREE, DMNSN_BVH_ORDERED);
 
   dmnsn_intersection intersection;
   dmnsn_ray ray = dmnsn_new_ray(
@@ -94,7 +98,7 @@ main(void)
     dmnsn_new_vector(0.0, 0.0, 1.0)
   );
 
-  if (!dmnsn_bvh_intersection(bvh, ray, &intersection, true)) {
+  if (!dmnsn_bvh_intersection(bvh, NULL, ray, &intersection, NULL, true)) {
     fprintf(stderr, "--- Didn't find intersection! ---\n");
     return EXIT_FAILURE;
   }
@@ -0,0 +1,143 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Basic tests of SAH BVHs.
+ */
+
+#include "../../platform/platform.c"
+#include "../../concurrency/threads.c"
+#include "../../concurrency/future.c"
+#include "../../concurrency/sort.c"
+#include "../../concurrency/tasks.c"
+#include "../../bvh/bvh.c"
+#include "../../bvh/lbvh.c"
+#include "../../bvh/prtree.c"
+#include "../../bvh/sah.c"
+#include "tests.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned int calls = 0;
+
+static bool
+dmnsn_fake_intersection_fn(const dmnsn_object *object, dmnsn_ray ray,
+                           dmnsn_intersection *intersection)
+{
+  // Hit the middle of the box, so the BVH can't miss it
+  dmnsn_aabb box = object->aabb;
+  double z = (box.min.Z + box.max.Z)/2.0;
+  intersection->t = (z - ray.x0.Z)/ray.n.Z;
+  intersection->normal = dmnsn_x;
+  ++calls;
+
+  dmnsn_vector p = dmnsn_ray_point(ray, intersection->t);
+  return intersection->t >= 0.0
+    && p.X > box.min.X && p.X < box.max.X
+    && p.Y > box.min.Y && p.Y < box.max.Y;
+}
+
+static void
+dmnsn_randomize_aabb(dmnsn_object *object)
+{
+  dmnsn_vector a, b;
+
+  for (unsigned int i = 0; i < 3; ++i) {
+    // Small boxes, so the tree can actually separate them
+    a.n[i] = dmnsn_test_random(1.0);
+    b.n[i] = a.n[i] + 0.1*dmnsn_test_random(1.0);
+  }
+
+  object->aabb.min = dmnsn_vector_min(a, b);
+  object->aabb.max = dmnsn_vector_max(a, b);
+}
+
+static const dmnsn_object_vtable dmnsn_fake_vtable = {
+  .intersection_fn = dmnsn_fake_intersection_fn,
+};
+
+static dmnsn_object *
+dmnsn_new_fake_object(dmnsn_pool *pool)
+{
+  dmnsn_object *object = dmnsn_new_object(pool);
+  dmnsn_randomize_aabb(object);
+  object->vtable = &dmnsn_fake_vtable;
+  object->trans_inv = dmnsn_identity_matrix();
+  return object;
+}
+
+int
+main(void)
+{
+  // Treat warnings as errors for tests
+  dmnsn_die_on_warnings(true);
+
+  dmnsn_pool *pool = dmnsn_new_pool();
+
+  const size_t nobjects = 4096;
+  dmnsn_array *objects = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+
+  for (size_t i = 0; i < nobjects; ++i) {
+    dmnsn_object *object = dmnsn_new_fake_object(pool);
+    dmnsn_array_push(objects, &object);
+  }
+
+  dmnsn_bvh *sah = dmnsn_new_bvh(objects, DMNSN_BVH_SAH, DMNSN_BVH_ORDERED);
+  dmnsn_bvh *none = dmnsn_new_bvh(objects, DMNSN_BVH_NONE, DMNSN_BVH_PREORDER);
+
+  // The SAH tree must find the same intersections as brute force, and prune
+  // boxes behind the closest intersection
+  const unsigned int nrays = 1000;
+  unsigned int sah_calls = 0, none_calls = 0;
+  for (unsigned int i = 0; i < nrays; ++i) {
+    dmnsn_ray ray = dmnsn_new_ray(
+      dmnsn_new_vector(dmnsn_test_random(1.0), dmnsn_test_random(1.0), -2.0),
+      dmnsn_new_vector(0.1*dmnsn_test_random(1.0), 0.1*dmnsn_test_random(1.0), 1.0)
+    );
+
+    dmnsn_intersection sah_intersection, none_intersection;
+
+    calls = 0;
+    bool sah_found = dmnsn_bvh_intersection(sah, NULL, ray, &sah_intersection, NULL, true);
+    sah_calls += calls;
+
+    calls = 0;
+    bool none_found = dmnsn_bvh_intersection(none, NULL, ray, &none_intersection, NULL, true);
+    none_calls += calls;
+
+    if (sah_found != none_found
+        || (sah_found && sah_intersection.t != none_intersection.t)) {
+      fprintf(stderr, "--- Wrong intersection for ray %u! ---\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (sah_calls >= none_calls) {
+    fprintf(stderr,
+            "--- Too many intersection function calls: %u (vs. %u)! ---\n",
+            sah_calls, none_calls);
+    return EXIT_FAILURE;
+  }
+
+  dmnsn_delete_bvh(none);
+  dmnsn_delete_bvh(sah);
+  dmnsn_delete_pool(pool);
+  return EXIT_SUCCESS;
+}
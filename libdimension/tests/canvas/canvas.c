@@ -0,0 +1,129 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+
+/**
+ * @file
+ * Canvas storage format tests.
+ */
+
+#include "tests.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+static dmnsn_pool *pool;
+
+DMNSN_TEST_SETUP(canvas)
+{
+  pool = dmnsn_new_pool();
+}
+
+DMNSN_TEST_TEARDOWN(canvas)
+{
+  dmnsn_delete_pool(pool);
+}
+
+/// A pixel value that's different for every coordinate.
+static dmnsn_tcolor
+dmnsn_test_pixel(size_t x, size_t y)
+{
+  return dmnsn_new_tcolor5(x/64.0, y/32.0, (x + y)/96.0, 0.25, 1.0/(x + 1));
+}
+
+/// Check that every pixel of a canvas survives being stored in it.
+static void
+dmnsn_test_format(dmnsn_canvas_format format, double tolerance)
+{
+  // Not a multiple of the tile size in either dimension
+  const size_t width = 37, height = 21;
+  dmnsn_canvas *canvas = dmnsn_new_canvas_format(pool, width, height, format);
+  ck_assert(canvas->format == format);
+
+  dmnsn_tcolor row[37];
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      row[x] = dmnsn_test_pixel(x, y);
+    }
+    dmnsn_canvas_set_row(canvas, y, row);
+  }
+
+  for (size_t y = 0; y < height; ++y) {
+    dmnsn_canvas_get_span(canvas, 0, y, width, row);
+    for (size_t x = 0; x < width; ++x) {
+      dmnsn_tcolor expected = dmnsn_test_pixel(x, y);
+      dmnsn_tcolor pixel = dmnsn_canvas_get_pixel(canvas, x, y);
+      ck_assert(fabs(pixel.c.R - expected.c.R) <= tolerance);
+      ck_assert(fabs(pixel.c.G - expected.c.G) <= tolerance);
+      ck_assert(fabs(pixel.c.B - expected.c.B) <= tolerance);
+      ck_assert(fabs(pixel.T - expected.T) <= tolerance);
+      ck_assert(fabs(pixel.F - expected.F) <= tolerance);
+      ck_assert(memcmp(&pixel, &row[x], sizeof(pixel)) == 0);
+    }
+  }
+}
+
+DMNSN_TEST(canvas, double)
+{
+  dmnsn_test_format(DMNSN_CANVAS_DOUBLE, 0.0);
+  dmnsn_test_format(DMNSN_CANVAS_DOUBLE | DMNSN_CANVAS_TILED, 0.0);
+}
+
+DMNSN_TEST(canvas, float)
+{
+  dmnsn_test_format(DMNSN_CANVAS_FLOAT, 1.0e-7);
+  dmnsn_test_format(DMNSN_CANVAS_FLOAT | DMNSN_CANVAS_TILED, 1.0e-7);
+}
+
+DMNSN_TEST(canvas, half)
+{
+  dmnsn_test_format(DMNSN_CANVAS_HALF, 1.0e-3);
+  dmnsn_test_format(DMNSN_CANVAS_HALF | DMNSN_CANVAS_TILED, 1.0e-3);
+}
+
+DMNSN_TEST(canvas, linear16)
+{
+  dmnsn_test_format(DMNSN_CANVAS_LINEAR16, 0.5/UINT16_MAX);
+  dmnsn_test_format(DMNSN_CANVAS_LINEAR16 | DMNSN_CANVAS_TILED, 0.5/UINT16_MAX);
+}
+
+DMNSN_TEST(canvas, half_range)
+{
+  // Half-precision keeps high dynamic range values, and rounds to nearest
+  dmnsn_canvas *canvas = dmnsn_new_canvas_format(pool, 1, 1, DMNSN_CANVAS_HALF);
+  dmnsn_canvas_set_pixel(canvas, 0, 0, dmnsn_new_tcolor5(1000.0, 1.0e-6, 65504.0, 1.0 + 1.0/2048.0, 0.0));
+  dmnsn_tcolor pixel = dmnsn_canvas_get_pixel(canvas, 0, 0);
+  ck_assert(pixel.c.R == 1000.0);
+  ck_assert(fabs(pixel.c.G - 1.0e-6) <= ldexp(1.0, -25));
+  ck_assert(pixel.c.B == 65504.0);
+  ck_assert(pixel.T == 1.0);
+  ck_assert(pixel.F == 0.0);
+}
+
+DMNSN_TEST(canvas, linear16_clamp)
+{
+  dmnsn_canvas *canvas = dmnsn_new_canvas_format(pool, 1, 1, DMNSN_CANVAS_LINEAR16);
+  dmnsn_canvas_set_pixel(canvas, 0, 0, dmnsn_new_tcolor5(-1.0, 2.0, 1.0, 0.0, 0.5));
+  dmnsn_tcolor pixel = dmnsn_canvas_get_pixel(canvas, 0, 0);
+  ck_assert(pixel.c.R == 0.0);
+  ck_assert(pixel.c.G == 1.0);
+  ck_assert(pixel.c.B == 1.0);
+  ck_assert(pixel.T == 0.0);
+  ck_assert(fabs(pixel.F - 0.5) <= 0.5/UINT16_MAX);
+}
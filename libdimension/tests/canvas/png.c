@@ -105,6 +105,48 @@ main(void)
 
   fclose(ofile);
 
+  /*
+   * The first image was compressed in parallel stripes, and the second by
+   * libpng in one go; they should decode to the same pixels
+   */
+
+  printf("Comparing striped and serial PNGs\n");
+  ifile = fopen("png2.png", "rb");
+  if (!ifile) {
+    fprintf(stderr, "--- Couldn't open 'png2.png' for reading! ---\n");
+    ret = EXIT_FAILURE;
+    goto exit;
+  }
+
+  dmnsn_canvas *serial = dmnsn_png_read_canvas(pool, ifile);
+  if (!serial) {
+    fprintf(stderr, "--- Reading canvas from PNG failed! ---\n");
+    fclose(ifile);
+    ret = EXIT_FAILURE;
+    goto exit;
+  }
+
+  fclose(ifile);
+
+  if (serial->width != canvas->width || serial->height != canvas->height) {
+    fprintf(stderr, "--- PNG dimensions differ! ---\n");
+    ret = EXIT_FAILURE;
+    goto exit;
+  }
+
+  for (size_t y = 0; y < canvas->height; ++y) {
+    for (size_t x = 0; x < canvas->width; ++x) {
+      dmnsn_tcolor a = dmnsn_canvas_get_pixel(canvas, x, y);
+      dmnsn_tcolor b = dmnsn_canvas_get_pixel(serial, x, y);
+      if (a.c.R != b.c.R || a.c.G != b.c.G || a.c.B != b.c.B
+          || a.T != b.T || a.F != b.F) {
+        fprintf(stderr, "--- PNGs differ at (%zu, %zu)! ---\n", x, y);
+        ret = EXIT_FAILURE;
+        goto exit;
+      }
+    }
+  }
+
  exit:
   dmnsn_delete_pool(pool);
   return ret;
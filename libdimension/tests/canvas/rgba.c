@@ -0,0 +1,128 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+
+/**
+ * @file
+ * Tests for the sRGB conversion kernels.
+ */
+
+#include "../../platform/platform.c"
+#include "../../concurrency/future.c"
+#include "../../concurrency/threads.c"
+#include "../../canvas/rgba.c"
+#include "tests.h"
+
+/// The exact result of encoding a channel.
+static long
+dmnsn_exact_sRGB(double Clinear, double max)
+{
+  return lround(dmnsn_clamp(dmnsn_sRGB_gamma(Clinear), 0.0, 1.0)*max);
+}
+
+DMNSN_TEST(rgba, encode_error)
+{
+  // Dense in the linear segment and the steep part of the curve just above it
+  const size_t n = 1 << 16;
+  for (size_t i = 0; i <= n; ++i) {
+    double x = (double)i/n;
+    double C = x*x*x;
+    dmnsn_tcolor tcolor = dmnsn_new_tcolor5(C, x, 1.0 - C, 0.0, 0.0);
+
+    uint16_t rgba16[4];
+    dmnsn_tcolors_to_rgba16(&tcolor, 1, rgba16);
+    ck_assert(labs(rgba16[0] - dmnsn_exact_sRGB(C, UINT16_MAX)) <= 1);
+    ck_assert(labs(rgba16[1] - dmnsn_exact_sRGB(x, UINT16_MAX)) <= 1);
+    ck_assert(labs(rgba16[2] - dmnsn_exact_sRGB(1.0 - C, UINT16_MAX)) <= 1);
+
+    uint8_t rgba8[4];
+    dmnsn_tcolors_to_rgba8(&tcolor, 1, rgba8);
+    ck_assert(labs(rgba8[0] - dmnsn_exact_sRGB(C, UINT8_MAX)) <= 1);
+    ck_assert(labs(rgba8[1] - dmnsn_exact_sRGB(x, UINT8_MAX)) <= 1);
+    ck_assert(labs(rgba8[2] - dmnsn_exact_sRGB(1.0 - C, UINT8_MAX)) <= 1);
+  }
+}
+
+DMNSN_TEST(rgba, clamp)
+{
+  dmnsn_tcolor tcolor = dmnsn_new_tcolor5(-1.0, 2.0, 1.0, 1.5, 0.0);
+  uint16_t rgba16[4];
+  dmnsn_tcolors_to_rgba16(&tcolor, 1, rgba16);
+  ck_assert_int_eq(rgba16[0], 0);
+  ck_assert_int_eq(rgba16[1], UINT16_MAX);
+  ck_assert_int_eq(rgba16[2], UINT16_MAX);
+  ck_assert_int_eq(rgba16[3], UINT16_MAX);
+}
+
+DMNSN_TEST(rgba, vector_matches_scalar)
+{
+  // An odd count leaves pixels over for the scalar loop
+  enum { N = 1027 };
+  dmnsn_tcolor tcolors[N];
+  for (size_t i = 0; i < N; ++i) {
+    tcolors[i] = dmnsn_new_tcolor5(
+      0.5 + dmnsn_test_random(0.75),
+      0.5 + dmnsn_test_random(0.75),
+      0.5*dmnsn_test_random(0.01),
+      0.5 + dmnsn_test_random(0.75),
+      i%2 ? 0.5 + dmnsn_test_random(0.5) : 0.0
+    );
+  }
+  tcolors[0].c.G = NAN;
+  tcolors[1].T = NAN;
+
+  uint8_t rgba8[4*N];
+  uint16_t rgba16[4*N];
+  dmnsn_tcolors_to_rgba8(tcolors, N, rgba8);
+  dmnsn_tcolors_to_rgba16(tcolors, N, rgba16);
+
+  for (size_t i = 0; i < N; ++i) {
+    dmnsn_tcolor tcolor = dmnsn_tcolor_remove_filter(tcolors[i]);
+    double channels[3] = { tcolor.c.R, tcolor.c.G, tcolor.c.B };
+    for (size_t j = 0; j < 3; ++j) {
+      ck_assert_int_eq(rgba8[4*i + j], (uint8_t)dmnsn_sRGB_encode(channels[j], UINT8_MAX));
+      ck_assert_int_eq(rgba16[4*i + j], (uint16_t)dmnsn_sRGB_encode(channels[j], UINT16_MAX));
+    }
+    ck_assert_int_eq(rgba8[4*i + 3], (uint8_t)(dmnsn_clamp(tcolor.T, 0.0, 1.0)*UINT8_MAX + 0.5));
+    ck_assert_int_eq(rgba16[4*i + 3], (uint16_t)(dmnsn_clamp(tcolor.T, 0.0, 1.0)*UINT16_MAX + 0.5));
+  }
+}
+
+DMNSN_TEST(rgba, round_trip)
+{
+  // Decoding is exact, and encoding is close enough to get every value back
+  const size_t n = UINT16_MAX + 1;
+  uint16_t *rgba16 = dmnsn_malloc(4*n*sizeof(uint16_t));
+  for (size_t i = 0; i <= UINT16_MAX; ++i) {
+    rgba16[4*i] = rgba16[4*i + 1] = rgba16[4*i + 2] = rgba16[4*i + 3] = i;
+  }
+
+  dmnsn_tcolor *tcolors = dmnsn_malloc(n*sizeof(dmnsn_tcolor));
+  dmnsn_rgba16_to_tcolors(rgba16, n, 4, tcolors);
+
+  uint16_t *result = dmnsn_malloc(4*n*sizeof(uint16_t));
+  dmnsn_tcolors_to_rgba16(tcolors, n, result);
+  for (size_t i = 0; i < 4*n; ++i) {
+    ck_assert_int_eq(result[i], rgba16[i]);
+  }
+
+  dmnsn_free(result);
+  dmnsn_free(tcolors);
+  dmnsn_free(rgba16);
+}
@@ -27,6 +27,7 @@
 #include "../../concurrency/threads.c"
 #include "tests.h"
 #include <stdatomic.h>
+#include <stdint.h>
 
 static dmnsn_future *future;
 static atomic_int counter = ATOMIC_VAR_INIT(0);
@@ -96,3 +97,205 @@ DMNSN_TEST(future, pause_safely)
 
   dmnsn_join_thread(thread, NULL);
 }
+
+static int
+dmnsn_future_test_stage(void *ptr)
+{
+  dmnsn_future *stage = ptr;
+  dmnsn_future_set_total(stage, CHUNK);
+  for (int i = 0; i < CHUNK; ++i) {
+    dmnsn_future_increment(stage);
+  }
+  return 0;
+}
+
+static dmnsn_future *
+dmnsn_future_test_continuation(void *ptr)
+{
+  atomic_int *stages = ptr;
+  atomic_fetch_add(stages, 1);
+
+  dmnsn_future *stage = dmnsn_new_future();
+  dmnsn_new_thread(stage, dmnsn_future_test_stage, stage);
+  return stage;
+}
+
+static dmnsn_future *
+dmnsn_future_test_failed_continuation(void *ptr)
+{
+  return NULL;
+}
+
+DMNSN_TEST(chain, then)
+{
+  atomic_int stages = ATOMIC_VAR_INIT(0);
+
+  dmnsn_future *chain = dmnsn_future_test_continuation(&stages);
+  chain = dmnsn_future_then(chain, dmnsn_future_test_continuation, &stages);
+  chain = dmnsn_future_then(chain, dmnsn_future_test_continuation, &stages);
+
+  dmnsn_future_wait(chain, 0.5);
+  ck_assert(dmnsn_future_progress(chain) >= 0.5);
+
+  ck_assert_int_eq(dmnsn_future_join(chain), 0);
+  ck_assert_int_eq(atomic_load(&stages), 3);
+}
+
+DMNSN_TEST(chain, failed_continuation)
+{
+  dmnsn_future *chain = dmnsn_new_future();
+  dmnsn_new_thread(chain, dmnsn_future_test_stage, chain);
+  chain = dmnsn_future_then(chain, dmnsn_future_test_failed_continuation, NULL);
+  ck_assert(dmnsn_future_join(chain) != 0);
+}
+
+DMNSN_TEST(chain, wait_any)
+{
+  atomic_int stages = ATOMIC_VAR_INIT(0);
+
+  dmnsn_future *futures[3];
+  for (size_t i = 0; i < 3; ++i) {
+    futures[i] = dmnsn_future_test_continuation(&stages);
+  }
+
+  size_t i = dmnsn_future_wait_any(futures, 3);
+  ck_assert(dmnsn_future_is_done(futures[i]));
+
+  dmnsn_future_wait_all(futures, 3);
+  for (size_t j = 0; j < 3; ++j) {
+    ck_assert(dmnsn_future_is_done(futures[j]));
+    ck_assert_int_eq(dmnsn_future_join(futures[j]), 0);
+  }
+}
+
+static int
+dmnsn_threads_test_self(void *ptr)
+{
+  *(pthread_t *)ptr = pthread_self();
+  return 0;
+}
+
+DMNSN_TEST(threads, reuse)
+{
+  // Background threads run on pooled workers, which outlive their tasks
+  enum { NTASKS = 100 };
+  pthread_t threads[NTASKS];
+  for (size_t i = 0; i < NTASKS; ++i) {
+    dmnsn_future *task = dmnsn_new_future();
+    dmnsn_new_thread(task, dmnsn_threads_test_self, &threads[i]);
+    ck_assert_int_eq(dmnsn_future_join(task), 0);
+  }
+
+  size_t nreused = 0;
+  for (size_t i = 1; i < NTASKS; ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      if (pthread_equal(threads[i], threads[j])) {
+        ++nreused;
+        break;
+      }
+    }
+  }
+  ck_assert(nreused > NTASKS/2);
+}
+
+static int
+dmnsn_threads_test_forever(void *ptr)
+{
+  dmnsn_future *task = ptr;
+  dmnsn_future_set_total(task, SIZE_MAX);
+  while (true) {
+    dmnsn_future_increment(task);
+  }
+  return 0;
+}
+
+DMNSN_TEST(threads, cancel)
+{
+  // Cancelled tasks stop at their next dmnsn_future_increment()
+  dmnsn_future *task = dmnsn_new_future();
+  dmnsn_new_thread(task, dmnsn_threads_test_forever, task);
+  dmnsn_future_cancel(task);
+  ck_assert(dmnsn_future_join(task) != 0);
+
+  // The pool replaces the worker that exited
+  pthread_t thread;
+  task = dmnsn_new_future();
+  dmnsn_new_thread(task, dmnsn_threads_test_self, &thread);
+  ck_assert_int_eq(dmnsn_future_join(task), 0);
+}
+
+static int
+dmnsn_threads_test_ccforever(void *ptr, unsigned int thread, unsigned int nthreads)
+{
+  dmnsn_future *task = ptr;
+  while (true) {
+    dmnsn_future_increment(task);
+  }
+  return 0;
+}
+
+static int
+dmnsn_threads_test_concurrent(void *ptr)
+{
+  dmnsn_future *task = ptr;
+  dmnsn_future_set_total(task, SIZE_MAX);
+  return dmnsn_execute_concurrently(task, dmnsn_threads_test_ccforever, task, NTHREADS);
+}
+
+DMNSN_TEST(threads, cancel_concurrent)
+{
+  for (int i = 0; i < 10; ++i) {
+    dmnsn_future *task = dmnsn_new_future();
+    dmnsn_new_thread(task, dmnsn_threads_test_concurrent, task);
+    dmnsn_future_wait(task, 0.0);
+    dmnsn_future_cancel(task);
+    ck_assert(dmnsn_future_join(task) != 0);
+  }
+}
+
+static const int BATCHED = 100000;
+static atomic_int batched = ATOMIC_VAR_INIT(0);
+
+static int
+dmnsn_batch_test_ccthread(void *ptr, unsigned int thread, unsigned int nthreads)
+{
+  dmnsn_future *task = ptr;
+  for (int i = 0; i < BATCHED; ++i) {
+    atomic_fetch_add(&batched, 1);
+    dmnsn_future_increment(task);
+  }
+  return 0;
+}
+
+static int
+dmnsn_batch_test_thread(void *ptr)
+{
+  dmnsn_future *task = ptr;
+  return dmnsn_execute_concurrently(task, dmnsn_batch_test_ccthread, task, NTHREADS);
+}
+
+DMNSN_TEST(batch, pause_resume_wait)
+{
+  // Enough increments per thread that they are published in batches
+  dmnsn_future *task = dmnsn_new_future();
+  dmnsn_future_set_total(task, NTHREADS*BATCHED);
+  atomic_store(&batched, 0);
+  dmnsn_new_thread(task, dmnsn_batch_test_thread, task);
+
+  for (int i = 1; i <= 4; ++i) {
+    double progress = i/5.0;
+    dmnsn_future_wait(task, progress);
+    ck_assert(dmnsn_future_progress(task) >= progress);
+
+    // Paused threads have published everything they've done
+    dmnsn_future_pause(task);
+      size_t published = atomic_load(&task->progress);
+      ck_assert_int_eq(published, atomic_load(&batched));
+    dmnsn_future_resume(task);
+  }
+
+  dmnsn_future_wait(task, 1.0);
+  ck_assert(dmnsn_future_is_done(task));
+  ck_assert_int_eq(dmnsn_future_join(task), 0);
+  ck_assert_int_eq(atomic_load(&batched), NTHREADS*BATCHED);
+}
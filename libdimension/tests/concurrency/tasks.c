@@ -0,0 +1,130 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests for the work-stealing task runtime.
+ */
+
+#include "../../platform/platform.c"
+#include "../../concurrency/future.c"
+#include "../../concurrency/threads.c"
+#include "../../concurrency/tasks.c"
+#include "tests.h"
+#include <stdatomic.h>
+
+static atomic_int counter = ATOMIC_VAR_INIT(0);
+static atomic_uint max_active = ATOMIC_VAR_INIT(0);
+
+static void
+dmnsn_test_task(void *ptr)
+{
+  atomic_fetch_add(&counter, 1);
+
+  // Track the most workers ever running at once
+  unsigned int nactive = atomic_load(&dmnsn_tasks.nactive);
+  unsigned int max = atomic_load(&max_active);
+  while (nactive > max && !atomic_compare_exchange_weak(&max_active, &max, nactive));
+}
+
+/// Spawn a binary tree of tasks, depth levels deep.
+static void
+dmnsn_test_tree_task(void *ptr)
+{
+  int depth = (int)(intptr_t)ptr;
+  dmnsn_test_task(NULL);
+  if (depth > 0) {
+    dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+    dmnsn_spawn(&group, dmnsn_test_tree_task, (void *)(intptr_t)(depth - 1));
+    dmnsn_spawn(&group, dmnsn_test_tree_task, (void *)(intptr_t)(depth - 1));
+    dmnsn_sync(&group);
+  }
+}
+
+DMNSN_TEST_SETUP(tasks)
+{
+  atomic_store(&counter, 0);
+  atomic_store(&max_active, 0);
+}
+
+DMNSN_TEST_TEARDOWN(tasks)
+{
+}
+
+DMNSN_TEST(tasks, sync_empty)
+{
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  dmnsn_sync(&group);
+  dmnsn_sync(&group);
+  ck_assert_int_eq(atomic_load(&group.pending), 0);
+}
+
+DMNSN_TEST(tasks, many)
+{
+  static const int NTASKS = 100000;
+
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  for (int i = 0; i < NTASKS; ++i) {
+    dmnsn_spawn(&group, dmnsn_test_task, NULL);
+  }
+  dmnsn_sync(&group);
+
+  ck_assert_int_eq(atomic_load(&counter), NTASKS);
+  ck_assert_int_eq(atomic_load(&group.pending), 0);
+  ck_assert_int_eq(atomic_load(&dmnsn_tasks.nqueued), 0);
+}
+
+DMNSN_TEST(tasks, nested)
+{
+  static const int DEPTH = 12;
+
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  dmnsn_spawn(&group, dmnsn_test_tree_task, (void *)(intptr_t)DEPTH);
+  dmnsn_sync(&group);
+
+  ck_assert_int_eq(atomic_load(&counter), (1 << (DEPTH + 1)) - 1);
+}
+
+DMNSN_TEST(tasks, reuse)
+{
+  // Workers retire between bursts, and come back for the next one
+  for (int i = 0; i < 100; ++i) {
+    dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+    for (int j = 0; j < 100; ++j) {
+      dmnsn_spawn(&group, dmnsn_test_task, NULL);
+    }
+    dmnsn_sync(&group);
+  }
+
+  ck_assert_int_eq(atomic_load(&counter), 100*100);
+}
+
+DMNSN_TEST(tasks, bounded)
+{
+  // The syncing thread counts as a core, so never run more than ncpus - 1
+  // workers alongside it
+  dmnsn_task_group group = DMNSN_TASK_GROUP_INITIALIZER;
+  for (int i = 0; i < 64; ++i) {
+    dmnsn_spawn(&group, dmnsn_test_tree_task, (void *)(intptr_t)6);
+  }
+  dmnsn_sync(&group);
+
+  ck_assert(atomic_load(&max_active) <= dmnsn_tasks.nworkers);
+  ck_assert(dmnsn_tasks.nworkers < dmnsn_ncpus() || dmnsn_tasks.nworkers == 0);
+}
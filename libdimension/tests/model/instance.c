@@ -0,0 +1,234 @@
+/*************************************************************************
+ * Copyright (C) 2010-2014 Tavian Barnes <tavianator@tavianator.com>     *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests that instances behave like copies of their prototypes.
+ */
+
+#include "tests.h"
+#include <stdlib.h>
+
+static dmnsn_pool *pool;
+
+DMNSN_TEST_SETUP(instance)
+{
+  pool = dmnsn_new_pool();
+}
+
+DMNSN_TEST_TEARDOWN(instance)
+{
+  dmnsn_delete_pool(pool);
+}
+
+static dmnsn_texture *
+dmnsn_test_texture(void)
+{
+  dmnsn_texture *texture = dmnsn_new_texture(pool);
+  texture->pigment = dmnsn_new_solid_pigment(pool, DMNSN_TCOLOR(dmnsn_black));
+  return texture;
+}
+
+/// The prototype: a union of a sphere and a cube.
+static dmnsn_object *
+dmnsn_new_prototype(void)
+{
+  dmnsn_object *sphere = dmnsn_new_sphere(pool);
+  sphere->trans = dmnsn_translation_matrix(dmnsn_new_vector(0.0, 1.0, 0.0));
+
+  dmnsn_object *cube = dmnsn_new_cube(pool);
+  cube->trans = dmnsn_scale_matrix(dmnsn_new_vector(1.0, 0.5, 2.0));
+
+  dmnsn_array *objects = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+  dmnsn_array_push(objects, &sphere);
+  dmnsn_array_push(objects, &cube);
+  return dmnsn_new_csg_union(pool, objects);
+}
+
+static dmnsn_matrix
+dmnsn_random_trans(void)
+{
+  dmnsn_matrix trans = dmnsn_translation_matrix(dmnsn_test_random_vector(4.0));
+  trans = dmnsn_matrix_mul(trans, dmnsn_rotation_matrix(dmnsn_vector_mul(0.5, dmnsn_test_random_vector(4.0))));
+  return dmnsn_matrix_mul(trans, dmnsn_scale_matrix(dmnsn_new_vector(1.0, 1.5, 0.5)));
+}
+
+DMNSN_TEST(instance, copies)
+{
+  enum { NCOPIES = 8 };
+
+  // Many instances of one prototype, and the same number of real copies
+  dmnsn_object *prototype = dmnsn_new_prototype();
+  dmnsn_array *instances = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+  dmnsn_array *copies = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+  for (size_t i = 0; i < NCOPIES; ++i) {
+    dmnsn_matrix trans = dmnsn_random_trans();
+
+    dmnsn_object *instance = dmnsn_new_instance(pool, prototype);
+    instance->trans = trans;
+    dmnsn_array_push(instances, &instance);
+
+    dmnsn_object *copy = dmnsn_new_prototype();
+    copy->trans = trans;
+    dmnsn_array_push(copies, &copy);
+  }
+
+  dmnsn_object *instance_union = dmnsn_new_csg_union(pool, instances);
+  instance_union->texture = dmnsn_test_texture();
+  dmnsn_object_precompute(instance_union);
+  ck_assert(prototype->precomputed);
+
+  dmnsn_object *copy_union = dmnsn_new_csg_union(pool, copies);
+  copy_union->texture = dmnsn_test_texture();
+  dmnsn_object_precompute(copy_union);
+
+  // Each instance's bounding box must cover its copy's
+  for (size_t i = 0; i < NCOPIES; ++i) {
+    dmnsn_object *instance, *copy;
+    dmnsn_array_get(instances, i, &instance);
+    dmnsn_array_get(copies, i, &copy);
+    for (unsigned int j = 0; j < 3; ++j) {
+      ck_assert(instance->aabb.min.n[j] <= copy->aabb.min.n[j] + 1.0e-9);
+      ck_assert(instance->aabb.max.n[j] >= copy->aabb.max.n[j] - 1.0e-9);
+    }
+  }
+
+  unsigned int nhits = 0;
+  for (unsigned int i = 0; i < 10000; ++i) {
+    dmnsn_ray ray = dmnsn_new_ray(dmnsn_test_random_vector(4.0), dmnsn_test_random_vector(4.0));
+
+    dmnsn_intersection intersection, expected;
+    bool hit = dmnsn_object_intersection(instance_union, ray, &intersection);
+    bool expected_hit = dmnsn_object_intersection(copy_union, ray, &expected);
+    ck_assert_msg(hit == expected_hit, "Ray %u: hit mismatch", i);
+    if (!hit) {
+      continue;
+    }
+
+    ++nhits;
+    ck_assert_msg(dmnsn_test_close(intersection.t, expected.t, 1.0e-9),
+                  "Ray %u: t == %.17g, expected %.17g", i, intersection.t, expected.t);
+    for (unsigned int j = 0; j < 3; ++j) {
+      ck_assert_msg(dmnsn_test_close(intersection.normal.n[j], expected.normal.n[j], 1.0e-9),
+                    "Ray %u: normal mismatch", i);
+    }
+    bool found = false;
+    DMNSN_ARRAY_FOREACH (dmnsn_object **, instance, instances) {
+      found = found || intersection.object == *instance;
+    }
+    ck_assert_msg(found, "Ray %u: intersection object isn't an instance", i);
+
+    double t = intersection.t;
+    ck_assert(dmnsn_object_occlusion(instance_union, ray, t*1.01));
+    ck_assert(!dmnsn_object_occlusion(instance_union, ray, t*0.99));
+
+    dmnsn_vector point = dmnsn_ray_point(ray, t);
+    dmnsn_vector inside = dmnsn_vector_sub(point, dmnsn_vector_mul(1.0e-6, expected.normal));
+    dmnsn_vector outside = dmnsn_vector_add(point, dmnsn_vector_mul(1.0e-6, expected.normal));
+    ck_assert(dmnsn_object_inside(instance_union, inside) == dmnsn_object_inside(copy_union, inside));
+    ck_assert(dmnsn_object_inside(instance_union, outside) == dmnsn_object_inside(copy_union, outside));
+  }
+
+  ck_assert(nhits > 0);
+}
+
+DMNSN_TEST(instance, texture)
+{
+  // Instances inherit their prototype's texture, and its placement
+  dmnsn_object *prototype = dmnsn_new_sphere(pool);
+  prototype->texture = dmnsn_test_texture();
+  prototype->trans = dmnsn_translation_matrix(dmnsn_new_vector(1.0, 0.0, 0.0));
+
+  dmnsn_object *instance = dmnsn_new_instance(pool, prototype);
+  instance->trans = dmnsn_translation_matrix(dmnsn_new_vector(0.0, 2.0, 0.0));
+  dmnsn_object_precompute(instance);
+  ck_assert(instance->texture == prototype->texture);
+
+  dmnsn_vector point = dmnsn_transform_point(instance->pigment_trans, dmnsn_new_vector(1.0, 2.0, 3.0));
+  ck_assert(dmnsn_test_close(point.n[0], 0.0, 1.0e-9));
+  ck_assert(dmnsn_test_close(point.n[1], 0.0, 1.0e-9));
+  ck_assert(dmnsn_test_close(point.n[2], 3.0, 1.0e-9));
+
+  // Or have their own
+  dmnsn_object *other = dmnsn_new_instance(pool, prototype);
+  other->texture = dmnsn_test_texture();
+  other->trans = dmnsn_translation_matrix(dmnsn_new_vector(0.0, 2.0, 0.0));
+  dmnsn_object_precompute(other);
+
+  point = dmnsn_transform_point(other->pigment_trans, dmnsn_new_vector(1.0, 2.0, 3.0));
+  ck_assert(dmnsn_test_close(point.n[0], 1.0, 1.0e-9));
+  ck_assert(dmnsn_test_close(point.n[1], 0.0, 1.0e-9));
+  ck_assert(dmnsn_test_close(point.n[2], 3.0, 1.0e-9));
+}
+
+DMNSN_TEST(instance, multi_texture)
+{
+  // A prototype with one textured and one untextured part
+  dmnsn_object *sphere = dmnsn_new_sphere(pool);
+  sphere->texture = dmnsn_test_texture();
+  sphere->trans = dmnsn_translation_matrix(dmnsn_new_vector(3.0, 0.0, 0.0));
+  dmnsn_texture *sphere_texture = sphere->texture;
+
+  dmnsn_object *cube = dmnsn_new_cube(pool);
+
+  dmnsn_array *parts = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+  dmnsn_array_push(parts, &sphere);
+  dmnsn_array_push(parts, &cube);
+  dmnsn_object *prototype = dmnsn_new_csg_union(pool, parts);
+
+  // One instance inherits the scene's texture, and one has its own
+  dmnsn_object *plain = dmnsn_new_instance(pool, prototype);
+  plain->trans = dmnsn_translation_matrix(dmnsn_new_vector(0.0, 5.0, 0.0));
+
+  dmnsn_object *textured = dmnsn_new_instance(pool, prototype);
+  textured->texture = dmnsn_test_texture();
+  textured->trans = dmnsn_translation_matrix(dmnsn_new_vector(0.0, -5.0, 0.0));
+
+  dmnsn_array *instances = DMNSN_PALLOC_ARRAY(pool, dmnsn_object *);
+  dmnsn_array_push(instances, &plain);
+  dmnsn_array_push(instances, &textured);
+  dmnsn_object *scene = dmnsn_new_csg_union(pool, instances);
+  scene->texture = dmnsn_test_texture();
+  dmnsn_object_precompute(scene);
+  ck_assert(plain->texture == scene->texture);
+
+  for (int i = 0; i < 2; ++i) {
+    dmnsn_object *instance = i == 0 ? plain : textured;
+    double y = i == 0 ? 5.0 : -5.0;
+
+    // The sphere keeps its own texture, placed relative to the instance
+    dmnsn_intersection intersection;
+    dmnsn_ray ray = dmnsn_new_ray(dmnsn_new_vector(3.0, y, -5.0), dmnsn_z);
+    ck_assert(dmnsn_object_intersection(scene, ray, &intersection));
+    ck_assert(intersection.object == sphere);
+    ck_assert(intersection.object->texture == sphere_texture);
+    ck_assert(intersection.instanced);
+
+    dmnsn_vector point = dmnsn_transform_point(intersection.object->pigment_trans, intersection.instance_point);
+    ck_assert(dmnsn_test_close(point.n[0], 0.0, 1.0e-9));
+    ck_assert(dmnsn_test_close(point.n[1], 0.0, 1.0e-9));
+    ck_assert(dmnsn_test_close(point.n[2], -1.0, 1.0e-9));
+
+    // The cube takes the instance's texture
+    ray = dmnsn_new_ray(dmnsn_new_vector(0.0, y, -5.0), dmnsn_z);
+    ck_assert(dmnsn_object_intersection(scene, ray, &intersection));
+    ck_assert(intersection.object == instance);
+    ck_assert(!intersection.instanced);
+  }
+}
@@ -0,0 +1,609 @@
+/*************************************************************************
+ * Copyright (C) 2010-2014 Tavian Barnes <tavianator@tavianator.com>     *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests for triangle meshes.
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static dmnsn_pool *pool;
+
+DMNSN_TEST_SETUP(mesh)
+{
+  pool = dmnsn_new_pool();
+}
+
+DMNSN_TEST_TEARDOWN(mesh)
+{
+  dmnsn_delete_pool(pool);
+}
+
+/// A random vertex, exactly representable in single precision.
+static dmnsn_vector
+dmnsn_random_vertex(void)
+{
+  dmnsn_vector vertex = dmnsn_test_random_vector(2.0);
+  for (unsigned int i = 0; i < 3; ++i) {
+    vertex.n[i] = (float)vertex.n[i];
+  }
+  return vertex;
+}
+
+static void
+dmnsn_precompute(dmnsn_object *object)
+{
+  object->texture = dmnsn_new_texture(pool);
+  object->texture->pigment = dmnsn_new_solid_pigment(pool, DMNSN_TCOLOR(dmnsn_black));
+  dmnsn_object_precompute(object);
+}
+
+/// Check a mesh against the equivalent individual triangles.
+static void
+dmnsn_assert_mesh_matches(bool smooth)
+{
+  enum { NTRIANGLES = 64 };
+  dmnsn_vector vertices[3*NTRIANGLES], normals[3*NTRIANGLES];
+  uint32_t indices[3*NTRIANGLES];
+  dmnsn_object *triangles[NTRIANGLES];
+  for (size_t i = 0; i < 3*NTRIANGLES; ++i) {
+    vertices[i] = dmnsn_random_vertex();
+    normals[i] = dmnsn_vector_normalized(dmnsn_test_random_vector(2.0));
+    indices[i] = i;
+  }
+  for (size_t i = 0; i < NTRIANGLES; ++i) {
+    if (smooth) {
+      triangles[i] = dmnsn_new_smooth_triangle(pool, vertices + 3*i, normals + 3*i);
+    } else {
+      triangles[i] = dmnsn_new_triangle(pool, vertices + 3*i);
+    }
+    dmnsn_precompute(triangles[i]);
+  }
+
+  dmnsn_object *mesh = dmnsn_new_mesh(pool, vertices, smooth ? normals : NULL, 3*NTRIANGLES, indices, NTRIANGLES);
+  dmnsn_precompute(mesh);
+
+  for (unsigned int i = 0; i < 10000; ++i) {
+    dmnsn_ray ray = dmnsn_new_ray(dmnsn_test_random_vector(2.0), dmnsn_test_random_vector(2.0));
+
+    dmnsn_intersection expected = { .t = INFINITY };
+    size_t closest = 0;
+    for (size_t j = 0; j < NTRIANGLES; ++j) {
+      dmnsn_intersection intersection;
+      if (dmnsn_object_intersection(triangles[j], ray, &intersection) && intersection.t < expected.t) {
+        expected = intersection;
+        closest = j;
+      }
+    }
+
+    dmnsn_intersection intersection;
+    bool hit = dmnsn_object_intersection(mesh, ray, &intersection);
+    ck_assert_msg(hit == !isinf(expected.t), "Ray %u: hit mismatch", i);
+    ck_assert_msg(hit == dmnsn_object_occlusion(mesh, ray, INFINITY), "Ray %u: occlusion mismatch", i);
+    if (!hit) {
+      continue;
+    }
+
+    ck_assert_msg(dmnsn_test_close(intersection.t, expected.t, 1.0e-6),
+                  "Ray %u: t == %.17g, expected %.17g", i, intersection.t, expected.t);
+    ck_assert(dmnsn_object_occlusion(mesh, ray, intersection.t*1.01));
+    ck_assert(!dmnsn_object_occlusion(mesh, ray, intersection.t*0.99));
+
+    if (smooth) {
+      // Smooth triangles interpolate their normals in a different basis, so
+      // work out the expected normal from the barycentric coordinates
+      dmnsn_vector a = vertices[3*closest];
+      dmnsn_vector ab = dmnsn_vector_sub(vertices[3*closest + 1], a);
+      dmnsn_vector ac = dmnsn_vector_sub(vertices[3*closest + 2], a);
+      dmnsn_vector ap = dmnsn_vector_sub(dmnsn_ray_point(ray, expected.t), a);
+      dmnsn_vector normal = dmnsn_vector_cross(ab, ac);
+      double area = dmnsn_vector_dot(normal, normal);
+      double u = dmnsn_vector_dot(dmnsn_vector_cross(ap, ac), normal)/area;
+      double v = dmnsn_vector_dot(dmnsn_vector_cross(ab, ap), normal)/area;
+      expected.normal = dmnsn_vector_normalized(dmnsn_vector_add(
+        dmnsn_vector_mul(1.0 - u - v, normals[3*closest]),
+        dmnsn_vector_add(
+          dmnsn_vector_mul(u, normals[3*closest + 1]),
+          dmnsn_vector_mul(v, normals[3*closest + 2])
+        )
+      ));
+    }
+
+    // Flat triangles may face either way
+    double dot = dmnsn_vector_dot(intersection.normal, expected.normal);
+    ck_assert_msg(fabs((smooth ? dot : fabs(dot)) - 1.0) <= 1.0e-5,
+                  "Ray %u: normal mismatch", i);
+  }
+}
+
+DMNSN_TEST(mesh, flat)
+{
+  dmnsn_assert_mesh_matches(false);
+}
+
+DMNSN_TEST(mesh, smooth)
+{
+  dmnsn_assert_mesh_matches(true);
+}
+
+DMNSN_TEST(mesh, errors)
+{
+  dmnsn_vector vertices[] = { dmnsn_zero, dmnsn_x, dmnsn_y };
+  uint32_t indices[] = { 0, 1, 3 };
+
+  // Index out of range
+  errno = 0;
+  ck_assert(!dmnsn_new_mesh(pool, vertices, NULL, 3, indices, 1));
+  ck_assert_int_eq(errno, EINVAL);
+
+  // Empty mesh
+  errno = 0;
+  ck_assert(!dmnsn_new_mesh(pool, vertices, NULL, 3, indices, 0));
+  ck_assert_int_eq(errno, EINVAL);
+
+  // No vertices
+  errno = 0;
+  ck_assert(!dmnsn_new_mesh(pool, NULL, NULL, 0, indices, 1));
+  ck_assert_int_eq(errno, EINVAL);
+
+  // Non-finite or single-precision overflowing coordinates
+  indices[2] = 2;
+  double invalid[] = { INFINITY, NAN, 1.0e39 };
+  for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); ++i) {
+    vertices[1].n[1] = invalid[i];
+    errno = 0;
+    ck_assert(!dmnsn_new_mesh(pool, vertices, NULL, 3, indices, 1));
+    ck_assert_int_eq(errno, EINVAL);
+    vertices[1] = dmnsn_x;
+
+    dmnsn_vector normals[] = { dmnsn_z, dmnsn_z, dmnsn_z };
+    normals[2].n[0] = invalid[i];
+    errno = 0;
+    ck_assert(!dmnsn_new_mesh(pool, vertices, normals, 3, indices, 1));
+    ck_assert_int_eq(errno, EINVAL);
+  }
+  ck_assert(dmnsn_new_mesh(pool, vertices, NULL, 3, indices, 1));
+}
+
+DMNSN_TEST(mesh, watertight)
+{
+  // A bumpy grid of quads, split into two triangles each
+  enum { N = 16 };
+  dmnsn_vector vertices[(N + 1)*(N + 1)];
+  uint32_t indices[6*N*N];
+  for (size_t i = 0; i <= N; ++i) {
+    for (size_t j = 0; j <= N; ++j) {
+      vertices[i*(N + 1) + j] = dmnsn_new_vector(i, j, (float)dmnsn_test_random(2.0)/8.0);
+    }
+  }
+  uint32_t *index = indices;
+  for (uint32_t i = 0; i < N; ++i) {
+    for (uint32_t j = 0; j < N; ++j) {
+      uint32_t a = i*(N + 1) + j, b = a + 1, c = a + N + 1, d = c + 1;
+      *index++ = a;
+      *index++ = b;
+      *index++ = d;
+      *index++ = a;
+      *index++ = d;
+      *index++ = c;
+    }
+  }
+
+  dmnsn_object *mesh = dmnsn_new_mesh(pool, vertices, NULL, (N + 1)*(N + 1), indices, 2*N*N);
+  dmnsn_precompute(mesh);
+
+  // Aim rays exactly at the interior vertices, and at points on the edges
+  // between them, where rounding could otherwise make rays slip through
+  for (unsigned int i = 0; i < 10000; ++i) {
+    size_t row = 1 + rand()%(N - 1), col = 1 + rand()%(N - 1);
+    size_t drow = rand()%2, dcol = rand()%2;
+    if (row + drow >= N || col + dcol >= N) {
+      continue;
+    }
+    size_t v1 = row*(N + 1) + col;
+    size_t v2 = (row + drow)*(N + 1) + col + dcol;
+
+    double s = rand()%2 ? 0.0 : (double)rand()/RAND_MAX;
+    dmnsn_vector target = dmnsn_vector_add(vertices[v1], dmnsn_vector_mul(s, dmnsn_vector_sub(vertices[v2], vertices[v1])));
+    dmnsn_vector x0 = dmnsn_vector_add(target, dmnsn_vector_mul(4.0, dmnsn_test_random_vector(2.0)));
+    x0.n[2] = 4.0*(rand()%2 ? 1.0 : -1.0) + dmnsn_test_random(2.0);
+    dmnsn_ray ray = dmnsn_new_ray(x0, dmnsn_vector_sub(target, x0));
+
+    dmnsn_intersection intersection;
+    ck_assert_msg(dmnsn_object_intersection(mesh, ray, &intersection),
+                  "Ray %u aimed at " DMNSN_VECTOR_FORMAT " missed",
+                  i, DMNSN_VECTOR_PRINTF(target));
+    ck_assert(dmnsn_object_occlusion(mesh, ray, INFINITY));
+  }
+}
+
+/// Check that two meshes give exactly the same intersections.
+static void
+dmnsn_assert_meshes_match(dmnsn_object *mesh, dmnsn_object *expected)
+{
+  dmnsn_precompute(mesh);
+  dmnsn_precompute(expected);
+
+  unsigned int nhits = 0;
+  for (unsigned int i = 0; i < 1000; ++i) {
+    dmnsn_ray ray = dmnsn_new_ray(dmnsn_test_random_vector(2.0), dmnsn_test_random_vector(2.0));
+
+    dmnsn_intersection intersection, expected_intersection;
+    bool hit = dmnsn_object_intersection(mesh, ray, &intersection);
+    ck_assert_msg(hit == dmnsn_object_intersection(expected, ray, &expected_intersection),
+                  "Ray %u: hit mismatch", i);
+    if (!hit) {
+      continue;
+    }
+
+    ++nhits;
+    ck_assert_msg(intersection.t == expected_intersection.t,
+                  "Ray %u: t == %.17g, expected %.17g", i, intersection.t, expected_intersection.t);
+    for (unsigned int j = 0; j < 3; ++j) {
+      ck_assert_msg(intersection.normal.n[j] == expected_intersection.normal.n[j],
+                    "Ray %u: normal mismatch", i);
+    }
+  }
+
+  ck_assert(nhits > 0);
+}
+
+/// Read a mesh from a string.
+static dmnsn_object *
+dmnsn_read_mesh_string(const char *str, size_t size)
+{
+  FILE *file = tmpfile();
+  ck_assert(file);
+  ck_assert_int_eq(fwrite(str, 1, size, file), size);
+  rewind(file);
+
+  dmnsn_object *mesh = dmnsn_read_mesh(pool, file);
+  fclose(file);
+  return mesh;
+}
+
+/// A pyramid with a square base.
+static const dmnsn_vector dmnsn_pyramid_vertices[] = {
+  { { -1.0, -1.0, 0.0 } },
+  { {  1.0, -1.0, 0.0 } },
+  { {  1.0,  1.0, 0.0 } },
+  { { -1.0,  1.0, 0.0 } },
+  { {  0.0,  0.0, 1.5 } },
+};
+
+/// The pyramid's faces, with the base split in two.
+static const uint32_t dmnsn_pyramid_indices[] = {
+  0, 3, 2,
+  0, 2, 1,
+  0, 1, 4,
+  1, 2, 4,
+  2, 3, 4,
+  3, 0, 4,
+};
+
+DMNSN_TEST(mesh, obj)
+{
+  static const char obj[] =
+    "# A pyramid\n"
+    "o pyramid\n"
+    "v -1 -1 0\n"
+    "v 1 -1 0\n"
+    "v 1.0 1.0 0.0\n"
+    "v -1 1 0 1\n"
+    "v 0 0 1.5\r\n"
+    "vt 0 0\n"
+    "s off\n"
+    "f 1/1 4/1 3/1 2/1\n"
+    "f -5 -4 -1 # relative indices\n"
+    "f 2 3 5\n"
+    "f 3 4 5\n"
+    "f 4 1 5\n";
+  dmnsn_object *mesh = dmnsn_read_mesh_string(obj, sizeof(obj) - 1);
+  ck_assert(mesh);
+
+  dmnsn_object *expected = dmnsn_new_mesh(pool, dmnsn_pyramid_vertices, NULL, 5, dmnsn_pyramid_indices, 6);
+  dmnsn_assert_meshes_match(mesh, expected);
+}
+
+DMNSN_TEST(mesh, obj_normals)
+{
+  // The base corners have different normals for the base and the sides
+  static const char obj[] =
+    "v -1 -1 0\n"
+    "v 1 -1 0\n"
+    "v 1 1 0\n"
+    "v -1 1 0\n"
+    "v 0 0 1.5\n"
+    "vn 0 0 -2\n"
+    "vn -1 -1 1\n"
+    "vn 1 -1 1\n"
+    "vn 1 1 1\n"
+    "vn -1 1 1\n"
+    "vn 0 0 1\n"
+    "f 1//1 4//1 3//1 2//1\n"
+    "f 1//2 2//3 5//6\n"
+    "f 2/1/3 3/1/4 5/1/6\n"
+    "f 3//4 4//5 5//6\n"
+    "f 4//5 1//2 5//6\n";
+  dmnsn_object *mesh = dmnsn_read_mesh_string(obj, sizeof(obj) - 1);
+  ck_assert(mesh);
+
+  dmnsn_vector normals[] = {
+    dmnsn_new_vector(0.0, 0.0, -1.0),
+    dmnsn_new_vector(-1.0, -1.0, 1.0),
+    dmnsn_new_vector(1.0, -1.0, 1.0),
+    dmnsn_new_vector(1.0, 1.0, 1.0),
+    dmnsn_new_vector(-1.0, 1.0, 1.0),
+    dmnsn_new_vector(0.0, 0.0, 1.0),
+  };
+  static const uint32_t corners[][2] = {
+    { 0, 0 }, { 3, 0 }, { 2, 0 },
+    { 0, 0 }, { 2, 0 }, { 1, 0 },
+    { 0, 1 }, { 1, 2 }, { 4, 5 },
+    { 1, 2 }, { 2, 3 }, { 4, 5 },
+    { 2, 3 }, { 3, 4 }, { 4, 5 },
+    { 3, 4 }, { 0, 1 }, { 4, 5 },
+  };
+
+  // Give every corner its own vertex
+  dmnsn_vector corner_vertices[18], corner_normals[18];
+  uint32_t indices[18];
+  for (uint32_t i = 0; i < 18; ++i) {
+    corner_vertices[i] = dmnsn_pyramid_vertices[corners[i][0]];
+    corner_normals[i] = normals[corners[i][1]];
+    indices[i] = i;
+  }
+
+  dmnsn_object *expected = dmnsn_new_mesh(pool, corner_vertices, corner_normals, 18, indices, 6);
+  dmnsn_assert_meshes_match(mesh, expected);
+}
+
+DMNSN_TEST(mesh, obj_errors)
+{
+  static const char *objs[] = {
+    "",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 -4\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n",
+    "v 0 0 0\nv 1 0\nv 0 1 0\nf 1 2 3\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1//1 2//1 3//1\n",
+    "v 0 0 nan\nv 1 0 0\nv 0 1 0\nf 1 2 3\n",
+    "v 0 0 0\nv inf 0 0\nv 0 1 0\nf 1 2 3\n",
+    "v 0 0 0\nv 1e39 0 0\nv 0 1 0\nf 1 2 3\n",
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 nan\nf 1//1 2//1 3//1\n",
+  };
+
+  for (size_t i = 0; i < sizeof(objs)/sizeof(objs[0]); ++i) {
+    errno = 0;
+    ck_assert_msg(!dmnsn_read_mesh_string(objs[i], strlen(objs[i])), "OBJ %zu parsed", i);
+    ck_assert_int_eq(errno, EINVAL);
+  }
+}
+
+/// Append a value to a PLY body in the given byte order.
+static void
+dmnsn_ply_append(char **pos, const void *value, size_t size, bool big_endian)
+{
+  const unsigned char *bytes = value;
+  bool little_endian_host = *(const unsigned char *)&(const uint16_t){ 1 } == 1;
+  for (size_t i = 0; i < size; ++i) {
+    size_t j = (big_endian == little_endian_host) ? size - i - 1 : i;
+    *(*pos)++ = bytes[j];
+  }
+}
+
+/// Build a binary PLY version of the pyramid.
+static size_t
+dmnsn_make_ply(char *buffer, bool big_endian, bool normals)
+{
+  char *pos = buffer;
+  pos += sprintf(pos,
+    "ply\n"
+    "format %s 1.0\n"
+    "comment A pyramid\n"
+    "element vertex 5\n"
+    "property float x\n"
+    "property uchar red\n"
+    "property double y\n"
+    "property float32 z\n"
+    "%s"
+    "element face 5\n"
+    "property list uchar int vertex_indices\n"
+    "property ushort flags\n"
+    "element edge 1\n"
+    "property int vertex1\n"
+    "property int vertex2\n"
+    "end_header\n",
+    big_endian ? "binary_big_endian" : "binary_little_endian",
+    normals ? "property float nx\nproperty float ny\nproperty float nz\n" : "");
+
+  for (size_t i = 0; i < 5; ++i) {
+    dmnsn_vector v = dmnsn_pyramid_vertices[i];
+    float x = v.n[0], z = v.n[2];
+    double y = v.n[1];
+    uint8_t red = 255;
+    dmnsn_ply_append(&pos, &x, sizeof(x), big_endian);
+    dmnsn_ply_append(&pos, &red, sizeof(red), big_endian);
+    dmnsn_ply_append(&pos, &y, sizeof(y), big_endian);
+    dmnsn_ply_append(&pos, &z, sizeof(z), big_endian);
+    if (normals) {
+      float nx = v.n[0], ny = v.n[1], nz = 1.0f;
+      dmnsn_ply_append(&pos, &nx, sizeof(nx), big_endian);
+      dmnsn_ply_append(&pos, &ny, sizeof(ny), big_endian);
+      dmnsn_ply_append(&pos, &nz, sizeof(nz), big_endian);
+    }
+  }
+
+  static const int32_t faces[][4] = {
+    { 4, 0, 3, 2 },
+    { 3, 0, 1, 4 },
+    { 3, 1, 2, 4 },
+    { 3, 2, 3, 4 },
+    { 3, 3, 0, 4 },
+  };
+  for (size_t i = 0; i < 5; ++i) {
+    uint8_t count = faces[i][0];
+    dmnsn_ply_append(&pos, &count, sizeof(count), big_endian);
+    for (size_t j = 0; j < count; ++j) {
+      int32_t index = j < 3 ? faces[i][j + 1] : 1;
+      dmnsn_ply_append(&pos, &index, sizeof(index), big_endian);
+    }
+    uint16_t flags = 0xABCD;
+    dmnsn_ply_append(&pos, &flags, sizeof(flags), big_endian);
+  }
+
+  int32_t edge[] = { 0, 1 };
+  dmnsn_ply_append(&pos, &edge[0], sizeof(edge[0]), big_endian);
+  dmnsn_ply_append(&pos, &edge[1], sizeof(edge[1]), big_endian);
+
+  return pos - buffer;
+}
+
+/// Check a PLY version of the pyramid.
+static void
+dmnsn_assert_ply_matches(bool big_endian, bool normals)
+{
+  char ply[1024];
+  size_t size = dmnsn_make_ply(ply, big_endian, normals);
+  dmnsn_object *mesh = dmnsn_read_mesh_string(ply, size);
+  ck_assert(mesh);
+
+  dmnsn_vector vertex_normals[5];
+  for (size_t i = 0; i < 5; ++i) {
+    dmnsn_vector v = dmnsn_pyramid_vertices[i];
+    vertex_normals[i] = dmnsn_new_vector(v.n[0], v.n[1], 1.0);
+  }
+  dmnsn_object *expected = dmnsn_new_mesh(pool, dmnsn_pyramid_vertices, normals ? vertex_normals : NULL, 5, dmnsn_pyramid_indices, 6);
+  dmnsn_assert_meshes_match(mesh, expected);
+
+  // Truncated files should fail cleanly
+  for (size_t i = 0; i < size; i += 7) {
+    errno = 0;
+    ck_assert_msg(!dmnsn_read_mesh_string(ply, i), "Truncated PLY of size %zu parsed", i);
+    ck_assert_int_eq(errno, EINVAL);
+  }
+}
+
+DMNSN_TEST(mesh, ply_little_endian)
+{
+  dmnsn_assert_ply_matches(false, false);
+}
+
+DMNSN_TEST(mesh, ply_big_endian)
+{
+  dmnsn_assert_ply_matches(true, true);
+}
+
+DMNSN_TEST(mesh, ply_non_finite)
+{
+  // Overwrite the first vertex's x coordinate, then the x component of its
+  // normal
+  static const size_t offsets[] = { 0, sizeof(float) + sizeof(uint8_t) + sizeof(double) + sizeof(float) };
+  static const float values[] = { NAN, INFINITY };
+
+  for (size_t i = 0; i < 2; ++i) {
+    char ply[1024];
+    size_t size = dmnsn_make_ply(ply, false, true);
+    char *pos = strstr(ply, "end_header\n") + strlen("end_header\n") + offsets[i];
+    dmnsn_ply_append(&pos, &values[i], sizeof(values[i]), false);
+
+    errno = 0;
+    ck_assert_msg(!dmnsn_read_mesh_string(ply, size), "PLY %zu parsed", i);
+    ck_assert_int_eq(errno, EINVAL);
+  }
+}
+
+/// Build a binary PLY triangle, preceded by an element with no properties.
+static size_t
+dmnsn_make_ply_empty_element(char *buffer, const char *count)
+{
+  char *pos = buffer;
+  pos += sprintf(pos,
+    "ply\n"
+    "format binary_little_endian 1.0\n"
+    "element empty %s\n"
+    "element vertex 3\n"
+    "property float x\n"
+    "property float y\n"
+    "property float z\n"
+    "element face 1\n"
+    "property list uchar int vertex_indices\n"
+    "end_header\n",
+    count);
+
+  for (size_t i = 0; i < 3; ++i) {
+    float v[3] = { i == 1, i == 2, 0.0f };
+    for (size_t j = 0; j < 3; ++j) {
+      dmnsn_ply_append(&pos, &v[j], sizeof(v[j]), false);
+    }
+  }
+
+  uint8_t n = 3;
+  dmnsn_ply_append(&pos, &n, sizeof(n), false);
+  for (int32_t i = 0; i < 3; ++i) {
+    dmnsn_ply_append(&pos, &i, sizeof(i), false);
+  }
+
+  return pos - buffer;
+}
+
+DMNSN_TEST(mesh, ply_empty_element)
+{
+  char ply[1024];
+
+  // An element with no properties is fine as long as it has no records
+  size_t size = dmnsn_make_ply_empty_element(ply, "0");
+  ck_assert(dmnsn_read_mesh_string(ply, size));
+
+  // Otherwise its count can't be bounded by the file size, so reject it
+  // rather than skipping zero-byte records forever
+  size = dmnsn_make_ply_empty_element(ply, "18446744073709551615");
+  errno = 0;
+  ck_assert(!dmnsn_read_mesh_string(ply, size));
+  ck_assert_int_eq(errno, EINVAL);
+}
+
+DMNSN_TEST(mesh, ply_ascii)
+{
+  static const char ply[] =
+    "ply\n"
+    "format ascii 1.0\n"
+    "element vertex 3\n"
+    "property float x\n"
+    "property float y\n"
+    "property float z\n"
+    "element face 1\n"
+    "property list uchar int vertex_indices\n"
+    "end_header\n"
+    "0 0 0\n"
+    "1 0 0\n"
+    "0 1 0\n"
+    "3 0 1 2\n";
+  errno = 0;
+  ck_assert(!dmnsn_read_mesh_string(ply, sizeof(ply) - 1));
+  ck_assert_int_eq(errno, EINVAL);
+}
@@ -0,0 +1,152 @@
+/*************************************************************************
+ * Copyright (C) 2010-2014 Tavian Barnes <tavianator@tavianator.com>     *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests that packet intersection and occlusion callbacks match the scalar
+ * intersection callbacks exactly.
+ */
+
+#include "tests.h"
+#include <math.h>
+#include <stdlib.h>
+
+static dmnsn_pool *pool;
+
+DMNSN_TEST_SETUP(packet)
+{
+  pool = dmnsn_new_pool();
+}
+
+DMNSN_TEST_TEARDOWN(packet)
+{
+  dmnsn_delete_pool(pool);
+}
+
+/// Make a random ray, sometimes axis-parallel to hit the edge cases.
+static dmnsn_ray
+dmnsn_random_ray(void)
+{
+  dmnsn_vector x0 = dmnsn_new_vector(dmnsn_test_random(2.0), dmnsn_test_random(2.0), dmnsn_test_random(2.0));
+  dmnsn_vector n = dmnsn_new_vector(dmnsn_test_random(2.0), dmnsn_test_random(2.0), dmnsn_test_random(2.0));
+  if (rand()%8 == 0) {
+    n.n[rand()%3] = 0.0;
+  }
+  return dmnsn_new_ray(x0, n);
+}
+
+static void
+dmnsn_assert_packets_match(dmnsn_object *object)
+{
+  object->texture = dmnsn_new_texture(pool);
+  object->texture->pigment = dmnsn_new_solid_pigment(pool, DMNSN_TCOLOR(dmnsn_black));
+  dmnsn_object_precompute(object);
+
+  for (unsigned int i = 0; i < 1000; ++i) {
+    dmnsn_ray rays[DMNSN_OBJECT_PACKET_SIZE];
+    unsigned int mask = rand()%(1U << DMNSN_OBJECT_PACKET_SIZE);
+    for (unsigned int k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+      rays[k] = dmnsn_random_ray();
+    }
+
+    dmnsn_intersection intersections[DMNSN_OBJECT_PACKET_SIZE];
+    unsigned int hits = dmnsn_object_hit_packet(object, rays, mask, intersections);
+    ck_assert_int_eq(hits & ~mask, 0);
+
+    for (unsigned int k = 0; k < DMNSN_OBJECT_PACKET_SIZE; ++k) {
+      if (!(mask & (1U << k))) {
+        continue;
+      }
+
+      dmnsn_intersection expected;
+      bool hit = dmnsn_object_hit(object, rays[k], &expected);
+      ck_assert_msg(hit == !!(hits & (1U << k)), "Packet %u, ray %u: hit mismatch", i, k);
+      ck_assert_msg(hit == dmnsn_object_occlusion(object, rays[k], INFINITY),
+                    "Packet %u, ray %u: occlusion mismatch", i, k);
+      if (!hit) {
+        continue;
+      }
+
+      ck_assert(!dmnsn_object_occlusion(object, rays[k], expected.t));
+      ck_assert(dmnsn_object_occlusion(object, rays[k], nextafter(expected.t, INFINITY)));
+
+      ck_assert_msg(intersections[k].t == expected.t,
+                    "Packet %u, ray %u: t == %.17g, expected %.17g",
+                    i, k, intersections[k].t, expected.t);
+      ck_assert(intersections[k].object == expected.object);
+
+      dmnsn_object_finalize(object, &intersections[k]);
+      dmnsn_object_finalize(object, &expected);
+      for (unsigned int j = 0; j < 3; ++j) {
+        ck_assert_msg(intersections[k].normal.n[j] == expected.normal.n[j],
+                      "Packet %u, ray %u: normal mismatch", i, k);
+      }
+    }
+  }
+}
+
+DMNSN_TEST(packet, sphere)
+{
+  dmnsn_assert_packets_match(dmnsn_new_sphere(pool));
+}
+
+DMNSN_TEST(packet, plane)
+{
+  dmnsn_assert_packets_match(dmnsn_new_plane(pool, dmnsn_new_vector(1.0, 2.0, 3.0)));
+}
+
+DMNSN_TEST(packet, cube)
+{
+  dmnsn_assert_packets_match(dmnsn_new_cube(pool));
+}
+
+DMNSN_TEST(packet, cone)
+{
+  dmnsn_assert_packets_match(dmnsn_new_cone(pool, 0.5, 1.0, true));
+}
+
+DMNSN_TEST(packet, cylinder)
+{
+  dmnsn_assert_packets_match(dmnsn_new_cone(pool, 1.0, 1.0, true));
+}
+
+DMNSN_TEST(packet, triangle)
+{
+  dmnsn_vector vertices[] = {
+    dmnsn_new_vector(-1.0, -1.0, 0.5),
+    dmnsn_new_vector(1.0, -0.5, -0.5),
+    dmnsn_new_vector(0.0, 1.0, 0.0),
+  };
+  dmnsn_assert_packets_match(dmnsn_new_triangle(pool, vertices));
+}
+
+DMNSN_TEST(packet, smooth_triangle)
+{
+  dmnsn_vector vertices[] = {
+    dmnsn_new_vector(-1.0, -1.0, 0.5),
+    dmnsn_new_vector(1.0, -0.5, -0.5),
+    dmnsn_new_vector(0.0, 1.0, 0.0),
+  };
+  dmnsn_vector normals[] = {
+    dmnsn_new_vector(0.0, 0.0, 1.0),
+    dmnsn_new_vector(0.0, 1.0, 1.0),
+    dmnsn_new_vector(1.0, 0.0, 1.0),
+  };
+  dmnsn_assert_packets_match(dmnsn_new_smooth_triangle(pool, vertices, normals));
+}
@@ -0,0 +1,213 @@
+/*************************************************************************
+ * Copyright (C) 2010-2014 Tavian Barnes <tavianator@tavianator.com>     *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+/**
+ * @file
+ * Tests that the transformation fast paths, and primitives stored in world
+ * space, match transforming the rays by hand.
+ */
+
+#include "tests.h"
+#include <stdlib.h>
+
+static dmnsn_pool *pool;
+
+DMNSN_TEST_SETUP(transform)
+{
+  pool = dmnsn_new_pool();
+}
+
+DMNSN_TEST_TEARDOWN(transform)
+{
+  dmnsn_delete_pool(pool);
+}
+
+/// Precompute an object with a plain texture.
+static void
+dmnsn_test_precompute(dmnsn_object *object)
+{
+  object->texture = dmnsn_new_texture(pool);
+  object->texture->pigment = dmnsn_new_solid_pigment(pool, DMNSN_TCOLOR(dmnsn_black));
+  dmnsn_object_precompute(object);
+}
+
+/// The transformations to test.
+static dmnsn_matrix
+dmnsn_test_transform(unsigned int i)
+{
+  dmnsn_vector translate = dmnsn_new_vector(0.5, -1.0, 1.5);
+  switch (i) {
+  case 0:
+    return dmnsn_identity_matrix();
+  case 1:
+    return dmnsn_translation_matrix(translate);
+  case 2:
+    return dmnsn_matrix_mul(dmnsn_translation_matrix(translate), dmnsn_scale_matrix(dmnsn_new_vector(2.0, 2.0, 2.0)));
+  case 3:
+    return dmnsn_matrix_mul(dmnsn_translation_matrix(translate), dmnsn_scale_matrix(dmnsn_new_vector(0.5, -2.0, 1.5)));
+  case 4:
+    return dmnsn_matrix_mul(dmnsn_translation_matrix(translate), dmnsn_scale_matrix(dmnsn_new_vector(-1.5, -1.5, -1.5)));
+  case 5:
+    return dmnsn_matrix_mul(
+      dmnsn_rotation_matrix(dmnsn_new_vector(0.3, -0.7, 1.1)),
+      dmnsn_scale_matrix(dmnsn_new_vector(1.5, 1.5, 1.5))
+    );
+  default:
+    return dmnsn_matrix_mul(
+      dmnsn_rotation_matrix(dmnsn_new_vector(0.3, -0.7, 1.1)),
+      dmnsn_scale_matrix(dmnsn_new_vector(1.5, 0.5, 1.0))
+    );
+  }
+}
+
+#define DMNSN_TEST_TRANSFORMS 7
+
+/// Check an object with each transformation against an untransformed copy.
+static void
+dmnsn_assert_transforms_match(dmnsn_object *(*constructor)(void))
+{
+  dmnsn_object *reference = constructor();
+  dmnsn_test_precompute(reference);
+
+  for (unsigned int i = 0; i < DMNSN_TEST_TRANSFORMS; ++i) {
+    dmnsn_matrix trans = dmnsn_test_transform(i);
+    dmnsn_matrix trans_inv = dmnsn_matrix_inverse(trans);
+    dmnsn_object *object = constructor();
+    object->trans = trans;
+    dmnsn_test_precompute(object);
+
+    for (unsigned int j = 0; j < 1000; ++j) {
+      dmnsn_ray ray = dmnsn_new_ray(dmnsn_test_random_vector(4.0), dmnsn_test_random_vector(4.0));
+      dmnsn_ray ray_trans = dmnsn_transform_ray(trans_inv, ray);
+
+      dmnsn_intersection intersection, expected;
+      bool hit = dmnsn_object_intersection(object, ray, &intersection);
+      bool expected_hit = dmnsn_object_intersection(reference, ray_trans, &expected);
+      ck_assert_msg(hit == expected_hit, "Transform %u, ray %u: hit mismatch", i, j);
+
+      if (hit) {
+        ck_assert_msg(dmnsn_test_close(intersection.t, expected.t, 1.0e-9),
+                      "Transform %u, ray %u: t == %.17g, expected %.17g",
+                      i, j, intersection.t, expected.t);
+
+        dmnsn_vector normal = dmnsn_vector_normalized(dmnsn_transform_normal(trans_inv, expected.normal));
+        for (unsigned int k = 0; k < 3; ++k) {
+          ck_assert_msg(dmnsn_test_close(intersection.normal.n[k], normal.n[k], 1.0e-9),
+                        "Transform %u, ray %u: normal mismatch", i, j);
+        }
+
+        double t = intersection.t;
+        ck_assert(dmnsn_object_occlusion(object, ray, t*1.01));
+        ck_assert(!dmnsn_object_occlusion(object, ray, t*0.99));
+      }
+
+      dmnsn_vector point = dmnsn_test_random_vector(4.0);
+      dmnsn_vector point_trans = dmnsn_transform_point(trans_inv, point);
+      ck_assert_msg(dmnsn_object_inside(object, point) == dmnsn_object_inside(reference, point_trans),
+                    "Transform %u, point %u: inside mismatch", i, j);
+    }
+  }
+}
+
+static dmnsn_object *
+dmnsn_test_sphere(void)
+{
+  return dmnsn_new_sphere(pool);
+}
+
+DMNSN_TEST(transform, sphere)
+{
+  dmnsn_assert_transforms_match(dmnsn_test_sphere);
+}
+
+static dmnsn_object *
+dmnsn_test_cube(void)
+{
+  return dmnsn_new_cube(pool);
+}
+
+DMNSN_TEST(transform, cube)
+{
+  dmnsn_assert_transforms_match(dmnsn_test_cube);
+}
+
+static dmnsn_object *
+dmnsn_test_plane(void)
+{
+  dmnsn_object *plane = dmnsn_new_plane(pool, dmnsn_new_vector(1.0, 2.0, -0.5));
+  plane->intrinsic_trans = dmnsn_translation_matrix(dmnsn_new_vector(0.0, 0.5, 0.0));
+  return plane;
+}
+
+DMNSN_TEST(transform, plane)
+{
+  dmnsn_assert_transforms_match(dmnsn_test_plane);
+}
+
+static dmnsn_object *
+dmnsn_test_cone(void)
+{
+  return dmnsn_new_cone(pool, 1.0, 0.5, true);
+}
+
+DMNSN_TEST(transform, cone)
+{
+  dmnsn_assert_transforms_match(dmnsn_test_cone);
+}
+
+DMNSN_TEST(transform, kinds)
+{
+  static const dmnsn_transform_kind kinds[DMNSN_TEST_TRANSFORMS] = {
+    DMNSN_TRANSFORM_IDENTITY,
+    DMNSN_TRANSFORM_TRANSLATE,
+    DMNSN_TRANSFORM_SCALE,
+    DMNSN_TRANSFORM_GENERAL,
+    DMNSN_TRANSFORM_GENERAL,
+    DMNSN_TRANSFORM_GENERAL,
+    DMNSN_TRANSFORM_GENERAL,
+  };
+
+  for (unsigned int i = 0; i < DMNSN_TEST_TRANSFORMS; ++i) {
+    dmnsn_object *cone = dmnsn_test_cone();
+    cone->trans = dmnsn_test_transform(i);
+    dmnsn_test_precompute(cone);
+    ck_assert_int_eq(cone->trans_kind, kinds[i]);
+  }
+
+  // Spheres, axis-aligned cubes, and planes are stored in world space
+  dmnsn_object *sphere = dmnsn_test_sphere();
+  sphere->trans = dmnsn_test_transform(5);
+  dmnsn_test_precompute(sphere);
+  ck_assert_int_eq(sphere->trans_kind, DMNSN_TRANSFORM_IDENTITY);
+
+  dmnsn_object *ellipsoid = dmnsn_test_sphere();
+  ellipsoid->trans = dmnsn_test_transform(6);
+  dmnsn_test_precompute(ellipsoid);
+  ck_assert_int_eq(ellipsoid->trans_kind, DMNSN_TRANSFORM_GENERAL);
+
+  dmnsn_object *cube = dmnsn_test_cube();
+  cube->trans = dmnsn_test_transform(3);
+  dmnsn_test_precompute(cube);
+  ck_assert_int_eq(cube->trans_kind, DMNSN_TRANSFORM_IDENTITY);
+
+  dmnsn_object *plane = dmnsn_test_plane();
+  plane->trans = dmnsn_test_transform(6);
+  dmnsn_test_precompute(plane);
+  ck_assert_int_eq(plane->trans_kind, DMNSN_TRANSFORM_IDENTITY);
+}
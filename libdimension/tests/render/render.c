@@ -396,6 +396,49 @@ main(void)
     }
 
     fclose(ofile);
+
+    // Exports after a cancelled render shouldn't wait for its rows
+    printf("Writing cleared canvas to PNG after cancelling a render\n");
+    future = dmnsn_render_async(scene);
+    dmnsn_future_cancel(future);
+    dmnsn_future_join(future);
+    dmnsn_canvas_clear(scene->canvas, DMNSN_TCOLOR(dmnsn_black));
+
+    ofile = tmpfile();
+    if (!ofile) {
+      fprintf(stderr, "--- Couldn't open a temporary file! ---\n");
+      goto exit;
+    }
+
+    if (dmnsn_png_write_canvas(scene->canvas, ofile) != 0) {
+      fclose(ofile);
+      fprintf(stderr, "--- Writing canvas to PNG after cancelling failed! ---\n");
+      goto exit;
+    }
+
+    fclose(ofile);
+
+    // Cancelling an export that's waiting for rows shouldn't wait for them
+    printf("Cancelling a PNG export during a paused render\n");
+    future = dmnsn_render_async(scene);
+    dmnsn_future_pause(future);
+
+    ofile = tmpfile();
+    if (!ofile) {
+      dmnsn_future_resume(future);
+      dmnsn_future_join(future);
+      fprintf(stderr, "--- Couldn't open a temporary file! ---\n");
+      goto exit;
+    }
+
+    dmnsn_future *png_future = dmnsn_png_write_canvas_async(scene->canvas, ofile);
+    dmnsn_future_cancel(png_future);
+    dmnsn_future_join(png_future);
+    fclose(ofile);
+
+    dmnsn_future_resume(future);
+    dmnsn_future_cancel(future);
+    dmnsn_future_join(future);
   }
 
   ret = EXIT_SUCCESS;
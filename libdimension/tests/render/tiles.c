@@ -0,0 +1,112 @@
+/*************************************************************************
+ * Copyright (C) 2014 Tavian Barnes <tavianator@tavianator.com>          *
+ *                                                                       *
+ * This file is part of The Dimension Test Suite.                        *
+ *                                                                       *
+ * The Dimension Test Suite is free software; you can redistribute it    *
+ * and/or modify it under the terms of the GNU General Public License as *
+ * published by the Free Software Foundation; either version 3 of the    *
+ * License, or (at your option) any later version.                       *
+ *                                                                       *
+ * The Dimension Test Suite is distributed in the hope that it will be   *
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty   *
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  *
+ * General Public License for more details.                              *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *************************************************************************/
+
+
+/**
+ * @file
+ * Tests for tile ordering.
+ */
+
+#include "../../render/tiles.c"
+#include "tests.h"
+#include <stdbool.h>
+
+/// Check that an order is a permutation of the scanline-ordered tiles.
+static void
+dmnsn_assert_tile_permutation(size_t width, size_t height, size_t tile_width, size_t tile_height, dmnsn_tile_order order)
+{
+  dmnsn_canvas canvas = { .width = width, .height = height };
+  size_t ntiles;
+  dmnsn_render_tile *tiles = dmnsn_new_render_tiles(&canvas, tile_width, tile_height, order, &ntiles);
+
+  size_t ncols = (width + tile_width - 1)/tile_width;
+  size_t nrows = (height + tile_height - 1)/tile_height;
+  ck_assert_int_eq(ntiles, ncols*nrows);
+
+  bool *seen = dmnsn_malloc(ntiles*sizeof(bool));
+  for (size_t i = 0; i < ntiles; ++i) {
+    seen[i] = false;
+  }
+
+  for (size_t i = 0; i < ntiles; ++i) {
+    // Find the scanline index of the tile; rows are counted from the top
+    const dmnsn_render_tile *tile = &tiles[i];
+    ck_assert(tile->x%tile_width == 0);
+    ck_assert(tile->y + tile->height <= height);
+    size_t tx = tile->x/tile_width;
+    size_t ty = (height - tile->y - tile->height)/tile_height;
+    ck_assert(tx < ncols && ty < nrows);
+
+    dmnsn_render_tile expected = dmnsn_render_tile_at(&canvas, tile_width, tile_height, tx, ty);
+    ck_assert_int_eq(tile->x, expected.x);
+    ck_assert_int_eq(tile->y, expected.y);
+    ck_assert_int_eq(tile->width, expected.width);
+    ck_assert_int_eq(tile->height, expected.height);
+
+    size_t index = ty*ncols + tx;
+    ck_assert_msg(!seen[index], "Tile %zu appears twice", index);
+    seen[index] = true;
+  }
+
+  dmnsn_free(seen);
+  dmnsn_free(tiles);
+}
+
+/// Check every order for a given canvas and tile size.
+static void
+dmnsn_assert_tile_permutations(size_t width, size_t height, size_t tile_width, size_t tile_height)
+{
+  dmnsn_assert_tile_permutation(width, height, tile_width, tile_height, DMNSN_TILE_SCANLINE);
+  dmnsn_assert_tile_permutation(width, height, tile_width, tile_height, DMNSN_TILE_HILBERT);
+  dmnsn_assert_tile_permutation(width, height, tile_width, tile_height, DMNSN_TILE_CENTER_OUT);
+}
+
+DMNSN_TEST(tiles, square)
+{
+  // A 4x4 grid, exactly one Hilbert curve
+  dmnsn_assert_tile_permutations(64, 64, 16, 16);
+}
+
+DMNSN_TEST(tiles, non_square)
+{
+  // A 7x3 grid, with partial tiles on the right and bottom
+  dmnsn_assert_tile_permutations(100, 40, 16, 16);
+  dmnsn_assert_tile_permutations(40, 100, 16, 16);
+}
+
+DMNSN_TEST(tiles, non_power_of_two)
+{
+  // 5x5 and 3x6 grids, within an 8x8 curve
+  dmnsn_assert_tile_permutations(50, 50, 10, 10);
+  dmnsn_assert_tile_permutations(33, 60, 11, 10);
+}
+
+DMNSN_TEST(tiles, single)
+{
+  dmnsn_assert_tile_permutations(1, 1, 1, 1);
+  dmnsn_assert_tile_permutations(17, 9, 17, 9);
+}
+
+DMNSN_TEST(tiles, empty)
+{
+  dmnsn_canvas canvas = { .width = 0, .height = 16 };
+  size_t ntiles = 1;
+  ck_assert(!dmnsn_new_render_tiles(&canvas, 16, 16, DMNSN_TILE_HILBERT, &ntiles));
+  ck_assert_int_eq(ntiles, 0);
+}
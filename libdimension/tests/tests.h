@@ -22,6 +22,8 @@
 
 #include "dimension.h"
 #include <check.h>
+#include <math.h>
+#include <stdlib.h>
 
 #if DMNSN_CXX
 // We've been included from a C++ file; mark everything here as extern "C"
@@ -107,6 +109,30 @@ void dmnsn_test_teardown(void);
   static void                                                           \
   fixture(void)
 
+/**
+ * A random number between -\p max and \p max.  The default test fixture seeds
+ * rand(), so tests are reproducible.
+ */
+static inline double
+dmnsn_test_random(double max)
+{
+  return max*(2.0*((double)rand())/RAND_MAX - 1.0);
+}
+
+/// A random vector, with each component between -\p max and \p max.
+static inline dmnsn_vector
+dmnsn_test_random_vector(double max)
+{
+  return dmnsn_new_vector(dmnsn_test_random(max), dmnsn_test_random(max), dmnsn_test_random(max));
+}
+
+/// Whether \p a is within a relative \p tolerance of \p b.
+static inline bool
+dmnsn_test_close(double a, double b, double tolerance)
+{
+  return fabs(a - b) <= tolerance*dmnsn_max(1.0, fabs(b));
+}
+
 /// Test canvas.
 void dmnsn_paint_test_canvas(dmnsn_canvas *canvas);
 
@@ -49,6 +49,8 @@ dmnsn_test_setup(void)
 {
   // Treat warnings as errors for tests
   dmnsn_die_on_warnings(true);
+  // Make random tests reproducible
+  srand(1);
 }
 
 void